@@ -0,0 +1,185 @@
+#include "SyntheticData.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+namespace {
+
+// Independent streams for the words, and for each frame of each kind.
+enum Stream { WORDS = 0, TRAINING = 1, MAP = 2, QUERIES = 3, DESCRIPTORS = 4 };
+
+std::uint64_t streamSeed(std::uint64_t seed, int stream, std::uint64_t index) {
+  // splitmix64 of the three
+  std::uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (1 + stream) +
+                    0xBF58476D1CE4E5B9ULL * index;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void normaliseRow(float *row, int cols) {
+  double norm = 0;
+  for (int j = 0; j < cols; ++j) {
+    norm += row[j] * row[j];
+  }
+  norm = std::sqrt(norm);
+  for (int j = 0; j < cols; ++j) {
+    row[j] = static_cast<float>(row[j] / norm);
+  }
+}
+
+} // namespace
+
+// ----------------- SyntheticData -----------------
+
+ofpy3::bench::SyntheticData::SyntheticData(const SyntheticConfig &config)
+    : config(config), words(), groups(config.vocabSize),
+      groupOf(config.vocabSize), training(), map(), queries(),
+      queryPlaces() {
+  CV_Assert(config.vocabSize > 0 && config.descriptorSize > 0);
+  CV_Assert(config.wordsPerFrame > 0 && config.groupSize > 0);
+
+  std::mt19937_64 random(streamSeed(config.seed, WORDS, 0));
+  std::normal_distribution<float> gaussian;
+  words.create(config.vocabSize, config.descriptorSize, CV_32F);
+  for (int i = 0; i < config.vocabSize; ++i) {
+    float *row = words.ptr<float>(i);
+    for (int j = 0; j < config.descriptorSize; ++j) {
+      row[j] = gaussian(random);
+    }
+    normaliseRow(row, config.descriptorSize);
+  }
+
+  // Co-occurring words are scattered over the vocabulary
+  std::iota(groups.begin(), groups.end(), 0);
+  std::shuffle(groups.begin(), groups.end(), random);
+  for (int i = 0; i < config.vocabSize; ++i) {
+    groupOf[groups[i]] = i / config.groupSize;
+  }
+
+  for (int i = 0; i < config.trainingFrames; ++i) {
+    training.push_back(frame(streamSeed(config.seed, TRAINING, i)));
+  }
+  for (int i = 0; i < config.mapSize; ++i) {
+    map.push_back(frame(streamSeed(config.seed, MAP, i)));
+  }
+  for (int i = 0; i < config.queries; ++i) {
+    const std::uint64_t frameSeed = streamSeed(config.seed, QUERIES, i);
+    if (map.empty()) {
+      queryPlaces.push_back(-1);
+      queries.push_back(frame(frameSeed));
+    } else {
+      queryPlaces.push_back(static_cast<int>(frameSeed % map.size()));
+      queries.push_back(revisit(map[queryPlaces.back()], frameSeed));
+    }
+  }
+}
+
+ofpy3::SparseBOW
+ofpy3::bench::SyntheticData::frame(std::uint64_t frameSeed) const {
+  std::mt19937_64 random(frameSeed);
+  std::uniform_int_distribution<int> pickWord(0, config.vocabSize - 1);
+  std::uniform_real_distribution<double> uniform;
+
+  const int numWords = std::min(config.wordsPerFrame, config.vocabSize);
+  std::vector<char> seen(config.vocabSize, 0);
+  std::vector<int> frameWords;
+  while ((int)frameWords.size() < numWords) {
+    const int word = pickWord(random);
+    if (!seen[word]) {
+      seen[word] = 1;
+      frameWords.push_back(word);
+    }
+    const int group = groupOf[word];
+    const int groupEnd =
+        std::min((group + 1) * config.groupSize, config.vocabSize);
+    for (int i = group * config.groupSize;
+         i < groupEnd && (int)frameWords.size() < numWords; ++i) {
+      if (!seen[groups[i]] && uniform(random) < config.coOccurrence) {
+        seen[groups[i]] = 1;
+        frameWords.push_back(groups[i]);
+      }
+    }
+  }
+  std::sort(frameWords.begin(), frameWords.end());
+
+  SparseBOW bow;
+  bow.words = frameWords;
+  bow.values.assign(frameWords.size(), 1.0f / frameWords.size());
+  return bow;
+}
+
+ofpy3::SparseBOW
+ofpy3::bench::SyntheticData::revisit(const SparseBOW &bow,
+                                     std::uint64_t frameSeed) const {
+  std::mt19937_64 random(frameSeed);
+  std::uniform_real_distribution<double> uniform;
+  std::uniform_int_distribution<int> pickWord(0, config.vocabSize - 1);
+
+  std::vector<char> seen(config.vocabSize, 0);
+  std::vector<int> frameWords;
+  int replaced = 0;
+  for (int word : bow.words) {
+    if (uniform(random) < config.revisitNoise) {
+      ++replaced;
+    } else {
+      seen[word] = 1;
+      frameWords.push_back(word);
+    }
+  }
+  while (replaced > 0 && (int)frameWords.size() < config.vocabSize) {
+    const int word = pickWord(random);
+    if (!seen[word]) {
+      seen[word] = 1;
+      frameWords.push_back(word);
+      --replaced;
+    }
+  }
+  std::sort(frameWords.begin(), frameWords.end());
+
+  SparseBOW revisited;
+  revisited.words = frameWords;
+  revisited.values.assign(frameWords.size(), 1.0f / frameWords.size());
+  return revisited;
+}
+
+cv::Mat ofpy3::bench::SyntheticData::descriptors(
+    const SparseBOW &bow, std::uint64_t frameSeed) const {
+  CV_Assert(!bow.empty());
+  std::mt19937_64 random(streamSeed(config.seed, DESCRIPTORS, frameSeed));
+  std::normal_distribution<float> gaussian(0.0f,
+                                           (float)config.descriptorNoise);
+  cv::Mat descs(config.descriptorsPerFrame, config.descriptorSize, CV_32F);
+  for (int i = 0; i < descs.rows; ++i) {
+    // Every word of the frame at least once, then round robin
+    const float *word = words.ptr<float>(bow.words[i % bow.words.size()]);
+    float *row = descs.ptr<float>(i);
+    for (int j = 0; j < descs.cols; ++j) {
+      row[j] = word[j] + gaussian(random);
+    }
+    normaliseRow(row, descs.cols);
+  }
+  return descs;
+}
+
+cv::Mat
+ofpy3::bench::SyntheticData::randomDescriptors(int numDescriptors,
+                                               int numWords,
+                                               std::uint64_t seed) const {
+  CV_Assert(numWords > 0 && numWords <= config.vocabSize);
+  std::mt19937_64 random(streamSeed(config.seed, DESCRIPTORS, seed));
+  std::uniform_int_distribution<int> pickWord(0, numWords - 1);
+  std::normal_distribution<float> gaussian(0.0f,
+                                           (float)config.descriptorNoise);
+  cv::Mat descs(numDescriptors, config.descriptorSize, CV_32F);
+  for (int i = 0; i < descs.rows; ++i) {
+    const float *word = words.ptr<float>(pickWord(random));
+    float *row = descs.ptr<float>(i);
+    for (int j = 0; j < descs.cols; ++j) {
+      row[j] = word[j] + gaussian(random);
+    }
+    normaliseRow(row, descs.cols);
+  }
+  return descs;
+}
@@ -0,0 +1,85 @@
+#ifndef SYNTHETIC_DATA_H
+#define SYNTHETIC_DATA_H
+
+#include "SparseBOW.h"
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+namespace bench {
+
+/**
+ * The shape of a synthetic workload. Everything generated from it is a pure
+ * function of these values, seed included.
+ */
+struct SyntheticConfig {
+  int vocabSize = 10000;
+  int descriptorSize = 64;
+  // Distinct words per frame, and descriptors per frame (spread over them).
+  int wordsPerFrame = 300;
+  int descriptorsPerFrame = 600;
+  // Frames in the map, in the Chow-Liu training data, and queries.
+  int mapSize = 1000;
+  int trainingFrames = 500;
+  int queries = 50;
+  // Words come in groups of groupSize; when a frame sees a word, each other
+  // word of its group is seen too with this probability. 0 gives independent
+  // words, 1 words that always co-occur.
+  int groupSize = 8;
+  double coOccurrence = 0.5;
+  // Queries revisit a map frame, with this fraction of its words replaced.
+  double revisitNoise = 0.2;
+  // Standard deviation of descriptors around their word.
+  double descriptorNoise = 0.02;
+  std::uint64_t seed = 42;
+};
+
+/**
+ * Synthetic descriptors and bags-of-words with controllable vocabulary size,
+ * words per frame, map size and co-occurrence structure.
+ */
+class SyntheticData {
+public:
+  explicit SyntheticData(const SyntheticConfig &config);
+
+  const SyntheticConfig &getConfig() const { return config; }
+
+  // vocabSize x descriptorSize CV_32F words, unit length (like SURF).
+  const cv::Mat &getWords() const { return words; }
+
+  // The frames' bags-of-words. Queries revisit map frames queryPlace[i].
+  const std::vector<SparseBOW> &getTrainingBOWs() const { return training; }
+  const std::vector<SparseBOW> &getMapBOWs() const { return map; }
+  const std::vector<SparseBOW> &getQueryBOWs() const { return queries; }
+  int getQueryPlace(int query) const { return queryPlaces[query]; }
+
+  // descriptorsPerFrame descriptors of a frame's words, as a feature
+  // extractor would give them.
+  cv::Mat descriptors(const SparseBOW &bow, std::uint64_t frameSeed) const;
+  // numDescriptors descriptors scattered around random words among the
+  // first numWords.
+  cv::Mat randomDescriptors(int numDescriptors, int numWords,
+                            std::uint64_t seed) const;
+
+private:
+  SparseBOW frame(std::uint64_t frameSeed) const;
+  SparseBOW revisit(const SparseBOW &bow, std::uint64_t frameSeed) const;
+
+private:
+  SyntheticConfig config;
+  cv::Mat words;
+  // Word ids by group: group g is groups[g * groupSize, (g + 1) * groupSize).
+  std::vector<int> groups;
+  std::vector<int> groupOf;
+  std::vector<SparseBOW> training;
+  std::vector<SparseBOW> map;
+  std::vector<SparseBOW> queries;
+  std::vector<int> queryPlaces;
+};
+
+} // namespace bench
+} // namespace ofpy3
+
+#endif // SYNTHETIC_DATA_H
@@ -0,0 +1,610 @@
+/**
+ * ofpy3_bench: reproducible synthetic benchmarks of quantization, vocabulary
+ * clustering, Chow-Liu tree building and localization with every FabMap
+ * version. Results are written as JSON, one entry per benchmark with its
+ * throughput, latency percentiles, and its peak RSS and RSS growth.
+ *
+ *   ofpy3_bench [--vocab-size=N] [--map-size=N] [--filter=localize] ...
+ *
+ * Run with --help for every option.
+ */
+
+#include "ChowLiuTreeBuilder.h"
+#include "DescriptorStore.h"
+#include "FabMapEngine.h"
+#include "FabMapVocabulary.h"
+#include "SparseFabMap.h"
+#include "SyntheticData.h"
+#include "VocabularyClusterer.h"
+
+#include <bowmsctrainer.hpp>
+#include <chowliutree.hpp>
+#include <fabmap.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+using ofpy3::bench::SyntheticConfig;
+using ofpy3::bench::SyntheticData;
+
+struct Options {
+  SyntheticConfig data;
+  // Clustering input: descriptors around the first clusterWords words.
+  int clusterDescriptors = 20000;
+  int clusterWords = 1000;
+  double clusterSize = 0.45;
+  double infoThreshold = 0.0005;
+  std::string newPlaceMethod = "Sampled";
+  std::string bayesMethod = "ChowLiu";
+  int numSamples = 500;
+  int threads = 0;
+  int lutPrecision = 6;
+  // Also run the single threaded of2 Chow-Liu builder (O(V^2) memory).
+  bool reference = false;
+  // Only run the benchmarks whose name contains this.
+  std::string filter;
+  std::string output;
+};
+
+struct Result {
+  std::string name;
+  std::string unit;
+  double itemsPerIteration = 0;
+  std::vector<double> latencies; // seconds, one per iteration
+  // The RSS high-water mark while the benchmark ran (see RssWindow), and how
+  // far it rose above the RSS the benchmark started with.
+  long peakRssKb = 0;
+  long rssGrowthKb = 0;
+  // Benchmark specific figures, such as recall.
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+#if defined(__linux__)
+// A field of /proc/self/status in kB, such as VmRSS or VmHWM, 0 if missing.
+long procStatusKb(const std::string &field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, field.size() + 1, field + ":") == 0) {
+      return std::atol(line.c_str() + field.size() + 1);
+    }
+  }
+  return 0;
+}
+#endif
+
+long peakRssKb() {
+#if defined(__linux__)
+  // Unlike ru_maxrss, this is reset by resetPeakRss.
+  return procStatusKb("VmHWM");
+#elif defined(__APPLE__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024; // bytes
+#elif defined(__unix__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss; // kilobytes
+#else
+  return 0;
+#endif
+}
+
+// Resets the peak RSS to the current RSS, where the kernel allows it (Linux
+// 4.0 onwards). Returns whether it did.
+bool resetPeakRss() {
+#if defined(__linux__)
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+  clearRefs.flush();
+  return clearRefs.good();
+#else
+  return false;
+#endif
+}
+
+/**
+ * The memory one benchmark uses, from its construction on. Where the peak
+ * can be reset, the peak is the benchmark's own and the growth is measured
+ * from the RSS it started with. Elsewhere the process's peak never
+ * decreases, so the growth only shows what a benchmark adds past every
+ * earlier one (run it alone with --filter to attribute its memory).
+ */
+class RssWindow {
+public:
+  RssWindow() {
+#if defined(__linux__)
+    startKb = resetPeakRss() ? procStatusKb("VmRSS") : peakRssKb();
+#else
+    startKb = peakRssKb();
+#endif
+  }
+
+  void record(Result &result) const {
+    result.peakRssKb = peakRssKb();
+    result.rssGrowthKb = std::max(0L, result.peakRssKb - startKb);
+  }
+
+private:
+  long startKb;
+};
+
+// Times work(i) for each of iterations, each doing itemsPerIteration units.
+// Memory is measured from window if given (to include untimed setup), else
+// from the first iteration.
+Result measure(const std::string &name, const std::string &unit,
+               int iterations, double itemsPerIteration,
+               const std::function<void(int)> &work,
+               const RssWindow *window = nullptr) {
+  const RssWindow ownWindow;
+  Result result;
+  result.name = name;
+  result.unit = unit;
+  result.itemsPerIteration = itemsPerIteration;
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    work(i);
+    result.latencies.push_back(std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count());
+  }
+  (window ? window : &ownWindow)->record(result);
+  return result;
+}
+
+// Nearest rank percentile of sorted values.
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const std::size_t rank = static_cast<std::size_t>(
+      std::max(1.0, std::ceil(p / 100.0 * sorted.size())));
+  return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+std::string jsonString(const std::string &value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string jsonNumber(double value) {
+  std::ostringstream out;
+  out.precision(9);
+  out << value;
+  return out.str();
+}
+
+void writeJson(std::ostream &out, const Options &options,
+               const std::vector<Result> &results) {
+  const SyntheticConfig &data = options.data;
+  out << "{\n  \"config\": {"
+      << "\"vocab_size\": " << data.vocabSize
+      << ", \"descriptor_size\": " << data.descriptorSize
+      << ", \"words_per_frame\": " << data.wordsPerFrame
+      << ", \"descriptors_per_frame\": " << data.descriptorsPerFrame
+      << ", \"map_size\": " << data.mapSize
+      << ", \"training_frames\": " << data.trainingFrames
+      << ", \"queries\": " << data.queries
+      << ", \"group_size\": " << data.groupSize
+      << ", \"co_occurrence\": " << jsonNumber(data.coOccurrence)
+      << ", \"revisit_noise\": " << jsonNumber(data.revisitNoise)
+      << ", \"seed\": " << data.seed
+      << ", \"cluster_descriptors\": " << options.clusterDescriptors
+      << ", \"cluster_words\": " << options.clusterWords
+      << ", \"new_place_method\": " << jsonString(options.newPlaceMethod)
+      << ", \"bayes_method\": " << jsonString(options.bayesMethod)
+      << ", \"num_samples\": " << options.numSamples
+      << ", \"threads\": " << options.threads << "},\n  \"results\": [";
+  for (std::size_t r = 0; r < results.size(); ++r) {
+    const Result &result = results[r];
+    std::vector<double> sorted(result.latencies);
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double latency : sorted) {
+      total += latency;
+    }
+    const double mean = sorted.empty() ? 0 : total / sorted.size();
+    out << (r ? ",\n    {" : "\n    {") << "\"name\": " << jsonString(result.name)
+        << ", \"unit\": " << jsonString(result.unit)
+        << ", \"iterations\": " << sorted.size()
+        << ", \"items_per_iteration\": " << jsonNumber(result.itemsPerIteration)
+        << ", \"throughput\": "
+        << jsonNumber(total > 0 ? result.itemsPerIteration * sorted.size() /
+                                      total
+                                : 0)
+        << ", \"latency_ms\": {\"mean\": " << jsonNumber(mean * 1e3)
+        << ", \"p50\": " << jsonNumber(percentile(sorted, 50) * 1e3)
+        << ", \"p90\": " << jsonNumber(percentile(sorted, 90) * 1e3)
+        << ", \"p99\": " << jsonNumber(percentile(sorted, 99) * 1e3)
+        << ", \"max\": "
+        << jsonNumber(sorted.empty() ? 0 : sorted.back() * 1e3) << "}"
+        << ", \"peak_rss_kb\": " << result.peakRssKb
+        << ", \"rss_growth_kb\": " << result.rssGrowthKb;
+    for (const auto &metric : result.metrics) {
+      out << ", " << jsonString(metric.first) << ": "
+          << jsonNumber(metric.second);
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// ----------------- Benchmarks -----------------
+
+class Bench {
+public:
+  Bench(const Options &options, std::vector<Result> &results)
+      : options(options), data(options.data), results(results) {}
+
+  bool selected(const std::string &name) const {
+    return options.filter.empty() ||
+           name.find(options.filter) != std::string::npos;
+  }
+
+  bool anySelected(std::initializer_list<const char *> names) const {
+    for (const char *name : names) {
+      if (selected(name)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void add(const Result &result) {
+    std::cerr << result.name << ": " << result.latencies.size()
+              << " iterations" << std::endl;
+    results.push_back(result);
+  }
+
+  void quantization() {
+    if (!anySelected(
+            {"quantize.compute", "quantize.sparse", "quantize.exact"})) {
+      return;
+    }
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < data.getConfig().queries; ++i) {
+      frames.push_back(data.descriptors(data.getQueryBOWs()[i], i));
+    }
+    const double descsPerFrame = data.getConfig().descriptorsPerFrame;
+
+    ofpy3::FabMapVocabulary vocabulary(ofpy3::Settings(), data.getWords(),
+                                       false);
+    if (selected("quantize.compute")) {
+      add(measure("quantize.compute", "descriptors", (int)frames.size(),
+                  descsPerFrame, [&](int i) {
+                    cv::Mat bow;
+                    vocabulary.compute(frames[i], bow);
+                  }));
+    }
+    if (selected("quantize.sparse")) {
+      add(measure("quantize.sparse", "descriptors", (int)frames.size(),
+                  descsPerFrame,
+                  [&](int i) { vocabulary.quantize(frames[i]); }));
+    }
+    if (selected("quantize.exact")) {
+      vocabulary.setExactSearch(true);
+      Result result = measure(
+          "quantize.exact", "descriptors", (int)frames.size(), descsPerFrame,
+          [&](int i) { vocabulary.quantize(frames[i]); });
+      vocabulary.setExactSearch(false);
+      add(result);
+    }
+  }
+
+  void clustering() {
+    if (!anySelected({"cluster.of2", "cluster.parallel"})) {
+      return;
+    }
+    const cv::Mat descs = data.randomDescriptors(
+        options.clusterDescriptors,
+        std::min(options.clusterWords, data.getConfig().vocabSize), 0);
+    if (selected("cluster.of2")) {
+      cv::Mat words;
+      Result result =
+          measure("cluster.of2", "descriptors", 1, descs.rows, [&](int) {
+            of2::BOWMSCTrainer trainer(options.clusterSize);
+            trainer.add(descs);
+            words = trainer.cluster();
+          });
+      result.metrics.push_back({"words", (double)words.rows});
+      add(result);
+    }
+    if (selected("cluster.parallel")) {
+      ofpy3::DescriptorStore store;
+      store.append(descs);
+      cv::Mat words;
+      Result result =
+          measure("cluster.parallel", "descriptors", 1, descs.rows, [&](int) {
+            words = ofpy3::clusterVocabulary(store, options.clusterSize);
+          });
+      result.metrics.push_back({"words", (double)words.rows});
+      add(result);
+    }
+  }
+
+  void chowLiu() {
+    const std::vector<ofpy3::SparseBOW> &training = data.getTrainingBOWs();
+    const int vocabSize = data.getConfig().vocabSize;
+    if (selected("chowliu.parallel")) {
+      add(measure("chowliu.parallel", "frames", 1, training.size(), [&](int) {
+        ofpy3::buildChowLiuTree(training, vocabSize, options.infoThreshold);
+      }));
+    }
+    if (options.reference && selected("chowliu.of2")) {
+      const cv::Mat dense = ofpy3::toDense(training, vocabSize);
+      add(measure("chowliu.of2", "frames", 1, training.size(), [&](int) {
+        of2::ChowLiuTree tree;
+        tree.add(dense);
+        tree.make(options.infoThreshold);
+      }));
+    }
+  }
+
+  void localization() {
+    if (!anySelected(
+            {"localize.FABMAP1.sparse", "localize.FABMAPLUT.sparse",
+             "localize.FABMAP1.of2", "localize.FABMAPLUT.of2",
+             "localize.FABMAP2.sparse", "localize.FABMAPFBO.of2",
+             "localize.FABMAP2.of2"})) {
+      return;
+    }
+    const cv::Mat clTree = ofpy3::buildChowLiuTree(
+        data.getTrainingBOWs(), data.getConfig().vocabSize,
+        options.infoThreshold);
+    int flags = options.newPlaceMethod == "Sampled" ? of2::FabMap::SAMPLED
+                                                    : of2::FabMap::MEAN_FIELD;
+    flags |= options.bayesMethod == "ChowLiu" ? of2::FabMap::CHOW_LIU
+                                              : of2::FabMap::NAIVE_BAYES;
+    // FABMAP2 only samples its new place
+    const int fabmap2Flags =
+        (flags & ~of2::FabMap::MEAN_FIELD) | of2::FabMap::SAMPLED;
+    const double PzGe = 0.39;
+    const double PzGne = 0.0;
+    const int vocabSize = data.getConfig().vocabSize;
+
+    localize("localize.FABMAP1.sparse", [&]() {
+      ofpy3::SparseFabMap *fabmap = new ofpy3::SparseFabMap(
+          clTree, PzGe, PzGne, flags, options.numSamples);
+      fabmap->setNumThreads(options.threads);
+      return std::unique_ptr<ofpy3::FabMapEngine>(fabmap);
+    });
+    localize("localize.FABMAPLUT.sparse", [&]() {
+      ofpy3::SparseFabMap *fabmap = new ofpy3::SparseFabMap(
+          clTree, PzGe, PzGne, flags, options.numSamples,
+          ofpy3::SparseFabMap::FABMAPLUT, options.lutPrecision);
+      fabmap->setNumThreads(options.threads);
+      return std::unique_ptr<ofpy3::FabMapEngine>(fabmap);
+    });
+    localize("localize.FABMAP2.sparse", [&]() {
+      ofpy3::SparseFabMap *fabmap = new ofpy3::SparseFabMap(
+          clTree, PzGe, PzGne, fabmap2Flags, options.numSamples,
+          ofpy3::SparseFabMap::FABMAP2);
+      fabmap->setNumThreads(options.threads);
+      return std::unique_ptr<ofpy3::FabMapEngine>(fabmap);
+    });
+    localize("localize.FABMAP1.of2", [&]() {
+      return std::unique_ptr<ofpy3::FabMapEngine>(new ofpy3::Of2FabMapEngine(
+          std::make_shared<of2::FabMap1>(clTree, PzGe, PzGne, flags,
+                                         options.numSamples),
+          vocabSize));
+    });
+    localize("localize.FABMAPLUT.of2", [&]() {
+      return std::unique_ptr<ofpy3::FabMapEngine>(new ofpy3::Of2FabMapEngine(
+          std::make_shared<of2::FabMapLUT>(clTree, PzGe, PzGne, flags,
+                                           options.numSamples,
+                                           options.lutPrecision),
+          vocabSize));
+    });
+    localize("localize.FABMAPFBO.of2", [&]() {
+      return std::unique_ptr<ofpy3::FabMapEngine>(new ofpy3::Of2FabMapEngine(
+          std::make_shared<of2::FabMapFBO>(clTree, PzGe, PzGne, flags,
+                                           options.numSamples, 1e-8, 1e-8, 512,
+                                           9),
+          vocabSize));
+    });
+    localize("localize.FABMAP2.of2", [&]() {
+      return std::unique_ptr<ofpy3::FabMapEngine>(new ofpy3::Of2FabMapEngine(
+          std::make_shared<of2::FabMap2>(clTree, PzGe, PzGne, fabmap2Flags),
+          vocabSize));
+    });
+  }
+
+private:
+  // Builds the map untimed, then times each query against it (without
+  // adding it). Also reports how often the best match is the revisited place.
+  void localize(const std::string &name,
+                const std::function<std::unique_ptr<ofpy3::FabMapEngine>()>
+                    &makeEngine) {
+    if (!selected(name)) {
+      return;
+    }
+    const RssWindow window;
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<ofpy3::FabMapEngine> engine = makeEngine();
+    engine->addTraining(data.getTrainingBOWs());
+    for (const ofpy3::SparseBOW &bow : data.getMapBOWs()) {
+      engine->add(bow);
+    }
+    const double setup = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+    const std::vector<ofpy3::SparseBOW> &queries = data.getQueryBOWs();
+    int correct = 0;
+    std::vector<of2::IMatch> matches;
+    Result result =
+        measure(name, "frames", (int)queries.size(), 1, [&](int i) {
+          engine->localize(queries[i], matches, false,
+                           ofpy3::MatchSelection());
+          const auto best = std::max_element(
+              matches.begin(), matches.end(),
+              [](const of2::IMatch &a, const of2::IMatch &b) {
+                return a.match < b.match;
+              });
+          if (best != matches.end() &&
+              best->imgIdx == data.getQueryPlace(i)) {
+            ++correct;
+          }
+        }, &window);
+    result.metrics.push_back({"setup_seconds", setup});
+    result.metrics.push_back(
+        {"recall_at_1", queries.empty() ? 0.0 : (double)correct / queries.size()});
+    add(result);
+  }
+
+  const Options &options;
+  SyntheticData data;
+  std::vector<Result> &results;
+};
+
+// ----------------- Command line -----------------
+
+void usage() {
+  std::cerr
+      << "usage: ofpy3_bench [options]\n"
+         "  --vocab-size=N             words in the vocabulary (10000)\n"
+         "  --descriptor-size=N        floats per descriptor (64)\n"
+         "  --words-per-frame=N        distinct words per frame (300)\n"
+         "  --descriptors-per-frame=N  descriptors per frame (600)\n"
+         "  --map-size=N               places in the map (1000)\n"
+         "  --training-frames=N        Chow-Liu training frames (500)\n"
+         "  --queries=N                timed queries (50)\n"
+         "  --group-size=N             words per co-occurrence group (8)\n"
+         "  --co-occurrence=P          P(group word | word seen) (0.5)\n"
+         "  --revisit-noise=P          fraction of words a query changes "
+         "(0.2)\n"
+         "  --seed=N                   random seed (42)\n"
+         "  --cluster-descriptors=N    descriptors to cluster (20000)\n"
+         "  --cluster-words=N          words they are drawn around (1000)\n"
+         "  --cluster-size=D           clustering radius (0.45)\n"
+         "  --new-place=Sampled|Meanfield  (Sampled)\n"
+         "  --bayes=ChowLiu|Naive      (ChowLiu)\n"
+         "  --samples=N                new place samples (500)\n"
+         "  --threads=N                sparse engine threads, 0 for all "
+         "(0)\n"
+         "  --reference                also run the of2 Chow-Liu builder\n"
+         "  --filter=TEXT              only benchmarks whose name has TEXT\n"
+         "  --output=FILE              write the JSON there, not stdout\n";
+}
+
+bool parseArgs(int argc, char **argv, Options &options) {
+  SyntheticConfig &data = options.data;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    const std::size_t equals = arg.find('=');
+    if (equals != std::string::npos) {
+      value = arg.substr(equals + 1);
+      arg = arg.substr(0, equals);
+    } else if (arg != "--reference" && arg != "--help" && i + 1 < argc) {
+      value = argv[++i];
+    }
+
+    if (arg == "--help") {
+      return false;
+    } else if (arg == "--reference") {
+      options.reference = true;
+    } else if (arg == "--vocab-size") {
+      data.vocabSize = std::stoi(value);
+    } else if (arg == "--descriptor-size") {
+      data.descriptorSize = std::stoi(value);
+    } else if (arg == "--words-per-frame") {
+      data.wordsPerFrame = std::stoi(value);
+    } else if (arg == "--descriptors-per-frame") {
+      data.descriptorsPerFrame = std::stoi(value);
+    } else if (arg == "--map-size") {
+      data.mapSize = std::stoi(value);
+    } else if (arg == "--training-frames") {
+      data.trainingFrames = std::stoi(value);
+    } else if (arg == "--queries") {
+      data.queries = std::stoi(value);
+    } else if (arg == "--group-size") {
+      data.groupSize = std::stoi(value);
+    } else if (arg == "--co-occurrence") {
+      data.coOccurrence = std::stod(value);
+    } else if (arg == "--revisit-noise") {
+      data.revisitNoise = std::stod(value);
+    } else if (arg == "--seed") {
+      data.seed = std::stoull(value);
+    } else if (arg == "--cluster-descriptors") {
+      options.clusterDescriptors = std::stoi(value);
+    } else if (arg == "--cluster-words") {
+      options.clusterWords = std::stoi(value);
+    } else if (arg == "--cluster-size") {
+      options.clusterSize = std::stod(value);
+    } else if (arg == "--new-place") {
+      options.newPlaceMethod = value;
+    } else if (arg == "--bayes") {
+      options.bayesMethod = value;
+    } else if (arg == "--samples") {
+      options.numSamples = std::stoi(value);
+    } else if (arg == "--threads") {
+      options.threads = std::stoi(value);
+    } else if (arg == "--filter") {
+      options.filter = value;
+    } else if (arg == "--output") {
+      options.output = value;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  try {
+    if (!parseArgs(argc, argv, options)) {
+      usage();
+      return 2;
+    }
+  } catch (const std::exception &) {
+    usage();
+    return 2;
+  }
+
+  std::vector<Result> results;
+  Bench bench(options, results);
+  bench.quantization();
+  bench.clustering();
+  bench.chowLiu();
+  bench.localization();
+
+  if (options.output.empty()) {
+    writeJson(std::cout, options, results);
+  } else {
+    std::ofstream out(options.output);
+    writeJson(out, options, results);
+    if (!out) {
+      std::cerr << "could not write " << options.output << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,485 @@
+/**
+ * ofpy3-cli: trains a model and localizes over a directory of images or
+ * descriptors, with no Python interpreter.
+ *
+ *   ofpy3-cli train --input=train/ --model=model.bin
+ *   ofpy3-cli tree --input=train/ --model=model.bin --output=model.bin
+ *   ofpy3-cli localize --input=run/ --model=model.bin > results.csv
+ *
+ * Settings are read from a YAML, JSON or XML file laid out as the Python
+ * settings dict. Run with --help for every option.
+ */
+
+#include "ChowLiuTree.h"
+#include "FabMapVocabulary.h"
+#include "ImagePipeline.h"
+#include "OpenFABMAP.h"
+#include "Settings.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace {
+
+struct Options {
+  std::string command;
+  std::string settingsFile;
+  std::string input;
+  std::string model;
+  // Where train and tree write the model, the --model file if empty.
+  std::string output;
+  // Localization
+  bool add = true;
+  std::string loadMap;
+  std::string saveMap;
+  bool stats = false;
+  std::string trace;
+  int batchSize = 256;
+  // Model files
+  bool compress = false;
+  bool mmap = true;
+};
+
+// ----------------- Inputs -----------------
+
+bool endsWith(const std::string &text, const std::string &suffix) {
+  if (text.size() < suffix.size()) {
+    return false;
+  }
+  std::string end = text.substr(text.size() - suffix.size());
+  std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+  return end == suffix;
+}
+
+// cv::FileStorage files (models, settings and descriptors) by extension.
+bool isFileStorage(const std::string &path) {
+  return endsWith(path, ".yml") || endsWith(path, ".yaml") ||
+         endsWith(path, ".xml") || endsWith(path, ".json") ||
+         endsWith(path, ".gz");
+}
+
+bool isDescriptorFile(const std::string &path) {
+  return endsWith(path, ".npy") || isFileStorage(path);
+}
+
+// The files in a directory, or matching a glob pattern, sorted.
+std::vector<std::string> listInputs(const std::string &input) {
+  std::vector<cv::String> matches;
+  cv::glob(input, matches, false);
+  std::vector<std::string> paths(matches.begin(), matches.end());
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+/**
+ * Reads a 2D C-ordered float32 or uint8 array from a NumPy .npy file, as
+ * np.save writes it. Enough for descriptors, not a general reader.
+ */
+cv::Mat readNpy(const std::string &path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  char magic[8];
+  if (!in.read(magic, sizeof(magic)) ||
+      std::string(magic, 6) != "\x93NUMPY") {
+    CV_Error(CV_StsError, path + ": not a .npy file");
+  }
+  std::uint32_t headerLength = 0;
+  unsigned char length[4] = {0, 0, 0, 0};
+  // Version 1 has a 2 byte header length, later versions 4 bytes
+  in.read(reinterpret_cast<char *>(length), magic[6] == 1 ? 2 : 4);
+  for (int i = 3; i >= 0; --i) {
+    headerLength = (headerLength << 8) | length[i];
+  }
+  std::string header(headerLength, ' ');
+  in.read(&header[0], headerLength);
+  if (!in) {
+    CV_Error(CV_StsError, path + ": truncated .npy header");
+  }
+
+  int type = -1;
+  if (header.find("'<f4'") != std::string::npos) {
+    type = CV_32F;
+  } else if (header.find("'|u1'") != std::string::npos) {
+    type = CV_8U;
+  } else {
+    CV_Error(CV_StsError, path + ": descriptors must be float32 or uint8");
+  }
+  if (header.find("'fortran_order': False") == std::string::npos) {
+    CV_Error(CV_StsError, path + ": descriptors must be C ordered");
+  }
+  const std::size_t shape = header.find("'shape': (");
+  if (shape == std::string::npos) {
+    CV_Error(CV_StsError, path + ": no shape in .npy header");
+  }
+  int rows = 0, cols = 0;
+  const char *dims = header.c_str() + shape + 10;
+  char *end;
+  rows = static_cast<int>(std::strtol(dims, &end, 10));
+  if (*end == ',') {
+    cols = static_cast<int>(std::strtol(end + 1, &end, 10));
+  }
+  if (rows < 0 || cols <= 0) {
+    CV_Error(CV_StsError, path + ": descriptors must be a 2D array");
+  }
+
+  cv::Mat descs(rows, cols, type);
+  in.read(reinterpret_cast<char *>(descs.data),
+          static_cast<std::streamsize>(descs.total() * descs.elemSize()));
+  if (!in) {
+    CV_Error(CV_StsError, path + ": truncated .npy data");
+  }
+  return descs;
+}
+
+// One frame's descriptors, from a .npy file or under "descriptors" in a
+// cv::FileStorage file.
+cv::Mat readDescriptors(const std::string &path) {
+  if (endsWith(path, ".npy")) {
+    return readNpy(path);
+  }
+  cv::FileStorage fs(path, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    CV_Error(CV_StsError, path + ": cannot open descriptor file");
+  }
+  cv::Mat descs;
+  fs["descriptors"] >> descs;
+  return descs;
+}
+
+// ----------------- Models -----------------
+
+// A mapped model must not be rewritten in place, so tree (which may write
+// over it) reads it into memory.
+std::shared_ptr<ofpy3::ChowLiuTree> loadModel(const Options &options,
+                                              const ofpy3::Settings &settings,
+                                              bool useMmap) {
+  if (isFileStorage(options.model)) {
+    return ofpy3::ChowLiuTree::load(settings, options.model);
+  }
+  return ofpy3::ChowLiuTree::loadBinary(settings, options.model, useMmap,
+                                        false);
+}
+
+void saveModel(const Options &options, const ofpy3::ChowLiuTree &tree) {
+  const std::string &filename =
+      options.output.empty() ? options.model : options.output;
+  if (isFileStorage(filename)) {
+    tree.save(filename);
+  } else {
+    tree.saveBinary(filename, options.compress);
+  }
+  std::cerr << "wrote " << filename << std::endl;
+}
+
+// ----------------- Commands -----------------
+
+// Clusters the vocabulary, and writes a model holding just that.
+int trainVocabulary(const Options &options, const ofpy3::Settings &settings) {
+  ofpy3::FabMapVocabularyBuilder builder(settings);
+  builder.initDetectorExtractor(settings);
+  int frames = 0;
+  for (const std::string &path : listInputs(options.input)) {
+    if (isDescriptorFile(path)) {
+      builder.addTrainingDescs(readDescriptors(path));
+      ++frames;
+    } else if (builder.loadAndAddTrainingImage(path)) {
+      ++frames;
+    } else {
+      std::cerr << "skipped " << path << std::endl;
+    }
+  }
+  std::cerr << "clustering the descriptors of " << frames << " frames"
+            << std::endl;
+  ofpy3::ChowLiuTree tree(builder.buildVocabulary(), settings);
+  saveModel(options, tree);
+  return 0;
+}
+
+// Adds training frames to a model and (re)builds its Chow-Liu tree.
+int buildTree(const Options &options, const ofpy3::Settings &settings) {
+  std::shared_ptr<ofpy3::ChowLiuTree> tree =
+      loadModel(options, settings, false);
+  std::vector<std::string> images;
+  std::vector<cv::Mat> descs;
+  for (const std::string &path : listInputs(options.input)) {
+    if (isDescriptorFile(path)) {
+      descs.push_back(readDescriptors(path));
+    } else {
+      images.push_back(path);
+    }
+  }
+  tree->reserve(tree->getTrainingBOWs().size() + images.size() + descs.size());
+  const std::vector<bool> loaded = tree->loadAndAddTrainingImages(images);
+  for (std::size_t i = 0; i < loaded.size(); ++i) {
+    if (!loaded[i]) {
+      std::cerr << "skipped " << images[i] << std::endl;
+    }
+  }
+  tree->addTrainingDescsBatch(descs);
+  std::cerr << "building the tree over " << tree->getTrainingBOWs().size()
+            << " frames" << std::endl;
+  tree->buildChowLiuTree();
+  saveModel(options, *tree);
+  return 0;
+}
+
+void writeRow(std::ostream &out, const ofpy3::PipelineResult &result) {
+  out << result.path << ',' << result.queryIdx << ',' << result.bestIdx << ','
+      << result.bestLikelihood << '\n';
+}
+
+void printStats(const ofpy3::Stats &stats, std::size_t mapBytes) {
+  const double ms = 1e-6;
+  std::cerr << "stage        count    mean_ms     p50_ms     p99_ms\n";
+  for (int i = 0; i < static_cast<int>(ofpy3::Stage::Count); ++i) {
+    const ofpy3::Stage stage = static_cast<ofpy3::Stage>(i);
+    const ofpy3::Histogram::Snapshot snapshot = stats.getStage(stage);
+    if (!snapshot.count) {
+      continue;
+    }
+    std::cerr << std::left;
+    std::cerr.width(10);
+    std::cerr << ofpy3::stageName(stage) << std::right;
+    std::cerr.width(8);
+    std::cerr << snapshot.count;
+    std::cerr.width(11);
+    std::cerr << snapshot.mean() * ms;
+    std::cerr.width(11);
+    std::cerr << snapshot.quantile(0.5) * ms;
+    std::cerr.width(11);
+    std::cerr << snapshot.quantile(0.99) * ms << '\n';
+  }
+  std::cerr << "map_bytes " << mapBytes << std::endl;
+}
+
+/**
+ * Localizes every frame of the input in order, writing one CSV row per frame
+ * to the output (stdout if none): path, query index, best match and its
+ * likelihood. Frames that could not be loaded, or had no features, get a
+ * query index of -1. Images go through an ImagePipeline, descriptor files
+ * are quantized a batch at a time.
+ */
+int localizeInput(const Options &options, const ofpy3::Settings &settings) {
+  std::shared_ptr<ofpy3::ChowLiuTree> tree =
+      loadModel(options, settings, options.mmap);
+  ofpy3::OpenFABMAP openFabMap(tree, settings);
+  std::shared_ptr<ofpy3::Stats> stats = openFabMap.getStats();
+  if (options.stats || !options.trace.empty()) {
+    stats->setEnabled(true);
+  }
+  if (!options.trace.empty()) {
+    stats->setTracing(true);
+  }
+  if (!options.loadMap.empty()) {
+    openFabMap.loadMap(options.loadMap);
+  }
+
+  std::ofstream file;
+  if (!options.output.empty()) {
+    file.open(options.output.c_str(), std::ios::trunc);
+    if (!file) {
+      std::cerr << "could not write " << options.output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = options.output.empty() ? std::cout : file;
+  out.precision(17);
+  out << "path,query_idx,best_idx,best_likelihood\n";
+
+  const std::vector<std::string> paths = listInputs(options.input);
+  std::vector<std::string> images;
+  std::vector<std::string> descFiles;
+  for (const std::string &path : paths) {
+    if (isDescriptorFile(path)) {
+      descFiles.push_back(path);
+    } else {
+      images.push_back(path);
+    }
+  }
+  if (!images.empty() && !descFiles.empty()) {
+    std::cerr << options.input << ": mixes images and descriptor files"
+              << std::endl;
+    return 1;
+  }
+
+  if (!images.empty()) {
+    std::size_t next = 0;
+    std::shared_ptr<ofpy3::ImagePipeline> pipeline = openFabMap.startPipeline(
+        [&images, &next](std::string &path) {
+          if (next == images.size()) {
+            return false;
+          }
+          path = images[next++];
+          return true;
+        },
+        [&out](const ofpy3::PipelineResult &result) { writeRow(out, result); },
+        options.add);
+    pipeline->wait();
+  }
+
+  const int batchSize = std::max(1, options.batchSize);
+  for (std::size_t begin = 0; begin < descFiles.size(); begin += batchSize) {
+    const std::size_t end =
+        std::min(descFiles.size(), begin + static_cast<std::size_t>(batchSize));
+    std::vector<cv::Mat> descs;
+    for (std::size_t i = begin; i < end; ++i) {
+      descs.push_back(readDescriptors(descFiles[i]));
+    }
+    const ofpy3::BatchResult batch =
+        openFabMap.processDescsBatch(descs, options.add);
+    for (std::size_t i = 0; i < descs.size(); ++i) {
+      ofpy3::PipelineResult result;
+      result.path = descFiles[begin + i];
+      result.processed = batch.queryIdx[i] >= 0;
+      result.queryIdx = batch.queryIdx[i];
+      result.bestIdx = batch.bestIdx[i];
+      result.bestLikelihood = batch.bestLikelihood[i];
+      writeRow(out, result);
+    }
+  }
+
+  out.flush();
+  if (!out) {
+    std::cerr << "error writing the results" << std::endl;
+    return 1;
+  }
+  if (!options.saveMap.empty()) {
+    openFabMap.saveMap(options.saveMap);
+  }
+  if (options.stats) {
+    printStats(*stats, openFabMap.getMapBytes());
+  }
+  if (!options.trace.empty()) {
+    stats->writeTrace(options.trace);
+  }
+  return 0;
+}
+
+// ----------------- Command line -----------------
+
+void usage() {
+  std::cerr
+      << "usage: ofpy3-cli train|tree|localize [options]\n"
+         "  train     cluster a vocabulary from the input, write a model\n"
+         "  tree      add the input to a model's training data, build its\n"
+         "            Chow-Liu tree\n"
+         "  localize  localize the input in order, write CSV results\n"
+         "\n"
+         "  --input=DIR|GLOB   images, or descriptor files (.npy, or .yml/\n"
+         "                     .xml/.json with a \"descriptors\" matrix)\n"
+         "  --settings=FILE    settings (.yml/.json/.xml), as the Python dict\n"
+         "  --model=FILE       model file; .yml/.xml/.json/.gz are read and\n"
+         "                     written with cv::FileStorage, anything else\n"
+         "                     is the binary model format\n"
+         "  --output=FILE      train/tree: the model to write (--model)\n"
+         "                     localize: the CSV to write (stdout)\n"
+         "  --compress         write the training data sparse\n"
+         "  --no-mmap          read binary models into memory\n"
+         "  --no-add           localize without adding frames to the map\n"
+         "  --load-map=FILE    restore a place map before localizing\n"
+         "  --save-map=FILE    save the place map after localizing\n"
+         "  --batch-size=N     descriptor files localized per batch (256)\n"
+         "  --stats            print stage timings to stderr\n"
+         "  --trace=FILE       write a Chrome trace of the stages\n";
+}
+
+bool parseArgs(int argc, char **argv, Options &options) {
+  if (argc < 2) {
+    return false;
+  }
+  options.command = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    const std::size_t equals = arg.find('=');
+    if (equals != std::string::npos) {
+      value = arg.substr(equals + 1);
+      arg = arg.substr(0, equals);
+    } else if (arg != "--compress" && arg != "--no-mmap" &&
+               arg != "--no-add" && arg != "--stats" && arg != "--help" &&
+               i + 1 < argc) {
+      value = argv[++i];
+    }
+
+    if (arg == "--help") {
+      return false;
+    } else if (arg == "--input") {
+      options.input = value;
+    } else if (arg == "--settings") {
+      options.settingsFile = value;
+    } else if (arg == "--model") {
+      options.model = value;
+    } else if (arg == "--output") {
+      options.output = value;
+    } else if (arg == "--compress") {
+      options.compress = true;
+    } else if (arg == "--no-mmap") {
+      options.mmap = false;
+    } else if (arg == "--no-add") {
+      options.add = false;
+    } else if (arg == "--load-map") {
+      options.loadMap = value;
+    } else if (arg == "--save-map") {
+      options.saveMap = value;
+    } else if (arg == "--batch-size") {
+      options.batchSize = std::stoi(value);
+    } else if (arg == "--stats") {
+      options.stats = true;
+    } else if (arg == "--trace") {
+      options.trace = value;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  if (options.command != "train" && options.command != "tree" &&
+      options.command != "localize") {
+    std::cerr << "unknown command " << options.command << std::endl;
+    return false;
+  }
+  if (options.input.empty() || options.model.empty()) {
+    std::cerr << "--input and --model are required" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  try {
+    if (!parseArgs(argc, argv, options)) {
+      usage();
+      return 2;
+    }
+  } catch (const std::exception &) {
+    usage();
+    return 2;
+  }
+
+  try {
+    const ofpy3::Settings settings =
+        options.settingsFile.empty()
+            ? ofpy3::Settings()
+            : ofpy3::Settings::load(options.settingsFile);
+    if (options.command == "train") {
+      return trainVocabulary(options, settings);
+    } else if (options.command == "tree") {
+      return buildTree(options, settings);
+    }
+    return localizeInput(options, settings);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -33,7 +33,12 @@ vb.add_training_image(img)
 import cv2
 import numpy as np
 
-vb = of.VocabularyBuilder(SETTINGS)
+# ORB descriptors are binary, cluster and match them as packed bits
+BINARY_SETTINGS = dict(SETTINGS)
+BINARY_SETTINGS["VocabTrainOptions"] = dict()
+BINARY_SETTINGS["VocabTrainOptions"]["DescriptorType"] = "Binary"
+BINARY_SETTINGS["VocabTrainOptions"]["ClusterSize"] = 64  # Hamming bits
+vb = of.VocabularyBuilder(BINARY_SETTINGS)
 
 gray = cv2.imread("lenna.png", cv2.IMREAD_GRAYSCALE)
 orb = cv2.ORB_create(nfeatures=1500)
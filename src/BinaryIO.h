@@ -0,0 +1,85 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+namespace binaryio {
+
+// Written into headers, so files from a machine of the other endianness are
+// rejected rather than misread.
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304u;
+
+/**
+ * 64 bit FNV-1a hash, used as a cheap checksum. Pass the previous result as
+ * seed to checksum data in pieces.
+ */
+inline std::uint64_t checksum(const void *data, std::size_t size,
+                              std::uint64_t seed = 0xcbf29ce484222325ull) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  std::uint64_t hash = seed;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// The checksum of a whole file, false if it cannot be read.
+inline bool fileChecksum(const std::string &filename, std::uint64_t &result) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in.good()) {
+    return false;
+  }
+  std::uint64_t hash = checksum(nullptr, 0);
+  char buffer[65536];
+  while (in) {
+    in.read(buffer, sizeof(buffer));
+    hash = checksum(buffer, static_cast<std::size_t>(in.gcount()), hash);
+  }
+  result = hash;
+  return true;
+}
+
+inline std::uint64_t alignUp(std::uint64_t offset, std::uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename T> void write(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> bool read(std::istream &in, T &value) {
+  in.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return in.gcount() == static_cast<std::streamsize>(sizeof(T));
+}
+
+inline void writePadding(std::ostream &out, std::uint64_t alignment) {
+  static const char zeros[64] = {0};
+  std::uint64_t position = static_cast<std::uint64_t>(out.tellp());
+  std::uint64_t padding = alignUp(position, alignment) - position;
+  while (padding > 0) {
+    std::uint64_t chunk = padding < sizeof(zeros) ? padding : sizeof(zeros);
+    out.write(zeros, static_cast<std::streamsize>(chunk));
+    padding -= chunk;
+  }
+}
+
+inline void check(bool condition, const std::string &filename,
+                  const std::string &message) {
+  if (!condition) {
+    CV_Error(CV_StsParseError, filename + ": " + message);
+  }
+}
+
+} // namespace binaryio
+} // namespace ofpy3
+
+#endif // BINARY_IO_H
@@ -0,0 +1,90 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace ofpy3 {
+
+/**
+ * A blocking FIFO queue between threads. With a capacity, push blocks while
+ * the queue is full, which is what holds fast producers back to the pace of
+ * their consumers; a capacity of 0 leaves it unbounded. Once closed, pushes
+ * fail and pops drain what is left before failing.
+ */
+template <typename T> class BoundedQueue {
+public:
+  enum Status { ITEM, TIMEOUT, CLOSED };
+
+  explicit BoundedQueue(std::size_t capacity = 0)
+      : capacity(capacity), closed(false) {}
+
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] {
+      return closed || capacity == 0 || items.size() < capacity;
+    });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+    return take(item);
+  }
+
+  // As pop, but gives up after timeout.
+  template <typename Rep, typename Period>
+  Status popFor(T &item, const std::chrono::duration<Rep, Period> &timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!notEmpty.wait_for(lock, timeout,
+                           [this] { return closed || !items.empty(); })) {
+      return TIMEOUT;
+    }
+    return take(item) ? ITEM : CLOSED;
+  }
+
+  // Whether the queue is closed and everything in it has been popped.
+  bool drained() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed && items.empty();
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+private:
+  bool take(T &item) {
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+private:
+  const std::size_t capacity;
+  bool closed;
+  std::deque<T> items;
+  mutable std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+};
+
+} // namespace ofpy3
+
+#endif // BOUNDED_QUEUE_H
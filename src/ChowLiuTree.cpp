@@ -1,104 +1,303 @@
 #include "ChowLiuTree.h"
+#include "BinaryIO.h"
+#include "ModelFile.h"
 #include <chowliutree.hpp>
-#include <conversion.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
 #include <iostream>
 
+namespace {
+
+// Runs work(i) for every i in [0, n) across the OpenMP threads, and rethrows
+// the first exception once they are done.
+template <typename Work> void parallelFor(int n, const Work &work) {
+  std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < n; ++i) {
+    try {
+      work(i);
+    } catch (...) {
+#pragma omp critical
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// The directory part of a path, with its trailing separator.
+std::string directoryOf(const std::string &filename) {
+  const std::size_t separator = filename.find_last_of("/\\");
+  return separator == std::string::npos ? std::string()
+                                        : filename.substr(0, separator + 1);
+}
+
+/**
+ * Saves the vocabulary's FLANN index next to a model file, returning the
+ * index file's name (relative to the model's directory, which is how it is
+ * recorded) and checksum, or an empty name if there is no index.
+ */
+std::string saveIndex(const ofpy3::FabMapVocabulary &vocabulary,
+                      const std::string &modelFile, std::uint64_t &checksum) {
+  const std::string indexFile = modelFile + ".flann";
+  if (!vocabulary.saveIndex(indexFile) ||
+      !ofpy3::binaryio::fileChecksum(indexFile, checksum)) {
+    return std::string();
+  }
+  return indexFile.substr(directoryOf(indexFile).size());
+}
+
+/**
+ * The index file recorded with a model, if it is still the one saved with
+ * it: an index file from another model (or a stale one) is ignored, and the
+ * index rebuilt, rather than trusted with only a shape check.
+ */
+std::string savedIndex(const std::string &modelFile,
+                       const std::string &indexFile, std::uint64_t checksum) {
+  if (indexFile.empty()) {
+    return std::string();
+  }
+  const bool absolute = indexFile[0] == '/' || indexFile[0] == '\\';
+  const std::string path =
+      absolute ? indexFile : directoryOf(modelFile) + indexFile;
+  std::uint64_t actual = 0;
+  if (!ofpy3::binaryio::fileChecksum(path, actual) || actual != checksum) {
+    std::cerr << "Ignoring vocabulary index " << path
+              << ", it does not match the model; rebuilding it" << std::endl;
+    return std::string();
+  }
+  return path;
+}
+
+} // namespace
+
 // ----------------- ChowLiuTree -----------------
 
 ofpy3::ChowLiuTree::ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary,
-                                pybind11::dict settings)
-    : ChowLiuTree(vocabulary, cv::Mat(), cv::Mat(), settings) {}
+                                const Settings &settings)
+    : ChowLiuTree(vocabulary, cv::Mat(), std::vector<SparseBOW>(), settings) {}
 
 ofpy3::ChowLiuTree::ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary,
                                 cv::Mat chowLiuTree, cv::Mat fabmapTrainData,
-                                pybind11::dict settings)
+                                const Settings &settings)
+    : ChowLiuTree(vocabulary, std::move(chowLiuTree),
+                  ofpy3::fromDense(fabmapTrainData), settings) {}
+
+ofpy3::ChowLiuTree::ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary,
+                                cv::Mat chowLiuTree,
+                                std::vector<SparseBOW> fabmapTrainData,
+                                const Settings &settings)
     : vocabulary(vocabulary), chowLiuTree(std::move(chowLiuTree)),
       fabmapTrainData(std::move(fabmapTrainData)),
-      lowerInformationBound(0.0005), treeBuilt(!this->chowLiuTree.empty()) {
+      lowerInformationBound(0.0005), referenceBuilder(false),
+      treeBuilt(!this->chowLiuTree.empty()) {
   if (settings.contains("ChowLiuOptions")) {
-    pybind11::dict trainSettings = settings["ChowLiuOptions"];
-    if (trainSettings.contains("LowerInfoBound")) {
-      lowerInformationBound = trainSettings["LowerInfoBound"].cast<double>();
-    }
+    const Settings trainSettings = settings.section("ChowLiuOptions");
+    lowerInformationBound =
+        trainSettings.get<double>("LowerInfoBound", lowerInformationBound);
+    referenceBuilder =
+        trainSettings.get<std::string>("Builder", "") == "Reference";
   }
   vocabulary->convert();
 }
 
 ofpy3::ChowLiuTree::~ChowLiuTree() {}
 
-bool ofpy3::ChowLiuTree::loadAndAddTrainingImage(std::string imagePath) {
-  cv::Mat frame = cv::imread(imagePath, CV_LOAD_IMAGE_UNCHANGED);
-  return addTrainingImageInternal(frame);
+bool ofpy3::ChowLiuTree::loadAndAddTrainingImage(
+    const std::string &imagePath) {
+  return addTrainingImage(cv::imread(imagePath, CV_LOAD_IMAGE_UNCHANGED));
 }
 
-bool ofpy3::ChowLiuTree::addTrainingImage(
-    const pybind11::array_t<uchar> &frame) {
-  NDArrayConverter cvt;
-  cv::Mat mat{cvt.toMat(frame.ptr())};
-  return addTrainingImageInternal(mat);
+bool ofpy3::ChowLiuTree::addTrainingImage(const cv::Mat &frame) {
+  if (frame.data) {
+    addTrainingBOW(vocabulary->generateSparseBOW(frame));
+    return true;
+  }
+  return false;
 }
 
-bool ofpy3::ChowLiuTree::addTrainingDesc(
-    const pybind11::array_t<float> &desc_arr) {
-  NDArrayConverter cvt;
-  cv::Mat desc{cvt.toMat(desc_arr.ptr())};
+bool ofpy3::ChowLiuTree::addTrainingDesc(const cv::Mat &desc) {
   if (desc.data) {
-    cv::Mat bow = vocabulary->generateBOWImageDescsInternal(desc);
-    fabmapTrainData.push_back(std::move(bow));
-    treeBuilt = false;
+    addTrainingBOW(vocabulary->quantize(desc));
     return true;
   }
   return false;
 }
 
-bool ofpy3::ChowLiuTree::addTrainingImageInternal(const cv::Mat &frame) {
-  if (frame.data) {
-    cv::Mat bow = vocabulary->generateBOWImageDescs(frame);
-    fabmapTrainData.push_back(std::move(bow));
-    treeBuilt = false;
-    return true;
+/**
+ * Quantizes a list of descriptor matrices (one per frame) on all cores and
+ * adds them to the training data in list order. Returns, per frame, whether
+ * it had descriptors, as addTrainingDesc does.
+ */
+std::vector<bool> ofpy3::ChowLiuTree::addTrainingDescsBatch(
+    const std::vector<cv::Mat> &descMats) {
+  const int numFrames = static_cast<int>(descMats.size());
+  std::vector<bool> added(numFrames);
+  for (int i = 0; i < numFrames; ++i) {
+    added[i] = descMats[i].data != nullptr;
   }
-  return false;
+
+  std::vector<SparseBOW> bows(numFrames);
+  parallelFor(numFrames, [&](int i) {
+    if (descMats[i].data) {
+      bows[i] = vocabulary->quantize(descMats[i]);
+    }
+  });
+  addTrainingBOWs(bows);
+  return added;
+}
+
+/**
+ * Loads, detects and extracts features from and quantizes a list of images
+ * on all cores, adding them to the training data in list order. Returns, per
+ * image, whether it could be loaded.
+ */
+std::vector<bool> ofpy3::ChowLiuTree::loadAndAddTrainingImages(
+    const std::vector<std::string> &imagePaths) {
+  const int numFrames = static_cast<int>(imagePaths.size());
+  std::vector<SparseBOW> bows(numFrames);
+  std::vector<char> loaded(numFrames, 0);
+  parallelFor(numFrames, [&](int i) {
+    cv::Mat frame = cv::imread(imagePaths[i], CV_LOAD_IMAGE_UNCHANGED);
+    if (frame.data) {
+      loaded[i] = 1;
+      bows[i] = vocabulary->generateSparseBOW(frame);
+    }
+  });
+  addTrainingBOWs(bows);
+  return std::vector<bool>(loaded.begin(), loaded.end());
+}
+
+void ofpy3::ChowLiuTree::addTrainingBOW(SparseBOW bow) {
+  // Frames without any features add nothing, as with the dense rows before.
+  if (bow.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  fabmapTrainData.push_back(std::move(bow));
+  denseTrainData = cv::Mat();
+  treeBuilt = false;
+}
+
+// Appends a batch of frames in order, under one lock.
+void ofpy3::ChowLiuTree::addTrainingBOWs(std::vector<SparseBOW> &bows) {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  fabmapTrainData.reserve(fabmapTrainData.size() + bows.size());
+  for (SparseBOW &bow : bows) {
+    if (!bow.empty()) {
+      fabmapTrainData.push_back(std::move(bow));
+      denseTrainData = cv::Mat();
+      treeBuilt = false;
+    }
+  }
+}
+
+// Makes room for this many training frames up front.
+void ofpy3::ChowLiuTree::reserve(std::size_t numFrames) {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  fabmapTrainData.reserve(numFrames);
 }
 
-void ofpy3::ChowLiuTree::buildChowLiuTree() {
-  of2::ChowLiuTree tree;
-  tree.add(fabmapTrainData);
-  chowLiuTree = tree.make(lowerInformationBound);
+/**
+ * Builds the tree from the training data, in parallel unless the
+ * "Reference" builder is selected. Both give the same tree, the reference
+ * (single threaded, over the dense training data) is kept for validation.
+ *
+ * @param progress Called with the number of words in the tree so far, and
+ * the vocabulary size. Not called by the reference builder.
+ */
+void ofpy3::ChowLiuTree::buildChowLiuTree(const ChowLiuProgress &progress) {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  if (referenceBuilder) {
+    of2::ChowLiuTree tree;
+    tree.add(denseTrainingData());
+    chowLiuTree = tree.make(lowerInformationBound);
+  } else {
+    chowLiuTree = ofpy3::buildChowLiuTree(fabmapTrainData,
+                                          vocabulary->getVocabularySize(),
+                                          lowerInformationBound, progress);
+  }
   treeBuilt = true;
 }
 
-bool ofpy3::ChowLiuTree::isTreeBuilt() const { return treeBuilt; }
+bool ofpy3::ChowLiuTree::isTreeBuilt() const {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  return treeBuilt;
+}
 
 std::shared_ptr<ofpy3::FabMapVocabulary>
 ofpy3::ChowLiuTree::getVocabulary() const {
   return vocabulary;
 }
 
-cv::Mat ofpy3::ChowLiuTree::getChowLiuTree() const { return chowLiuTree; }
+cv::Mat ofpy3::ChowLiuTree::getChowLiuTree() const {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  return chowLiuTree;
+}
+
+cv::Mat ofpy3::ChowLiuTree::getTrainingData() const {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  return denseTrainingData();
+}
+
+// Must be called with trainDataMutex held.
+cv::Mat ofpy3::ChowLiuTree::denseTrainingData() const {
+  if (!denseTrainData.empty()) {
+    return denseTrainData;
+  }
+  return ofpy3::toDense(fabmapTrainData, vocabulary->getVocabularySize());
+}
 
-cv::Mat ofpy3::ChowLiuTree::getTrainingData() const { return fabmapTrainData; }
+const std::vector<ofpy3::SparseBOW> &
+ofpy3::ChowLiuTree::getTrainingBOWs() const {
+  return fabmapTrainData;
+}
 
 void ofpy3::ChowLiuTree::save(std::string filename) const {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
   cv::FileStorage fs;
   fs.open(filename, cv::FileStorage::WRITE);
   vocabulary->save(fs);
+  // The nearest-word index is written alongside, so that load does not need
+  // to rebuild it. Its checksum ties it to this model.
+  std::uint64_t indexChecksum = 0;
+  const std::string indexFile = saveIndex(*vocabulary, filename, indexChecksum);
+  if (!indexFile.empty()) {
+    char checksum[17];
+    std::snprintf(checksum, sizeof(checksum), "%016llx",
+                  static_cast<unsigned long long>(indexChecksum));
+    fs << "VocabularyIndex" << indexFile;
+    fs << "VocabularyIndexChecksum" << std::string(checksum);
+  }
   if (treeBuilt) {
     fs << "ChowLiuTree" << chowLiuTree;
-    fs << "FabMapTrainingData" << fabmapTrainData;
+    fs << "FabMapTrainingData" << denseTrainingData();
   }
   fs.release();
 }
 
 std::shared_ptr<ofpy3::ChowLiuTree>
-ofpy3::ChowLiuTree::load(pybind11::dict settings, std::string filename) {
+ofpy3::ChowLiuTree::load(const Settings &settings, std::string filename) {
   cv::FileStorage fs;
   fs.open(filename, cv::FileStorage::READ);
 
+  // Models from before the checksum was recorded rebuild their index.
+  std::string indexFile;
+  if (!fs["VocabularyIndex"].empty() &&
+      !fs["VocabularyIndexChecksum"].empty()) {
+    std::string savedFile, savedChecksum;
+    fs["VocabularyIndex"] >> savedFile;
+    fs["VocabularyIndexChecksum"] >> savedChecksum;
+    indexFile = savedIndex(filename, savedFile,
+                           std::strtoull(savedChecksum.c_str(), nullptr, 16));
+  }
+
   std::shared_ptr<ofpy3::FabMapVocabulary> vocab =
-      ofpy3::FabMapVocabulary::load(settings, fs);
+      ofpy3::FabMapVocabulary::load(settings, fs, indexFile);
 
   cv::Mat chowLiuTree;
   fs["ChowLiuTree"] >> chowLiuTree;
@@ -111,3 +310,55 @@ ofpy3::ChowLiuTree::load(pybind11::dict settings, std::string filename) {
   return std::make_shared<ofpy3::ChowLiuTree>(vocab, chowLiuTree,
                                               fabmapTrainData, settings);
 }
+
+void ofpy3::ChowLiuTree::saveBinary(std::string filename,
+                                    bool compressTrainingData) const {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  std::uint64_t indexChecksum = 0;
+  const std::string indexFile = saveIndex(*vocabulary, filename, indexChecksum);
+  cv::Mat treeCentres, treeNodes;
+  if (std::shared_ptr<const VocabularyTree> vocabTree =
+          vocabulary->getTree()) {
+    treeCentres = vocabTree->getCentres();
+    treeNodes = vocabTree->getNodes();
+  }
+  if (treeBuilt) {
+    ofpy3::writeModelFile(filename, vocabulary->getVocabulary(),
+                          vocabulary->isBinary(), treeCentres, treeNodes,
+                          chowLiuTree, fabmapTrainData, indexFile,
+                          indexChecksum, compressTrainingData);
+  } else {
+    ofpy3::writeModelFile(filename, vocabulary->getVocabulary(),
+                          vocabulary->isBinary(), treeCentres, treeNodes,
+                          cv::Mat(), std::vector<SparseBOW>(), indexFile,
+                          indexChecksum, compressTrainingData);
+  }
+}
+
+std::shared_ptr<ofpy3::ChowLiuTree>
+ofpy3::ChowLiuTree::loadBinary(const Settings &settings, std::string filename,
+                               bool useMmap, bool verify) {
+  ofpy3::ModelData model = ofpy3::readModelFile(filename, useMmap, verify);
+
+  std::shared_ptr<ofpy3::VocabularyTree> vocabTree;
+  if (!model.vocabularyTreeNodes.empty()) {
+    vocabTree = std::make_shared<ofpy3::VocabularyTree>(
+        model.vocabulary, model.vocabularyTreeCentres,
+        model.vocabularyTreeNodes);
+  }
+  std::shared_ptr<ofpy3::FabMapVocabulary> vocab =
+      std::make_shared<ofpy3::FabMapVocabulary>(
+          settings, model.vocabulary, model.vocabularyBinary,
+          savedIndex(filename, model.vocabularyIndex,
+                     model.vocabularyIndexChecksum),
+          model.storage, vocabTree);
+  vocab->applySettings(settings);
+
+  std::shared_ptr<ofpy3::ChowLiuTree> tree =
+      std::make_shared<ofpy3::ChowLiuTree>(vocab, model.chowLiuTree,
+                                           std::move(model.trainingData),
+                                           settings);
+  tree->denseTrainData = model.denseTrainingData;
+  tree->storage = model.storage;
+  return tree;
+}
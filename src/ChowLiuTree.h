@@ -1,48 +1,79 @@
 #ifndef CHOWLIUTREE_H
 #define CHOWLIUTREE_H
 
+#include "ChowLiuTreeBuilder.h"
 #include "FabMapVocabulary.h"
+#include "Settings.h"
+#include <mutex>
 #include <string>
-
-#include <pybind11/pybind11.h>
+#include <vector>
 
 namespace ofpy3 {
 
 class ChowLiuTree {
 public:
   ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary,
-              pybind11::dict settings);
+              const Settings &settings);
+  ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary, cv::Mat chowLiuTree,
+              cv::Mat fabmapTrainData, const Settings &settings);
   ChowLiuTree(std::shared_ptr<FabMapVocabulary> vocabulary, cv::Mat chowLiuTree,
-              cv::Mat fabmapTrainData, pybind11::dict settings);
+              std::vector<SparseBOW> fabmapTrainData, const Settings &settings);
   virtual ~ChowLiuTree();
 
-  // These function are exposed to python
-  bool loadAndAddTrainingImage(std::string imagePath);
-  bool addTrainingImage(const pybind11::array_t<uchar> &frame);
-  void buildChowLiuTree();
+  bool loadAndAddTrainingImage(const std::string &imagePath);
+  bool addTrainingImage(const cv::Mat &frame);
+  void buildChowLiuTree(const ChowLiuProgress &progress = ChowLiuProgress());
+  void reserve(std::size_t numFrames);
 
-  bool addTrainingDesc(
-      const pybind11::array_t<float> &desc_arr);
+  bool addTrainingDesc(const cv::Mat &desc);
+  std::vector<bool> addTrainingDescsBatch(const std::vector<cv::Mat> &descs);
+  std::vector<bool>
+  loadAndAddTrainingImages(const std::vector<std::string> &imagePaths);
 
- private:
-  bool addTrainingImageInternal(const cv::Mat &frame);
+private:
+  void addTrainingBOW(SparseBOW bow);
+  void addTrainingBOWs(std::vector<SparseBOW> &bows);
 
 public:
   void save(std::string filename) const;
-  static std::shared_ptr<ChowLiuTree> load(pybind11::dict settings,
+  static std::shared_ptr<ChowLiuTree> load(const Settings &settings,
                                            std::string filename);
+  void saveBinary(std::string filename, bool compressTrainingData) const;
+  static std::shared_ptr<ChowLiuTree> loadBinary(const Settings &settings,
+                                                 std::string filename,
+                                                 bool useMmap, bool verify);
 
   bool isTreeBuilt() const;
   std::shared_ptr<FabMapVocabulary> getVocabulary() const;
   cv::Mat getChowLiuTree() const;
+  // The training data as dense rows, as the of2 classes take it. This is a
+  // copy, prefer getTrainingBOWs, unless the model was loaded from a binary
+  // file that stores them dense.
   cv::Mat getTrainingData() const;
+  // Not to be called while training data is still being added.
+  const std::vector<SparseBOW> &getTrainingBOWs() const;
+
+private:
+  cv::Mat denseTrainingData() const;
 
 private:
   std::shared_ptr<FabMapVocabulary> vocabulary;
   cv::Mat chowLiuTree;
-  cv::Mat fabmapTrainData;
+  std::vector<SparseBOW> fabmapTrainData;
+  // fabmapTrainData as dense rows in the model file's storage, if it was
+  // loaded that way and has not been added to since.
+  cv::Mat denseTrainData;
   double lowerInformationBound;
+  // Build with of2::ChowLiuTree rather than ofpy3::buildChowLiuTree.
+  bool referenceBuilder;
   bool treeBuilt;
+
+  // Owns the memory mapped model file the matrices point into, if any.
+  std::shared_ptr<const void> storage;
+
+  // Guards the training data and tree, which may be added to from several
+  // threads.
+  mutable std::mutex trainDataMutex;
 };
 
 } // namespace ofpy3
@@ -0,0 +1,229 @@
+#include "ChowLiuTreeBuilder.h"
+#include "Hamming.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+
+namespace {
+
+/**
+ * The training rows each word occurs in, one bit per row, so that counting
+ * the rows two words co-occur in is an AND and a popcount per 64 rows.
+ */
+class Occurrences {
+public:
+  Occurrences(const std::vector<ofpy3::SparseBOW> &rows, int numWords)
+      : numRows(static_cast<int>(rows.size())), blocks((rows.size() + 63) / 64),
+        bits(numWords * blocks, 0), counts(numWords, 0) {
+    for (std::size_t r = 0; r < rows.size(); ++r) {
+      for (std::size_t k = 0; k < rows[r].size(); ++k) {
+        const int word = rows[r].words[k];
+        CV_Assert(word >= 0 && word < numWords);
+        bits[word * blocks + r / 64] |= std::uint64_t(1) << (r % 64);
+        ++counts[word];
+      }
+    }
+  }
+
+  int rows() const { return numRows; }
+  int count(int word) const { return counts[word]; }
+
+  int cooccurrences(int a, int b) const {
+    const std::uint64_t *pa = &bits[a * blocks];
+    const std::uint64_t *pb = &bits[b * blocks];
+    int total = 0;
+    for (std::size_t i = 0; i < blocks; ++i) {
+      total += ofpy3::popcount64(pa[i] & pb[i]);
+    }
+    return total;
+  }
+
+private:
+  int numRows;
+  std::size_t blocks;
+  std::vector<std::uint64_t> bits;
+  std::vector<int> counts;
+};
+
+struct Edge {
+  float score;
+  int word1; // the lower word id, or -1 for no edge
+  int word2;
+};
+
+// Whether a comes before b in the reference's sorted edge list: by score,
+// then (the sort being stable) in the order the pairs were scored.
+bool ahead(const Edge &a, const Edge &b) {
+  if (a.score != b.score) {
+    return a.score > b.score;
+  }
+  if (a.word1 != b.word1) {
+    return a.word1 < b.word1;
+  }
+  return a.word2 < b.word2;
+}
+
+/**
+ * The word statistics, computed with exactly the arithmetic of
+ * of2::ChowLiuTree (P, JP, CP and calcMutInfo), so that scores and tree
+ * values come out bit for bit the same.
+ */
+class Statistics {
+public:
+  explicit Statistics(const Occurrences &occurrences)
+      : occurrences(occurrences) {}
+
+  double P(int word) const {
+    return (0.98 * occurrences.count(word) / occurrences.rows()) + 0.01;
+  }
+
+  Edge edge(int u, int v) const {
+    Edge e;
+    e.word1 = std::min(u, v);
+    e.word2 = std::max(u, v);
+    e.score = static_cast<float>(mutualInformation(e.word1, e.word2));
+    return e;
+  }
+
+  // P(a | b) and P(a | !b)
+  double CP(int a, int b, bool zb) const {
+    const int both = occurrences.cooccurrences(a, b);
+    const int total =
+        zb ? occurrences.count(b) : occurrences.rows() - occurrences.count(b);
+    const int count = zb ? both : occurrences.count(a) - both;
+    if (total) {
+      return (double)(0.98 * count) / total + 0.01;
+    }
+    return 0.01;
+  }
+
+private:
+  double mutualInformation(int word1, int word2) const {
+    const int rows = occurrences.rows();
+    const int n1 = occurrences.count(word1);
+    const int n2 = occurrences.count(word2);
+    const int n11 = occurrences.cooccurrences(word1, word2);
+    const double p1 = P(word1), p2 = P(word2);
+
+    double accumulation = 0;
+    double P00 = static_cast<double>(rows - n1 - n2 + n11) / rows;
+    if (P00)
+      accumulation += P00 * std::log(P00 / ((1 - p1) * (1 - p2)));
+    double P01 = static_cast<double>(n2 - n11) / rows;
+    if (P01)
+      accumulation += P01 * std::log(P01 / ((1 - p1) * p2));
+    double P10 = static_cast<double>(n1 - n11) / rows;
+    if (P10)
+      accumulation += P10 * std::log(P10 / (p1 * (1 - p2)));
+    double P11 = static_cast<double>(n11) / rows;
+    if (P11)
+      accumulation += P11 * std::log(P11 / (p1 * p2));
+    return accumulation;
+  }
+
+  const Occurrences &occurrences;
+};
+
+} // namespace
+
+cv::Mat ofpy3::buildChowLiuTree(const std::vector<SparseBOW> &trainingData,
+                                int vocabSize, double infoThreshold,
+                                const ChowLiuProgress &progress) {
+  CV_Assert(!trainingData.empty());
+  CV_Assert(vocabSize > 0);
+  const Occurrences occurrences(trainingData, vocabSize);
+  const Statistics stats(occurrences);
+
+  // Grow the maximum spanning tree from word 0. best[v] is the best edge
+  // from the tree to v, for each word v still outside it.
+  std::vector<int> remaining;
+  for (int v = 1; v < vocabSize; ++v) {
+    remaining.push_back(v);
+  }
+  Edge none;
+  none.score = 0.f;
+  none.word1 = none.word2 = -1;
+  std::vector<Edge> best(vocabSize, none);
+  std::vector<Edge> treeEdges;
+  treeEdges.reserve(vocabSize - 1);
+
+  const int reportEvery = std::max(1, vocabSize / 100);
+  int last = 0; // the word most recently added to the tree
+  while (!remaining.empty()) {
+    const int numRemaining = static_cast<int>(remaining.size());
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < numRemaining; ++i) {
+      const int v = remaining[i];
+      Edge e = stats.edge(last, v);
+      if (e.score >= infoThreshold &&
+          (best[v].word1 < 0 || ahead(e, best[v]))) {
+        best[v] = e;
+      }
+    }
+
+    int next = -1;
+    for (int i = 0; i < numRemaining; ++i) {
+      const Edge &e = best[remaining[i]];
+      if (e.word1 >= 0 && (next < 0 || ahead(e, best[remaining[next]]))) {
+        next = i;
+      }
+    }
+    if (next < 0) {
+      CV_Error(CV_StsError, "Chow-Liu tree: the words are not connected by "
+                            "edges above the lower information bound");
+    }
+    last = remaining[next];
+    treeEdges.push_back(best[last]);
+    remaining[next] = remaining.back();
+    remaining.pop_back();
+
+    const int numAdded = vocabSize - static_cast<int>(remaining.size());
+    if (progress && (numAdded % reportEvery == 0 || remaining.empty())) {
+      progress(numAdded, vocabSize);
+    }
+  }
+
+  // The reference roots the tree at the first word of its best edge.
+  int root = 0;
+  if (!treeEdges.empty()) {
+    root = std::min_element(treeEdges.begin(), treeEdges.end(), ahead)->word1;
+  }
+  std::vector<std::vector<int>> neighbours(vocabSize);
+  for (const Edge &e : treeEdges) {
+    neighbours[e.word1].push_back(e.word2);
+    neighbours[e.word2].push_back(e.word1);
+  }
+
+  cv::Mat cltree(4, vocabSize, CV_64F);
+  std::vector<int> parent(vocabSize, -1);
+  std::queue<int> queue;
+  parent[root] = root;
+  queue.push(root);
+  while (!queue.empty()) {
+    const int q = queue.front();
+    queue.pop();
+    for (int child : neighbours[q]) {
+      if (parent[child] < 0) {
+        parent[child] = q;
+        queue.push(child);
+      }
+    }
+  }
+
+#pragma omp parallel for schedule(static)
+  for (int q = 0; q < vocabSize; ++q) {
+    const int pq = parent[q];
+    cltree.at<double>(0, q) = pq;
+    cltree.at<double>(1, q) = stats.P(q);
+    if (q == root) {
+      // setting P(zq|zpq) to P(zq) gives the root no dependence on a parent
+      cltree.at<double>(2, q) = stats.P(q);
+      cltree.at<double>(3, q) = stats.P(q);
+    } else {
+      cltree.at<double>(2, q) = stats.CP(q, pq, true);
+      cltree.at<double>(3, q) = stats.CP(q, pq, false);
+    }
+  }
+  return cltree;
+}
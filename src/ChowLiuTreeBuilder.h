@@ -0,0 +1,33 @@
+#ifndef CHOW_LIU_TREE_BUILDER_H
+#define CHOW_LIU_TREE_BUILDER_H
+
+#include "SparseBOW.h"
+#include <functional>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+// Called with the number of words added to the tree so far, and the total.
+typedef std::function<void(int wordsAdded, int numWords)> ChowLiuProgress;
+
+/**
+ * Builds the Chow-Liu tree of the training bags-of-words, in the 4 x V CV_64F
+ * layout of of2::ChowLiuTree::make, and identical to it.
+ *
+ * Rather than scoring every word pair into one sorted list, the words'
+ * occurrences are bit-packed and the maximum spanning tree is grown with
+ * Prim's algorithm: each word added to the tree scores its edges to every
+ * word not yet in it, in parallel, with a popcount co-occurrence kernel.
+ * Memory is the bit-packed training data plus O(V). Edges are ordered as the
+ * reference orders them (by score, then by word ids), so ties resolve the
+ * same way.
+ */
+cv::Mat buildChowLiuTree(const std::vector<SparseBOW> &trainingData,
+                         int vocabSize, double infoThreshold,
+                         const ChowLiuProgress &progress = ChowLiuProgress());
+
+} // namespace ofpy3
+
+#endif // CHOW_LIU_TREE_BUILDER_H
@@ -0,0 +1,138 @@
+#include "DescriptorStore.h"
+#include "BinaryIO.h"
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define OFPY3_HAVE_MMAP
+#endif
+
+// ----------------- DescriptorStore -----------------
+
+ofpy3::DescriptorStore::DescriptorStore(int chunkRows,
+                                        const std::string &scratchDir)
+    : chunkRows(static_cast<std::size_t>(std::max(1, chunkRows))),
+      scratchDir(scratchDir), reservedRows(0), numRows(0), numCols(0),
+      matType(-1), chunks(), scratchFd(-1), scratchSize(0) {}
+
+ofpy3::DescriptorStore::~DescriptorStore() {
+  chunks.clear();
+#ifdef OFPY3_HAVE_MMAP
+  if (scratchFd >= 0) {
+    ::close(scratchFd);
+  }
+#endif
+}
+
+void ofpy3::DescriptorStore::reserve(std::size_t rows) {
+  reservedRows = std::max(reservedRows, rows);
+  if (matType >= 0) {
+    while (chunks.size() * chunkRows < reservedRows) {
+      addChunk();
+    }
+  }
+}
+
+void ofpy3::DescriptorStore::append(const cv::Mat &descs) {
+  if (descs.empty()) {
+    return;
+  }
+  if (matType < 0) {
+    numCols = descs.cols;
+    matType = descs.type();
+    reserve(reservedRows);
+  }
+  CV_Assert(descs.cols == numCols && descs.type() == matType);
+
+  int copied = 0;
+  while (copied < descs.rows) {
+    if (numRows == chunks.size() * chunkRows) {
+      addChunk();
+    }
+    const int offset = static_cast<int>(numRows % chunkRows);
+    const int count = std::min(descs.rows - copied,
+                               static_cast<int>(chunkRows) - offset);
+    cv::Mat target =
+        chunks[numRows / chunkRows].rows.rowRange(offset, offset + count);
+    descs.rowRange(copied, copied + count).copyTo(target);
+    copied += count;
+    numRows += count;
+  }
+}
+
+void ofpy3::DescriptorStore::convertTo(DescriptorStore &out,
+                                       int type) const {
+  for (std::size_t k = 0; k < numChunks(); ++k) {
+    cv::Mat converted;
+    chunk(k).convertTo(converted, type);
+    out.append(converted);
+  }
+}
+
+void ofpy3::DescriptorStore::clear() {
+  chunks.clear();
+  numRows = 0;
+  numCols = 0;
+  matType = -1;
+#ifdef OFPY3_HAVE_MMAP
+  if (scratchFd >= 0 && ::ftruncate(scratchFd, 0) == 0) {
+    scratchSize = 0;
+  }
+#endif
+}
+
+cv::Mat ofpy3::DescriptorStore::row(std::size_t i) const {
+  CV_Assert(i < numRows);
+  return chunks[i / chunkRows].rows.row(static_cast<int>(i % chunkRows));
+}
+
+std::size_t ofpy3::DescriptorStore::numChunks() const {
+  return (numRows + chunkRows - 1) / chunkRows;
+}
+
+cv::Mat ofpy3::DescriptorStore::chunk(std::size_t k) const {
+  CV_Assert(k < numChunks());
+  const std::size_t filled = std::min(chunkRows, numRows - k * chunkRows);
+  return chunks[k].rows.rowRange(0, static_cast<int>(filled));
+}
+
+void ofpy3::DescriptorStore::addChunk() {
+  Chunk chunk;
+#ifdef OFPY3_HAVE_MMAP
+  if (!scratchDir.empty()) {
+    if (scratchFd < 0) {
+      std::string path = scratchDir + "/ofpy3-descriptors-XXXXXX";
+      std::vector<char> pathBuffer(path.begin(), path.end());
+      pathBuffer.push_back('\0');
+      scratchFd = ::mkstemp(pathBuffer.data());
+      binaryio::check(scratchFd >= 0, scratchDir,
+                      "cannot create descriptor scratch file");
+      // Nothing else needs the file, it goes away with the descriptor.
+      ::unlink(pathBuffer.data());
+    }
+
+    const std::uint64_t bytes = static_cast<std::uint64_t>(chunkRows) *
+                                numCols * CV_ELEM_SIZE(matType);
+    const std::uint64_t offset = scratchSize;
+    const std::uint64_t end = binaryio::alignUp(
+        offset + bytes, static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE)));
+    binaryio::check(::ftruncate(scratchFd, static_cast<off_t>(end)) == 0,
+                    scratchDir, "cannot grow descriptor scratch file");
+    void *mapped = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          scratchFd, static_cast<off_t>(offset));
+    binaryio::check(mapped != MAP_FAILED, scratchDir,
+                    "cannot map descriptor scratch file");
+    scratchSize = end;
+    chunk.storage = std::shared_ptr<void>(
+        mapped, [bytes](void *p) { ::munmap(p, bytes); });
+    chunk.rows =
+        cv::Mat(static_cast<int>(chunkRows), numCols, matType, mapped);
+    chunks.push_back(chunk);
+    return;
+  }
+#endif
+  chunk.rows = cv::Mat(static_cast<int>(chunkRows), numCols, matType);
+  chunks.push_back(chunk);
+}
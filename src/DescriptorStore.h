@@ -0,0 +1,82 @@
+#ifndef DESCRIPTOR_STORE_H
+#define DESCRIPTOR_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * An append-only matrix of descriptors, stored in fixed size chunks of rows
+ * so that it grows without ever copying what it holds. With a scratch
+ * directory the chunks are memory mapped from an (unlinked) file there
+ * instead of allocated, so the OS can page them out rather than the process
+ * running out of memory.
+ *
+ * All rows share the column count and type of the first matrix appended.
+ */
+class DescriptorStore {
+public:
+  explicit DescriptorStore(int chunkRows = 65536,
+                           const std::string &scratchDir = std::string());
+  ~DescriptorStore();
+  DescriptorStore(const DescriptorStore &) = delete;
+  DescriptorStore &operator=(const DescriptorStore &) = delete;
+
+  // Allocates room for this many rows up front. Before the first append the
+  // row size is unknown, so the hint is kept until then.
+  void reserve(std::size_t rows);
+  void append(const cv::Mat &descs);
+  void clear();
+  // Appends every row of this store to out, converted to type.
+  void convertTo(DescriptorStore &out, int type) const;
+
+  std::size_t rows() const { return numRows; }
+  int cols() const { return numCols; }
+  int type() const { return matType; }
+  bool empty() const { return numRows == 0; }
+
+  template <typename T> T *ptr(std::size_t i) {
+    return chunks[i / chunkRows].rows.ptr<T>(static_cast<int>(i % chunkRows));
+  }
+  template <typename T> const T *ptr(std::size_t i) const {
+    return chunks[i / chunkRows].rows.ptr<T>(static_cast<int>(i % chunkRows));
+  }
+  // A header onto row i, valid until the store is cleared or destroyed.
+  cv::Mat row(std::size_t i) const;
+
+  // The filled rows of each chunk, as headers onto the store's memory.
+  std::size_t numChunks() const;
+  cv::Mat chunk(std::size_t k) const;
+
+private:
+  struct Chunk {
+    cv::Mat rows;
+    // Owns the mapping rows points into, if the chunk is memory mapped.
+    std::shared_ptr<void> storage;
+  };
+
+  void addChunk();
+
+private:
+  std::size_t chunkRows;
+  std::string scratchDir;
+  std::size_t reservedRows;
+
+  std::size_t numRows;
+  int numCols;
+  int matType;
+  std::vector<Chunk> chunks;
+
+  int scratchFd;
+  std::uint64_t scratchSize;
+};
+
+} // namespace ofpy3
+
+#endif // DESCRIPTOR_STORE_H
@@ -0,0 +1,279 @@
+#include "ExactMatcher.h"
+#include <algorithm>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define OFPY3_X86_KERNELS
+#endif
+
+#if defined(__aarch64__) || (defined(__ARM_NEON) && defined(__ARM_FP))
+#include <arm_neon.h>
+#define OFPY3_NEON_KERNELS
+#endif
+
+namespace {
+
+const int PANEL = 16;     // words per panel
+const int BLOCK = 4;      // descriptors per block
+const int WORD_TILE = 16; // panels per tile, 256 words
+const int BATCH = 64;     // descriptors per batch
+
+// dots[r * PANEL + l] = a[r] . word l of panel, for the BLOCK rows of a
+// (each dims long) against one panel.
+typedef void (*PanelKernel)(const float *a, const float *panel, int dims,
+                            float *dots);
+
+void scalarKernel(const float *a, const float *panel, int dims, float *dots) {
+  float acc[BLOCK][PANEL] = {};
+  for (int d = 0; d < dims; ++d) {
+    const float *p = panel + d * PANEL;
+    for (int r = 0; r < BLOCK; ++r) {
+      const float x = a[r * dims + d];
+      for (int l = 0; l < PANEL; ++l) {
+        acc[r][l] += x * p[l];
+      }
+    }
+  }
+  std::copy(&acc[0][0], &acc[0][0] + BLOCK * PANEL, dots);
+}
+
+#ifdef OFPY3_X86_KERNELS
+__attribute__((target("avx2,fma"))) void
+avx2Kernel(const float *a, const float *panel, int dims, float *dots) {
+  __m256 acc[BLOCK][2];
+  for (int r = 0; r < BLOCK; ++r) {
+    acc[r][0] = _mm256_setzero_ps();
+    acc[r][1] = _mm256_setzero_ps();
+  }
+  for (int d = 0; d < dims; ++d) {
+    const __m256 p0 = _mm256_loadu_ps(panel + d * PANEL);
+    const __m256 p1 = _mm256_loadu_ps(panel + d * PANEL + 8);
+    for (int r = 0; r < BLOCK; ++r) {
+      const __m256 x = _mm256_broadcast_ss(a + r * dims + d);
+      acc[r][0] = _mm256_fmadd_ps(x, p0, acc[r][0]);
+      acc[r][1] = _mm256_fmadd_ps(x, p1, acc[r][1]);
+    }
+  }
+  for (int r = 0; r < BLOCK; ++r) {
+    _mm256_storeu_ps(dots + r * PANEL, acc[r][0]);
+    _mm256_storeu_ps(dots + r * PANEL + 8, acc[r][1]);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+avx512Kernel(const float *a, const float *panel, int dims, float *dots) {
+  __m512 acc[BLOCK];
+  for (int r = 0; r < BLOCK; ++r) {
+    acc[r] = _mm512_setzero_ps();
+  }
+  for (int d = 0; d < dims; ++d) {
+    const __m512 p = _mm512_loadu_ps(panel + d * PANEL);
+    for (int r = 0; r < BLOCK; ++r) {
+      acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a[r * dims + d]), p, acc[r]);
+    }
+  }
+  for (int r = 0; r < BLOCK; ++r) {
+    _mm512_storeu_ps(dots + r * PANEL, acc[r]);
+  }
+}
+#endif
+
+#ifdef OFPY3_NEON_KERNELS
+void neonKernel(const float *a, const float *panel, int dims, float *dots) {
+  float32x4_t acc[BLOCK][4];
+  for (int r = 0; r < BLOCK; ++r) {
+    for (int q = 0; q < 4; ++q) {
+      acc[r][q] = vdupq_n_f32(0.f);
+    }
+  }
+  for (int d = 0; d < dims; ++d) {
+    float32x4_t p[4];
+    for (int q = 0; q < 4; ++q) {
+      p[q] = vld1q_f32(panel + d * PANEL + 4 * q);
+    }
+    for (int r = 0; r < BLOCK; ++r) {
+      const float x = a[r * dims + d];
+      for (int q = 0; q < 4; ++q) {
+        acc[r][q] = vmlaq_n_f32(acc[r][q], p[q], x);
+      }
+    }
+  }
+  for (int r = 0; r < BLOCK; ++r) {
+    for (int q = 0; q < 4; ++q) {
+      vst1q_f32(dots + r * PANEL + 4 * q, acc[r][q]);
+    }
+  }
+}
+#endif
+
+PanelKernel panelKernel(ofpy3::MatcherKernel kernel) {
+  switch (kernel) {
+#ifdef OFPY3_X86_KERNELS
+  case ofpy3::MatcherKernel::AVX2:
+    return avx2Kernel;
+  case ofpy3::MatcherKernel::AVX512:
+    return avx512Kernel;
+#endif
+#ifdef OFPY3_NEON_KERNELS
+  case ofpy3::MatcherKernel::NEON:
+    return neonKernel;
+#endif
+  default:
+    return scalarKernel;
+  }
+}
+
+} // namespace
+
+ofpy3::MatcherKernel ofpy3::detectMatcherKernel() {
+  if (isMatcherKernelSupported(MatcherKernel::AVX512)) {
+    return MatcherKernel::AVX512;
+  }
+  if (isMatcherKernelSupported(MatcherKernel::AVX2)) {
+    return MatcherKernel::AVX2;
+  }
+  if (isMatcherKernelSupported(MatcherKernel::NEON)) {
+    return MatcherKernel::NEON;
+  }
+  return MatcherKernel::Scalar;
+}
+
+bool ofpy3::isMatcherKernelSupported(MatcherKernel kernel) {
+  switch (kernel) {
+  case MatcherKernel::Auto:
+  case MatcherKernel::Scalar:
+    return true;
+#ifdef OFPY3_X86_KERNELS
+  case MatcherKernel::AVX2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case MatcherKernel::AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+#ifdef OFPY3_NEON_KERNELS
+  case MatcherKernel::NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+ofpy3::MatcherKernel ofpy3::parseMatcherKernel(const std::string &name) {
+  const MatcherKernel kernels[] = {MatcherKernel::Auto, MatcherKernel::Scalar,
+                                   MatcherKernel::AVX2, MatcherKernel::AVX512,
+                                   MatcherKernel::NEON};
+  for (MatcherKernel kernel : kernels) {
+    if (matcherKernelName(kernel) == name) {
+      return kernel;
+    }
+  }
+  CV_Error(CV_StsBadArg, "unknown matcher kernel: " + name);
+  return MatcherKernel::Auto;
+}
+
+std::string ofpy3::matcherKernelName(MatcherKernel kernel) {
+  switch (kernel) {
+  case MatcherKernel::Auto:
+    return "Auto";
+  case MatcherKernel::Scalar:
+    return "Scalar";
+  case MatcherKernel::AVX2:
+    return "AVX2";
+  case MatcherKernel::AVX512:
+    return "AVX512";
+  case MatcherKernel::NEON:
+    return "NEON";
+  }
+  return "Unknown";
+}
+
+// ----------------- ExactMatcher -----------------
+
+ofpy3::ExactMatcher::ExactMatcher(const cv::Mat &words, MatcherKernel kernel)
+    : kernel(kernel == MatcherKernel::Auto ? detectMatcherKernel() : kernel),
+      numWords(words.rows), dims(words.cols),
+      numPanels((words.rows + PANEL - 1) / PANEL), panels(), norms() {
+  CV_Assert(!words.empty() && words.type() == CV_32F);
+  if (!isMatcherKernelSupported(this->kernel)) {
+    CV_Error(CV_StsBadArg, "matcher kernel not supported on this CPU: " +
+                               matcherKernelName(this->kernel));
+  }
+
+  panels.assign(static_cast<std::size_t>(numPanels) * dims * PANEL, 0.f);
+  norms.assign(static_cast<std::size_t>(numPanels) * PANEL,
+               std::numeric_limits<float>::infinity());
+  for (int w = 0; w < numWords; ++w) {
+    const float *word = words.ptr<float>(w);
+    float *panel = &panels[static_cast<std::size_t>(w / PANEL) * dims * PANEL];
+    float norm = 0.f;
+    for (int d = 0; d < dims; ++d) {
+      panel[d * PANEL + w % PANEL] = word[d];
+      norm += word[d] * word[d];
+    }
+    norms[w] = norm;
+  }
+}
+
+std::vector<int>
+ofpy3::ExactMatcher::nearestWords(const cv::Mat &descriptors) const {
+  CV_Assert(descriptors.type() == CV_32F && descriptors.cols == dims);
+  const PanelKernel multiply = panelKernel(kernel);
+  const int numDescs = descriptors.rows;
+  const int numBatches = (numDescs + BATCH - 1) / BATCH;
+
+  std::vector<int> nearest(numDescs);
+#pragma omp parallel
+  {
+    std::vector<float> batch(static_cast<std::size_t>(BATCH) * dims);
+    float best[BATCH];
+    int bestWord[BATCH];
+    float dots[BLOCK * PANEL];
+
+#pragma omp for schedule(dynamic)
+    for (int b = 0; b < numBatches; ++b) {
+      const int start = b * BATCH;
+      const int rows = std::min(BATCH, numDescs - start);
+      // Pad the batch with zero rows up to a whole number of blocks
+      const int paddedRows = (rows + BLOCK - 1) / BLOCK * BLOCK;
+      for (int r = 0; r < paddedRows; ++r) {
+        float *row = &batch[static_cast<std::size_t>(r) * dims];
+        if (r < rows) {
+          const float *descriptor = descriptors.ptr<float>(start + r);
+          std::copy(descriptor, descriptor + dims, row);
+        } else {
+          std::fill(row, row + dims, 0.f);
+        }
+        best[r] = std::numeric_limits<float>::infinity();
+        bestWord[r] = 0;
+      }
+
+      for (int tile = 0; tile < numPanels; tile += WORD_TILE) {
+        const int tileEnd = std::min(numPanels, tile + WORD_TILE);
+        for (int r0 = 0; r0 < paddedRows; r0 += BLOCK) {
+          const float *block = &batch[static_cast<std::size_t>(r0) * dims];
+          for (int p = tile; p < tileEnd; ++p) {
+            multiply(block,
+                     &panels[static_cast<std::size_t>(p) * dims * PANEL],
+                     dims, dots);
+            // Words are visited in order, so strict < keeps the first
+            // nearest.
+            const float *panelNorms = &norms[p * PANEL];
+            for (int r = 0; r < BLOCK; ++r) {
+              for (int l = 0; l < PANEL; ++l) {
+                const float dist = panelNorms[l] - 2.f * dots[r * PANEL + l];
+                if (dist < best[r0 + r]) {
+                  best[r0 + r] = dist;
+                  bestWord[r0 + r] = p * PANEL + l;
+                }
+              }
+            }
+          }
+        }
+      }
+      std::copy(bestWord, bestWord + rows, &nearest[start]);
+    }
+  }
+  return nearest;
+}
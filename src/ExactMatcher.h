@@ -0,0 +1,56 @@
+#ifndef EXACT_MATCHER_H
+#define EXACT_MATCHER_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+// Instruction sets the exact matcher has kernels for.
+enum class MatcherKernel { Auto, Scalar, AVX2, AVX512, NEON };
+
+// The best kernel this CPU supports.
+MatcherKernel detectMatcherKernel();
+bool isMatcherKernelSupported(MatcherKernel kernel);
+// Names as used in the settings: "Auto", "Scalar", "AVX2", "AVX512", "NEON".
+MatcherKernel parseMatcherKernel(const std::string &name);
+std::string matcherKernelName(MatcherKernel kernel);
+
+/**
+ * Exact nearest-word search over a float vocabulary, by brute force. The
+ * squared distances are computed as |b|^2 - 2ab (the query's |a|^2 does not
+ * change which word is nearest), with the dot products done as a tiled
+ * matrix product: the words are packed into panels of 16, a block of 4
+ * descriptors is multiplied against each panel in SIMD registers, and the
+ * argmin is taken as each block of distances is produced, so the distance
+ * matrix is never stored. Word panels are visited in tiles that stay in
+ * cache across a batch of descriptors.
+ *
+ * Results are the nearest word up to float rounding (the first on ties),
+ * whichever kernel runs.
+ */
+class ExactMatcher {
+public:
+  ExactMatcher(const cv::Mat &words, MatcherKernel kernel = MatcherKernel::Auto);
+
+  MatcherKernel getKernel() const { return kernel; }
+
+  // The nearest word to each row of descriptors (CV_32F).
+  std::vector<int> nearestWords(const cv::Mat &descriptors) const;
+
+private:
+  MatcherKernel kernel;
+  int numWords;
+  int dims;
+  int numPanels;
+  // Panel p holds words [16p, 16p + 16) as dims x 16, row major.
+  std::vector<float> panels;
+  // |b|^2 per word, +inf for the padding at the end of the last panel.
+  std::vector<float> norms;
+};
+
+} // namespace ofpy3
+
+#endif // EXACT_MATCHER_H
@@ -0,0 +1,87 @@
+#include "FabMapEngine.h"
+#include <algorithm>
+
+std::vector<int>
+ofpy3::selectLikelihoods(const std::vector<double> &likelihoods,
+                         const MatchSelection &selection) {
+  std::vector<int> kept;
+  for (std::size_t i = 0; i < likelihoods.size(); ++i) {
+    if (likelihoods[i] >= selection.minLikelihood) {
+      kept.push_back(static_cast<int>(i));
+    }
+  }
+  if (selection.topK > 0 && (int)kept.size() > selection.topK) {
+    // Most likely first, earlier places first among equals
+    std::nth_element(kept.begin(), kept.begin() + selection.topK - 1,
+                     kept.end(), [&likelihoods](int a, int b) {
+                       return likelihoods[a] > likelihoods[b] ||
+                              (likelihoods[a] == likelihoods[b] && a < b);
+                     });
+    kept.resize(selection.topK);
+    std::sort(kept.begin(), kept.end());
+  }
+  return kept;
+}
+
+void ofpy3::selectMatches(std::vector<of2::IMatch> &matches,
+                          const MatchSelection &selection) {
+  if (selection.all()) {
+    return;
+  }
+  std::vector<double> likelihoods(matches.size());
+  for (std::size_t i = 0; i < matches.size(); ++i) {
+    likelihoods[i] = matches[i].likelihood;
+  }
+  std::vector<int> kept = selectLikelihoods(likelihoods, selection);
+  for (std::size_t i = 0; i < kept.size(); ++i) {
+    matches[i] = matches[kept[i]];
+  }
+  matches.resize(kept.size());
+}
+
+// ----------------- Of2FabMapEngine -----------------
+
+ofpy3::Of2FabMapEngine::Of2FabMapEngine(std::shared_ptr<of2::FabMap> fabmap,
+                                        int vocabSize)
+    : fabmap(std::move(fabmap)), vocabSize(vocabSize) {}
+
+void ofpy3::Of2FabMapEngine::addTraining(const std::vector<SparseBOW> &bows) {
+  fabmap->addTraining(ofpy3::toDense(bows, vocabSize));
+}
+
+void ofpy3::Of2FabMapEngine::addTraining(const cv::Mat &rows) {
+  CV_Assert(rows.empty() || rows.cols == vocabSize);
+  fabmap->addTraining(rows);
+}
+
+void ofpy3::Of2FabMapEngine::add(const SparseBOW &bow) {
+  fabmap->add(bow.toDense(vocabSize));
+}
+
+void ofpy3::Of2FabMapEngine::localize(const SparseBOW &bow,
+                                      std::vector<of2::IMatch> &matches,
+                                      bool addQ,
+                                      const MatchSelection &selection) {
+  fabmap->localize(bow.toDense(vocabSize), matches, addQ);
+  selectMatches(matches, selection);
+}
+
+std::size_t ofpy3::Of2FabMapEngine::numPlaces() const {
+  return fabmap->getTestImgDescriptors().size();
+}
+
+ofpy3::SparseBOW ofpy3::Of2FabMapEngine::getPlace(std::size_t index) const {
+  return SparseBOW::fromDense(fabmap->getTestImgDescriptors()[index]);
+}
+
+// of2 keeps every place and training bag-of-words as a dense row.
+std::size_t ofpy3::Of2FabMapEngine::memoryBytes() const {
+  std::size_t bytes = 0;
+  for (const cv::Mat &row : fabmap->getTrainingImgDescriptors()) {
+    bytes += row.total() * row.elemSize();
+  }
+  for (const cv::Mat &row : fabmap->getTestImgDescriptors()) {
+    bytes += row.total() * row.elemSize();
+  }
+  return bytes;
+}
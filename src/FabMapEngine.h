@@ -0,0 +1,93 @@
+#ifndef FABMAP_ENGINE_H
+#define FABMAP_ENGINE_H
+
+#include "SparseBOW.h"
+#include "Stats.h"
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <fabmap.hpp>
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * Which matches localize returns: at most topK (0 for no limit) of the most
+ * likely, and only those with a likelihood of at least minLikelihood. The
+ * new place is a candidate like any other. Survivors stay in place order.
+ */
+struct MatchSelection {
+  int topK = 0;
+  double minLikelihood = -std::numeric_limits<double>::infinity();
+
+  bool all() const {
+    return topK <= 0 &&
+           minLikelihood == -std::numeric_limits<double>::infinity();
+  }
+};
+
+// The indices of the likelihoods a selection keeps, ascending.
+std::vector<int> selectLikelihoods(const std::vector<double> &likelihoods,
+                                   const MatchSelection &selection);
+// Drops the matches a selection does not keep.
+void selectMatches(std::vector<of2::IMatch> &matches,
+                   const MatchSelection &selection);
+
+/**
+ * What OpenFABMAPPython needs of a FAB-MAP implementation: a map of places
+ * to localize sparse bags-of-words against. Implementations are not
+ * internally synchronised; localize without adding (and without a motion
+ * model) may run concurrently, everything else must be exclusive.
+ */
+class FabMapEngine {
+public:
+  virtual ~FabMapEngine() = default;
+
+  virtual void addTraining(const std::vector<SparseBOW> &bows) = 0;
+  virtual void add(const SparseBOW &bow) = 0;
+  // Matches are normalised over every place, whichever are selected.
+  virtual void localize(const SparseBOW &bow,
+                        std::vector<of2::IMatch> &matches, bool addQ,
+                        const MatchSelection &selection) = 0;
+
+  virtual std::size_t numPlaces() const = 0;
+  virtual SparseBOW getPlace(std::size_t index) const = 0;
+  // Roughly the bytes the map (places and training data) takes.
+  virtual std::size_t memoryBytes() const = 0;
+
+  // Where engines that time the parts of localize record them, if anywhere.
+  void setStats(std::shared_ptr<Stats> stats) { this->stats = stats; }
+
+protected:
+  std::shared_ptr<Stats> stats;
+};
+
+/**
+ * An of2::FabMap (any version) behind the engine interface. of2 only takes
+ * dense 1 x V rows, bags-of-words are expanded for it here.
+ */
+class Of2FabMapEngine : public FabMapEngine {
+public:
+  Of2FabMapEngine(std::shared_ptr<of2::FabMap> fabmap, int vocabSize);
+
+  void addTraining(const std::vector<SparseBOW> &bows) override;
+  // Dense 1 x V rows, which of2 keeps without copying.
+  void addTraining(const cv::Mat &rows);
+  void add(const SparseBOW &bow) override;
+  void localize(const SparseBOW &bow, std::vector<of2::IMatch> &matches,
+                bool addQ, const MatchSelection &selection) override;
+
+  std::size_t numPlaces() const override;
+  SparseBOW getPlace(std::size_t index) const override;
+  std::size_t memoryBytes() const override;
+
+private:
+  std::shared_ptr<of2::FabMap> fabmap;
+  int vocabSize;
+};
+
+} // namespace ofpy3
+
+#endif // FABMAP_ENGINE_H
@@ -2,178 +2,458 @@
 //#include <opencv2/nonfree/nonfree.hpp>
 #endif
 #include "FabMapVocabulary.h"
-#include "detectorsAndExtractors.h"
+#include "Hamming.h"
+#include "VocabularyClusterer.h"
 #include <bowmsctrainer.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
-#include <conversion.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <limits>
 
 // ----------------- FabMapVocabulary -----------------
 
 ofpy3::FabMapVocabulary::FabMapVocabulary(
-    cv::Ptr<cv::FeatureDetector> detector,
-    cv::Ptr<cv::DescriptorExtractor> extractor, cv::Mat vocabulary)
-    : detector(std::move(detector)), extractor(std::move(extractor)),
-      vocab(std::move(vocabulary)) {}
+    const Settings &featureSettings, cv::Mat vocabulary, bool binary,
+    const std::string &indexFile, std::shared_ptr<const void> storage,
+    std::shared_ptr<const VocabularyTree> tree)
+    : extractors(featureSettings), vocab(std::move(vocabulary)), storage(std::move(storage)),
+      binary(binary), tree(std::move(tree)),
+      treeSearchWidth(1), exactMatcher(), index(), indexLoaded(false) {
+  CV_Assert(!binary || vocab.type() == CV_8U);
+  // FLANN's L2 index needs float words, vocabularies straight out of the
+  // builder may still be in the descriptor type until convert() is called.
+  if (vocab.type() == CV_32F && !this->tree) {
+    if (indexFile.empty() || !loadIndex(indexFile)) {
+      buildIndex();
+    }
+  }
+}
 
 cv::Mat ofpy3::FabMapVocabulary::getVocabulary() const { return vocab; }
 
-cv::Mat
-ofpy3::FabMapVocabulary::generateBOWImageDescs(const cv::Mat &frame) const {
-  // use a FLANN matcher to generate bag-of-words representations
-  cv::Ptr<cv::DescriptorMatcher> matcher =
-      cv::DescriptorMatcher::create("FlannBased");
-  cv::BOWImgDescriptorExtractor bide(extractor, matcher);
-  bide.setVocabulary(vocab);
+int ofpy3::FabMapVocabulary::getVocabularySize() const { return vocab.rows; }
 
-  cv::Mat bow;
-  std::vector<cv::KeyPoint> kpts;
+bool ofpy3::FabMapVocabulary::isBinary() const { return binary; }
 
-  detector->detect(frame, kpts);
-  bide.compute(frame, kpts, bow);
-  return bow;
+std::shared_ptr<const ofpy3::VocabularyTree>
+ofpy3::FabMapVocabulary::getTree() const {
+  return tree;
 }
 
-cv::Mat
-ofpy3::FabMapVocabulary::generateBOWImageDescsInternal(cv::Mat desc) const {
-  // use a FLANN matcher to generate bag-of-words representations
-  cv::Ptr<cv::DescriptorMatcher> matcher =
-      cv::DescriptorMatcher::create("FlannBased");
+void ofpy3::FabMapVocabulary::applySettings(const Settings &settings) {
+  if (settings.contains("QuantizerOptions")) {
+    const Settings quantizerSettings = settings.section("QuantizerOptions");
+    const std::string kernel =
+        quantizerSettings.get<std::string>("Kernel", "Auto");
+    if (quantizerSettings.contains("Search")) {
+      setExactSearch(
+          quantizerSettings.get<std::string>("Search", "") == "Exact", kernel);
+    }
+  }
+  if (settings.contains("VocabTreeOptions")) {
+    const Settings treeSettings = settings.section("VocabTreeOptions");
+    if (treeSettings.contains("SearchWidth")) {
+      setTreeSearchWidth(treeSettings.get<int>("SearchWidth", 1));
+    }
+  }
+}
 
-  cv::Mat bow;
+int ofpy3::FabMapVocabulary::getTreeSearchWidth() const {
+  return treeSearchWidth;
+}
+
+/**
+ * The number of nodes kept at each level when descending the vocabulary
+ * tree: 1 is fastest, wider is closer to the exact nearest word. Can be
+ * changed between queries.
+ */
+void ofpy3::FabMapVocabulary::setTreeSearchWidth(int searchWidth) {
+  treeSearchWidth = std::max(1, searchWidth);
+}
 
-  compute(matcher, desc, bow);
+/**
+ * Switches float vocabularies between the approximate search (the vocabulary
+ * tree or FLANN index) and exact brute force matching with the given kernel
+ * ("Auto" picks the best this CPU supports). Binary vocabularies are always
+ * matched exactly, this has no effect on them.
+ */
+void ofpy3::FabMapVocabulary::setExactSearch(bool exact,
+                                             const std::string &kernel) {
+  std::shared_ptr<const ExactMatcher> matcher;
+  if (exact && !binary) {
+    cv::Mat words = vocab;
+    if (words.type() != CV_32F) {
+      vocab.convertTo(words, CV_32F);
+    }
+    matcher = std::make_shared<ExactMatcher>(words, parseMatcherKernel(kernel));
+  }
+  std::atomic_store(&exactMatcher, matcher);
+}
+
+std::string ofpy3::FabMapVocabulary::getExactKernel() const {
+  std::shared_ptr<const ExactMatcher> matcher = std::atomic_load(&exactMatcher);
+  return matcher ? matcherKernelName(matcher->getKernel()) : std::string();
+}
 
+ofpy3::SparseBOW
+ofpy3::FabMapVocabulary::generateSparseBOW(const cv::Mat &frame, Stats *stats,
+                                           long frameIndex) const {
+  // The descriptors are the extractor's scratch buffer, so it is held until
+  // they have been quantized.
+  FeatureExtractorPool::Lease extractor = extractors.acquire();
+  if (!extractor->detectAndCompute(frame, stats, frameIndex)) {
+    return SparseBOW();
+  }
+
+  return quantize(extractor->getDescriptors(), stats, frameIndex);
+}
+
+ofpy3::SparseBOW
+ofpy3::FabMapVocabulary::quantize(cv::Mat keypointDescriptors, Stats *stats,
+                                  long frameIndex) const {
+  SparseBOW bow;
+  {
+    StageTimer timer(stats, Stage::Quantize, frameIndex);
+    bow = quantizeDescriptors(keypointDescriptors);
+  }
+  recordCounter(stats, Counter::Descriptors, keypointDescriptors.rows);
+  recordCounter(stats, Counter::Words, bow.words.size());
   return bow;
 }
 
-void ofpy3::FabMapVocabulary::compute(
-    cv::Ptr<cv::DescriptorMatcher> dmatcher, cv::Mat keypointDescriptors,
-    cv::Mat &_imgDescriptor ) const
-{
+ofpy3::SparseBOW ofpy3::FabMapVocabulary::quantizeDescriptors(
+    cv::Mat keypointDescriptors) const {
   CV_Assert( !vocab.empty() );
   CV_Assert(!keypointDescriptors.empty());
+  if (binary) {
+    return SparseBOW::fromNearestWords(nearestBinaryWords(keypointDescriptors));
+  }
 
-  int clusterCount = vocab.rows; // = vocabulary.rows
+  if (keypointDescriptors.type() != vocab.type()) {
+    cv::Mat converted;
+    keypointDescriptors.convertTo(converted, vocab.type());
+    keypointDescriptors = converted;
+  }
+  if (std::shared_ptr<const ExactMatcher> matcher =
+          std::atomic_load(&exactMatcher)) {
+    return SparseBOW::fromNearestWords(
+        matcher->nearestWords(keypointDescriptors));
+  }
+  if (tree) {
+    return SparseBOW::fromNearestWords(
+        tree->quantize(keypointDescriptors, treeSearchWidth));
+  }
+  CV_Assert(index);
+
+  // Match keypoint descriptors to cluster center (to vocabulary), using the
+  // same search parameters as the FlannBased DescriptorMatcher.
+  cv::Mat indices, dists;
+  index->knnSearch(keypointDescriptors, indices, dists, 1,
+                   cv::flann::SearchParams());
+
+  std::vector<int> nearestWords(indices.rows);
+  for (int i = 0; i < indices.rows; i++) {
+    int trainIdx = indices.at<int>(i, 0); // cluster index
+    CV_Assert(trainIdx >= 0 && trainIdx < vocab.rows);
+    nearestWords[i] = trainIdx;
+  }
+  return SparseBOW::fromNearestWords(std::move(nearestWords));
+}
 
-  // Match keypoint descriptors to cluster center (to vocabulary)
-  std::vector<cv::DMatch> matches;
-  dmatcher->match( keypointDescriptors, vocab, matches );
+/**
+ * The nearest word to each binary descriptor by Hamming distance, the first
+ * on ties. This is an exact search, with a popcount per 64 bits.
+ */
+std::vector<int> ofpy3::FabMapVocabulary::nearestBinaryWords(
+    const cv::Mat &descriptors) const {
+  cv::Mat descs = descriptors;
+  if (descs.type() != CV_8U) {
+    // Binary descriptors passed in as float arrays
+    descriptors.convertTo(descs, CV_8U);
+  }
+  CV_Assert(descs.cols == vocab.cols);
+
+  std::vector<int> nearestWords(descs.rows);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < descs.rows; i++) {
+    const uchar *descriptor = descs.ptr<uchar>(i);
+    int minDist = std::numeric_limits<int>::max();
+    int nearest = 0;
+    for (int q = 0; q < vocab.rows; q++) {
+      const int dist =
+          ofpy3::hammingDistance(descriptor, vocab.ptr<uchar>(q), vocab.cols);
+      if (dist < minDist) {
+        minDist = dist;
+        nearest = q;
+      }
+    }
+    nearestWords[i] = nearest;
+  }
+  return nearestWords;
+}
 
-  // Compute image descriptor
+cv::Mat
+ofpy3::FabMapVocabulary::generateBOWImageDescs(const cv::Mat &frame) const {
+  SparseBOW bow = generateSparseBOW(frame);
+  if (bow.empty()) {
+    return cv::Mat();
+  }
+  return bow.toDense(vocab.rows);
+}
 
-  _imgDescriptor.create(1, clusterCount, CV_32FC1);
-  _imgDescriptor.setTo(cv::Scalar::all(0));
+cv::Mat
+ofpy3::FabMapVocabulary::generateBOWImageDescsInternal(cv::Mat desc) const {
+  cv::Mat bow;
 
-  float *dptr = _imgDescriptor.ptr<float>();
-  for( size_t i = 0; i < matches.size(); i++ )
-  {
-    int queryIdx = matches[i].queryIdx;
-    int trainIdx = matches[i].trainIdx; // cluster index
-    CV_Assert( queryIdx == (int)i );
+  compute(desc, bow);
 
-    dptr[trainIdx] = dptr[trainIdx] + 1.f;
-  }
+  return bow;
+}
 
-  // Normalize image descriptor.
-  _imgDescriptor /= keypointDescriptors.size().height;
+void ofpy3::FabMapVocabulary::compute(cv::Mat keypointDescriptors,
+                                      cv::Mat &_imgDescriptor) const {
+  _imgDescriptor = quantize(keypointDescriptors).toDense(vocab.rows);
 }
 
 void ofpy3::FabMapVocabulary::convert() {
-  cv::Mat vocab_;
-  vocab.convertTo(vocab_, CV_32F);
-  vocab = vocab_;
+  if (binary) {
+    // Binary words stay packed, they are matched without an index.
+    return;
+  }
+  if (vocab.type() != CV_32F) {
+    cv::Mat vocab_;
+    vocab.convertTo(vocab_, CV_32F);
+    vocab = vocab_;
+    index.reset();
+  }
+  if (!index && !tree) {
+    buildIndex();
+  }
 }
 
+void ofpy3::FabMapVocabulary::buildIndex() {
+  CV_Assert(!vocab.empty());
+  CV_Assert(vocab.type() == CV_32F);
+  // Default KD-tree parameters, as used by the FlannBased DescriptorMatcher.
+  index = std::make_shared<cv::flann::Index>(vocab,
+                                             cv::flann::KDTreeIndexParams());
+  indexLoaded = false;
+}
 
+bool ofpy3::FabMapVocabulary::loadIndex(const std::string &indexFile) {
+  std::ifstream exists(indexFile.c_str());
+  if (!exists.good()) {
+    return false;
+  }
+  std::shared_ptr<cv::flann::Index> loaded =
+      std::make_shared<cv::flann::Index>();
+  // Fails if the saved index was built over a differently shaped vocabulary.
+  if (!loaded->load(vocab, indexFile)) {
+    return false;
+  }
+  index = loaded;
+  indexLoaded = true;
+  return true;
+}
 
 void ofpy3::FabMapVocabulary::save(cv::FileStorage fileStorage) const {
   // Note that this is a partial save, assume that the settings are saved
   // elsewhere.
   fileStorage << "Vocabulary" << vocab;
+  fileStorage << "VocabularyBinary" << (binary ? 1 : 0);
+  if (tree) {
+    fileStorage << "VocabularyTreeCentres" << tree->getCentres();
+    fileStorage << "VocabularyTreeNodes" << tree->getNodes();
+  }
+}
+
+bool ofpy3::FabMapVocabulary::saveIndex(const std::string &indexFile) const {
+  if (!index) {
+    return false;
+  }
+  index->save(indexFile);
+  return true;
+}
+
+bool ofpy3::FabMapVocabulary::isIndexLoaded() const {
+  return index && indexLoaded;
 }
 
 std::shared_ptr<ofpy3::FabMapVocabulary>
-ofpy3::FabMapVocabulary::load(const pybind11::dict &settings,
-                              cv::FileStorage fileStorage) {
+ofpy3::FabMapVocabulary::load(const Settings &settings,
+                              cv::FileStorage fileStorage,
+                              const std::string &indexFile) {
   cv::Mat vocab;
   fileStorage["Vocabulary"] >> vocab;
+  // Models from before the flag was saved only stored binary words as uint8.
+  bool binary = vocab.type() == CV_8U;
+  if (!fileStorage["VocabularyBinary"].empty()) {
+    binary = (int)fileStorage["VocabularyBinary"] != 0;
+  }
 
-  return std::make_shared<ofpy3::FabMapVocabulary>(
-      ofpy3::generateDetector(settings), ofpy3::generateExtractor(settings),
-      vocab);
+  std::shared_ptr<ofpy3::VocabularyTree> tree;
+  if (!fileStorage["VocabularyTreeNodes"].empty()) {
+    cv::Mat centres, nodes;
+    fileStorage["VocabularyTreeCentres"] >> centres;
+    fileStorage["VocabularyTreeNodes"] >> nodes;
+    tree = std::make_shared<ofpy3::VocabularyTree>(vocab, centres, nodes);
+  }
+
+  std::shared_ptr<ofpy3::FabMapVocabulary> vocabulary =
+      std::make_shared<ofpy3::FabMapVocabulary>(settings, vocab, binary,
+                                                indexFile, nullptr, tree);
+  vocabulary->applySettings(settings);
+  return vocabulary;
 }
 
 // ----------------- FabMapVocabularyBuilder -----------------
 
-ofpy3::FabMapVocabularyBuilder::FabMapVocabularyBuilder(pybind11::dict settings)
-    : vocabTrainData(), clusterRadius(0.45) {
+ofpy3::FabMapVocabularyBuilder::FabMapVocabularyBuilder(
+    const Settings &settings)
+    : featureSettings(settings), extractors(), vocabTrainData(),
+      clusterRadius(0.45), referenceClusterer(false), binary(false),
+      treeVocabulary(false), treeBranching(10), treeDepth(4),
+      treeIterations(10), treeSearchWidth(1), maxTrainDescriptors(0),
+      seenTrainDescriptors(0), sampler() {
+  int chunkRows = 65536;
+  std::string scratchDir;
   if (settings.contains("VocabTrainOptions")) {
-    pybind11::dict trainSettings = settings["VocabTrainOptions"];
-    if (trainSettings.contains("ClusterSize")) {
-      clusterRadius = trainSettings["ClusterSize"].cast<double>();
+    const Settings trainSettings = settings.section("VocabTrainOptions");
+    binary = trainSettings.get<std::string>("DescriptorType", "") == "Binary";
+    if (binary) {
+      // In bits, the Hamming radius
+      clusterRadius = 64;
+    }
+    clusterRadius = trainSettings.get<double>("ClusterSize", clusterRadius);
+    if (trainSettings.contains("Clusterer")) {
+      const std::string clusterer =
+          trainSettings.get<std::string>("Clusterer", "");
+      referenceClusterer = clusterer == "Reference";
+      treeVocabulary = clusterer == "Tree";
     }
+    maxTrainDescriptors =
+        trainSettings.get<int>("MaxDescriptors", maxTrainDescriptors);
+    if (trainSettings.contains("Seed")) {
+      sampler.seed(trainSettings.get<std::uint64_t>("Seed", 0));
+    }
+    chunkRows = trainSettings.get<int>("ChunkRows", chunkRows);
+    scratchDir = trainSettings.get<std::string>("ScratchDir", scratchDir);
+  }
+  if (settings.contains("VocabTreeOptions")) {
+    const Settings treeSettings = settings.section("VocabTreeOptions");
+    treeBranching = treeSettings.get<int>("Branching", treeBranching);
+    treeDepth = treeSettings.get<int>("Depth", treeDepth);
+    treeIterations = treeSettings.get<int>("Iterations", treeIterations);
+    treeSearchWidth = treeSettings.get<int>("SearchWidth", treeSearchWidth);
   }
+  vocabTrainData.reset(new DescriptorStore(chunkRows, scratchDir));
 }
 
 void ofpy3::FabMapVocabularyBuilder::initDetectorExtractor(
-    pybind11::dict settings) {
-  detector = ofpy3::generateDetector(settings);
-  extractor = ofpy3::generateExtractor(settings);
+    const Settings &settings) {
+  extractors.reset(new FeatureExtractorPool(settings));
+  featureSettings = settings;
 }
 
 bool ofpy3::FabMapVocabularyBuilder::loadAndAddTrainingImage(
-    std::string imagePath) {
-  cv::Mat frame = cv::imread(imagePath, CV_LOAD_IMAGE_UNCHANGED);
-  return addTrainingImageInternal(frame);
-}
-
-bool ofpy3::FabMapVocabularyBuilder::addTrainingImage(
-    const pybind11::array_t<uchar> &frame) {
-  NDArrayConverter cvt;
-  cv::Mat mat{cvt.toMat(frame.ptr())};
-  return addTrainingImageInternal(mat);
-}
-
-void ofpy3::FabMapVocabularyBuilder::addTrainingDescs(
-    const pybind11::array_t<uchar> &descs) {
-  NDArrayConverter cvt;
-  cv::Mat mat{cvt.toMat(descs.ptr())};
-  addTrainingDescsInternal(mat);
+    const std::string &imagePath) {
+  return addTrainingImage(cv::imread(imagePath, CV_LOAD_IMAGE_UNCHANGED));
 }
 
-bool ofpy3::FabMapVocabularyBuilder::addTrainingImageInternal(
-    const cv::Mat &frame) {
-  cv::Mat descs, feats;
-  std::vector<cv::KeyPoint> kpts;
-
+bool ofpy3::FabMapVocabularyBuilder::addTrainingImage(const cv::Mat &frame) {
   if (frame.data) {
-    // detect & extract features
-    detector->detect(frame, kpts);
-    extractor->compute(frame, kpts, descs);
-
-    // add all descriptors to the training data
-    addTrainingDescsInternal(descs);
+    CV_Assert(extractors);
+    // detect & extract features, then add all descriptors to the training
+    // data (copied in) before handing the extractor back
+    FeatureExtractorPool::Lease extractor = extractors->acquire();
+    if (extractor->detectAndCompute(frame)) {
+      addTrainingDescs(extractor->getDescriptors());
+    }
     return true;
   }
   return false;
 }
 
-void ofpy3::FabMapVocabularyBuilder::addTrainingDescsInternal(
-    const cv::Mat &descs) {
-  vocabTrainData.push_back(descs);
+void ofpy3::FabMapVocabularyBuilder::addTrainingDescs(const cv::Mat &descs) {
+  // Binary vocabularies are clustered on the packed bits themselves.
+  CV_Assert(!binary || descs.empty() || descs.type() == CV_8U);
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  if (maxTrainDescriptors <= 0) {
+    vocabTrainData->append(descs);
+    return;
+  }
+
+  if (descs.empty()) {
+    return;
+  }
+  CV_Assert(vocabTrainData->empty() ||
+            (descs.cols == vocabTrainData->cols() &&
+             descs.type() == vocabTrainData->type()));
+
+  // Reservoir sampling: fill up to the limit, then each new descriptor
+  // replaces a random one with probability limit / seen.
+  const int stored = static_cast<int>(vocabTrainData->rows());
+  int first = 0;
+  if (stored < maxTrainDescriptors) {
+    first = std::min(descs.rows, maxTrainDescriptors - stored);
+    vocabTrainData->append(descs.rowRange(0, first));
+    seenTrainDescriptors += first;
+  }
+  for (int i = first; i < descs.rows; ++i) {
+    ++seenTrainDescriptors;
+    std::uint64_t slot = sampler() % seenTrainDescriptors;
+    if (slot < static_cast<std::uint64_t>(maxTrainDescriptors)) {
+      cv::Mat target = vocabTrainData->row(static_cast<std::size_t>(slot));
+      descs.row(i).copyTo(target);
+    }
+  }
+}
+
+/**
+ * Allocates room for this many training descriptors up front (or, with
+ * MaxDescriptors, for at most that many), so adding them never allocates.
+ */
+void ofpy3::FabMapVocabularyBuilder::reserve(std::size_t numDescriptors) {
+  std::lock_guard<std::mutex> lock(trainDataMutex);
+  if (maxTrainDescriptors > 0) {
+    numDescriptors = std::min(numDescriptors,
+                              static_cast<std::size_t>(maxTrainDescriptors));
+  }
+  vocabTrainData->reserve(numDescriptors);
 }
 
 std::shared_ptr<ofpy3::FabMapVocabulary>
 ofpy3::FabMapVocabularyBuilder::buildVocabulary() {
   // Build the vocab
-  of2::BOWMSCTrainer trainer(clusterRadius);
-  trainer.add(vocabTrainData);
-  cv::Mat vocab = trainer.cluster();
+  cv::Mat vocab;
+  std::shared_ptr<ofpy3::VocabularyTree> tree;
+  {
+    std::lock_guard<std::mutex> lock(trainDataMutex);
+    if (binary) {
+      vocab = ofpy3::clusterBinaryVocabulary(*vocabTrainData, clusterRadius);
+    } else if (referenceClusterer) {
+      of2::BOWMSCTrainer trainer(clusterRadius);
+      for (std::size_t k = 0; k < vocabTrainData->numChunks(); ++k) {
+        trainer.add(vocabTrainData->chunk(k));
+      }
+      trainer.cluster().convertTo(vocab, CV_32F);
+    } else if (treeVocabulary) {
+      tree = ofpy3::VocabularyTree::build(*vocabTrainData, treeBranching,
+                                          treeDepth, treeIterations, sampler());
+      vocab = tree->getWords();
+    } else {
+      vocab = ofpy3::clusterVocabulary(*vocabTrainData, clusterRadius);
+    }
+  }
 
   // Return the vocab object
-  return std::make_shared<ofpy3::FabMapVocabulary>(detector, extractor,
-                                                   std::move(vocab));
+  std::shared_ptr<ofpy3::FabMapVocabulary> vocabulary =
+      std::make_shared<ofpy3::FabMapVocabulary>(
+          featureSettings, std::move(vocab), binary, std::string(), nullptr,
+          tree);
+  vocabulary->setTreeSearchWidth(treeSearchWidth);
+  return vocabulary;
 }
@@ -1,67 +1,148 @@
 #ifndef FABMAPVOCABULARY_H
 #define FABMAPVOCABULARY_H
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <string>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
+#include <opencv2/flann/flann.hpp>
 
-#include <pybind11/numpy.h>
-#include <pybind11/pybind11.h>
+#include "DescriptorStore.h"
+#include "ExactMatcher.h"
+#include "FeatureExtractor.h"
+#include "Settings.h"
+#include "SparseBOW.h"
+#include "Stats.h"
+#include "VocabularyTree.h"
 
 namespace ofpy3 {
 
 class FabMapVocabulary {
 public:
-  FabMapVocabulary(cv::Ptr<cv::FeatureDetector> detector,
-                   cv::Ptr<cv::DescriptorExtractor> extractor,
-                   cv::Mat vocabulary);
+  // featureSettings picks the detector and extractor (FeatureOptions).
+  // Binary vocabularies must be CV_8U.
+  FabMapVocabulary(const Settings &featureSettings, cv::Mat vocabulary,
+                   bool binary, const std::string &indexFile = std::string(),
+                   std::shared_ptr<const void> storage = nullptr,
+                   std::shared_ptr<const VocabularyTree> tree = nullptr);
   virtual ~FabMapVocabulary() = default;
 
   cv::Mat getVocabulary() const;
+  int getVocabularySize() const;
+  bool isBinary() const;
+  std::shared_ptr<const VocabularyTree> getTree() const;
+
+  // Query time options (QuantizerOptions and the vocabulary tree's search
+  // width).
+  void applySettings(const Settings &settings);
+  int getTreeSearchWidth() const;
+  void setTreeSearchWidth(int searchWidth);
+  void setExactSearch(bool exact, const std::string &kernel = "Auto");
+  // The kernel exact search runs with, empty if search is approximate.
+  std::string getExactKernel() const;
+
+  // With stats, the stages (and descriptor and word counts) are recorded.
+  SparseBOW generateSparseBOW(const cv::Mat &frame, Stats *stats = nullptr,
+                              long frameIndex = -1) const;
+  SparseBOW quantize(cv::Mat keypointDescriptors, Stats *stats = nullptr,
+                     long frameIndex = -1) const;
+
+  // Dense 1 x V equivalents, for code that still needs them.
   cv::Mat generateBOWImageDescs(const cv::Mat &frame) const;
   cv::Mat generateBOWImageDescsInternal(cv::Mat desc) const;
-
-  void compute(
-      cv::Ptr<cv::DescriptorMatcher> dmatcher, cv::Mat keypointDescriptors,
-      cv::Mat &_imgDescriptor ) const;
+  void compute(cv::Mat keypointDescriptors, cv::Mat &_imgDescriptor) const;
 
   void convert();
 
   void save(cv::FileStorage fileStorage) const;
-  static std::shared_ptr<FabMapVocabulary> load(const pybind11::dict &settings,
-                                                cv::FileStorage fileStorage);
+  bool saveIndex(const std::string &indexFile) const;
+  // Whether the nearest-word index came from a saved file, not a rebuild.
+  bool isIndexLoaded() const;
+  static std::shared_ptr<FabMapVocabulary>
+  load(const Settings &settings, cv::FileStorage fileStorage,
+       const std::string &indexFile = std::string());
+
+private:
+  bool loadIndex(const std::string &indexFile);
+  void buildIndex();
+  SparseBOW quantizeDescriptors(cv::Mat keypointDescriptors) const;
+  std::vector<int> nearestBinaryWords(const cv::Mat &descriptors) const;
 
 private:
-  cv::Ptr<cv::FeatureDetector> detector;
-  cv::Ptr<cv::DescriptorExtractor> extractor;
+  // A detector and extractor per thread generating BOWs.
+  FeatureExtractorPool extractors;
   cv::Mat vocab;
+  // Owns the memory mapped model file vocab points into, if any.
+  std::shared_ptr<const void> storage;
+
+  // Binary vocabularies (CV_8U, packed bits, from ORB/BRIEF descriptors) are
+  // matched by Hamming distance, float ones by L2 through index. Set
+  // explicitly, a float vocabulary may be CV_8U until convert().
+  bool binary;
+
+  // With a vocabulary tree, float descriptors are quantized by descending it
+  // (vocab then holds its leaves) and no index is built.
+  std::shared_ptr<const VocabularyTree> tree;
+  std::atomic<int> treeSearchWidth;
+
+  // If set, float descriptors are matched exactly by brute force instead of
+  // through the tree or index. Swapped atomically, queries keep the matcher
+  // they started with.
+  std::shared_ptr<const ExactMatcher> exactMatcher;
+
+  // Nearest-word index over vocab, built once and shared by every query.
+  // Searching a built FLANN index is read-only, so concurrent quantize() calls
+  // are safe; the index is only rebuilt by convert(), before any queries.
+  std::shared_ptr<cv::flann::Index> index;
+  bool indexLoaded;
 };
 
 class FabMapVocabularyBuilder {
 public:
-  explicit FabMapVocabularyBuilder(pybind11::dict settings = pybind11::dict());
+  explicit FabMapVocabularyBuilder(const Settings &settings = Settings());
   virtual ~FabMapVocabularyBuilder() = default;
 
-  // These function are exposed to python
-  void initDetectorExtractor(pybind11::dict settings);
-  bool loadAndAddTrainingImage(std::string imagePath);
-  bool addTrainingImage(const pybind11::array_t<uchar> &frame);
-  void addTrainingDescs(const pybind11::array_t<uchar> &descs);
+  void initDetectorExtractor(const Settings &settings);
+  bool loadAndAddTrainingImage(const std::string &imagePath);
+  bool addTrainingImage(const cv::Mat &frame);
+  void addTrainingDescs(const cv::Mat &descs);
+  void reserve(std::size_t numDescriptors);
 
   std::shared_ptr<FabMapVocabulary> buildVocabulary();
 
 private:
-  bool addTrainingImageInternal(const cv::Mat &frame);
-  void addTrainingDescsInternal(const cv::Mat &descs);
-
-private:
-  cv::Ptr<cv::FeatureDetector> detector;
-  cv::Ptr<cv::DescriptorExtractor> extractor;
+  // The settings the vocabulary's detector and extractor are made from.
+  Settings featureSettings;
+  // Set by initDetectorExtractor, a detector and extractor per thread adding
+  // training images.
+  std::unique_ptr<FeatureExtractorPool> extractors;
 
-  cv::Mat vocabTrainData;
+  std::unique_ptr<DescriptorStore> vocabTrainData;
   double clusterRadius;
+  // Cluster with of2::BOWMSCTrainer rather than ofpy3::clusterVocabulary.
+  bool referenceClusterer;
+  // Build a binary vocabulary from binary descriptors.
+  bool binary;
+  // Build a hierarchical k-means vocabulary tree (float descriptors only).
+  bool treeVocabulary;
+  int treeBranching;
+  int treeDepth;
+  int treeIterations;
+  int treeSearchWidth;
+
+  // If positive, vocabTrainData is a uniform sample (reservoir) of at most
+  // this many of the descriptors added.
+  int maxTrainDescriptors;
+  std::uint64_t seenTrainDescriptors;
+  std::mt19937_64 sampler;
+
+  // Guards vocabTrainData, which may be added to from several threads.
+  std::mutex trainDataMutex;
 };
 
 } // namespace ofpy3
@@ -0,0 +1,72 @@
+#include "FeatureExtractor.h"
+#include "detectorsAndExtractors.h"
+
+// ----------------- FeatureExtractor -----------------
+
+ofpy3::FeatureExtractor::FeatureExtractor(const Settings &settings)
+    : detector(), extractor(), feature2D(generateFeature2D(settings)),
+      keypoints(), descriptors() {
+  if (!feature2D) {
+    detector = generateDetector(settings);
+    extractor = generateExtractor(settings);
+  }
+}
+
+bool ofpy3::FeatureExtractor::detectAndCompute(const cv::Mat &frame,
+                                               Stats *stats, long frameIndex) {
+  // The buffers keep their capacity, so frames of similar size reuse them.
+  keypoints.clear();
+
+  if (feature2D) {
+    StageTimer timer(stats, Stage::Detect, frameIndex);
+    (*feature2D)(frame, cv::noArray(), keypoints, descriptors);
+  } else {
+    {
+      StageTimer timer(stats, Stage::Detect, frameIndex);
+      detector->detect(frame, keypoints);
+    }
+    if (keypoints.empty()) {
+      return false;
+    }
+    {
+      StageTimer timer(stats, Stage::Extract, frameIndex);
+      extractor->compute(frame, keypoints, descriptors);
+    }
+  }
+  return !keypoints.empty() && !descriptors.empty();
+}
+
+// ----------------- FeatureExtractorPool -----------------
+
+ofpy3::FeatureExtractorPool::Lease::Lease(
+    const FeatureExtractorPool *pool,
+    std::unique_ptr<FeatureExtractor> extractor)
+    : pool(pool), extractor(std::move(extractor)) {}
+
+ofpy3::FeatureExtractorPool::Lease::~Lease() {
+  if (extractor) {
+    std::lock_guard<std::mutex> lock(pool->idleMutex);
+    pool->idle.push_back(std::move(extractor));
+  }
+}
+
+ofpy3::FeatureExtractorPool::FeatureExtractorPool(const Settings &settings)
+    : settings(settings), idleMutex(), idle() {
+  idle.push_back(std::unique_ptr<FeatureExtractor>(
+      new FeatureExtractor(this->settings)));
+}
+
+ofpy3::FeatureExtractorPool::Lease
+ofpy3::FeatureExtractorPool::acquire() const {
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    if (!idle.empty()) {
+      std::unique_ptr<FeatureExtractor> extractor = std::move(idle.back());
+      idle.pop_back();
+      return Lease(this, std::move(extractor));
+    }
+  }
+  // Made outside the lock, detectors can be slow to construct.
+  return Lease(this, std::unique_ptr<FeatureExtractor>(
+                         new FeatureExtractor(settings)));
+}
@@ -0,0 +1,90 @@
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "Settings.h"
+#include "Stats.h"
+
+namespace ofpy3 {
+
+/**
+ * Detects keypoints and extracts their descriptors, as configured in the
+ * FeatureOptions settings. When the detector and extractor are the same
+ * SURF, SIFT or ORB algorithm this is a single detectAndCompute pass (see
+ * generateFeature2D), otherwise a detect then a compute.
+ *
+ * Not thread safe: the detector and extractor may keep state between calls,
+ * and the keypoints and descriptors are scratch buffers reused frame to
+ * frame. Give each thread its own, e.g. from a FeatureExtractorPool.
+ */
+class FeatureExtractor {
+public:
+  explicit FeatureExtractor(const Settings &settings);
+
+  bool isFused() const { return static_cast<bool>(feature2D); }
+
+  // False if the frame has no features. A fused pass is timed as
+  // Stage::Detect, with no Stage::Extract.
+  bool detectAndCompute(const cv::Mat &frame, Stats *stats = nullptr,
+                        long frameIndex = -1);
+  // Valid until the next detectAndCompute.
+  const cv::Mat &getDescriptors() const { return descriptors; }
+
+private:
+  cv::Ptr<cv::FeatureDetector> detector;
+  cv::Ptr<cv::DescriptorExtractor> extractor;
+  cv::Ptr<cv::Feature2D> feature2D;
+
+  std::vector<cv::KeyPoint> keypoints;
+  cv::Mat descriptors;
+};
+
+/**
+ * FeatureExtractors for concurrent use, one per thread at a time. Idle ones
+ * are kept for reuse, so there are only ever as many as threads have used
+ * the pool at once.
+ */
+class FeatureExtractorPool {
+public:
+  // Hands a FeatureExtractor back to the pool when destroyed.
+  class Lease {
+  public:
+    Lease(const FeatureExtractorPool *pool,
+          std::unique_ptr<FeatureExtractor> extractor);
+    Lease(Lease &&other) = default;
+    ~Lease();
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+
+    FeatureExtractor *operator->() const { return extractor.get(); }
+    FeatureExtractor &operator*() const { return *extractor; }
+
+  private:
+    const FeatureExtractorPool *pool;
+    std::unique_ptr<FeatureExtractor> extractor;
+  };
+
+  // One FeatureExtractor is made up front, so bad settings fail here.
+  explicit FeatureExtractorPool(const Settings &settings);
+  FeatureExtractorPool(const FeatureExtractorPool &) = delete;
+  FeatureExtractorPool &operator=(const FeatureExtractorPool &) = delete;
+
+  Lease acquire() const;
+
+private:
+  Settings settings;
+  // Guards idle.
+  mutable std::mutex idleMutex;
+  mutable std::vector<std::unique_ptr<FeatureExtractor>> idle;
+};
+
+} // namespace ofpy3
+
+#endif // FEATURE_EXTRACTOR_H
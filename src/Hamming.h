@@ -0,0 +1,39 @@
+#ifndef HAMMING_H
+#define HAMMING_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace ofpy3 {
+
+inline int popcount64(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return static_cast<int>((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Hamming distance between two packed bit strings of size bytes.
+inline int hammingDistance(const unsigned char *a, const unsigned char *b,
+                           int size) {
+  int distance = 0;
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    std::uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    distance += popcount64(x ^ y);
+  }
+  for (; i < size; ++i) {
+    distance += popcount64(static_cast<std::uint64_t>(a[i] ^ b[i]));
+  }
+  return distance;
+}
+
+} // namespace ofpy3
+
+#endif // HAMMING_H
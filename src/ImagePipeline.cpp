@@ -0,0 +1,233 @@
+#include "ImagePipeline.h"
+#include <opencv2/highgui/highgui.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// ----------------- PipelineOptions -----------------
+
+ofpy3::PipelineOptions::PipelineOptions()
+    : decodeThreads(2),
+      extractThreads(
+          std::max(1, static_cast<int>(std::thread::hardware_concurrency()) -
+                          1)),
+      queueSize(16) {}
+
+// ----------------- ImagePipeline -----------------
+
+ofpy3::ImagePipeline::ImagePipeline(std::shared_ptr<FabMapVocabulary> vocabulary,
+                                    Localizer localizer,
+                                    const PipelineOptions &options,
+                                    std::shared_ptr<Stats> stats)
+    : vocabulary(std::move(vocabulary)), localizer(std::move(localizer)),
+      options(options), stats(std::move(stats)), source(), sink(),
+      decodeQueue(std::max(1, options.queueSize)),
+      extractQueue(std::max(1, options.queueSize)),
+      localizeQueue(std::max(1, options.queueSize)), resultQueue(),
+      inFlight(0), decodersLeft(0), extractorsLeft(0), cancelled(false),
+      error(), threads() {
+  this->options.decodeThreads = std::max(1, options.decodeThreads);
+  this->options.extractThreads = std::max(1, options.extractThreads);
+  this->options.queueSize = std::max(1, options.queueSize);
+  // Every queue full and every worker busy, plus the frame being localized
+  maxInFlight = 3 * this->options.queueSize + this->options.decodeThreads +
+                this->options.extractThreads + 1;
+}
+
+ofpy3::ImagePipeline::~ImagePipeline() {
+  cancel();
+  join();
+}
+
+void ofpy3::ImagePipeline::start(Source source, Sink sink) {
+  CV_Assert(threads.empty());
+  this->source = std::move(source);
+  this->sink = std::move(sink);
+  decodersLeft = options.decodeThreads;
+  extractorsLeft = options.extractThreads;
+
+  threads.emplace_back(&ImagePipeline::feed, this);
+  for (int i = 0; i < options.decodeThreads; ++i) {
+    threads.emplace_back(&ImagePipeline::decode, this);
+  }
+  for (int i = 0; i < options.extractThreads; ++i) {
+    threads.emplace_back(&ImagePipeline::extract, this);
+  }
+  threads.emplace_back(&ImagePipeline::localize, this);
+}
+
+bool ofpy3::ImagePipeline::nextResult(PipelineResult &result,
+                                      double timeoutSeconds) {
+  if (timeoutSeconds < 0) {
+    return resultQueue.pop(result);
+  }
+  return resultQueue.popFor(result,
+                            std::chrono::duration<double>(timeoutSeconds)) ==
+         BoundedQueue<PipelineResult>::ITEM;
+}
+
+bool ofpy3::ImagePipeline::finished() const { return resultQueue.drained(); }
+
+void ofpy3::ImagePipeline::wait() {
+  join();
+  std::lock_guard<std::mutex> lock(errorMutex);
+  if (error) {
+    std::exception_ptr raised = error;
+    error = nullptr;
+    std::rethrow_exception(raised);
+  }
+}
+
+void ofpy3::ImagePipeline::cancel() {
+  cancelled = true;
+  decodeQueue.close();
+  extractQueue.close();
+  localizeQueue.close();
+  std::lock_guard<std::mutex> lock(slotMutex);
+  slotFree.notify_all();
+}
+
+void ofpy3::ImagePipeline::join() {
+  for (std::thread &thread : threads) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+void ofpy3::ImagePipeline::fail() {
+  {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+  }
+  cancel();
+}
+
+void ofpy3::ImagePipeline::releaseSlot() {
+  std::lock_guard<std::mutex> lock(slotMutex);
+  --inFlight;
+  slotFree.notify_one();
+}
+
+void ofpy3::ImagePipeline::feed() {
+  try {
+    std::size_t index = 0;
+    std::string path;
+    while (!cancelled && source(path)) {
+      {
+        std::unique_lock<std::mutex> lock(slotMutex);
+        slotFree.wait(lock,
+                      [this] { return cancelled || inFlight < maxInFlight; });
+        if (cancelled) {
+          break;
+        }
+        ++inFlight;
+      }
+      Frame frame;
+      frame.index = index++;
+      frame.path = path;
+      if (!decodeQueue.push(std::move(frame))) {
+        break;
+      }
+    }
+  } catch (...) {
+    fail();
+  }
+  decodeQueue.close();
+}
+
+void ofpy3::ImagePipeline::decode() {
+  Frame frame;
+  while (decodeQueue.pop(frame)) {
+    if (!cancelled) {
+      if (stats && stats->isEnabled()) {
+        frame.statsFrame = stats->nextFrame();
+        frame.start = Stats::Clock::now();
+      }
+      try {
+        StageTimer timer(stats.get(), Stage::Decode, frame.statsFrame);
+        frame.image = cv::imread(frame.path, CV_LOAD_IMAGE_UNCHANGED);
+      } catch (...) {
+        fail();
+      }
+    }
+    // Frames are passed on even when they fail, the localizer waits for
+    // every index in turn.
+    extractQueue.push(std::move(frame));
+  }
+  if (--decodersLeft == 0) {
+    extractQueue.close();
+  }
+}
+
+void ofpy3::ImagePipeline::extract() {
+#ifdef _OPENMP
+  // The extract threads already use the cores. Quantizing here with an
+  // OpenMP team each (nearest-word search is parallel over descriptors)
+  // would run some extractThreads x cores threads. This only affects
+  // this thread.
+  omp_set_num_threads(1);
+#endif
+  Frame frame;
+  while (extractQueue.pop(frame)) {
+    if (!cancelled && frame.image.data) {
+      try {
+        frame.bow = vocabulary->generateSparseBOW(frame.image, stats.get(),
+                                                  frame.statsFrame);
+      } catch (...) {
+        fail();
+      }
+    }
+    frame.image.release();
+    localizeQueue.push(std::move(frame));
+  }
+  if (--extractorsLeft == 0) {
+    localizeQueue.close();
+  }
+}
+
+void ofpy3::ImagePipeline::localize() {
+  // Frames finish extraction out of order, hold them until their turn.
+  std::map<std::size_t, Frame> pending;
+  std::size_t next = 0;
+  Frame frame;
+  while (localizeQueue.pop(frame)) {
+    pending.emplace(frame.index, std::move(frame));
+    for (auto it = pending.find(next); it != pending.end();
+         it = pending.find(next)) {
+      if (!cancelled) {
+        try {
+          PipelineResult result;
+          result.path = it->second.path;
+          result.processed = false;
+          result.queryIdx = -1;
+          result.bestIdx = -1;
+          result.bestLikelihood = 0.0;
+          localizer(it->second.bow, result);
+          if (it->second.statsFrame >= 0) {
+            stats->recordStage(Stage::Frame, it->second.start,
+                               Stats::Clock::now(), it->second.statsFrame);
+          }
+          if (sink) {
+            sink(result);
+          } else {
+            resultQueue.push(std::move(result));
+          }
+        } catch (...) {
+          fail();
+        }
+      }
+      pending.erase(it);
+      ++next;
+      releaseSlot();
+    }
+  }
+  resultQueue.close();
+}
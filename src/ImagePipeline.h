@@ -0,0 +1,144 @@
+#ifndef IMAGE_PIPELINE_H
+#define IMAGE_PIPELINE_H
+
+#include "BoundedQueue.h"
+#include "FabMapVocabulary.h"
+#include "SparseBOW.h"
+#include "Stats.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+struct PipelineOptions {
+  int decodeThreads;
+  int extractThreads;
+  // Capacity of each queue between stages.
+  int queueSize;
+
+  PipelineOptions();
+};
+
+struct PipelineResult {
+  std::string path;
+  // Whether the image was loaded and had features, the rest is -1/0 if not.
+  bool processed;
+  int queryIdx;
+  int bestIdx;
+  double bestLikelihood;
+};
+
+/**
+ * Streams images through decode, feature extraction/quantization and
+ * localization stages running concurrently, so that disk I/O and extraction
+ * of later frames overlap the localization of earlier ones.
+ *
+ * Paths are pulled from the source on a feeder thread, decoded and extracted
+ * by pools of decodeThreads and extractThreads, and localized on a single
+ * thread strictly in source order. Extraction threads quantize serially, the
+ * pool is the parallelism. The stages are connected by bounded
+ * queues and the number of frames in flight is capped, so a slow stage holds
+ * back the ones before it (and the source) rather than frames piling up in
+ * memory.
+ *
+ * Results are passed to the sink, on the localization thread and in order,
+ * or if there is no sink queued for nextResult.
+ *
+ * With stats, each frame is timed from decoding to the end of its
+ * localization, besides the stages themselves.
+ */
+class ImagePipeline {
+public:
+  // Sets path to the next image, or returns false when there are no more.
+  typedef std::function<bool(std::string &path)> Source;
+  // Localizes a frame (and records the result); bow may be empty.
+  typedef std::function<void(const SparseBOW &bow, PipelineResult &result)>
+      Localizer;
+  typedef std::function<void(const PipelineResult &result)> Sink;
+
+  ImagePipeline(std::shared_ptr<FabMapVocabulary> vocabulary,
+                Localizer localizer, const PipelineOptions &options,
+                std::shared_ptr<Stats> stats = nullptr);
+  virtual ~ImagePipeline();
+  ImagePipeline(const ImagePipeline &) = delete;
+  ImagePipeline &operator=(const ImagePipeline &) = delete;
+
+  void start(Source source, Sink sink = Sink());
+
+  // Waits up to timeoutSeconds (forever if negative) for the next result.
+  // Returns false on timeout or once every result has been delivered.
+  bool nextResult(PipelineResult &result, double timeoutSeconds = -1);
+  // Whether every result has been delivered.
+  bool finished() const;
+
+  // Waits for every frame to be localized. Rethrows the first error any
+  // stage (or the source or sink) raised.
+  void wait();
+  // Stops the pipeline, dropping the frames in flight.
+  void cancel();
+
+protected:
+  void join();
+
+private:
+  struct Frame {
+    std::size_t index;
+    std::string path;
+    cv::Mat image;
+    SparseBOW bow;
+    // The frame's number in stats and when decoding started, if timed.
+    long statsFrame = -1;
+    Stats::Clock::time_point start;
+  };
+
+  void feed();
+  void decode();
+  void extract();
+  void localize();
+  void fail();
+  void releaseSlot();
+
+private:
+  std::shared_ptr<FabMapVocabulary> vocabulary;
+  Localizer localizer;
+  PipelineOptions options;
+  std::shared_ptr<Stats> stats;
+  Source source;
+  Sink sink;
+
+  BoundedQueue<Frame> decodeQueue;
+  BoundedQueue<Frame> extractQueue;
+  BoundedQueue<Frame> localizeQueue;
+  // Unbounded, results are small and may be read only after wait().
+  BoundedQueue<PipelineResult> resultQueue;
+
+  // Frames between the source and the end of localization, capped so that
+  // the localizer's reordering cannot grow without bound.
+  std::mutex slotMutex;
+  std::condition_variable slotFree;
+  int inFlight;
+  int maxInFlight;
+
+  std::atomic<int> decodersLeft;
+  std::atomic<int> extractorsLeft;
+  std::atomic<bool> cancelled;
+
+  std::mutex errorMutex;
+  std::exception_ptr error;
+
+  std::vector<std::thread> threads;
+};
+
+} // namespace ofpy3
+
+#endif // IMAGE_PIPELINE_H
@@ -0,0 +1,171 @@
+#include "LoopClosureStore.h"
+#include <opencv2/core/core.hpp>
+#include <limits>
+
+// ----------------- LoopClosureStore -----------------
+
+ofpy3::LoopClosureStore::LoopClosureStore(Retention retention, int topK,
+                                          int lastN)
+    : retention(retention), topK(topK), lastN(lastN), mutex(), numQueries(0),
+      lastMatch(-1) {
+  CV_Assert(retention != KEEP_TOP_K || topK > 0);
+  CV_Assert(retention != KEEP_LAST_N || lastN > 0);
+}
+
+/**
+ * Records the matches of one query, as returned by FabMap::localize.
+ *
+ * @param matches The matches of the query, including the new place.
+ * @param bestMatchIndex Set to the most probable place (-1 for a new place),
+ * by the normalised match probability, the first on ties.
+ * @param bestLikelihood Set to the (log) likelihood of that place, 0 if
+ * there are no matches.
+ * @return The index assigned to the query.
+ */
+int ofpy3::LoopClosureStore::record(const std::vector<of2::IMatch> &matches,
+                                    int &bestMatchIndex,
+                                    double &bestLikelihood) {
+  bestLikelihood = 0.0;
+  bestMatchIndex = -1;
+  // By probability: likelihoods are logs, and without the priors.
+  double bestMatch = -std::numeric_limits<double>::infinity();
+  for (std::vector<of2::IMatch>::const_iterator iter = matches.begin();
+       iter != matches.end(); ++iter) {
+    if (iter->match > bestMatch) {
+      bestMatch = iter->match;
+      bestLikelihood = iter->likelihood;
+      bestMatchIndex = iter->imgIdx;
+    }
+  }
+
+  // Select the matches to retain before taking the lock.
+  std::vector<of2::IMatch> retained;
+  selectRetained(matches, retained);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  const int queryIndex = numQueries;
+  append(queryIndex, bestMatchIndex, bestLikelihood,
+         retention == KEEP_TOP_K ? retained : matches);
+  return queryIndex;
+}
+
+/**
+ * Re-records a query from a saved map, keeping its original index.
+ */
+void ofpy3::LoopClosureStore::restore(int queryIndex, int bestMatchIndex,
+                                      double bestLikelihood,
+                                      const std::vector<of2::IMatch> &matches) {
+  std::vector<of2::IMatch> retained;
+  selectRetained(matches, retained);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  CV_Assert(queryIndex >= numQueries);
+  append(queryIndex, bestMatchIndex, bestLikelihood,
+         retention == KEEP_TOP_K ? retained : matches);
+}
+
+void ofpy3::LoopClosureStore::selectRetained(
+    const std::vector<of2::IMatch> &matches,
+    std::vector<of2::IMatch> &retained) const {
+  if (retention != KEEP_TOP_K) {
+    return;
+  }
+  retained.assign(matches.begin(), matches.end());
+  if ((int)retained.size() > topK) {
+    std::partial_sort(retained.begin(), retained.begin() + topK,
+                      retained.end(),
+                      [](const of2::IMatch &a, const of2::IMatch &b) {
+                        return a.likelihood > b.likelihood;
+                      });
+    retained.resize(topK);
+  }
+}
+
+// Must be called with the mutex held.
+void ofpy3::LoopClosureStore::append(int queryIndex, int bestMatchIndex,
+                                     double bestLikelihood,
+                                     const std::vector<of2::IMatch> &matches) {
+  numQueries = queryIndex + 1;
+  lastMatch = bestMatchIndex;
+
+  queryIdx.push_back(queryIndex);
+  bestIdx.push_back(bestMatchIndex);
+  this->bestLikelihood.push_back(bestLikelihood);
+  for (std::vector<of2::IMatch>::const_iterator iter = matches.begin();
+       iter != matches.end(); ++iter) {
+    matchQueryIdx.push_back(queryIndex);
+    matchImgIdx.push_back(iter->imgIdx);
+    matchLikelihood.push_back(iter->likelihood);
+  }
+
+  if (retention == KEEP_LAST_N && (int)queryIdx.size() > lastN) {
+    const int firstKept = queryIndex - lastN + 1;
+    std::size_t dropped = 0;
+    while (dropped < matchQueryIdx.size() &&
+           matchQueryIdx[dropped] < firstKept) {
+      ++dropped;
+    }
+    matchQueryIdx.popFront(dropped);
+    matchImgIdx.popFront(dropped);
+    matchLikelihood.popFront(dropped);
+
+    dropped = queryIdx.size() - lastN;
+    queryIdx.popFront(dropped);
+    bestIdx.popFront(dropped);
+    this->bestLikelihood.popFront(dropped);
+  }
+}
+
+void ofpy3::LoopClosureStore::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  numQueries = 0;
+  lastMatch = -1;
+  queryIdx.clear();
+  bestIdx.clear();
+  bestLikelihood.clear();
+  matchQueryIdx.clear();
+  matchImgIdx.clear();
+  matchLikelihood.clear();
+}
+
+int ofpy3::LoopClosureStore::getNumQueries() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return numQueries;
+}
+
+int ofpy3::LoopClosureStore::getLastMatch() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return lastMatch;
+}
+
+ofpy3::LoopClosureStore::Columns ofpy3::LoopClosureStore::getColumns() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  Columns columns;
+  columns.queryIdx = snapshot(queryIdx);
+  columns.bestIdx = snapshot(bestIdx);
+  columns.bestLikelihood = snapshot(bestLikelihood);
+  columns.matchQueryIdx = snapshot(matchQueryIdx);
+  columns.matchImgIdx = snapshot(matchImgIdx);
+  columns.matchLikelihood = snapshot(matchLikelihood);
+  return columns;
+}
+
+template <typename T>
+ofpy3::LoopClosureStore::Columns::Column<T>
+ofpy3::LoopClosureStore::snapshot(const SharedColumn<T> &column) {
+  Columns::Column<T> view;
+  view.data = column.data();
+  view.offset = column.offset();
+  view.size = column.size();
+  return view;
+}
+
+ofpy3::LoopClosureStore::Retention
+ofpy3::LoopClosureStore::parseRetention(const std::string &retention) {
+  if (retention == "TopK") {
+    return KEEP_TOP_K;
+  } else if (retention == "LastN") {
+    return KEEP_LAST_N;
+  }
+  return KEEP_ALL;
+}
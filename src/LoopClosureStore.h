@@ -0,0 +1,140 @@
+#ifndef LOOP_CLOSURE_STORE_H
+#define LOOP_CLOSURE_STORE_H
+
+#include <fabmap.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ofpy3 {
+
+/**
+ * An append-only column of values whose storage can be shared with readers.
+ * Appending never moves or overwrites an element a reader can see: when the
+ * buffer is full, a larger one is allocated and the old one is left to the
+ * readers still holding it. Dropping old values likewise compacts into a new
+ * buffer.
+ */
+template <typename T> class SharedColumn {
+public:
+  SharedColumn() : buffer(), first(0), last(0) {}
+
+  void push_back(const T &value) {
+    if (!buffer || last == buffer->size()) {
+      reallocate(std::max<std::size_t>(16, 2 * size()));
+    }
+    (*buffer)[last++] = value;
+  }
+
+  // Drops the oldest count values. The buffer is only compacted once the
+  // dropped prefix outgrows the live values, so this is amortized O(1).
+  void popFront(std::size_t count) {
+    first += std::min(count, size());
+    if (first > size()) {
+      reallocate(std::max<std::size_t>(16, 2 * size()));
+    }
+  }
+
+  void clear() {
+    buffer.reset();
+    first = last = 0;
+  }
+
+  std::size_t size() const { return last - first; }
+  const T &operator[](std::size_t i) const { return (*buffer)[first + i]; }
+
+  // The current buffer, of which [offset(), offset() + size()) is live.
+  std::shared_ptr<const std::vector<T>> data() const { return buffer; }
+  std::size_t offset() const { return first; }
+
+private:
+  void reallocate(std::size_t capacity) {
+    std::shared_ptr<std::vector<T>> resized =
+        std::make_shared<std::vector<T>>(capacity);
+    for (std::size_t i = 0; i < size(); ++i) {
+      (*resized)[i] = (*buffer)[first + i];
+    }
+    last = size();
+    first = 0;
+    buffer = resized;
+  }
+
+  std::shared_ptr<std::vector<T>> buffer;
+  std::size_t first;
+  std::size_t last;
+};
+
+/**
+ * Columnar history of localization results. The best match of every query is
+ * kept in three parallel columns, and the (retained) match list of every
+ * query in three more, one row per match, with a query's rows contiguous.
+ */
+class LoopClosureStore {
+public:
+  enum Retention {
+    KEEP_ALL,   // every match of every query
+    KEEP_TOP_K, // the topK most likely matches of every query
+    KEEP_LAST_N // every match of the lastN most recent queries only
+  };
+
+  // A consistent snapshot of the columns, safe to read while recording
+  // continues.
+  struct Columns {
+    template <typename T> struct Column {
+      std::shared_ptr<const std::vector<T>> data;
+      std::size_t offset;
+      std::size_t size;
+    };
+    Column<int> queryIdx;
+    Column<int> bestIdx;
+    Column<double> bestLikelihood;
+    Column<int> matchQueryIdx;
+    Column<int> matchImgIdx;
+    Column<double> matchLikelihood;
+  };
+
+  explicit LoopClosureStore(Retention retention = KEEP_ALL, int topK = 0,
+                            int lastN = 0);
+
+  int record(const std::vector<of2::IMatch> &matches, int &bestMatchIndex,
+             double &bestLikelihood);
+  void restore(int queryIndex, int bestMatchIndex, double bestLikelihood,
+               const std::vector<of2::IMatch> &matches);
+  void clear();
+
+  int getNumQueries() const;
+  int getLastMatch() const;
+  Columns getColumns() const;
+
+  static Retention parseRetention(const std::string &retention);
+
+private:
+  void selectRetained(const std::vector<of2::IMatch> &matches,
+                      std::vector<of2::IMatch> &retained) const;
+  void append(int queryIndex, int bestMatchIndex, double bestLikelihood,
+              const std::vector<of2::IMatch> &matches);
+
+  template <typename T>
+  static Columns::Column<T> snapshot(const SharedColumn<T> &column);
+
+  Retention retention;
+  int topK;
+  int lastN;
+
+  mutable std::mutex mutex;
+  int numQueries;
+  int lastMatch;
+  SharedColumn<int> queryIdx;
+  SharedColumn<int> bestIdx;
+  SharedColumn<double> bestLikelihood;
+  SharedColumn<int> matchQueryIdx;
+  SharedColumn<int> matchImgIdx;
+  SharedColumn<double> matchLikelihood;
+};
+
+} // namespace ofpy3
+
+#endif // LOOP_CLOSURE_STORE_H
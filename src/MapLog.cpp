@@ -0,0 +1,208 @@
+#include "MapLog.h"
+#include "BinaryIO.h"
+#include <cstring>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define OFPY3_HAVE_TRUNCATE
+#endif
+
+namespace {
+
+const char MAGIC[8] = {'O', 'F', 'P', 'Y', '3', 'M', 'A', 'P'};
+const std::uint32_t VERSION = 1;
+
+enum RecordType : std::uint32_t { PLACE = 1, QUERY = 2 };
+
+struct LogHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byteOrder;
+  std::int32_t vocabSize;
+  std::uint32_t reserved;
+};
+
+// Records larger than this are taken to be corrupt rather than allocated.
+const std::uint64_t MAX_RECORD_SIZE = 1ull << 30;
+
+bool fileExists(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  return in.good();
+}
+
+} // namespace
+
+// ----------------- MapLogWriter -----------------
+
+ofpy3::MapLogWriter::MapLogWriter(const std::string &filename, int vocabSize,
+                                  bool truncate)
+    : filename(filename), out() {
+  if (truncate || !fileExists(filename)) {
+    out.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    binaryio::check(out.good(), filename, "cannot open map log for writing");
+    LogHeader header;
+    std::memset(&header, 0, sizeof(LogHeader));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = binaryio::BYTE_ORDER_MARK;
+    header.vocabSize = vocabSize;
+    binaryio::write(out, header);
+  } else {
+    // Check that we are appending to a log of the same map.
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    LogHeader header;
+    binaryio::check(binaryio::read(in, header) &&
+                        std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                        header.vocabSize == vocabSize,
+                    filename, "not a map log for this vocabulary");
+    in.close();
+    out.open(filename.c_str(), std::ios::binary | std::ios::app);
+    binaryio::check(out.good(), filename, "cannot open map log for writing");
+  }
+}
+
+void ofpy3::MapLogWriter::writePlace(int placeIndex, const SparseBOW &bow) {
+  std::ostringstream payload;
+  binaryio::write(payload, static_cast<std::int32_t>(placeIndex));
+  binaryio::write(payload, static_cast<std::uint32_t>(bow.size()));
+  for (std::size_t k = 0; k < bow.size(); ++k) {
+    binaryio::write(payload, static_cast<std::int32_t>(bow.words[k]));
+    binaryio::write(payload, bow.values[k]);
+  }
+  writeRecord(PLACE, payload.str());
+}
+
+void ofpy3::MapLogWriter::writeQuery(int queryIndex, int bestMatchIndex,
+                                     double bestLikelihood,
+                                     const std::vector<of2::IMatch> &matches) {
+  std::ostringstream payload;
+  binaryio::write(payload, static_cast<std::int32_t>(queryIndex));
+  binaryio::write(payload, static_cast<std::int32_t>(bestMatchIndex));
+  binaryio::write(payload, bestLikelihood);
+  binaryio::write(payload, static_cast<std::uint32_t>(matches.size()));
+  for (std::vector<of2::IMatch>::const_iterator iter = matches.begin();
+       iter != matches.end(); ++iter) {
+    binaryio::write(payload, static_cast<std::int32_t>(iter->imgIdx));
+    binaryio::write(payload, iter->likelihood);
+  }
+  writeRecord(QUERY, payload.str());
+}
+
+void ofpy3::MapLogWriter::flush() {
+  out.flush();
+  binaryio::check(out.good(), filename, "error writing map log");
+}
+
+void ofpy3::MapLogWriter::writeRecord(std::uint32_t type,
+                                      const std::string &payload) {
+  binaryio::write(out, type);
+  binaryio::write(out, static_cast<std::uint64_t>(payload.size()));
+  out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+  binaryio::write(out, binaryio::checksum(payload.data(), payload.size()));
+}
+
+// ----------------- readMapLog -----------------
+
+std::uint64_t ofpy3::readMapLog(
+    const std::string &filename, int vocabSize,
+    const std::function<void(int placeIndex, const SparseBOW &bow)> &onPlace,
+    const std::function<void(int queryIndex, int bestMatchIndex,
+                             double bestLikelihood,
+                             const std::vector<of2::IMatch> &matches)>
+        &onQuery) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  binaryio::check(in.good(), filename, "cannot open map log");
+
+  LogHeader header;
+  binaryio::check(binaryio::read(in, header) &&
+                      std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0,
+                  filename, "not an openfabmap_python3 map log");
+  binaryio::check(header.byteOrder == binaryio::BYTE_ORDER_MARK, filename,
+                  "map log was written with a different byte order");
+  binaryio::check(header.version == VERSION, filename,
+                  "unsupported map log version");
+  binaryio::check(header.vocabSize == vocabSize, filename,
+                  "map log was written with a different vocabulary");
+
+  std::uint64_t validEnd = sizeof(LogHeader);
+  std::string payload;
+  while (true) {
+    std::uint32_t type;
+    std::uint64_t size, checksum;
+    if (!binaryio::read(in, type) || !binaryio::read(in, size) ||
+        size > MAX_RECORD_SIZE) {
+      break;
+    }
+    payload.resize(size);
+    in.read(&payload[0], static_cast<std::streamsize>(size));
+    if (in.gcount() != static_cast<std::streamsize>(size) ||
+        !binaryio::read(in, checksum) ||
+        binaryio::checksum(payload.data(), payload.size()) != checksum) {
+      break;
+    }
+
+    std::istringstream record(payload);
+    if (type == PLACE) {
+      std::int32_t placeIndex;
+      std::uint32_t nnz;
+      binaryio::read(record, placeIndex);
+      binaryio::read(record, nnz);
+      SparseBOW bow;
+      bow.words.reserve(nnz);
+      bow.values.reserve(nnz);
+      for (std::uint32_t i = 0; i < nnz; ++i) {
+        std::int32_t q;
+        float value;
+        binaryio::read(record, q);
+        binaryio::read(record, value);
+        binaryio::check(q >= 0 && q < vocabSize &&
+                            (bow.words.empty() || q > bow.words.back()),
+                        filename, "word out of range in map log");
+        bow.words.push_back(q);
+        bow.values.push_back(value);
+      }
+      onPlace(placeIndex, bow);
+    } else if (type == QUERY) {
+      std::int32_t queryIndex, bestMatchIndex;
+      double bestLikelihood;
+      std::uint32_t numMatches;
+      binaryio::read(record, queryIndex);
+      binaryio::read(record, bestMatchIndex);
+      binaryio::read(record, bestLikelihood);
+      binaryio::read(record, numMatches);
+      std::vector<of2::IMatch> matches(numMatches);
+      for (std::uint32_t i = 0; i < numMatches; ++i) {
+        std::int32_t imgIdx;
+        double likelihood;
+        binaryio::read(record, imgIdx);
+        binaryio::read(record, likelihood);
+        matches[i].queryIdx = queryIndex;
+        matches[i].imgIdx = imgIdx;
+        matches[i].likelihood = likelihood;
+      }
+      onQuery(queryIndex, bestMatchIndex, bestLikelihood, matches);
+    }
+    // Unknown record types from newer writers are skipped.
+
+    validEnd += sizeof(type) + sizeof(size) + size + sizeof(checksum);
+  }
+  return validEnd;
+}
+
+void ofpy3::truncateMapLog(const std::string &filename, std::uint64_t offset) {
+#ifdef OFPY3_HAVE_TRUNCATE
+  binaryio::check(::truncate(filename.c_str(), static_cast<off_t>(offset)) ==
+                      0,
+                  filename, "cannot truncate map log");
+#else
+  // Rewrite the valid prefix instead.
+  std::string contents(offset, '\0');
+  {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    in.read(&contents[0], static_cast<std::streamsize>(offset));
+  }
+  std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(contents.data(), static_cast<std::streamsize>(offset));
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef MAP_LOG_H
+#define MAP_LOG_H
+
+#include "SparseBOW.h"
+#include <fabmap.hpp>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * Appends records to a FabMap place map log. A log is a header followed by a
+ * stream of self-contained, checksummed records, one per place added to the
+ * map and one per localized query. A full snapshot is simply a log written
+ * from scratch; checkpoints append the records since the last one, so saving
+ * costs O(new frames).
+ */
+class MapLogWriter {
+public:
+  // Starts a new log (truncating any existing file) if truncate is set or
+  // the file does not exist yet, otherwise appends to it.
+  MapLogWriter(const std::string &filename, int vocabSize, bool truncate);
+
+  void writePlace(int placeIndex, const SparseBOW &bow);
+  void writeQuery(int queryIndex, int bestMatchIndex, double bestLikelihood,
+                  const std::vector<of2::IMatch> &matches);
+  void flush();
+
+private:
+  void writeRecord(std::uint32_t type, const std::string &payload);
+
+  std::string filename;
+  std::ofstream out;
+};
+
+/**
+ * Replays a map log, in order. Reading stops cleanly at the first truncated
+ * or corrupt record, as left by a crash mid-checkpoint.
+ *
+ * @return The file offset just past the last valid record, where appending
+ * should resume.
+ */
+std::uint64_t readMapLog(
+    const std::string &filename, int vocabSize,
+    const std::function<void(int placeIndex, const SparseBOW &bow)> &onPlace,
+    const std::function<void(int queryIndex, int bestMatchIndex,
+                             double bestLikelihood,
+                             const std::vector<of2::IMatch> &matches)>
+        &onQuery);
+
+// Drops anything after offset, such as a partially written record.
+void truncateMapLog(const std::string &filename, std::uint64_t offset);
+
+} // namespace ofpy3
+
+#endif // MAP_LOG_H
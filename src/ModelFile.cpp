@@ -0,0 +1,452 @@
+#include "ModelFile.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define OFPY3_HAVE_MMAP
+#endif
+
+namespace {
+
+const char MAGIC[8] = {'O', 'F', 'P', 'Y', '3', 'M', 'D', 'L'};
+// Version 2 records whether the vocabulary is binary, version 1 files are
+// still read.
+const std::uint32_t VERSION = 2;
+const std::uint64_t ALIGNMENT = 64;
+
+enum SectionId : std::uint32_t {
+  VOCABULARY = 1,
+  CHOW_LIU_TREE = 2,
+  TRAINING_DATA = 3,
+  VOCABULARY_TREE_CENTRES = 4,
+  VOCABULARY_TREE_NODES = 5,
+  // 1 x n CV_8U: the index file's checksum (uint64), then its path
+  VOCABULARY_INDEX = 6
+};
+
+// Flags in the VOCABULARY section's reserved field (version 2 onwards).
+const std::uint32_t VOCABULARY_BINARY = 1;
+
+enum Encoding : std::uint32_t {
+  RAW = 0,   // the matrix data, row major
+  SPARSE = 1 // CV_32F rows as row starts (uint64), columns (int32), values
+};
+
+struct FileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byteOrder;
+  std::uint32_t numSections;
+  std::uint32_t reserved;
+  std::uint64_t sectionTableChecksum;
+};
+
+struct SectionEntry {
+  std::uint32_t id;
+  std::uint32_t encoding;
+  std::int32_t rows;
+  std::int32_t cols;
+  std::int32_t type;
+  std::uint32_t reserved;
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::uint64_t checksum;
+};
+
+// Sections are produced twice, once to checksum and once to write them, so
+// that large ones never need to be held in memory in their encoded form.
+typedef std::function<void(const char *data, std::size_t size)> Sink;
+
+struct Section {
+  SectionEntry entry;
+  std::function<void(const Sink &sink)> produce;
+};
+
+SectionEntry sectionEntry(SectionId id, Encoding encoding, int rows, int cols,
+                          int type) {
+  SectionEntry entry;
+  std::memset(&entry, 0, sizeof(SectionEntry));
+  entry.id = id;
+  entry.encoding = encoding;
+  entry.rows = rows;
+  entry.cols = cols;
+  entry.type = type;
+  return entry;
+}
+
+Section rawSection(SectionId id, const cv::Mat &mat) {
+  CV_Assert(mat.isContinuous());
+  Section section;
+  section.entry = sectionEntry(id, RAW, mat.rows, mat.cols, mat.type());
+  section.entry.size = mat.total() * mat.elemSize();
+  section.produce = [mat](const Sink &sink) {
+    sink(reinterpret_cast<const char *>(mat.data), mat.total() * mat.elemSize());
+  };
+  return section;
+}
+
+Section indexSection(SectionId id, const std::string &indexFile,
+                     std::uint64_t indexChecksum) {
+  std::vector<char> bytes(sizeof(indexChecksum) + indexFile.size());
+  std::memcpy(bytes.data(), &indexChecksum, sizeof(indexChecksum));
+  std::memcpy(bytes.data() + sizeof(indexChecksum), indexFile.data(),
+              indexFile.size());
+  Section section;
+  section.entry = sectionEntry(id, RAW, 1, (int)bytes.size(), CV_8U);
+  section.entry.size = bytes.size();
+  section.produce = [bytes](const Sink &sink) {
+    sink(bytes.data(), bytes.size());
+  };
+  return section;
+}
+
+Section denseBOWSection(SectionId id,
+                        const std::vector<ofpy3::SparseBOW> &bows,
+                        int vocabSize) {
+  Section section;
+  section.entry = sectionEntry(id, RAW, (int)bows.size(), vocabSize, CV_32F);
+  section.entry.size =
+      static_cast<std::uint64_t>(bows.size()) * vocabSize * sizeof(float);
+  section.produce = [&bows, vocabSize](const Sink &sink) {
+    std::vector<float> row(vocabSize);
+    for (std::size_t i = 0; i < bows.size(); ++i) {
+      std::fill(row.begin(), row.end(), 0.f);
+      for (std::size_t k = 0; k < bows[i].size(); ++k) {
+        row[bows[i].words[k]] = bows[i].values[k];
+      }
+      sink(reinterpret_cast<const char *>(row.data()),
+           row.size() * sizeof(float));
+    }
+  };
+  return section;
+}
+
+Section sparseBOWSection(SectionId id,
+                         const std::vector<ofpy3::SparseBOW> &bows,
+                         int vocabSize) {
+  std::uint64_t nnz = 0;
+  for (std::size_t i = 0; i < bows.size(); ++i) {
+    nnz += bows[i].size();
+  }
+  Section section;
+  section.entry = sectionEntry(id, SPARSE, (int)bows.size(), vocabSize, CV_32F);
+  section.entry.size = (bows.size() + 1) * sizeof(std::uint64_t) +
+                       nnz * sizeof(std::int32_t) + nnz * sizeof(float);
+  section.produce = [&bows](const Sink &sink) {
+    std::uint64_t rowStart = 0;
+    sink(reinterpret_cast<const char *>(&rowStart), sizeof(rowStart));
+    for (std::size_t i = 0; i < bows.size(); ++i) {
+      rowStart += bows[i].size();
+      sink(reinterpret_cast<const char *>(&rowStart), sizeof(rowStart));
+    }
+    for (std::size_t i = 0; i < bows.size(); ++i) {
+      for (std::size_t k = 0; k < bows[i].size(); ++k) {
+        std::int32_t col = bows[i].words[k];
+        sink(reinterpret_cast<const char *>(&col), sizeof(col));
+      }
+    }
+    for (std::size_t i = 0; i < bows.size(); ++i) {
+      sink(reinterpret_cast<const char *>(bows[i].values.data()),
+           bows[i].values.size() * sizeof(float));
+    }
+  };
+  return section;
+}
+
+// Checks a section's shape and type before anything is sized from it.
+void checkSection(const SectionEntry &entry, std::initializer_list<int> types,
+                  const std::string &filename) {
+  ofpy3::binaryio::check(entry.rows >= 0 && entry.cols >= 0, filename,
+                         "section has a negative shape");
+  ofpy3::binaryio::check(std::find(types.begin(), types.end(), entry.type) !=
+                             types.end(),
+                         filename, "section has an unexpected type");
+}
+
+cv::Mat decodeMatSection(const SectionEntry &entry, const char *data,
+                         const std::string &filename,
+                         std::initializer_list<int> types) {
+  checkSection(entry, types, filename);
+  ofpy3::binaryio::check(entry.encoding == RAW, filename,
+                         "unknown section encoding");
+  ofpy3::binaryio::check(
+      entry.size == static_cast<std::uint64_t>(entry.rows) * entry.cols *
+                        CV_ELEM_SIZE(entry.type),
+      filename, "section size does not match its shape");
+  // No copy, the matrix points into the file's storage. The mapping is
+  // private, so writing to it (which nothing should) never reaches the file.
+  return cv::Mat(entry.rows, entry.cols, entry.type, const_cast<char *>(data));
+}
+
+// A RAW section is also kept as dense rows in the file's storage.
+std::vector<ofpy3::SparseBOW>
+decodeBOWSection(const SectionEntry &entry, const char *data,
+                 const std::string &filename, cv::Mat &dense) {
+  checkSection(entry, {CV_32F}, filename);
+  if (entry.encoding == RAW) {
+    dense = decodeMatSection(entry, data, filename, {CV_32F});
+    return ofpy3::fromDense(dense);
+  }
+
+  ofpy3::binaryio::check(entry.encoding == SPARSE, filename,
+                         "unknown section encoding");
+  const std::uint64_t rowStartsSize =
+      (static_cast<std::uint64_t>(entry.rows) + 1) * sizeof(std::uint64_t);
+  ofpy3::binaryio::check(entry.size >= rowStartsSize, filename,
+                         "truncated sparse section");
+  std::vector<std::uint64_t> rowStarts(entry.rows + 1);
+  std::memcpy(rowStarts.data(), data, rowStartsSize);
+  const std::uint64_t nnz = rowStarts.back();
+  ofpy3::binaryio::check(entry.size == rowStartsSize +
+                                           nnz * sizeof(std::int32_t) +
+                                           nnz * sizeof(float),
+                         filename, "truncated sparse section");
+  const char *cols = data + rowStartsSize;
+  const char *values = cols + nnz * sizeof(std::int32_t);
+
+  std::vector<ofpy3::SparseBOW> bows(entry.rows);
+  for (int i = 0; i < entry.rows; ++i) {
+    ofpy3::binaryio::check(rowStarts[i] <= rowStarts[i + 1] &&
+                               rowStarts[i + 1] <= nnz,
+                           filename, "corrupt sparse section");
+    const std::size_t count = rowStarts[i + 1] - rowStarts[i];
+    bows[i].words.resize(count);
+    bows[i].values.resize(count);
+    std::memcpy(bows[i].words.data(),
+                cols + rowStarts[i] * sizeof(std::int32_t),
+                count * sizeof(std::int32_t));
+    std::memcpy(bows[i].values.data(), values + rowStarts[i] * sizeof(float),
+                count * sizeof(float));
+    // SparseBOW needs its words strictly ascending, as written.
+    for (std::size_t k = 0; k < count; ++k) {
+      ofpy3::binaryio::check(bows[i].words[k] >= 0 &&
+                                 bows[i].words[k] < entry.cols,
+                             filename, "sparse column out of range");
+      ofpy3::binaryio::check(k == 0 || bows[i].words[k] > bows[i].words[k - 1],
+                             filename, "sparse columns not ascending");
+    }
+  }
+  return bows;
+}
+
+void decodeIndexSection(const SectionEntry &entry, const char *data,
+                        const std::string &filename, std::string &indexFile,
+                        std::uint64_t &indexChecksum) {
+  ofpy3::binaryio::check(entry.encoding == RAW && entry.type == CV_8U &&
+                             entry.rows == 1 &&
+                             entry.cols >= (int)sizeof(indexChecksum) &&
+                             entry.size == (std::uint64_t)entry.cols,
+                         filename, "corrupt vocabulary index section");
+  std::memcpy(&indexChecksum, data, sizeof(indexChecksum));
+  indexFile.assign(data + sizeof(indexChecksum),
+                   entry.cols - sizeof(indexChecksum));
+}
+
+// Maps (or reads) the whole file, returning its bytes and their owner.
+std::shared_ptr<const void> openFile(const std::string &filename,
+                                     bool useMmap, const char *&bytes,
+                                     std::uint64_t &size) {
+#ifdef OFPY3_HAVE_MMAP
+  if (useMmap) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    ofpy3::binaryio::check(fd >= 0, filename, "cannot open model file");
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      ofpy3::binaryio::check(false, filename, "cannot stat model file");
+    }
+    size = static_cast<std::uint64_t>(info.st_size);
+    // Private, so that the matrices handed out may be written to without
+    // touching the file. Pages are still shared until they are written.
+    void *mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                          fd, 0);
+    ::close(fd);
+    ofpy3::binaryio::check(mapped != MAP_FAILED, filename,
+                           "cannot map model file");
+    bytes = static_cast<const char *>(mapped);
+    std::uint64_t mappedSize = size;
+    return std::shared_ptr<const void>(mapped, [mappedSize](const void *p) {
+      ::munmap(const_cast<void *>(p), mappedSize);
+    });
+  }
+#endif
+  std::ifstream in(filename.c_str(), std::ios::binary | std::ios::ate);
+  ofpy3::binaryio::check(in.good(), filename, "cannot open model file");
+  size = static_cast<std::uint64_t>(in.tellg());
+  in.seekg(0);
+  std::shared_ptr<std::vector<char>> buffer =
+      std::make_shared<std::vector<char>>(size);
+  in.read(buffer->data(), static_cast<std::streamsize>(size));
+  ofpy3::binaryio::check(in.good(), filename, "cannot read model file");
+  bytes = buffer->data();
+  return buffer;
+}
+
+} // namespace
+
+void ofpy3::writeModelFile(const std::string &filename,
+                           const cv::Mat &vocabulary, bool vocabularyBinary,
+                           const cv::Mat &vocabularyTreeCentres,
+                           const cv::Mat &vocabularyTreeNodes,
+                           const cv::Mat &chowLiuTree,
+                           const std::vector<SparseBOW> &trainingData,
+                           const std::string &vocabularyIndex,
+                           std::uint64_t vocabularyIndexChecksum,
+                           bool compressTrainingData) {
+  std::vector<Section> sections;
+  cv::Mat continuousVocabulary = vocabulary.isContinuous()
+                                     ? vocabulary
+                                     : vocabulary.clone();
+  cv::Mat continuousCentres = vocabularyTreeCentres.isContinuous()
+                                  ? vocabularyTreeCentres
+                                  : vocabularyTreeCentres.clone();
+  cv::Mat continuousNodes = vocabularyTreeNodes.isContinuous()
+                                ? vocabularyTreeNodes
+                                : vocabularyTreeNodes.clone();
+  cv::Mat continuousTree =
+      chowLiuTree.isContinuous() ? chowLiuTree : chowLiuTree.clone();
+  if (!continuousVocabulary.empty()) {
+    sections.push_back(rawSection(VOCABULARY, continuousVocabulary));
+    if (vocabularyBinary) {
+      sections.back().entry.reserved |= VOCABULARY_BINARY;
+    }
+  }
+  if (!continuousCentres.empty()) {
+    sections.push_back(
+        rawSection(VOCABULARY_TREE_CENTRES, continuousCentres));
+  }
+  if (!continuousNodes.empty()) {
+    sections.push_back(rawSection(VOCABULARY_TREE_NODES, continuousNodes));
+  }
+  if (!vocabularyIndex.empty()) {
+    sections.push_back(indexSection(VOCABULARY_INDEX, vocabularyIndex,
+                                    vocabularyIndexChecksum));
+  }
+  if (!continuousTree.empty()) {
+    sections.push_back(rawSection(CHOW_LIU_TREE, continuousTree));
+  }
+  if (!trainingData.empty()) {
+    sections.push_back(
+        compressTrainingData
+            ? sparseBOWSection(TRAINING_DATA, trainingData, vocabulary.rows)
+            : denseBOWSection(TRAINING_DATA, trainingData, vocabulary.rows));
+  }
+
+  // Lay out the sections after the header and section table
+  std::uint64_t offset = binaryio::alignUp(
+      sizeof(FileHeader) + sections.size() * sizeof(SectionEntry), ALIGNMENT);
+  std::vector<SectionEntry> table;
+  for (size_t i = 0; i < sections.size(); ++i) {
+    std::uint64_t checksum = binaryio::checksum(nullptr, 0);
+    sections[i].produce([&checksum](const char *data, std::size_t size) {
+      checksum = binaryio::checksum(data, size, checksum);
+    });
+    sections[i].entry.offset = offset;
+    sections[i].entry.checksum = checksum;
+    table.push_back(sections[i].entry);
+    offset = binaryio::alignUp(offset + sections[i].entry.size, ALIGNMENT);
+  }
+
+  FileHeader header;
+  std::memset(&header, 0, sizeof(FileHeader));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byteOrder = binaryio::BYTE_ORDER_MARK;
+  header.numSections = static_cast<std::uint32_t>(table.size());
+  header.sectionTableChecksum =
+      binaryio::checksum(table.data(), table.size() * sizeof(SectionEntry));
+
+  std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+  binaryio::check(out.good(), filename, "cannot open model file for writing");
+  binaryio::write(out, header);
+  for (size_t i = 0; i < table.size(); ++i) {
+    binaryio::write(out, table[i]);
+  }
+  for (size_t i = 0; i < sections.size(); ++i) {
+    binaryio::writePadding(out, ALIGNMENT);
+    sections[i].produce([&out](const char *data, std::size_t size) {
+      out.write(data, static_cast<std::streamsize>(size));
+    });
+  }
+  binaryio::check(out.good(), filename, "error writing model file");
+}
+
+ofpy3::ModelData ofpy3::readModelFile(const std::string &filename,
+                                      bool useMmap, bool verify) {
+  const char *bytes = nullptr;
+  std::uint64_t size = 0;
+  ModelData model;
+  model.storage = openFile(filename, useMmap, bytes, size);
+
+  FileHeader header;
+  binaryio::check(size >= sizeof(FileHeader), filename,
+                  "not an openfabmap_python3 model file");
+  std::memcpy(&header, bytes, sizeof(FileHeader));
+  binaryio::check(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0,
+                  filename, "not an openfabmap_python3 model file");
+  binaryio::check(header.byteOrder == binaryio::BYTE_ORDER_MARK, filename,
+                  "model file was written with a different byte order");
+  binaryio::check(header.version >= 1 && header.version <= VERSION, filename,
+                  "unsupported model file version");
+
+  const std::uint64_t tableSize =
+      static_cast<std::uint64_t>(header.numSections) * sizeof(SectionEntry);
+  binaryio::check(size >= sizeof(FileHeader) + tableSize, filename,
+                  "truncated section table");
+  const char *tableBytes = bytes + sizeof(FileHeader);
+  binaryio::check(binaryio::checksum(tableBytes, tableSize) ==
+                      header.sectionTableChecksum,
+                  filename, "section table checksum mismatch");
+
+  for (std::uint32_t i = 0; i < header.numSections; ++i) {
+    SectionEntry entry;
+    std::memcpy(&entry, tableBytes + i * sizeof(SectionEntry),
+                sizeof(SectionEntry));
+    binaryio::check(entry.offset % ALIGNMENT == 0 &&
+                        entry.offset <= size && entry.size <= size - entry.offset,
+                    filename, "section out of bounds");
+    const char *data = bytes + entry.offset;
+    if (verify) {
+      binaryio::check(binaryio::checksum(data, entry.size) == entry.checksum,
+                      filename, "section checksum mismatch");
+    }
+
+    if (entry.id == VOCABULARY) {
+      model.vocabulary =
+          decodeMatSection(entry, data, filename, {CV_32F, CV_8U});
+      // Version 1 only stored binary words as CV_8U.
+      model.vocabularyBinary = header.version >= 2
+                                   ? (entry.reserved & VOCABULARY_BINARY) != 0
+                                   : entry.type == CV_8U;
+      binaryio::check(!model.vocabularyBinary || entry.type == CV_8U,
+                      filename, "binary vocabulary is not CV_8U");
+    } else if (entry.id == VOCABULARY_TREE_CENTRES) {
+      model.vocabularyTreeCentres =
+          decodeMatSection(entry, data, filename, {CV_32F});
+    } else if (entry.id == VOCABULARY_TREE_NODES) {
+      model.vocabularyTreeNodes =
+          decodeMatSection(entry, data, filename, {CV_32S});
+    } else if (entry.id == CHOW_LIU_TREE) {
+      model.chowLiuTree = decodeMatSection(entry, data, filename, {CV_64F});
+      binaryio::check(model.chowLiuTree.rows == 4, filename,
+                      "Chow-Liu tree does not have 4 rows");
+    } else if (entry.id == TRAINING_DATA) {
+      model.trainingData = decodeBOWSection(entry, data, filename,
+                                            model.denseTrainingData);
+    } else if (entry.id == VOCABULARY_INDEX) {
+      decodeIndexSection(entry, data, filename, model.vocabularyIndex,
+                         model.vocabularyIndexChecksum);
+    }
+    // Sections from newer writers that this version does not know are skipped
+  }
+  return model;
+}
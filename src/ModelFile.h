@@ -0,0 +1,68 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include "SparseBOW.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * The parts of a trained model, as read from a binary model file. When the
+ * file is memory mapped, the matrices point into the mapping and storage
+ * keeps it alive: it must outlive every matrix (and every header onto one).
+ * The training data is always read into sparse form, and when it was stored
+ * dense the rows are kept as well, in place, for the of2 classes.
+ */
+struct ModelData {
+  cv::Mat vocabulary;
+  // Whether the vocabulary is binary words (see FabMapVocabulary)
+  bool vocabularyBinary = false;
+  // Empty unless the vocabulary is a VocabularyTree
+  cv::Mat vocabularyTreeCentres;
+  cv::Mat vocabularyTreeNodes;
+  cv::Mat chowLiuTree;
+  std::vector<SparseBOW> trainingData;
+  // Empty unless the training data was stored dense
+  cv::Mat denseTrainingData;
+  // The vocabulary's saved FLANN index, if any: its path (relative to the
+  // model file's directory) and the checksum of the index file.
+  std::string vocabularyIndex;
+  std::uint64_t vocabularyIndexChecksum = 0;
+  std::shared_ptr<const void> storage;
+};
+
+/**
+ * Writes a versioned binary model file. Each matrix is stored raw, in its
+ * own 64 byte aligned section with a checksum, so that the file can be
+ * memory mapped and used in place. The training data, which is mostly zeros,
+ * is written as dense CV_32F rows (readable by any tool) unless compressed,
+ * in which case it is stored in its sparse form. The vocabulary's index, if
+ * not empty, is recorded as in ModelData.
+ */
+void writeModelFile(const std::string &filename, const cv::Mat &vocabulary,
+                    bool vocabularyBinary,
+                    const cv::Mat &vocabularyTreeCentres,
+                    const cv::Mat &vocabularyTreeNodes,
+                    const cv::Mat &chowLiuTree,
+                    const std::vector<SparseBOW> &trainingData,
+                    const std::string &vocabularyIndex,
+                    std::uint64_t vocabularyIndexChecksum,
+                    bool compressTrainingData);
+
+/**
+ * Reads a binary model file written by writeModelFile. With useMmap the file
+ * is mapped copy-on-write, so its pages are shared between processes until
+ * written to, and raw sections are not copied. The header is always checked; with verify the section checksums
+ * are checked too, which reads the whole file.
+ */
+ModelData readModelFile(const std::string &filename, bool useMmap,
+                        bool verify);
+
+} // namespace ofpy3
+
+#endif // MODEL_FILE_H
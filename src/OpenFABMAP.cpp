@@ -0,0 +1,652 @@
+/*//////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this
+//  license. If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+// This file originates from the openFABMAP project:
+// [http://code.google.com/p/openfabmap/] -or-
+// [https://github.com/arrenglover/openfabmap]
+//
+// For published work which uses all or part of OpenFABMAP, please cite:
+// [http://ieeexplore.ieee.org/xpl/articleDetails.jsp?arnumber=6224843]
+//
+// Original Algorithm by Mark Cummins and Paul Newman:
+// [http://ijr.sagepub.com/content/27/6/647.short]
+// [http://ieeexplore.ieee.org/xpl/articleDetails.jsp?arnumber=5613942]
+// [http://ijr.sagepub.com/content/30/9/1100.abstract]
+//
+//                           License Agreement
+//
+// Copyright (C) 2012 Arren Glover [aj.glover@qut.edu.au] and
+//                    Will Maddern [w.maddern@qut.edu.au], all rights reserved.
+//
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//  * Redistribution's of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+//  * Redistribution's in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+//  * The name of the copyright holders may not be used to endorse or promote
+//    products derived from this software without specific prior written
+///   permission.
+//
+// This software is provided by the copyright holders and contributors "as is"
+// and any express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular purpose
+// are disclaimed. In no event shall the Intel Corporation or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or business
+// interruption) however caused and on any theory of liability, whether in
+// contract, strict liability,or tort (including negligence or otherwise)
+// arising in any way out of the use of this software, even if advised of the
+// possibility of such damage.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "OpenFABMAP.h"
+#include "MapLog.h"
+#include "SparseFabMap.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+template <typename T>
+T columnAt(const ofpy3::LoopClosureStore::Columns::Column<T> &column,
+           std::size_t i) {
+  return (*column.data)[column.offset + i];
+}
+
+} // namespace
+
+ofpy3::OpenFABMAP::OpenFABMAP(std::shared_ptr<ofpy3::ChowLiuTree> chowLiuTree,
+                              const Settings &settings)
+    : vocabulary(chowLiuTree->getVocabulary()), makeEngine(), fabmap(),
+      fabmapMutex(), motionModel(false), meanField(true), topK(0),
+      minLikelihood(-std::numeric_limits<double>::infinity()), results(),
+      pipelineOptions(), stats(std::make_shared<Stats>()), checkpointMutex(),
+      checkpointFile(), persistedPlaces(0), persistedQueries(0) {
+  // Build the chow liu tree, if it hasn't been already.
+  if (!chowLiuTree->isTreeBuilt()) {
+    chowLiuTree->buildChowLiuTree();
+  }
+  const Settings openFabMapOptions = settings.section("openFabMapOptions");
+
+  // create options flags
+  const std::string newPlaceMethod =
+      openFabMapOptions.get<std::string>("NewPlaceMethod", "Meanfield");
+  const std::string bayesMethod =
+      openFabMapOptions.get<std::string>("BayesMethod", "Naive");
+  const bool simpleMotionModel =
+      openFabMapOptions.get<bool>("SimpleMotion", false);
+
+  int options = 0;
+  if (newPlaceMethod == "Sampled") {
+    options |= of2::FabMap::SAMPLED;
+  } else {
+    options |= of2::FabMap::MEAN_FIELD;
+  }
+  if (bayesMethod == "ChowLiu") {
+    options |= of2::FabMap::CHOW_LIU;
+  } else {
+    options |= of2::FabMap::NAIVE_BAYES;
+  }
+  if (simpleMotionModel) {
+    options |= of2::FabMap::MOTION_MODEL;
+  }
+  motionModel = simpleMotionModel;
+
+  // create an instance of the desired type of FabMap
+  const std::string fabMapVersion =
+      openFabMapOptions.get<std::string>("FabMapVersion", "FABMAP2");
+
+  // Read common settings
+  const double PzGe = openFabMapOptions.get<double>("PzGe", 0.39);
+  const double PzGne = openFabMapOptions.get<double>("PzGne", 0.0);
+  const int numSamples = openFabMapOptions.get<int>("SimpleMotion", 3000);
+
+  // FABMAP1, FABMAPLUT and FABMAP2 run on the reference of2 implementation
+  // unless the sparse engine is asked for.
+  const std::string engine =
+      openFabMapOptions.get<std::string>("Engine", "Reference");
+  // threads scoring places on the sparse engine, 0 for all cores
+  const int threads = openFabMapOptions.get<int>("Threads", 0);
+  // training bags-of-words fixed once for the sampled new place on the
+  // sparse engine, 0 to resample them for every query
+  const int newPlaceSamples = openFabMapOptions.get<int>("NewPlaceSamples", 0);
+
+  // FABMAPLUT settings
+  int precision = 6;
+  if (fabMapVersion == "FABMAPLUT") {
+    precision = openFabMapOptions.get<int>("PzGe", precision);
+  }
+
+  // FABMAPFBO settings
+  const double rejectionThreshold =
+      openFabMapOptions.get<double>("RejectionThreshold", 1e-8);
+  const double PsGd = openFabMapOptions.get<double>("PsGd", 1e-8);
+  const int bisectionStart = openFabMapOptions.get<int>("BisectionStart", 512);
+  const int bisectionIts = openFabMapOptions.get<int>("BisectionIts", 9);
+
+  // Creates the appropriate FABMAP object, with the training data added for
+  // use with the sampling method. FABMAPFBO only has the reference
+  // implementation.
+  const int vocabSize = vocabulary->getVocabularySize();
+  makeEngine = [=](bool reference) {
+    const cv::Mat &clTree = chowLiuTree->getChowLiuTree();
+    std::unique_ptr<FabMapEngine> result;
+    if (fabMapVersion != "FABMAPFBO" && !reference) {
+      SparseFabMap::Version version = SparseFabMap::FABMAP2;
+      if (fabMapVersion == "FABMAP1") {
+        version = SparseFabMap::FABMAP1;
+      } else if (fabMapVersion == "FABMAPLUT") {
+        version = SparseFabMap::FABMAPLUT;
+      }
+      SparseFabMap *sparseFabMap = new SparseFabMap(
+          clTree, PzGe, PzGne, options, numSamples, version, precision);
+      result.reset(sparseFabMap);
+      sparseFabMap->addTraining(chowLiuTree->getTrainingBOWs());
+      sparseFabMap->setNumThreads(threads);
+      sparseFabMap->setFixedSamples(newPlaceSamples);
+    } else {
+      std::shared_ptr<of2::FabMap> of2FabMap;
+      if (fabMapVersion == "FABMAP1") {
+        of2FabMap = std::make_shared<of2::FabMap1>(clTree, PzGe, PzGne,
+                                                   options, numSamples);
+      } else if (fabMapVersion == "FABMAPLUT") {
+        of2FabMap = std::make_shared<of2::FabMapLUT>(
+            clTree, PzGe, PzGne, options, numSamples, precision);
+      } else if (fabMapVersion == "FABMAPFBO") {
+        of2FabMap = std::make_shared<of2::FabMapFBO>(
+            clTree, PzGe, PzGne, options, numSamples, rejectionThreshold,
+            PsGd, bisectionStart, bisectionIts);
+      } else { // Default to FABMAP2
+        of2FabMap =
+            std::make_shared<of2::FabMap2>(clTree, PzGe, PzGne, options);
+      }
+      Of2FabMapEngine *of2Engine = new Of2FabMapEngine(of2FabMap, vocabSize);
+      result.reset(of2Engine);
+      // Dense rows, held in the model file's storage when it has them.
+      of2Engine->addTraining(chowLiuTree->getTrainingData());
+    }
+    return result;
+  };
+  fabmap = makeEngine(engine == "Reference");
+  fabmap->setStats(stats);
+  meanField = (options & of2::FabMap::MEAN_FIELD) != 0;
+
+  // how much of the match history to keep
+  const Settings resultOptions = settings.section("ResultOptions");
+  const std::string retention =
+      resultOptions.get<std::string>("Retention", "All");
+  const int retainTopK = resultOptions.get<int>("TopK", 10);
+  const int lastN = resultOptions.get<int>("LastN", 1000);
+  results.reset(new LoopClosureStore(
+      LoopClosureStore::parseRetention(retention), retainTopK, lastN));
+
+  const Settings localizeSettings = settings.section("LocalizeOptions");
+  setTopK(localizeSettings.get<int>("TopK", topK));
+  setMinLikelihood(
+      localizeSettings.get<double>("MinLikelihood", minLikelihood));
+
+  const Settings pipelineSettings = settings.section("PipelineOptions");
+  pipelineOptions.decodeThreads =
+      pipelineSettings.get<int>("DecodeThreads", pipelineOptions.decodeThreads);
+  pipelineOptions.extractThreads = pipelineSettings.get<int>(
+      "ExtractThreads", pipelineOptions.extractThreads);
+  pipelineOptions.queueSize =
+      pipelineSettings.get<int>("QueueSize", pipelineOptions.queueSize);
+
+  const Settings statsSettings = settings.section("StatsOptions");
+  stats->setEnabled(statsSettings.get<bool>("Enabled", stats->isEnabled()));
+  if (statsSettings.get<bool>("Trace", false)) {
+    stats->setTracing(
+        true, statsSettings.get<std::size_t>("TraceCapacity", 1000000));
+  }
+}
+
+ofpy3::OpenFABMAP::~OpenFABMAP() {}
+
+void ofpy3::OpenFABMAP::addDesc(const cv::Mat &desc) {
+  SparseBOW bow = vocabulary->quantize(desc, stats.get());
+  std::unique_lock<std::shared_timed_mutex> lock(fabmapMutex);
+  fabmap->add(bow);
+}
+
+bool ofpy3::OpenFABMAP::loadAndProcessImage(const std::string &imageFile) {
+  const long frameIndex = stats->isEnabled() ? stats->nextFrame() : -1;
+  StageTimer timer(stats.get(), Stage::Frame, frameIndex);
+  cv::Mat frame;
+  {
+    StageTimer decodeTimer(stats.get(), Stage::Decode, frameIndex);
+    frame = cv::imread(imageFile, CV_LOAD_IMAGE_UNCHANGED);
+  }
+  return processImage(frame, frameIndex);
+}
+
+bool ofpy3::OpenFABMAP::processImage(const cv::Mat &frame) {
+  const long frameIndex = stats->isEnabled() ? stats->nextFrame() : -1;
+  StageTimer timer(stats.get(), Stage::Frame, frameIndex);
+  return processImage(frame, frameIndex);
+}
+
+bool ofpy3::OpenFABMAP::processImage(const cv::Mat &frame, long frameIndex) {
+  if (frame.data) {
+    SparseBOW bow =
+        vocabulary->generateSparseBOW(frame, stats.get(), frameIndex);
+    if (!bow.empty()) {
+      std::vector<of2::IMatch> matches;
+      int bestMatchIndex;
+      double bestLikelihood;
+      localize(bow, matches, true, bestMatchIndex, bestLikelihood);
+      return true;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool ofpy3::OpenFABMAP::processDesc(const cv::Mat &desc, bool addQ) {
+  const long frameIndex = stats->isEnabled() ? stats->nextFrame() : -1;
+  StageTimer timer(stats.get(), Stage::Frame, frameIndex);
+
+  SparseBOW bow = vocabulary->quantize(desc, stats.get(), frameIndex);
+
+  if (!bow.empty()) {
+    std::vector<of2::IMatch> matches;
+    int bestMatchIndex;
+    double bestLikelihood;
+    localize(bow, matches, addQ, bestMatchIndex, bestLikelihood);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+/**
+ * Quantizes and localizes a list of descriptor matrices in one call.
+ * Quantization is independent per frame and runs in parallel, localization
+ * runs in order since each frame is matched against the places added before
+ * it.
+ *
+ * @param descs (numKeypoints x descriptorSize) descriptors, one per frame.
+ * @param addQ Whether each frame is added to the map after it is localized.
+ */
+ofpy3::BatchResult
+ofpy3::OpenFABMAP::processDescsBatch(const std::vector<cv::Mat> &descs,
+                                     bool addQ) {
+  const int numFrames = static_cast<int>(descs.size());
+  std::vector<SparseBOW> bows(numFrames);
+  BatchResult batch;
+  batch.queryIdx.assign(numFrames, -1);
+  batch.bestIdx.assign(numFrames, -1);
+  batch.bestLikelihood.assign(numFrames, 0.0);
+  batch.matches.resize(numFrames);
+
+  std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < numFrames; ++i) {
+    if (descs[i].data) {
+      try {
+        bows[i] = vocabulary->quantize(descs[i], stats.get());
+      } catch (...) {
+#pragma omp critical
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  for (int i = 0; i < numFrames; ++i) {
+    if (!bows[i].empty()) {
+      batch.queryIdx[i] =
+          localize(bows[i], batch.matches[i], addQ, batch.bestIdx[i],
+                   batch.bestLikelihood[i]);
+    }
+  }
+  return batch;
+}
+
+/**
+ * Lays the matches of a batch out as a likelihood matrix.
+ *
+ * @return A (numFrames x numPlaces + 1) CV_64F matrix, the new place
+ * hypothesis in column 0 and place i in column i + 1, NaN where a place did
+ * not exist yet (or was not selected, with top_k or min_likelihood).
+ */
+cv::Mat ofpy3::denseLikelihoods(const BatchResult &batch) {
+  const int numFrames = static_cast<int>(batch.matches.size());
+  int numPlaces = 0;
+  for (const std::vector<of2::IMatch> &matches : batch.matches) {
+    for (const of2::IMatch &match : matches) {
+      numPlaces = std::max(numPlaces, match.imgIdx + 1);
+    }
+  }
+  cv::Mat likelihoods(numFrames, numPlaces + 1, CV_64F);
+  for (int i = 0; i < numFrames; ++i) {
+    for (int j = 0; j <= numPlaces; ++j) {
+      likelihoods.at<double>(i, j) = std::numeric_limits<double>::quiet_NaN();
+    }
+    for (const of2::IMatch &match : batch.matches[i]) {
+      likelihoods.at<double>(i, match.imgIdx + 1) = match.likelihood;
+    }
+  }
+  return likelihoods;
+}
+
+ofpy3::ImagePipeline::Localizer
+ofpy3::OpenFABMAP::pipelineLocalizer(bool addQ) {
+  return [this, addQ](const SparseBOW &bow, PipelineResult &result) {
+    if (bow.empty()) {
+      return;
+    }
+    std::vector<of2::IMatch> matches;
+    result.queryIdx = localize(bow, matches, addQ, result.bestIdx,
+                               result.bestLikelihood);
+    result.processed = true;
+  };
+}
+
+/**
+ * Starts localizing a stream of images in a pipeline (see ImagePipeline),
+ * configured by the PipelineOptions settings. The map must outlive it.
+ *
+ * @param source Hands out the image paths, on the pipeline's feeder thread.
+ * @param sink Called with each result, in order. If empty, results are read
+ * from the returned pipeline instead.
+ * @param addQ Whether each frame is added to the map after it is localized.
+ */
+std::shared_ptr<ofpy3::ImagePipeline>
+ofpy3::OpenFABMAP::startPipeline(ImagePipeline::Source source,
+                                 ImagePipeline::Sink sink, bool addQ) {
+  std::shared_ptr<ImagePipeline> pipeline = std::make_shared<ImagePipeline>(
+      vocabulary, pipelineLocalizer(addQ), pipelineOptions, stats);
+  pipeline->start(std::move(source), std::move(sink));
+  return pipeline;
+}
+
+const ofpy3::PipelineOptions &ofpy3::OpenFABMAP::getPipelineOptions() const {
+  return pipelineOptions;
+}
+
+std::shared_ptr<ofpy3::FabMapVocabulary>
+ofpy3::OpenFABMAP::getVocabulary() const {
+  return vocabulary;
+}
+
+/**
+ * Localizes a bag-of-words against the map and records the result. Pure
+ * queries run concurrently, while adding the query to the map (or, with the
+ * motion model, updating the prior from it) is serialized.
+ *
+ * The query is recorded under the same lock as it is localized, so query
+ * indices follow the order places are added in, and it is only added to the
+ * map once recorded, so a query that fails leaves neither behind.
+ *
+ * @return The index assigned to the query.
+ */
+int ofpy3::OpenFABMAP::localize(const SparseBOW &sparseBOW,
+                                std::vector<of2::IMatch> &matches, bool addQ,
+                                int &bestMatchIndex, double &bestLikelihood) {
+  MatchSelection selection;
+  selection.topK = topK;
+  selection.minLikelihood = minLikelihood;
+  if (addQ || motionModel) {
+    std::unique_lock<std::shared_timed_mutex> lock(fabmapMutex);
+    recordCounter(stats.get(), Counter::PlacesScored, fabmap->numPlaces());
+    {
+      StageTimer timer(stats.get(), Stage::Localize);
+      fabmap->localize(sparseBOW, matches, false, selection);
+    }
+    const int queryIndex =
+        results->record(matches, bestMatchIndex, bestLikelihood);
+    if (addQ) {
+      fabmap->add(sparseBOW);
+    }
+    return queryIndex;
+  } else {
+    std::shared_lock<std::shared_timed_mutex> lock(fabmapMutex);
+    recordCounter(stats.get(), Counter::PlacesScored, fabmap->numPlaces());
+    {
+      StageTimer timer(stats.get(), Stage::Localize);
+      fabmap->localize(sparseBOW, matches, false, selection);
+    }
+    return results->record(matches, bestMatchIndex, bestLikelihood);
+  }
+}
+
+int ofpy3::OpenFABMAP::getLastMatch() const { return results->getLastMatch(); }
+
+// The result history so far, see LoopClosureStore::Columns.
+ofpy3::LoopClosureStore::Columns ofpy3::OpenFABMAP::getResults() const {
+  return results->getColumns();
+}
+
+/**
+ * Drops the result history. The next checkpoint then starts its file afresh,
+ * since the query indices start over.
+ */
+void ofpy3::OpenFABMAP::clearResults() {
+  std::lock_guard<std::mutex> lock(checkpointMutex);
+  results->clear();
+  checkpointFile.clear();
+  persistedPlaces = 0;
+  persistedQueries = 0;
+}
+
+/**
+ * Checks the sparse engine against the reference of2 implementation: both
+ * are built afresh from the model, given the places of this map, and asked
+ * to localize the frames (without adding them). The map itself is left
+ * untouched. The sampled new place is random and left out of the comparison.
+ * Raises for FABMAPFBO, which has no sparse engine to check.
+ *
+ * @param descs (numKeypoints x descriptorSize) descriptors, one per frame.
+ * @return The number of queries and likelihoods compared, and the maximum
+ * and mean absolute error of the log likelihoods.
+ */
+ofpy3::EngineValidation
+ofpy3::OpenFABMAP::validateEngine(const std::vector<cv::Mat> &descs) {
+  EngineValidation report;
+  double sumError = 0.0;
+  std::unique_ptr<FabMapEngine> engine = makeEngine(false);
+  if (!dynamic_cast<SparseFabMap *>(engine.get())) {
+    CV_Error(CV_StsBadArg, "validateEngine: this FabMapVersion only has the "
+                           "reference engine, there is nothing to compare");
+  }
+  std::unique_ptr<FabMapEngine> reference = makeEngine(true);
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(fabmapMutex);
+    for (std::size_t i = 0; i < fabmap->numPlaces(); ++i) {
+      const SparseBOW bow = fabmap->getPlace(i);
+      engine->add(bow);
+      reference->add(bow);
+    }
+  }
+
+  std::vector<of2::IMatch> matches, referenceMatches;
+  for (const cv::Mat &desc : descs) {
+    if (!desc.data) {
+      continue;
+    }
+    const SparseBOW bow = vocabulary->quantize(desc);
+    if (bow.empty()) {
+      continue;
+    }
+    engine->localize(bow, matches, false, MatchSelection());
+    reference->localize(bow, referenceMatches, false, MatchSelection());
+    CV_Assert(matches.size() == referenceMatches.size());
+    for (std::size_t i = 0; i < matches.size(); ++i) {
+      CV_Assert(matches[i].imgIdx == referenceMatches[i].imgIdx);
+      if (matches[i].imgIdx == -1 && !meanField) {
+        continue;
+      }
+      const double error =
+          std::abs(matches[i].likelihood - referenceMatches[i].likelihood);
+      report.maxAbsError = std::max(report.maxAbsError, error);
+      sumError += error;
+      ++report.likelihoods;
+    }
+    ++report.queries;
+  }
+
+  if (report.likelihoods > 0) {
+    report.meanAbsError = sumError / report.likelihoods;
+  }
+  return report;
+}
+
+int ofpy3::OpenFABMAP::getTopK() const { return topK; }
+
+/**
+ * Keeps only the topK most likely matches (the new place included) of each
+ * query, 0 to keep them all. The rest are never handed out or recorded, and
+ * on the sparse engine never normalised either.
+ */
+void ofpy3::OpenFABMAP::setTopK(int topK) { this->topK = std::max(0, topK); }
+
+double ofpy3::OpenFABMAP::getMinLikelihood() const { return minLikelihood; }
+
+/**
+ * Keeps only the matches of each query with at least this (log) likelihood,
+ * -infinity to keep them all. Applies together with topK.
+ */
+void ofpy3::OpenFABMAP::setMinLikelihood(double minLikelihood) {
+  this->minLikelihood = minLikelihood;
+}
+
+std::shared_ptr<ofpy3::Stats> ofpy3::OpenFABMAP::getStats() const {
+  return stats;
+}
+
+// The current size of the place map.
+std::size_t ofpy3::OpenFABMAP::getMapBytes() {
+  std::shared_lock<std::shared_timed_mutex> lock(fabmapMutex);
+  return fabmap->memoryBytes();
+}
+
+/**
+ * Writes a snapshot of the place map: every place added to FabMap and the
+ * retained result history. Later checkpointMap calls on the same file append
+ * to it.
+ */
+void ofpy3::OpenFABMAP::saveMap(const std::string &filename) {
+  std::lock_guard<std::mutex> lock(checkpointMutex);
+  persistedPlaces = 0;
+  persistedQueries = 0;
+  writeMapLog(filename, true);
+}
+
+/**
+ * Appends the places and results since the last checkpoint (or saveMap, or
+ * loadMap) of this file. Checkpointing to a different file starts it afresh
+ * with a full snapshot.
+ */
+void ofpy3::OpenFABMAP::checkpointMap(const std::string &filename) {
+  std::lock_guard<std::mutex> lock(checkpointMutex);
+  const bool fresh = filename != checkpointFile;
+  if (fresh) {
+    persistedPlaces = 0;
+    persistedQueries = 0;
+  }
+  writeMapLog(filename, fresh);
+}
+
+/**
+ * Restores a place map written by saveMap/checkpointMap into this (empty)
+ * map. Places are re-added to FabMap, which rebuilds any inverted index it
+ * keeps (as FABMAP2 does), and the result history is restored. The motion
+ * model prior is not saved and starts afresh.
+ */
+void ofpy3::OpenFABMAP::loadMap(const std::string &filename) {
+  std::lock_guard<std::mutex> checkpointLock(checkpointMutex);
+  std::unique_lock<std::shared_timed_mutex> lock(fabmapMutex);
+  CV_Assert(fabmap->numPlaces() == 0 &&
+            results->getNumQueries() == 0);
+
+  std::uint64_t validEnd = ofpy3::readMapLog(
+      filename, vocabulary->getVocabulary().rows,
+      [this](int placeIndex, const SparseBOW &bow) {
+        CV_Assert(placeIndex == (int)fabmap->numPlaces());
+        fabmap->add(bow);
+      },
+      [this](int queryIndex, int bestMatchIndex, double bestLikelihood,
+             const std::vector<of2::IMatch> &matches) {
+        results->restore(queryIndex, bestMatchIndex, bestLikelihood, matches);
+      });
+
+  // Resume checkpointing where the log left off, dropping any record a crash
+  // left half written.
+  ofpy3::truncateMapLog(filename, validEnd);
+  checkpointFile = filename;
+  persistedPlaces = fabmap->numPlaces();
+  persistedQueries = results->getNumQueries();
+}
+
+// Must be called with checkpointMutex held. What has been persisted only
+// advances once the writes are flushed. If they fail, the next checkpoint
+// starts the file afresh rather than appending after a partial record.
+void ofpy3::OpenFABMAP::writeMapLog(const std::string &filename,
+                                    bool truncate) {
+  checkpointFile.clear();
+  ofpy3::MapLogWriter writer(filename, vocabulary->getVocabulary().rows,
+                             truncate);
+  std::size_t writtenPlaces = persistedPlaces;
+  int writtenQueries = persistedQueries;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(fabmapMutex);
+    const std::size_t numPlaces = fabmap->numPlaces();
+    for (std::size_t i = persistedPlaces; i < numPlaces; ++i) {
+      writer.writePlace((int)i, fabmap->getPlace(i));
+    }
+    writtenPlaces = numPlaces;
+  }
+
+  // A query's matches are contiguous and in query order, walk both together.
+  LoopClosureStore::Columns columns = results->getColumns();
+  std::size_t match = 0;
+  std::vector<of2::IMatch> matches;
+  for (std::size_t i = 0; i < columns.queryIdx.size; ++i) {
+    const int queryIndex = columnAt(columns.queryIdx, i);
+    while (match < columns.matchQueryIdx.size &&
+           columnAt(columns.matchQueryIdx, match) < queryIndex) {
+      ++match;
+    }
+    if (queryIndex < persistedQueries) {
+      continue;
+    }
+    matches.clear();
+    for (; match < columns.matchQueryIdx.size &&
+           columnAt(columns.matchQueryIdx, match) == queryIndex;
+         ++match) {
+      of2::IMatch imatch;
+      imatch.queryIdx = queryIndex;
+      imatch.imgIdx = columnAt(columns.matchImgIdx, match);
+      imatch.likelihood = columnAt(columns.matchLikelihood, match);
+      matches.push_back(imatch);
+    }
+    writer.writeQuery(queryIndex, columnAt(columns.bestIdx, i),
+                      columnAt(columns.bestLikelihood, i), matches);
+    writtenQueries = queryIndex + 1;
+  }
+  writer.flush();
+  persistedPlaces = writtenPlaces;
+  persistedQueries = writtenQueries;
+  checkpointFile = filename;
+}
@@ -0,0 +1,130 @@
+#ifndef OPEN_FABMAP_H
+#define OPEN_FABMAP_H
+
+#include "ChowLiuTree.h"
+#include "FabMapEngine.h"
+#include "FabMapVocabulary.h"
+#include "ImagePipeline.h"
+#include "LoopClosureStore.h"
+#include "Settings.h"
+#include "Stats.h"
+#include <atomic>
+#include <fabmap.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace ofpy3 {
+
+// The results of processDescsBatch, one entry per input frame.
+struct BatchResult {
+  // -1 for frames without descriptors.
+  std::vector<int> queryIdx;
+  std::vector<int> bestIdx;
+  std::vector<double> bestLikelihood;
+  // The matches each frame kept, see MatchSelection.
+  std::vector<std::vector<of2::IMatch>> matches;
+};
+
+cv::Mat denseLikelihoods(const BatchResult &batch);
+
+// How closely the engine in use agrees with the reference of2 one.
+struct EngineValidation {
+  int queries = 0;
+  std::size_t likelihoods = 0;
+  double maxAbsError = 0.0;
+  double meanAbsError = 0.0;
+};
+
+/**
+ * A FAB-MAP place map with its localization results, built from a trained
+ * ChowLiuTree and the openFabMapOptions, ResultOptions, LocalizeOptions,
+ * PipelineOptions and StatsOptions settings.
+ *
+ * Safe to use from several threads: queries that leave the map untouched run
+ * concurrently, anything adding a place is serialized.
+ */
+class OpenFABMAP {
+public:
+  OpenFABMAP(std::shared_ptr<ChowLiuTree> chowLiuTree,
+             const Settings &settings = Settings());
+  virtual ~OpenFABMAP();
+  OpenFABMAP(const OpenFABMAP &) = delete;
+  OpenFABMAP &operator=(const OpenFABMAP &) = delete;
+
+  void addDesc(const cv::Mat &desc);
+
+  bool loadAndProcessImage(const std::string &imageFile);
+  bool processImage(const cv::Mat &frame);
+  bool processDesc(const cv::Mat &desc, bool addQ);
+  BatchResult processDescsBatch(const std::vector<cv::Mat> &descs, bool addQ);
+
+  // Localizes the frames of an ImagePipeline, recording their results.
+  ImagePipeline::Localizer pipelineLocalizer(bool addQ);
+  std::shared_ptr<ImagePipeline> startPipeline(ImagePipeline::Source source,
+                                               ImagePipeline::Sink sink,
+                                               bool addQ);
+  const PipelineOptions &getPipelineOptions() const;
+  std::shared_ptr<FabMapVocabulary> getVocabulary() const;
+
+  int getLastMatch() const;
+  LoopClosureStore::Columns getResults() const;
+  void clearResults();
+  EngineValidation validateEngine(const std::vector<cv::Mat> &descs);
+
+  int getTopK() const;
+  void setTopK(int topK);
+  // -infinity when every likelihood is kept.
+  double getMinLikelihood() const;
+  void setMinLikelihood(double minLikelihood);
+
+  std::shared_ptr<Stats> getStats() const;
+  std::size_t getMapBytes();
+
+  void saveMap(const std::string &filename);
+  void checkpointMap(const std::string &filename);
+  void loadMap(const std::string &filename);
+
+private:
+  bool processImage(const cv::Mat &frame, long frameIndex);
+  int localize(const SparseBOW &sparseBOW, std::vector<of2::IMatch> &matches,
+               bool addQ, int &bestMatchIndex, double &bestLikelihood);
+  void writeMapLog(const std::string &filename, bool truncate);
+
+private:
+  std::shared_ptr<FabMapVocabulary> vocabulary;
+  // Builds a FAB-MAP engine from the model, the reference of2 one if asked.
+  std::function<std::unique_ptr<FabMapEngine>(bool reference)> makeEngine;
+  std::unique_ptr<FabMapEngine> fabmap;
+
+  // Guards fabmap. Queries that leave the map untouched share it, anything
+  // that adds a place (or updates the motion model prior) takes it
+  // exclusively.
+  std::shared_timed_mutex fabmapMutex;
+  bool motionModel;
+  bool meanField;
+
+  // The matches each query keeps, see MatchSelection.
+  std::atomic<int> topK;
+  std::atomic<double> minLikelihood;
+
+  std::unique_ptr<LoopClosureStore> results;
+
+  PipelineOptions pipelineOptions;
+
+  // Stage timings and counters, off unless enabled.
+  std::shared_ptr<Stats> stats;
+
+  // What has been written to checkpointFile so far.
+  std::mutex checkpointMutex;
+  std::string checkpointFile;
+  std::size_t persistedPlaces;
+  int persistedQueries;
+};
+
+} // namespace ofpy3
+
+#endif // OPEN_FABMAP_H
@@ -1,6 +1,7 @@
 #include "ChowLiuTree.h"
 #include "FabMapVocabulary.h"
 #include "openFABMAPPython.h"
+#include <opencv2/core/core.hpp>
 
 #include <pybind11/chrono.h>
 #include <pybind11/functional.h>
@@ -13,34 +14,126 @@ PYBIND11_MODULE(openfabmap_python3, m) {
   PyEval_InitThreads();
 
   pybind11::class_<ofpy3::FabMapVocabulary,
-                   std::shared_ptr<ofpy3::FabMapVocabulary>>(m, "Vocabulary");
+                   std::shared_ptr<ofpy3::FabMapVocabulary>>(m, "Vocabulary")
+      .def_property("tree_search_width",
+                    &ofpy3::FabMapVocabulary::getTreeSearchWidth,
+                    &ofpy3::FabMapVocabulary::setTreeSearchWidth)
+      .def("set_exact_search", &ofpy3::FabMapVocabulary::setExactSearch,
+           pybind11::arg("exact"), pybind11::arg("kernel") = "Auto")
+      .def_property_readonly("exact_kernel",
+                             &ofpy3::FabMapVocabulary::getExactKernel);
 
   pybind11::class_<ofpy3::FabMapVocabularyBuilder,
                    std::shared_ptr<ofpy3::FabMapVocabularyBuilder>>(
       m, "VocabularyBuilder")
-      .def(pybind11::init<pybind11::dict>())
+      .def(pybind11::init([](pybind11::dict settings) {
+        return std::make_shared<ofpy3::FabMapVocabularyBuilder>(
+            ofpy3::toSettings(settings));
+      }))
       .def("init_detector_extractor",
-           &ofpy3::FabMapVocabularyBuilder::initDetectorExtractor)
+           [](ofpy3::FabMapVocabularyBuilder &builder,
+              pybind11::dict settings) {
+             builder.initDetectorExtractor(ofpy3::toSettings(settings));
+           })
       .def("add_training_image",
-           &ofpy3::FabMapVocabularyBuilder::addTrainingImage)
+           [](ofpy3::FabMapVocabularyBuilder &builder,
+              const pybind11::array_t<uchar> &frame) {
+             cv::Mat mat = ofpy3::toMat(frame);
+             pybind11::gil_scoped_release release;
+             return builder.addTrainingImage(mat);
+           })
       .def("load_and_add_training_image",
-           &ofpy3::FabMapVocabularyBuilder::loadAndAddTrainingImage)
+           &ofpy3::FabMapVocabularyBuilder::loadAndAddTrainingImage,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
       .def("add_training_descs",
-           &ofpy3::FabMapVocabularyBuilder::addTrainingDescs)
+           [](ofpy3::FabMapVocabularyBuilder &builder,
+              const pybind11::array_t<uchar> &descs) {
+             cv::Mat mat = ofpy3::toMat(descs);
+             pybind11::gil_scoped_release release;
+             builder.addTrainingDescs(mat);
+           })
+      .def("reserve", &ofpy3::FabMapVocabularyBuilder::reserve,
+           pybind11::arg("num_descriptors"))
       .def("build_vocabulary",
-           &ofpy3::FabMapVocabularyBuilder::buildVocabulary);
+           &ofpy3::FabMapVocabularyBuilder::buildVocabulary,
+           pybind11::call_guard<pybind11::gil_scoped_release>());
 
   pybind11::class_<ofpy3::ChowLiuTree, std::shared_ptr<ofpy3::ChowLiuTree>>(
       m, "ChowLiuTree")
-      .def(pybind11::init<std::shared_ptr<ofpy3::FabMapVocabulary>,
-                          pybind11::dict>())
-      .def("add_training_image", &ofpy3::ChowLiuTree::addTrainingImage)
-      .def("add_training_desc", &ofpy3::ChowLiuTree::addTrainingDesc)
+      .def(pybind11::init([](std::shared_ptr<ofpy3::FabMapVocabulary> vocab,
+                             pybind11::dict settings) {
+        return std::make_shared<ofpy3::ChowLiuTree>(
+            vocab, ofpy3::toSettings(settings));
+      }))
+      .def("add_training_image",
+           [](ofpy3::ChowLiuTree &tree,
+              const pybind11::array_t<uchar> &frame) {
+             cv::Mat mat = ofpy3::toMat(frame);
+             pybind11::gil_scoped_release release;
+             return tree.addTrainingImage(mat);
+           })
+      .def("add_training_desc",
+           [](ofpy3::ChowLiuTree &tree, const pybind11::array_t<float> &desc) {
+             cv::Mat mat = ofpy3::toMat(desc);
+             pybind11::gil_scoped_release release;
+             return tree.addTrainingDesc(mat);
+           })
+      .def("add_training_descs_batch",
+           [](ofpy3::ChowLiuTree &tree, const pybind11::list &descs) {
+             const std::vector<cv::Mat> mats = ofpy3::toMats(descs);
+             pybind11::gil_scoped_release release;
+             return tree.addTrainingDescsBatch(mats);
+           },
+           pybind11::arg("descs"))
+      .def("reserve", &ofpy3::ChowLiuTree::reserve,
+           pybind11::arg("num_frames"))
       .def("load_and_add_training_image",
-           &ofpy3::ChowLiuTree::loadAndAddTrainingImage)
-      .def("build_chow_liu_tree", &ofpy3::ChowLiuTree::buildChowLiuTree)
-      .def("save", &ofpy3::ChowLiuTree::save)
-      .def("load", &ofpy3::ChowLiuTree::load);
+           &ofpy3::ChowLiuTree::loadAndAddTrainingImage,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("load_and_add_training_images",
+           &ofpy3::ChowLiuTree::loadAndAddTrainingImages,
+           pybind11::arg("paths"),
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("build_chow_liu_tree", &ofpy3::ChowLiuTree::buildChowLiuTree,
+           pybind11::arg("progress") = ofpy3::ChowLiuProgress(),
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("save", &ofpy3::ChowLiuTree::save,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def_static("load",
+                  [](pybind11::dict settings, std::string filename) {
+                    const ofpy3::Settings options =
+                        ofpy3::toSettings(settings);
+                    pybind11::gil_scoped_release release;
+                    return ofpy3::ChowLiuTree::load(options, filename);
+                  })
+      .def("save_binary", &ofpy3::ChowLiuTree::saveBinary,
+           pybind11::arg("filename"), pybind11::arg("compress") = false,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def_static("load_binary",
+                  [](pybind11::dict settings, std::string filename,
+                     bool useMmap, bool verify) {
+                    const ofpy3::Settings options =
+                        ofpy3::toSettings(settings);
+                    pybind11::gil_scoped_release release;
+                    return ofpy3::ChowLiuTree::loadBinary(options, filename,
+                                                          useMmap, verify);
+                  },
+                  pybind11::arg("settings"), pybind11::arg("filename"),
+                  pybind11::arg("mmap") = true, pybind11::arg("verify") = false);
+
+  pybind11::class_<ofpy3::PythonImagePipeline,
+                   std::shared_ptr<ofpy3::PythonImagePipeline>>(m,
+                                                               "ImagePipeline")
+      .def("next_result", &ofpy3::PythonImagePipeline::nextResult,
+           pybind11::arg("timeout") = pybind11::none())
+      .def_property_readonly("finished",
+                             &ofpy3::PythonImagePipeline::finished)
+      .def("wait", &ofpy3::PythonImagePipeline::wait)
+      .def("cancel", &ofpy3::PythonImagePipeline::cancel,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("__iter__",
+           [](pybind11::object self) { return self; })
+      .def("__next__", &ofpy3::PythonImagePipeline::next);
 
   pybind11::class_<ofpy3::OpenFABMAPPython,
                    std::shared_ptr<ofpy3::OpenFABMAPPython>>(m, "OpenFABMAP")
@@ -50,10 +143,41 @@ PYBIND11_MODULE(openfabmap_python3, m) {
            &ofpy3::OpenFABMAPPython::loadAndProcessImage)
       .def("process_image", &ofpy3::OpenFABMAPPython::ProcessImage)
       .def("process_desc", &ofpy3::OpenFABMAPPython::ProcessDesc)
+      .def("process_descs_batch", &ofpy3::OpenFABMAPPython::ProcessDescsBatch,
+           pybind11::arg("descs"), pybind11::arg("add") = true,
+           pybind11::arg("dense") = false)
+      .def("start_pipeline", &ofpy3::OpenFABMAPPython::startPipeline,
+           pybind11::arg("source"), pybind11::arg("callback") = pybind11::none(),
+           pybind11::arg("add") = true, pybind11::keep_alive<0, 1>())
       .def("add_desc", &ofpy3::OpenFABMAPPython::addDesc)
       .def("get_last_match", &ofpy3::OpenFABMAPPython::getLastMatch)
       .def("get_best_loop_closures",
            &ofpy3::OpenFABMAPPython::getBestLoopClosures)
       .def("get_all_loop_closures",
-           &ofpy3::OpenFABMAPPython::getAllLoopClosures);
+           &ofpy3::OpenFABMAPPython::getAllLoopClosures)
+      .def("get_results", &ofpy3::OpenFABMAPPython::getResults)
+      .def("clear_results", &ofpy3::OpenFABMAPPython::clearResults)
+      .def("validate_engine", &ofpy3::OpenFABMAPPython::validateEngine,
+           pybind11::arg("descs"))
+      .def_property("top_k", &ofpy3::OpenFABMAPPython::getTopK,
+                    &ofpy3::OpenFABMAPPython::setTopK)
+      .def_property("min_likelihood",
+                    &ofpy3::OpenFABMAPPython::getMinLikelihood,
+                    &ofpy3::OpenFABMAPPython::setMinLikelihood)
+      .def("get_stats", &ofpy3::OpenFABMAPPython::getStats)
+      .def("reset_stats", &ofpy3::OpenFABMAPPython::resetStats)
+      .def_property("stats_enabled",
+                    &ofpy3::OpenFABMAPPython::getStatsEnabled,
+                    &ofpy3::OpenFABMAPPython::setStatsEnabled)
+      .def("start_trace", &ofpy3::OpenFABMAPPython::startTrace,
+           pybind11::arg("capacity") = 1000000)
+      .def("stop_trace", &ofpy3::OpenFABMAPPython::stopTrace)
+      .def("save_trace", &ofpy3::OpenFABMAPPython::saveTrace,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("save_map", &ofpy3::OpenFABMAPPython::saveMap,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("checkpoint_map", &ofpy3::OpenFABMAPPython::checkpointMap,
+           pybind11::call_guard<pybind11::gil_scoped_release>())
+      .def("load_map", &ofpy3::OpenFABMAPPython::loadMap,
+           pybind11::call_guard<pybind11::gil_scoped_release>());
 }
\ No newline at end of file
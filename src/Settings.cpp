@@ -0,0 +1,160 @@
+#include "Settings.h"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+void typeError(const std::string &key, const char *expected) {
+  CV_Error(CV_StsBadArg,
+           "setting \"" + key + "\" should be " + std::string(expected));
+}
+
+} // namespace
+
+bool ofpy3::Settings::contains(const std::string &key) const {
+  return values.count(key) > 0;
+}
+
+ofpy3::Settings ofpy3::Settings::section(const std::string &key) const {
+  std::map<std::string, Value>::const_iterator it = values.find(key);
+  if (it == values.end()) {
+    return Settings();
+  }
+  if (it->second.type == Value::UNSUPPORTED) {
+    unsupportedError(key, it->second);
+  }
+  if (it->second.type != Value::SECTION) {
+    typeError(key, "a section");
+  }
+  return *it->second.section;
+}
+
+void ofpy3::Settings::set(const std::string &key, bool value) {
+  Value entry;
+  entry.type = Value::BOOL;
+  entry.boolean = value;
+  values[key] = entry;
+}
+
+void ofpy3::Settings::set(const std::string &key, std::int64_t value) {
+  Value entry;
+  entry.type = Value::INTEGER;
+  entry.integer = value;
+  values[key] = entry;
+}
+
+void ofpy3::Settings::set(const std::string &key, double value) {
+  Value entry;
+  entry.type = Value::REAL;
+  entry.real = value;
+  values[key] = entry;
+}
+
+void ofpy3::Settings::set(const std::string &key, const std::string &value) {
+  Value entry;
+  entry.type = Value::STRING;
+  entry.string = value;
+  values[key] = entry;
+}
+
+void ofpy3::Settings::set(const std::string &key, const Settings &section) {
+  Value entry;
+  entry.type = Value::SECTION;
+  entry.section = std::make_shared<const Settings>(section);
+  values[key] = entry;
+}
+
+void ofpy3::Settings::setUnsupported(const std::string &key,
+                                     const std::string &typeName) {
+  Value entry;
+  entry.type = Value::UNSUPPORTED;
+  entry.string = typeName;
+  values[key] = entry;
+}
+
+void ofpy3::Settings::unsupportedError(const std::string &key,
+                                       const Value &value) {
+  CV_Error(CV_StsBadArg, "setting \"" + key + "\" is a " + value.string +
+                             ", it should be a bool, number, string or dict");
+}
+
+// Booleans, and (as Python's bool is an int) the integers 0 and 1.
+void ofpy3::Settings::convert(const std::string &key, const Value &value,
+                              bool &out) {
+  if (value.type == Value::BOOL) {
+    out = value.boolean;
+    return;
+  }
+  if (value.type == Value::INTEGER &&
+      (value.integer == 0 || value.integer == 1)) {
+    out = value.integer == 1;
+    return;
+  }
+  if (value.type == Value::STRING) {
+    std::string lower = value.string;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower == "true" || lower == "false") {
+      out = lower == "true";
+      return;
+    }
+  }
+  typeError(key, "a boolean");
+}
+
+void ofpy3::Settings::convert(const std::string &key, const Value &value,
+                              double &out) {
+  if (value.type == Value::REAL) {
+    out = value.real;
+  } else if (value.type == Value::INTEGER) {
+    out = static_cast<double>(value.integer);
+  } else if (value.type == Value::BOOL) {
+    out = value.boolean ? 1.0 : 0.0;
+  } else {
+    typeError(key, "a number");
+  }
+}
+
+void ofpy3::Settings::convert(const std::string &key, const Value &value,
+                              std::string &out) {
+  if (value.type != Value::STRING) {
+    typeError(key, "a string");
+  }
+  out = value.string;
+}
+
+void ofpy3::Settings::convert(const std::string &key, const Value &value,
+                              std::int64_t &out) {
+  if (value.type == Value::INTEGER) {
+    out = value.integer;
+  } else if (value.type == Value::BOOL) {
+    out = value.boolean ? 1 : 0;
+  } else {
+    typeError(key, "an integer");
+  }
+}
+
+ofpy3::Settings ofpy3::Settings::load(const std::string &filename) {
+  cv::FileStorage fs(filename, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    CV_Error(CV_StsError, filename + ": cannot open settings file");
+  }
+  return fromFileNode(fs.root());
+}
+
+ofpy3::Settings ofpy3::Settings::fromFileNode(const cv::FileNode &node) {
+  Settings settings;
+  for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it) {
+    const cv::FileNode child = *it;
+    const std::string key = child.name();
+    if (child.isMap()) {
+      settings.set(key, fromFileNode(child));
+    } else if (child.isInt()) {
+      settings.set(key, static_cast<std::int64_t>((int)child));
+    } else if (child.isReal()) {
+      settings.set(key, (double)child);
+    } else if (child.isString()) {
+      settings.set(key, (std::string)child);
+    }
+  }
+  return settings;
+}
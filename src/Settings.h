@@ -0,0 +1,98 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * The settings of every class, laid out as the Python settings dict is:
+ * sections ("openFabMapOptions", "FeatureOptions", ...) of typed values
+ * (bool, integer, real or string) and nested sections. Built from a Python
+ * dict by the bindings, or read from a YAML, JSON or XML file.
+ *
+ * get returns the default for absent keys and throws (cv::Exception) for a
+ * value of the wrong type, as casting the Python object did. Values of
+ * other Python types (lists, tuples, ...) are kept as unsupported, and throw
+ * only when read, so a dict may carry keys that nothing reads.
+ */
+class Settings {
+public:
+  Settings() = default;
+
+  bool contains(const std::string &key) const;
+  // The nested section under key, empty if there is none.
+  Settings section(const std::string &key) const;
+
+  template <typename T> T get(const std::string &key, T defaultValue) const {
+    std::map<std::string, Value>::const_iterator it = values.find(key);
+    if (it == values.end()) {
+      return defaultValue;
+    }
+    if (it->second.type == Value::UNSUPPORTED) {
+      unsupportedError(key, it->second);
+    }
+    T value;
+    convert(key, it->second, value);
+    return value;
+  }
+
+  void set(const std::string &key, bool value);
+  void set(const std::string &key, std::int64_t value);
+  void set(const std::string &key, int value) {
+    set(key, static_cast<std::int64_t>(value));
+  }
+  void set(const std::string &key, double value);
+  void set(const std::string &key, const std::string &value);
+  void set(const std::string &key, const char *value) {
+    set(key, std::string(value));
+  }
+  void set(const std::string &key, const Settings &section);
+  // A value of a type get cannot read, typeName being its Python type.
+  void setUnsupported(const std::string &key, const std::string &typeName);
+
+  // Reads the top level map of a cv::FileStorage file. YAML has no booleans
+  // there, so "true" and "false" strings are read as such by get<bool>.
+  static Settings load(const std::string &filename);
+  static Settings fromFileNode(const cv::FileNode &node);
+
+private:
+  struct Value {
+    enum Type { BOOL, INTEGER, REAL, STRING, SECTION, UNSUPPORTED };
+    Type type = INTEGER;
+    bool boolean = false;
+    std::int64_t integer = 0;
+    double real = 0.0;
+    // The text, or the type name of an unsupported value.
+    std::string string;
+    std::shared_ptr<const Settings> section;
+  };
+
+  static void unsupportedError(const std::string &key, const Value &value);
+  static void convert(const std::string &key, const Value &value, bool &out);
+  static void convert(const std::string &key, const Value &value,
+                      double &out);
+  static void convert(const std::string &key, const Value &value,
+                      std::string &out);
+  static void convert(const std::string &key, const Value &value,
+                      std::int64_t &out);
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value>::type
+  convert(const std::string &key, const Value &value, T &out) {
+    std::int64_t integer;
+    convert(key, value, integer);
+    out = static_cast<T>(integer);
+  }
+
+  std::map<std::string, Value> values;
+};
+
+} // namespace ofpy3
+
+#endif // SETTINGS_H
@@ -0,0 +1,76 @@
+#include "SparseBOW.h"
+#include <algorithm>
+
+// ----------------- SparseBOW -----------------
+
+void ofpy3::SparseBOW::mark(std::vector<char> &observed) const {
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    observed[words[i]] = 1;
+  }
+}
+
+cv::Mat ofpy3::SparseBOW::toDense(int vocabSize) const {
+  cv::Mat bow = cv::Mat::zeros(1, vocabSize, CV_32F);
+  float *dptr = bow.ptr<float>();
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    CV_Assert(words[i] >= 0 && words[i] < vocabSize);
+    dptr[words[i]] = values[i];
+  }
+  return bow;
+}
+
+ofpy3::SparseBOW ofpy3::SparseBOW::fromDense(const cv::Mat &bow) {
+  CV_Assert(bow.rows == 1 && bow.type() == CV_32F);
+  SparseBOW sparse;
+  const float *dptr = bow.ptr<float>();
+  for (int q = 0; q < bow.cols; ++q) {
+    if (dptr[q] != 0.f) {
+      sparse.words.push_back(q);
+      sparse.values.push_back(dptr[q]);
+    }
+  }
+  return sparse;
+}
+
+ofpy3::SparseBOW
+ofpy3::SparseBOW::fromNearestWords(std::vector<int> nearestWords) {
+  SparseBOW sparse;
+  if (nearestWords.empty()) {
+    return sparse;
+  }
+  // Normalize the counts by the number of descriptors, dividing as the dense
+  // rows did so that the values are the same to the bit.
+  const float numDescriptors = static_cast<float>(nearestWords.size());
+  std::sort(nearestWords.begin(), nearestWords.end());
+  for (std::size_t i = 0; i < nearestWords.size();) {
+    std::size_t j = i;
+    while (j < nearestWords.size() && nearestWords[j] == nearestWords[i]) {
+      ++j;
+    }
+    sparse.words.push_back(nearestWords[i]);
+    sparse.values.push_back(static_cast<float>(j - i) / numDescriptors);
+    i = j;
+  }
+  return sparse;
+}
+
+cv::Mat ofpy3::toDense(const std::vector<SparseBOW> &bows, int vocabSize) {
+  cv::Mat dense = cv::Mat::zeros((int)bows.size(), vocabSize, CV_32F);
+  for (std::size_t i = 0; i < bows.size(); ++i) {
+    float *dptr = dense.ptr<float>((int)i);
+    for (std::size_t k = 0; k < bows[i].words.size(); ++k) {
+      CV_Assert(bows[i].words[k] >= 0 && bows[i].words[k] < vocabSize);
+      dptr[bows[i].words[k]] = bows[i].values[k];
+    }
+  }
+  return dense;
+}
+
+std::vector<ofpy3::SparseBOW> ofpy3::fromDense(const cv::Mat &bows) {
+  std::vector<SparseBOW> sparse;
+  sparse.reserve(bows.rows);
+  for (int i = 0; i < bows.rows; ++i) {
+    sparse.push_back(SparseBOW::fromDense(bows.row(i)));
+  }
+  return sparse;
+}
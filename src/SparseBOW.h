@@ -0,0 +1,41 @@
+#ifndef SPARSE_BOW_H
+#define SPARSE_BOW_H
+
+#include <cstddef>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * A bag-of-words as the ids of the words it contains, ascending, and their
+ * values: the word counts normalised by the number of descriptors, as in the
+ * dense 1 x V rows FabMap uses. A frame typically hits a few hundred of the
+ * vocabulary's words, so this is a small fraction of the dense size.
+ */
+struct SparseBOW {
+  std::vector<int> words;
+  std::vector<float> values;
+
+  bool empty() const { return words.empty(); }
+  std::size_t size() const { return words.size(); }
+
+  // Marks the words present, in a vector of vocabSize flags.
+  void mark(std::vector<char> &observed) const;
+
+  cv::Mat toDense(int vocabSize) const;
+  static SparseBOW fromDense(const cv::Mat &bow);
+
+  // Builds the bag-of-words of a frame from the nearest word of each of its
+  // descriptors.
+  static SparseBOW fromNearestWords(std::vector<int> nearestWords);
+};
+
+// Conversions to and from the legacy dense form, one row per bag-of-words.
+cv::Mat toDense(const std::vector<SparseBOW> &bows, int vocabSize);
+std::vector<SparseBOW> fromDense(const cv::Mat &bows);
+
+} // namespace ofpy3
+
+#endif // SPARSE_BOW_H
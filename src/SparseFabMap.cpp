@@ -0,0 +1,620 @@
+#include "SparseFabMap.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+namespace {
+
+// Places (and samples) are scored, and the normalising sum reduced, in blocks
+// of this many. Fixed, so that the reduction order is too.
+const int BLOCK_SIZE = 4096;
+
+int numBlocks(std::size_t n) {
+  return static_cast<int>((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+double logsumexp(double a, double b) {
+  return a > b ? std::log(1 + std::exp(b - a)) + a
+               : std::log(1 + std::exp(a - b)) + b;
+}
+
+/**
+ * The observation model of of2::FabMap, word by word: the Chow-Liu tree
+ * (rows: parent, P(zq), P(zq | zpq), P(zq | !zpq)) and the detector model.
+ */
+struct ObservationModel {
+  const cv::Mat &clTree;
+  double PzGe, PzNGe, PzGNe, PzNGNe;
+
+  double Pzq(int q, bool zq) const {
+    const double p = clTree.at<double>(1, q);
+    return zq ? p : 1 - p;
+  }
+  double PzqGzpq(int q, bool zq, bool zpq) const {
+    const double p = clTree.at<double>(zpq ? 2 : 3, q);
+    return zq ? p : 1 - p;
+  }
+  double PzqGeq(bool zq, bool eq) const {
+    if (eq) {
+      return zq ? PzGe : PzNGe;
+    }
+    return zq ? PzGNe : PzNGNe;
+  }
+  double PeqGL(int q, bool Lzq, bool eq) const {
+    const double alpha = PzqGeq(Lzq, true) * Pzq(q, true);
+    const double beta = PzqGeq(Lzq, false) * Pzq(q, false);
+    return eq ? alpha / (alpha + beta) : 1 - (alpha / (alpha + beta));
+  }
+  // Naive Bayes
+  double PzqGL(int q, bool zq, bool /*zpq*/, bool Lzq) const {
+    return PeqGL(q, Lzq, false) * PzqGeq(zq, false) +
+           PeqGL(q, Lzq, true) * PzqGeq(zq, true);
+  }
+  // Chow-Liu
+  double PzqGzpqL(int q, bool zq, bool zpq, bool Lzq) const {
+    double alpha = Pzq(q, zq) * PzqGeq(!zq, false) * PzqGzpq(q, !zq, zpq);
+    double beta = Pzq(q, !zq) * PzqGeq(zq, false) * PzqGzpq(q, zq, zpq);
+    double p = PeqGL(q, Lzq, false) * beta / (alpha + beta);
+    alpha = Pzq(q, zq) * PzqGeq(!zq, true) * PzqGzpq(q, !zq, zpq);
+    beta = Pzq(q, !zq) * PzqGeq(zq, true) * PzqGzpq(q, zq, zpq);
+    p += PeqGL(q, Lzq, true) * beta / (alpha + beta);
+    return p;
+  }
+  // The mean field new place term, log'd.
+  double meanField(int q, bool zq, bool zpq, bool naiveBayes) const {
+    if (naiveBayes) {
+      return std::log(Pzq(q, false) * PzqGeq(zq, false) +
+                      Pzq(q, true) * PzqGeq(zq, true));
+    }
+    double alpha = Pzq(q, zq) * PzqGeq(!zq, false) * PzqGzpq(q, !zq, zpq);
+    double beta = Pzq(q, !zq) * PzqGeq(zq, false) * PzqGzpq(q, zq, zpq);
+    double p = Pzq(q, false) * beta / (alpha + beta);
+    alpha = Pzq(q, zq) * PzqGeq(!zq, true) * PzqGzpq(q, !zq, zpq);
+    beta = Pzq(q, !zq) * PzqGeq(zq, true) * PzqGzpq(q, zq, zpq);
+    p += Pzq(q, true) * beta / (alpha + beta);
+    return std::log(p);
+  }
+};
+
+// The words of a bag-of-words that count as observed (value > 0, as in the
+// dense rows), ascending.
+template <typename Visit> void forObserved(const ofpy3::SparseBOW &bow, Visit visit) {
+  for (std::size_t i = 0; i < bow.words.size(); ++i) {
+    if (bow.values[i] > 0) {
+      visit(bow.words[i]);
+    }
+  }
+}
+
+// Fills in word q of a table from its eight terms.
+template <typename Terms, typename T>
+void tabulate(Terms &terms, int q, const T (&t)[8]) {
+  for (int s = 0; s < 4; ++s) {
+    terms.words[q].query[s] = t[s] - t[0];
+    terms.words[q].place[s] = (t[4 + s] - t[s]) - (t[4] - t[0]);
+  }
+  terms.present[q] = t[4] - t[0];
+  terms.base += t[0];
+}
+
+template <typename T, typename Allocator>
+std::size_t vectorBytes(const std::vector<T, Allocator> &v) {
+  return sizeof(v) + v.capacity() * sizeof(T);
+}
+
+std::size_t bowsBytes(const std::vector<ofpy3::SparseBOW> &bows) {
+  std::size_t bytes = vectorBytes(bows);
+  for (const ofpy3::SparseBOW &bow : bows) {
+    bytes += bow.words.capacity() * sizeof(int) +
+             bow.values.capacity() * sizeof(float);
+  }
+  return bytes;
+}
+
+std::size_t postingsBytes(const std::vector<std::vector<int>> &postings) {
+  std::size_t bytes = vectorBytes(postings);
+  for (const std::vector<int> &posting : postings) {
+    bytes += posting.capacity() * sizeof(int);
+  }
+  return bytes;
+}
+
+template <typename Terms> std::size_t termsBytes(const Terms &terms) {
+  return vectorBytes(terms.words) + vectorBytes(terms.present) +
+         vectorBytes(terms.placeDefaults) +
+         vectorBytes(terms.trainingDefaults) +
+         vectorBytes(terms.sampleDefaults);
+}
+
+} // namespace
+
+// ----------------- SparseFabMap -----------------
+
+ofpy3::SparseFabMap::SparseFabMap(const cv::Mat &clTree, double PzGe,
+                                  double PzGNe, int flags, int numSamples,
+                                  Version version, int lutPrecision)
+    : vocabSize(clTree.cols), parent(clTree.cols), childStart(),
+      children(), version(version), flags(flags), numSamples(numSamples),
+      fixedSamples(0), numThreads(1),
+      lut(version == FABMAPLUT), lutPrecision(lutPrecision), logTerms(),
+      lutTerms(), meanFieldTable(), meanFieldBase(0), places(),
+      postings(clTree.cols), training(), samplePostings(), Pnew(0.9), sFactor(0.99),
+      mBias(0.5), priorMatches() {
+  CV_Assert(clTree.type() == CV_64F && clTree.rows == 4);
+  CV_Assert(flags & of2::FabMap::MEAN_FIELD || flags & of2::FabMap::SAMPLED);
+  CV_Assert(flags & of2::FabMap::NAIVE_BAYES || flags & of2::FabMap::CHOW_LIU);
+  CV_Assert(version != FABMAP2 || flags & of2::FabMap::SAMPLED);
+  CV_Assert(!lut || lutPrecision >= 0);
+
+  childStart.assign(vocabSize + 1, 0);
+  for (int q = 0; q < vocabSize; ++q) {
+    parent[q] = static_cast<int>(clTree.at<double>(0, q));
+    CV_Assert(parent[q] >= 0 && parent[q] < vocabSize);
+    ++childStart[parent[q] + 1];
+  }
+  for (int q = 0; q < vocabSize; ++q) {
+    childStart[q + 1] += childStart[q];
+  }
+  children.resize(vocabSize);
+  std::vector<int> fill(childStart.begin(), childStart.end() - 1);
+  for (int q = 0; q < vocabSize; ++q) {
+    children[fill[parent[q]]++] = q;
+  }
+
+  const ObservationModel model = {clTree, PzGe, 1 - PzGe, PzGNe, 1 - PzGNe};
+  const bool naiveBayes = (flags & of2::FabMap::NAIVE_BAYES) != 0;
+  const double precFactor = lut ? std::pow(10.0, lutPrecision) : 0.0;
+  logTerms.base = 0;
+  lutTerms.base = 0;
+  if (lut) {
+    lutTerms.words.resize(vocabSize);
+    lutTerms.present.resize(vocabSize);
+  } else {
+    logTerms.words.resize(vocabSize);
+    logTerms.present.resize(vocabSize);
+  }
+  meanFieldTable.resize(static_cast<std::size_t>(vocabSize) * 4);
+  for (int q = 0; q < vocabSize; ++q) {
+    // t_q(Lzq, zq, zpq), indexed by (Lzq << 2) | (zq << 1) | zpq
+    double logP[8];
+    std::int64_t lutP[8];
+    for (int i = 0; i < 8; ++i) {
+      const bool Lzq = (i >> 2) & 1;
+      const bool zq = (i >> 1) & 1;
+      const bool zpq = i & 1;
+      const double p = naiveBayes ? model.PzqGL(q, zq, zpq, Lzq)
+                                  : model.PzqGzpqL(q, zq, zpq, Lzq);
+      logP[i] = std::log(p);
+      // As of2::FabMapLUT tabulates it
+      lutP[i] = lut ? -(int)(logP[i] * precFactor) : 0;
+    }
+    if (lut) {
+      tabulate(lutTerms, q, lutP);
+    } else {
+      tabulate(logTerms, q, logP);
+    }
+    if (version == FABMAP2) {
+      // Relative to the empty place, whose terms are t_q(0, s)
+      for (int s = 0; s < 4; ++s) {
+        logTerms.words[q].query[s] = 0;
+      }
+    }
+    for (int i = 0; i < 4; ++i) {
+      meanFieldTable[q * 4 + i] =
+          model.meanField(q, (i >> 1) & 1, i & 1, naiveBayes);
+    }
+    meanFieldBase += meanFieldTable[q * 4];
+  }
+  if (version == FABMAP2) {
+    logTerms.base = 0;
+  }
+}
+
+void ofpy3::SparseFabMap::addTraining(const std::vector<SparseBOW> &bows) {
+  for (const SparseBOW &bow : bows) {
+    training.push_back(bow);
+    if (lut) {
+      addDefaults(lutTerms, true);
+    } else {
+      addDefaults(logTerms, true);
+    }
+  }
+  if (fixedSamples > 0 || version == FABMAP2) {
+    setFixedSamples(fixedSamples);
+  }
+}
+
+/**
+ * Scores the sampled new place against a set of count training
+ * bags-of-words drawn once (without replacement, all of them if there are
+ * fewer), instead of drawing numSamples afresh for every query as of2 does.
+ * The set is indexed like the places, so a query only visits the samples
+ * sharing its words, and the new place likelihood no longer varies between
+ * identical queries. Fewer samples are faster and a coarser estimate.
+ * 0 restores of2's per-query sampling.
+ */
+void ofpy3::SparseFabMap::setFixedSamples(int count) {
+  fixedSamples = std::max(0, count);
+  samplePostings.assign(vocabSize, std::vector<int>());
+  logTerms.sampleDefaults.clear();
+  lutTerms.sampleDefaults.clear();
+  if (fixedSamples == 0 && version != FABMAP2) {
+    return;
+  }
+
+  std::vector<int> samples(training.size());
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = static_cast<int>(i);
+  }
+  const std::size_t chosen =
+      version == FABMAP2
+          ? samples.size()
+          : std::min(samples.size(), static_cast<std::size_t>(fixedSamples));
+  std::mt19937 random(0);
+  for (std::size_t i = 0; i < chosen; ++i) {
+    std::uniform_int_distribution<std::size_t> pick(i, samples.size() - 1);
+    std::swap(samples[i], samples[pick(random)]);
+  }
+  samples.resize(chosen);
+  std::sort(samples.begin(), samples.end());
+
+  for (std::size_t j = 0; j < samples.size(); ++j) {
+    forObserved(training[samples[j]], [&](int q) {
+      samplePostings[q].push_back(static_cast<int>(j));
+    });
+    if (lut) {
+      lutTerms.sampleDefaults.push_back(lutTerms.trainingDefaults[samples[j]]);
+    } else {
+      logTerms.sampleDefaults.push_back(logTerms.trainingDefaults[samples[j]]);
+    }
+  }
+}
+
+int ofpy3::SparseFabMap::getFixedSamples() const { return fixedSamples; }
+
+void ofpy3::SparseFabMap::add(const SparseBOW &bow) {
+  const int index = static_cast<int>(places.size());
+  places.push_back(bow);
+  forObserved(bow, [&](int q) { postings[q].push_back(index); });
+  if (lut) {
+    addDefaults(lutTerms, false);
+  } else {
+    addDefaults(logTerms, false);
+  }
+}
+
+template <typename T>
+void ofpy3::SparseFabMap::addDefaults(Terms<T> &terms, bool isTraining) {
+  const SparseBOW &bow = isTraining ? training.back() : places.back();
+  T sum = 0;
+  forObserved(bow, [&](int q) {
+    sum += terms.present[q];
+  });
+  (isTraining ? terms.trainingDefaults : terms.placeDefaults).push_back(sum);
+}
+
+template <typename Value>
+double ofpy3::SparseFabMap::logSum(std::size_t size, Value value) const {
+  // log(sum(exp(x))) of each block relative to its maximum, then of the
+  // blocks in order.
+  const int blocks = numBlocks(size);
+  std::vector<double> blockMax(blocks), blockSum(blocks);
+#pragma omp parallel for schedule(static) num_threads(numThreads) if (blocks > 1)
+  for (int b = 0; b < blocks; ++b) {
+    const std::size_t begin = static_cast<std::size_t>(b) * BLOCK_SIZE;
+    const std::size_t end = std::min<std::size_t>(begin + BLOCK_SIZE, size);
+    double max = -DBL_MAX;
+    for (std::size_t i = begin; i < end; ++i) {
+      max = std::max(max, value(i));
+    }
+    double sum = 0;
+    for (std::size_t i = begin; i < end; ++i) {
+      sum += std::exp(value(i) - max);
+    }
+    blockMax[b] = max;
+    blockSum[b] = sum;
+  }
+  const double max = *std::max_element(blockMax.begin(), blockMax.end());
+  double sum = 0;
+  for (int b = 0; b < blocks; ++b) {
+    sum += blockSum[b] * std::exp(blockMax[b] - max);
+  }
+  return max + std::log(sum);
+}
+
+void ofpy3::SparseFabMap::localize(const SparseBOW &bow,
+                                   std::vector<of2::IMatch> &matches,
+                                   bool addQ,
+                                   const MatchSelection &selection) {
+  const Query query = touchedWords(bow);
+  // The new place, then every place
+  std::vector<double> likelihoods(places.size() + 1);
+  {
+    StageTimer timer(stats.get(), Stage::NewPlace);
+    likelihoods[0] = newPlaceLikelihood(query);
+  }
+  {
+    StageTimer timer(stats.get(), Stage::Score);
+    if (lut) {
+      indexLikelihoods(lutTerms, lutTerms.placeDefaults, postings, query,
+                       &likelihoods[1]);
+    } else {
+      indexLikelihoods(logTerms, logTerms.placeDefaults, postings, query,
+                       &likelihoods[1]);
+    }
+  }
+
+  StageTimer timer(stats.get(), Stage::Normalise);
+  matches.clear();
+  if (flags & of2::FabMap::MOTION_MODEL || selection.all()) {
+    // The motion model prior needs every match
+    matches.reserve(likelihoods.size());
+    for (std::size_t i = 0; i < likelihoods.size(); ++i) {
+      matches.push_back(
+          of2::IMatch(0, static_cast<int>(i) - 1, likelihoods[i], 0));
+    }
+    normalise(matches);
+    selectMatches(matches, selection);
+  } else {
+    // Only the selected matches are normalised, against the sum over all.
+    const std::vector<int> kept = selectLikelihoods(likelihoods, selection);
+    const double logsum = logSum(
+        likelihoods.size(), [&likelihoods](std::size_t i) {
+          return likelihoods[i];
+        });
+    matches.reserve(kept.size());
+    for (int i : kept) {
+      matches.push_back(of2::IMatch(
+          0, i - 1, likelihoods[i],
+          sFactor * std::exp(likelihoods[i] - logsum) +
+              (1 - sFactor) / likelihoods.size()));
+    }
+  }
+  if (addQ) {
+    add(bow);
+  }
+}
+
+void ofpy3::SparseFabMap::setNumThreads(int threads) {
+  numThreads = threads > 0
+                   ? threads
+                   : std::max(1, static_cast<int>(
+                                     std::thread::hardware_concurrency()));
+}
+
+int ofpy3::SparseFabMap::getNumThreads() const { return numThreads; }
+
+std::size_t ofpy3::SparseFabMap::numPlaces() const { return places.size(); }
+
+ofpy3::SparseBOW ofpy3::SparseFabMap::getPlace(std::size_t index) const {
+  return places[index];
+}
+
+// The places, the training data and the indices and tables over them.
+std::size_t ofpy3::SparseFabMap::memoryBytes() const {
+  return bowsBytes(places) + postingsBytes(postings) + bowsBytes(training) +
+         postingsBytes(samplePostings) + termsBytes(logTerms) +
+         termsBytes(lutTerms) + vectorBytes(meanFieldTable) +
+         vectorBytes(parent) + vectorBytes(childStart) + vectorBytes(children);
+}
+
+ofpy3::SparseFabMap::Query
+ofpy3::SparseFabMap::touchedWords(const SparseBOW &bow) const {
+  std::vector<int> observed;
+  forObserved(bow, [&](int q) { observed.push_back(q); });
+
+  Query query;
+  query.words = observed;
+  for (int q : observed) {
+    query.words.insert(query.words.end(), &children[childStart[q]],
+                       &children[childStart[q + 1]]);
+  }
+  std::sort(query.words.begin(), query.words.end());
+  query.words.erase(std::unique(query.words.begin(), query.words.end()),
+                    query.words.end());
+
+  query.states.reserve(query.words.size());
+  for (int q : query.words) {
+    const bool zq = std::binary_search(observed.begin(), observed.end(), q);
+    const bool zpq =
+        std::binary_search(observed.begin(), observed.end(), parent[q]);
+    query.states.push_back(static_cast<unsigned char>((zq << 1) | zpq));
+  }
+  return query;
+}
+
+// The constant part of a query's log-likelihood, and the correction for each
+// touched word of the places containing it.
+template <typename T>
+T ofpy3::SparseFabMap::queryTerms(const Terms<T> &terms, const Query &query,
+                                  std::vector<T> &adjust) const {
+  T base = terms.base;
+  adjust.resize(query.words.size());
+  for (std::size_t k = 0; k < query.words.size(); ++k) {
+    const WordTerms<T> &word = terms.words[query.words[k]];
+    base += word.query[query.states[k]];
+    adjust[k] = word.place[query.states[k]];
+  }
+  return base;
+}
+
+template <typename T>
+void ofpy3::SparseFabMap::indexLikelihoods(
+    const Terms<T> &terms, const std::vector<T> &defaults,
+    const std::vector<std::vector<int>> &postings, const Query &query,
+    double *likelihoods) const {
+  std::vector<T> adjust;
+  const T base = queryTerms(terms, query, adjust);
+
+  const int size = static_cast<int>(defaults.size());
+  const int blocks = numBlocks(size);
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads) if (blocks > 1)
+  for (int b = 0; b < blocks; ++b) {
+    const int begin = b * BLOCK_SIZE;
+    const int end = std::min(begin + BLOCK_SIZE, size);
+    std::vector<T> sums(defaults.begin() + begin, defaults.begin() + end);
+    for (std::size_t k = 0; k < query.words.size(); ++k) {
+      if (adjust[k] == 0) {
+        continue;
+      }
+      // This block's slice of the postings
+      const std::vector<int> &posting = postings[query.words[k]];
+      for (auto entry = std::lower_bound(posting.begin(), posting.end(), begin);
+           entry != posting.end() && *entry < end; ++entry) {
+        sums[*entry - begin] += adjust[k];
+      }
+    }
+    for (int i = begin; i < end; ++i) {
+      likelihoods[i] = toLikelihood(base + sums[i - begin]);
+    }
+  }
+}
+
+template <typename T>
+void ofpy3::SparseFabMap::sampleLikelihoods(
+    const Terms<T> &terms, const Query &query, const std::vector<int> &samples,
+    std::vector<double> &likelihoods) const {
+  std::vector<T> adjust;
+  const T base = queryTerms(terms, query, adjust);
+
+  const int count = static_cast<int>(samples.size());
+  likelihoods.resize(count);
+#pragma omp parallel for schedule(dynamic, 64) num_threads(numThreads) if (count > BLOCK_SIZE / 8)
+  for (int j = 0; j < count; ++j) {
+    const SparseBOW &bow = training[samples[j]];
+    T sum = base + terms.trainingDefaults[samples[j]];
+    // Both word lists are ascending
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < bow.words.size() && k < query.words.size();
+         ++i) {
+      if (bow.values[i] <= 0) {
+        continue;
+      }
+      while (k < query.words.size() && query.words[k] < bow.words[i]) {
+        ++k;
+      }
+      if (k < query.words.size() && query.words[k] == bow.words[i]) {
+        sum += adjust[k];
+      }
+    }
+    likelihoods[j] = toLikelihood(sum);
+  }
+}
+
+double ofpy3::SparseFabMap::toLikelihood(std::int64_t sum) const {
+  return -std::pow(10.0, -lutPrecision) * static_cast<double>(sum);
+}
+
+double ofpy3::SparseFabMap::newPlaceLikelihood(const Query &query) const {
+  if (flags & of2::FabMap::MEAN_FIELD) {
+    double logP = meanFieldBase;
+    for (std::size_t k = 0; k < query.words.size(); ++k) {
+      const double *row = &meanFieldTable[query.words[k] * 4];
+      logP += row[query.states[k]] - row[0];
+    }
+    return logP;
+  }
+  if (flags & of2::FabMap::SAMPLED &&
+      (fixedSamples > 0 || version == FABMAP2)) {
+    CV_Assert(!training.empty());
+    const std::size_t count = lut ? lutTerms.sampleDefaults.size()
+                                  : logTerms.sampleDefaults.size();
+    CV_Assert(count > 0);
+    std::vector<double> likelihoods(count);
+    if (lut) {
+      indexLikelihoods(lutTerms, lutTerms.sampleDefaults, samplePostings,
+                       query, likelihoods.data());
+    } else {
+      indexLikelihoods(logTerms, logTerms.sampleDefaults, samplePostings,
+                       query, likelihoods.data());
+    }
+    return logSum(count,
+                  [&likelihoods](std::size_t i) { return likelihoods[i]; }) -
+           std::log((double)count);
+  }
+  if (flags & of2::FabMap::SAMPLED) {
+    CV_Assert(!training.empty());
+    CV_Assert(numSamples > 0);
+    // Sampled with replacement, as of2::FabMap does
+    std::vector<int> samples(numSamples);
+    for (int i = 0; i < numSamples; ++i) {
+      samples[i] = std::rand() % static_cast<int>(training.size());
+    }
+    std::vector<double> likelihoods;
+    if (lut) {
+      sampleLikelihoods(lutTerms, query, samples, likelihoods);
+    } else {
+      sampleLikelihoods(logTerms, query, samples, likelihoods);
+    }
+    double averageLogLikelihood = -DBL_MAX + likelihoods.front() + 1;
+    for (int i = 0; i < numSamples; ++i) {
+      averageLogLikelihood =
+          logsumexp(likelihoods[i], averageLogLikelihood);
+    }
+    return averageLogLikelihood - std::log((double)numSamples);
+  }
+  return 0;
+}
+
+
+// of2::FabMap::normaliseDistribution
+void ofpy3::SparseFabMap::normalise(std::vector<of2::IMatch> &matches) {
+  CV_Assert(!matches.empty());
+  const int size = static_cast<int>(matches.size());
+  const bool parallel = size > BLOCK_SIZE;
+  if (flags & of2::FabMap::MOTION_MODEL) {
+    const int numPrior = static_cast<int>(priorMatches.size());
+    matches[0].match = matches[0].likelihood + std::log(Pnew);
+    if (numPrior > 2) {
+      const int last = numPrior - 1;
+      matches[1].match = matches[1].likelihood;
+      matches[1].match += std::log((2 * (1 - mBias) * priorMatches[1].match +
+                                    priorMatches[1].match +
+                                    2 * mBias * priorMatches[2].match) /
+                                   3);
+#pragma omp parallel for schedule(static) num_threads(numThreads) if (parallel)
+      for (int i = 2; i < last; i++) {
+        matches[i].match = matches[i].likelihood;
+        matches[i].match +=
+            std::log((2 * (1 - mBias) * priorMatches[i - 1].match +
+                      priorMatches[i].match +
+                      2 * mBias * priorMatches[i + 1].match) /
+                     3);
+      }
+      matches[last].match = matches[last].likelihood;
+      matches[last].match +=
+          std::log((2 * (1 - mBias) * priorMatches[last - 1].match +
+                    priorMatches[last].match +
+                    2 * mBias * priorMatches[last].match) /
+                   3);
+      for (int i = numPrior; i < size; i++) {
+        matches[i].match = matches[i].likelihood;
+      }
+    } else {
+      for (int i = 1; i < size; i++) {
+        matches[i].match = matches[i].likelihood;
+      }
+    }
+
+    const double logsum = logSum(
+        matches.size(), [&matches](std::size_t i) { return matches[i].match; });
+#pragma omp parallel for schedule(static) num_threads(numThreads) if (parallel)
+    for (int i = 0; i < size; i++) {
+      matches[i].match = sFactor * std::exp(matches[i].match - logsum) +
+                         (1 - sFactor) / size;
+    }
+    priorMatches = matches;
+  } else {
+    const double logsum =
+        logSum(matches.size(),
+               [&matches](std::size_t i) { return matches[i].likelihood; });
+#pragma omp parallel for schedule(static) num_threads(numThreads) if (parallel)
+    for (int i = 0; i < size; i++) {
+      matches[i].match = sFactor * std::exp(matches[i].likelihood - logsum) +
+                         (1 - sFactor) / size;
+    }
+  }
+}
@@ -0,0 +1,208 @@
+#ifndef SPARSE_FABMAP_H
+#define SPARSE_FABMAP_H
+
+#include "FabMapEngine.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace ofpy3 {
+
+// Allocates with the given alignment, for tables laid out in cache lines.
+template <typename T, std::size_t Alignment> struct AlignedAllocator {
+  typedef T value_type;
+  template <typename U> struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(std::size_t n) {
+    // The raw pointer is kept just before the aligned block
+    char *raw = static_cast<char *>(
+        ::operator new(n * sizeof(T) + Alignment + sizeof(void *)));
+    std::uintptr_t aligned =
+        (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *) + Alignment -
+         1) &
+        ~static_cast<std::uintptr_t>(Alignment - 1);
+    reinterpret_cast<void **>(aligned)[-1] = raw;
+    return reinterpret_cast<T *>(aligned);
+  }
+  void deallocate(T *p, std::size_t) {
+    ::operator delete(reinterpret_cast<void **>(p)[-1]);
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const {
+    return false;
+  }
+};
+
+/**
+ * FABMAP1 (and FABMAPLUT and FABMAP2) over an inverted index, with the
+ * likelihoods of of2::FabMap1/of2::FabMapLUT/of2::FabMap2 but without
+ * visiting every word of every place.
+ *
+ * The log-likelihood of a query Z given place L is a sum over the words of
+ * a term t_q(Lzq, zq, zpq). Split each term into its value for a place
+ * without the word plus, if the place has it, the difference. Words that are
+ * not in the query and whose parent is not either (the vast majority) have
+ * zq = zpq = 0, so their part of the sum is
+ *   sum_q t_q(0, 0, 0) + sum_{q in L} [t_q(1, 0, 0) - t_q(0, 0, 0)]
+ * which is a constant plus a default term per place, kept up to date as
+ * places are added. Only the words the query touches (its words and their
+ * children) are then corrected, once for the query and once per place in
+ * their postings. A query costs O(places + postings of the touched words)
+ * rather than O(places x V).
+ *
+ * With a LUT precision the terms are of2::FabMapLUT's integers, so the sums
+ * are exact and the likelihoods identical; otherwise they are the same up
+ * to floating point summation order. The new place likelihood (mean field
+ * or sampled) and the normalisation, including the motion model, follow
+ * of2::FabMap.
+ *
+ * FABMAP2 scores a place relative to a place with no words: its
+ * log-likelihood is the FABMAP1 one less that of the empty place, which
+ * drops the constant and the query's own terms and leaves only the default
+ * and place corrections (of2::FabMap2's d1 to d4). Its new place is the
+ * average over every training bag-of-words, scored through their own index.
+ *
+ * The terms are tabulated once, at construction, in exactly the form the
+ * scoring loops consume them: per word and query state, the change to the
+ * constant and the correction for places containing the word. A word's
+ * terms fill one cache line, so a query costs one line per touched word and
+ * no logarithms.
+ *
+ * Places are scored in blocks of consecutive places spread over the OpenMP
+ * threads, each block reading only its slice of the postings. The
+ * normalising sum is reduced block by block in a fixed order, so the results
+ * do not depend on the number of threads.
+ */
+class SparseFabMap : public FabMapEngine {
+public:
+  enum Version { FABMAP1, FABMAPLUT, FABMAP2 };
+
+  // flags are of2::FabMap's, FABMAP2 requires SAMPLED as of2::FabMap2 does.
+  // lutPrecision is FABMAPLUT's, in decimal digits.
+  SparseFabMap(const cv::Mat &clTree, double PzGe, double PzGNe, int flags,
+               int numSamples, Version version = FABMAP1,
+               int lutPrecision = 6);
+
+  void addTraining(const std::vector<SparseBOW> &bows) override;
+  void add(const SparseBOW &bow) override;
+  void localize(const SparseBOW &bow, std::vector<of2::IMatch> &matches,
+                bool addQ, const MatchSelection &selection) override;
+
+  std::size_t numPlaces() const override;
+  SparseBOW getPlace(std::size_t index) const override;
+  std::size_t memoryBytes() const override;
+
+  // Training bags-of-words sampled once for the new place, 0 to resample
+  // numSamples per query. FABMAP2 always uses all of them.
+  void setFixedSamples(int count);
+  int getFixedSamples() const;
+
+  // Threads to score places (and samples) with, 0 for all cores.
+  void setNumThreads(int threads);
+  int getNumThreads() const;
+
+  // A word's terms, indexed by the query state s = (zq << 1) | zpq:
+  //   query[s] = t_q(0, s) - t_q(0, 0)
+  //   place[s] = [t_q(1, s) - t_q(0, s)] - [t_q(1, 0) - t_q(0, 0)]
+  // so that the log-likelihood of a place is base + its default + the sum
+  // of query[s] over the touched words, plus place[s] for those it contains.
+  template <typename T> struct WordTerms {
+    T query[4];
+    T place[4];
+  };
+
+  // The terms of the log-likelihood, in one of two number types.
+  template <typename T> struct Terms {
+    std::vector<WordTerms<T>, AlignedAllocator<WordTerms<T>, 64>> words;
+    // t_q(1, 0) - t_q(0, 0) per word, what containing it adds by default
+    std::vector<T> present;
+    // sum_q t_q(0, 0)
+    T base;
+    // sum_{q in L} [t_q(1, 0, 0) - t_q(0, 0, 0)] per place, per training
+    // bag-of-words, and per fixed sample
+    std::vector<T> placeDefaults;
+    std::vector<T> trainingDefaults;
+    std::vector<T> sampleDefaults;
+  };
+
+  // The words a query touches and their (zq << 1) | zpq states, ascending.
+  struct Query {
+    std::vector<int> words;
+    std::vector<unsigned char> states;
+  };
+
+private:
+  Query touchedWords(const SparseBOW &bow) const;
+  double newPlaceLikelihood(const Query &query) const;
+  void normalise(std::vector<of2::IMatch> &matches);
+
+  // The likelihoods of the entries of an index (places or fixed samples)
+  // given their defaults and postings.
+  template <typename T>
+  void indexLikelihoods(const Terms<T> &terms, const std::vector<T> &defaults,
+                        const std::vector<std::vector<int>> &postings,
+                        const Query &query, double *likelihoods) const;
+  template <typename T>
+  void sampleLikelihoods(const Terms<T> &terms, const Query &query,
+                         const std::vector<int> &samples,
+                         std::vector<double> &likelihoods) const;
+  template <typename T> void addDefaults(Terms<T> &terms, bool training);
+  template <typename T>
+  T queryTerms(const Terms<T> &terms, const Query &query,
+               std::vector<T> &adjust) const;
+  double toLikelihood(double sum) const { return sum; }
+  double toLikelihood(std::int64_t sum) const;
+  template <typename Value>
+  double logSum(std::size_t size, Value value) const;
+
+private:
+  int vocabSize;
+  std::vector<int> parent;
+  // Children of word q are children[childStart[q], childStart[q + 1]).
+  std::vector<int> childStart;
+  std::vector<int> children;
+
+  Version version;
+  int flags;
+  int numSamples;
+  int fixedSamples;
+  int numThreads;
+  bool lut;
+  int lutPrecision;
+  Terms<double> logTerms;
+  Terms<std::int64_t> lutTerms;
+
+  // The mean field new place term, 4 per word indexed by (zq << 1) | zpq,
+  // and its sum at zq = zpq = 0.
+  std::vector<double> meanFieldTable;
+  double meanFieldBase;
+
+  std::vector<SparseBOW> places;
+  // The places containing each word, ascending.
+  std::vector<std::vector<int>> postings;
+  std::vector<SparseBOW> training;
+  // The training bags-of-words containing each word, by fixed sample.
+  std::vector<std::vector<int>> samplePostings;
+
+  // of2::FabMap's motion model and smoothing constants
+  double Pnew;
+  double sFactor;
+  double mBias;
+  std::vector<of2::IMatch> priorMatches;
+};
+
+} // namespace ofpy3
+
+#endif // SPARSE_FABMAP_H
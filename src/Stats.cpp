@@ -0,0 +1,252 @@
+#include "Stats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+namespace {
+
+const char *const STAGE_NAMES[] = {"frame",    "decode",   "detect",
+                                   "extract",  "quantize", "localize",
+                                   "score",    "new_place", "normalise"};
+const char *const COUNTER_NAMES[] = {"descriptors", "words", "places_scored"};
+
+// Small sequential ids for the trace, in the order threads first record.
+int traceThreadId() {
+  static std::atomic<int> nextId(1);
+  thread_local const int id = nextId.fetch_add(1);
+  return id;
+}
+
+void atomicMin(std::atomic<std::uint64_t> &target, std::uint64_t value) {
+  std::uint64_t current = target.load(std::memory_order_relaxed);
+  while (value < current &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+void atomicMax(std::atomic<std::uint64_t> &target, std::uint64_t value) {
+  std::uint64_t current = target.load(std::memory_order_relaxed);
+  while (value > current &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+} // namespace
+
+const char *ofpy3::stageName(Stage stage) {
+  return STAGE_NAMES[static_cast<int>(stage)];
+}
+
+const char *ofpy3::counterName(Counter counter) {
+  return COUNTER_NAMES[static_cast<int>(counter)];
+}
+
+// ----------------- Histogram -----------------
+
+ofpy3::Histogram::Histogram() { reset(); }
+
+// Values below SUB_BUCKETS have a bucket each; above, each power of two
+// [2^e, 2^(e+1)) is split into SUB_BUCKETS equal buckets.
+int ofpy3::Histogram::bucketOf(std::uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return static_cast<int>(value);
+  }
+  int e = 63;
+  while (!(value >> e)) {
+    --e;
+  }
+  const int sub = static_cast<int>((value >> (e - 2)) & (SUB_BUCKETS - 1));
+  return SUB_BUCKETS * (e - 1) + sub;
+}
+
+std::uint64_t ofpy3::Histogram::bucketMax(int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return static_cast<std::uint64_t>(bucket);
+  }
+  const int e = bucket / SUB_BUCKETS + 1;
+  const std::uint64_t sub = bucket % SUB_BUCKETS;
+  const std::uint64_t width = std::uint64_t(1) << (e - 2);
+  return (SUB_BUCKETS + sub) * width + (width - 1);
+}
+
+void ofpy3::Histogram::record(std::uint64_t value) {
+  counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  atomicMin(min, value);
+  atomicMax(max, value);
+}
+
+void ofpy3::Histogram::reset() {
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  min.store(std::numeric_limits<std::uint64_t>::max(),
+            std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+}
+
+ofpy3::Histogram::Snapshot ofpy3::Histogram::snapshot() const {
+  Snapshot result;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    const std::uint64_t n = counts[i].load(std::memory_order_relaxed);
+    if (n) {
+      result.buckets.push_back(std::make_pair(bucketMax(i), n));
+      result.count += n;
+    }
+  }
+  result.sum = sum.load(std::memory_order_relaxed);
+  if (result.count) {
+    result.min = min.load(std::memory_order_relaxed);
+    result.max = max.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+std::uint64_t ofpy3::Histogram::Snapshot::quantile(double q) const {
+  if (!count) {
+    return 0;
+  }
+  const std::uint64_t rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(q * count)));
+  std::uint64_t seen = 0;
+  for (const auto &bucket : buckets) {
+    seen += bucket.second;
+    if (seen >= rank) {
+      return std::min(bucket.first, max);
+    }
+  }
+  return max;
+}
+
+// ----------------- Stats -----------------
+
+ofpy3::Stats::Stats()
+    : enabled(false), tracing(false), frames(0), traceMutex(),
+      epoch(Clock::now()), spans(), traceCapacity(0), droppedSpans(0) {}
+
+void ofpy3::Stats::setEnabled(bool enabled) { this->enabled = enabled; }
+
+void ofpy3::Stats::setTracing(bool tracing, std::size_t capacity) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (tracing) {
+    traceCapacity = capacity;
+    if (spans.size() > traceCapacity) {
+      spans.resize(traceCapacity);
+    }
+  }
+  this->tracing = tracing;
+}
+
+void ofpy3::Stats::recordStage(Stage stage, Clock::time_point start,
+                               Clock::time_point end, long frame) {
+  const std::int64_t duration =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  stages[static_cast<int>(stage)].record(
+      static_cast<std::uint64_t>(std::max<std::int64_t>(0, duration)));
+  if (!isTracing()) {
+    return;
+  }
+
+  Span span;
+  span.stage = stage;
+  span.thread = traceThreadId();
+  span.frame = frame;
+  span.durationNs = duration;
+  std::lock_guard<std::mutex> lock(traceMutex);
+  span.startNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch)
+          .count();
+  if (spans.size() < traceCapacity) {
+    spans.push_back(span);
+  } else {
+    ++droppedSpans;
+  }
+}
+
+void ofpy3::Stats::recordCounter(Counter counter, std::uint64_t value) {
+  counters[static_cast<int>(counter)].record(value);
+}
+
+void ofpy3::Stats::reset() {
+  for (Histogram &stage : stages) {
+    stage.reset();
+  }
+  for (Histogram &counter : counters) {
+    counter.reset();
+  }
+  std::lock_guard<std::mutex> lock(traceMutex);
+  spans.clear();
+  droppedSpans = 0;
+  epoch = Clock::now();
+}
+
+ofpy3::Histogram::Snapshot ofpy3::Stats::getStage(Stage stage) const {
+  return stages[static_cast<int>(stage)].snapshot();
+}
+
+ofpy3::Histogram::Snapshot ofpy3::Stats::getCounter(Counter counter) const {
+  return counters[static_cast<int>(counter)].snapshot();
+}
+
+std::size_t ofpy3::Stats::getTraceSpans() const {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  return spans.size();
+}
+
+std::size_t ofpy3::Stats::getDroppedSpans() const {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  return droppedSpans;
+}
+
+void ofpy3::Stats::writeTrace(const std::string &filename) const {
+  std::vector<Span> copy;
+  {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    copy = spans;
+  }
+
+  std::ofstream out(filename.c_str(), std::ios::trunc);
+  if (!out.good()) {
+    CV_Error(CV_StsError, filename + ": cannot open trace file for writing");
+  }
+  // Timestamps are microseconds, with nanosecond decimals
+  out.setf(std::ios::fixed);
+  out.precision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  const char *separator = "\n";
+  for (const Span &span : copy) {
+    const double start = span.startNs / 1e3;
+    const double end = (span.startNs + span.durationNs) / 1e3;
+    if (span.stage == Stage::Frame && span.frame >= 0) {
+      out << separator << "{\"name\": \"frame\", \"cat\": \"frame\", "
+          << "\"ph\": \"b\", \"id\": " << span.frame
+          << ", \"pid\": 1, \"tid\": " << span.thread << ", \"ts\": " << start
+          << "},\n{\"name\": \"frame\", \"cat\": \"frame\", \"ph\": \"e\", "
+          << "\"id\": " << span.frame << ", \"pid\": 1, \"tid\": "
+          << span.thread << ", \"ts\": " << end << "}";
+    } else {
+      out << separator << "{\"name\": \"" << stageName(span.stage)
+          << "\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+          << span.thread << ", \"ts\": " << start
+          << ", \"dur\": " << span.durationNs / 1e3;
+      if (span.frame >= 0) {
+        out << ", \"args\": {\"frame\": " << span.frame << "}";
+      }
+      out << "}";
+    }
+    separator = ",\n";
+  }
+  out << "\n]}\n";
+  if (!out.good()) {
+    CV_Error(CV_StsError, filename + ": error writing trace file");
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ofpy3 {
+
+// The timed stages of processing a frame. Score, NewPlace and Normalise are
+// the parts of Localize on the sparse engine.
+enum class Stage {
+  Frame,
+  Decode,
+  Detect,
+  Extract,
+  Quantize,
+  Localize,
+  Score,
+  NewPlace,
+  Normalise,
+  Count
+};
+
+// Per frame (or per query) quantities.
+enum class Counter { Descriptors, Words, PlacesScored, Count };
+
+const char *stageName(Stage stage);
+const char *counterName(Counter counter);
+
+/**
+ * A distribution of non-negative integers in log-linear buckets, four per
+ * power of two, so quantiles are within 25% of the exact value while the
+ * buckets cover the whole 64 bit range. Recording is lock-free and may race
+ * with other recordings and with snapshots; a snapshot taken meanwhile may
+ * miss the values in flight.
+ */
+class Histogram {
+public:
+  static const int SUB_BUCKETS = 4;
+  static const int NUM_BUCKETS = 64 * SUB_BUCKETS;
+
+  struct Snapshot {
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t min = 0;
+    std::uint64_t max = 0;
+    // (largest value, count) of each non-empty bucket, ascending.
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> buckets;
+
+    double mean() const { return count ? (double)sum / count : 0.0; }
+    // Nearest rank, as the largest value of its bucket (at most max).
+    std::uint64_t quantile(double q) const;
+  };
+
+  Histogram();
+  Histogram(const Histogram &) = delete;
+  Histogram &operator=(const Histogram &) = delete;
+
+  void record(std::uint64_t value);
+  void reset();
+  Snapshot snapshot() const;
+
+  static int bucketOf(std::uint64_t value);
+  static std::uint64_t bucketMax(int bucket);
+
+private:
+  std::atomic<std::uint64_t> counts[NUM_BUCKETS];
+  std::atomic<std::uint64_t> count;
+  std::atomic<std::uint64_t> sum;
+  std::atomic<std::uint64_t> min;
+  std::atomic<std::uint64_t> max;
+};
+
+/**
+ * Timings and counters of a localizer. Stage latencies (in nanoseconds) and
+ * counters are kept as histograms; optionally, every timed span is also
+ * kept for a Chrome trace (chrome://tracing, or ui.perfetto.dev), up to a
+ * capacity after which further spans are counted but dropped.
+ *
+ * Everything is off until enabled. Disabled, a StageTimer costs one relaxed
+ * atomic load and never reads the clock.
+ */
+class Stats {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Span {
+    Stage stage;
+    int thread;
+    // The frame the span belongs to, -1 if not known where it was timed.
+    long frame;
+    std::int64_t startNs;
+    std::int64_t durationNs;
+  };
+
+  Stats();
+  Stats(const Stats &) = delete;
+  Stats &operator=(const Stats &) = delete;
+
+  bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+  void setEnabled(bool enabled);
+  bool isTracing() const { return tracing.load(std::memory_order_relaxed); }
+  // Starts (with room for capacity spans) or stops keeping spans.
+  void setTracing(bool tracing, std::size_t capacity = 1000000);
+
+  // A fresh frame number, for the spans of one frame.
+  long nextFrame() { return frames.fetch_add(1, std::memory_order_relaxed); }
+
+  void recordStage(Stage stage, Clock::time_point start, Clock::time_point end,
+                   long frame = -1);
+  void recordCounter(Counter counter, std::uint64_t value);
+
+  // Clears every histogram and the trace.
+  void reset();
+
+  Histogram::Snapshot getStage(Stage stage) const;
+  Histogram::Snapshot getCounter(Counter counter) const;
+  std::size_t getTraceSpans() const;
+  std::size_t getDroppedSpans() const;
+
+  // Writes the spans as Chrome trace event JSON. Frames become async spans
+  // of their own, so they may cross threads (as in the pipeline).
+  void writeTrace(const std::string &filename) const;
+
+private:
+  std::atomic<bool> enabled;
+  std::atomic<bool> tracing;
+  std::atomic<long> frames;
+  Histogram stages[static_cast<int>(Stage::Count)];
+  Histogram counters[static_cast<int>(Counter::Count)];
+
+  mutable std::mutex traceMutex;
+  Clock::time_point epoch;
+  std::vector<Span> spans;
+  std::size_t traceCapacity;
+  std::size_t droppedSpans;
+};
+
+/**
+ * Times a stage from construction to destruction, if stats are enabled (and
+ * not null) at construction.
+ */
+class StageTimer {
+public:
+  StageTimer(Stats *stats, Stage stage, long frame = -1)
+      : stats(stats && stats->isEnabled() ? stats : nullptr), stage(stage),
+        frame(frame), start() {
+    if (this->stats) {
+      start = Stats::Clock::now();
+    }
+  }
+  ~StageTimer() {
+    if (stats) {
+      stats->recordStage(stage, start, Stats::Clock::now(), frame);
+    }
+  }
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+  Stats *stats;
+  Stage stage;
+  long frame;
+  Stats::Clock::time_point start;
+};
+
+// Records a counter value if stats are enabled (and not null).
+inline void recordCounter(Stats *stats, Counter counter,
+                          std::uint64_t value) {
+  if (stats && stats->isEnabled()) {
+    stats->recordCounter(counter, value);
+  }
+}
+
+} // namespace ofpy3
+
+#endif // STATS_H
@@ -0,0 +1,227 @@
+#include "VocabularyClusterer.h"
+#include "Hamming.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const int BATCH_SIZE = 4096;
+
+// Squared Euclidean distance between float descriptors.
+struct L2Metric {
+  typedef float Element;
+  typedef float Distance;
+
+  int dims;
+
+  // Gives up (returning something larger than bound) once past bound.
+  float operator()(const float *a, const float *b, float bound) const {
+    float sum = 0.f;
+    int d = 0;
+    for (; d + 8 <= dims; d += 8) {
+      for (int k = 0; k < 8; ++k) {
+        const float diff = a[d + k] - b[d + k];
+        sum += diff * diff;
+      }
+      if (sum > bound) {
+        return sum;
+      }
+    }
+    for (; d < dims; ++d) {
+      const float diff = a[d] - b[d];
+      sum += diff * diff;
+    }
+    return sum;
+  }
+};
+
+// Hamming distance between packed binary descriptors.
+struct HammingMetric {
+  typedef uchar Element;
+  typedef int Distance;
+
+  int dims;
+
+  int operator()(const uchar *a, const uchar *b, int) const {
+    return ofpy3::hammingDistance(a, b, dims);
+  }
+};
+
+/**
+ * Chooses the centres (the leaders of the sequential pass) and assigns every
+ * descriptor to its nearest centre, the first on ties. Returns the
+ * assignment, and the centres' rows in centres.
+ */
+template <typename Metric>
+std::vector<int>
+assignClusters(const ofpy3::DescriptorStore &data, const Metric &metric,
+               typename Metric::Distance radius,
+               std::vector<typename Metric::Element> &centres) {
+  typedef typename Metric::Element Element;
+  typedef typename Metric::Distance Distance;
+  const int numDescs = static_cast<int>(data.rows());
+  const int dims = metric.dims;
+
+  // Whether any of centres [first, last) is within radius of descriptor.
+  auto covered = [&](const Element *descriptor, int first, int last) {
+    for (int j = first; j < last; ++j) {
+      if (metric(descriptor, &centres[j * dims], radius) <= radius) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  centres.assign(data.ptr<Element>(0), data.ptr<Element>(0) + dims);
+  int numCentres = 1;
+  std::vector<char> isCovered(BATCH_SIZE);
+  for (int start = 1; start < numDescs; start += BATCH_SIZE) {
+    const int end = std::min(numDescs, start + BATCH_SIZE);
+    const int knownCentres = numCentres;
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int i = start; i < end; ++i) {
+      isCovered[i - start] = covered(data.ptr<Element>(i), 0, knownCentres);
+    }
+    // Only the centres this batch added remain to be checked, in order.
+    for (int i = start; i < end; ++i) {
+      if (!isCovered[i - start] &&
+          !covered(data.ptr<Element>(i), knownCentres, numCentres)) {
+        centres.insert(centres.end(), data.ptr<Element>(i),
+                       data.ptr<Element>(i) + dims);
+        ++numCentres;
+      }
+    }
+  }
+
+  std::vector<int> assignment(numDescs);
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < numDescs; ++i) {
+    const Element *descriptor = data.ptr<Element>(i);
+    Distance minDist = std::numeric_limits<Distance>::max();
+    int index = 0;
+    for (int j = 0; j < numCentres; ++j) {
+      const Distance dist = metric(descriptor, &centres[j * dims], minDist);
+      if (dist < minDist) {
+        minDist = dist;
+        index = j;
+      }
+    }
+    assignment[i] = index;
+  }
+  return assignment;
+}
+
+// Groups the descriptors by cluster: cluster j's members are
+// members[clusterStart[j], clusterStart[j + 1]).
+void groupClusters(const std::vector<int> &assignment, int numClusters,
+                   std::vector<int> &clusterStart, std::vector<int> &members) {
+  clusterStart.assign(numClusters + 1, 0);
+  for (int cluster : assignment) {
+    ++clusterStart[cluster + 1];
+  }
+  for (int j = 0; j < numClusters; ++j) {
+    clusterStart[j + 1] += clusterStart[j];
+  }
+  members.resize(assignment.size());
+  std::vector<int> fill(clusterStart.begin(), clusterStart.end() - 1);
+  for (std::size_t i = 0; i < assignment.size(); ++i) {
+    members[fill[assignment[i]]++] = static_cast<int>(i);
+  }
+}
+
+} // namespace
+
+cv::Mat ofpy3::clusterVocabulary(const DescriptorStore &descriptors,
+                                 double clusterSize) {
+  CV_Assert(!descriptors.empty());
+  // Distances are computed in float, convert other descriptor types chunk by
+  // chunk.
+  DescriptorStore converted;
+  if (descriptors.type() != CV_32F) {
+    descriptors.convertTo(converted, CV_32F);
+  }
+  const DescriptorStore &data =
+      descriptors.type() == CV_32F ? descriptors : converted;
+  const int dims = data.cols();
+
+  L2Metric metric;
+  metric.dims = dims;
+  // A negative cluster size makes every descriptor a centre, as before.
+  const float radius2 =
+      clusterSize < 0 ? -1.f : static_cast<float>(clusterSize * clusterSize);
+  std::vector<float> centres;
+  std::vector<int> assignment = assignClusters(data, metric, radius2, centres);
+  const int numCentres = static_cast<int>(centres.size()) / dims;
+
+  std::vector<int> clusterStart, members;
+  groupClusters(assignment, numCentres, clusterStart, members);
+
+  cv::Mat vocabulary(numCentres, dims, CV_32F);
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int j = 0; j < numCentres; ++j) {
+    std::vector<double> sum(dims, 0.0);
+    for (int m = clusterStart[j]; m < clusterStart[j + 1]; ++m) {
+      const float *descriptor = data.ptr<float>(members[m]);
+      for (int d = 0; d < dims; ++d) {
+        sum[d] += descriptor[d];
+      }
+    }
+    const double count = clusterStart[j + 1] - clusterStart[j];
+    float *word = vocabulary.ptr<float>(j);
+    for (int d = 0; d < dims; ++d) {
+      // A cluster can only be empty when its centre duplicates an earlier
+      // one (with a negative cluster size), keep the centre then.
+      word[d] = count > 0 ? static_cast<float>(sum[d] / count)
+                          : centres[j * dims + d];
+    }
+  }
+  return vocabulary;
+}
+
+cv::Mat ofpy3::clusterBinaryVocabulary(const DescriptorStore &descriptors,
+                                       double clusterSize) {
+  CV_Assert(!descriptors.empty());
+  CV_Assert(descriptors.type() == CV_8U);
+  const int bytes = descriptors.cols();
+
+  HammingMetric metric;
+  metric.dims = bytes;
+  const int radius = clusterSize < 0 ? -1 : static_cast<int>(clusterSize);
+  std::vector<uchar> centres;
+  std::vector<int> assignment =
+      assignClusters(descriptors, metric, radius, centres);
+  const int numCentres = static_cast<int>(centres.size()) / bytes;
+
+  std::vector<int> clusterStart, members;
+  groupClusters(assignment, numCentres, clusterStart, members);
+
+  cv::Mat vocabulary(numCentres, bytes, CV_8U);
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int j = 0; j < numCentres; ++j) {
+    const int count = clusterStart[j + 1] - clusterStart[j];
+    uchar *word = vocabulary.ptr<uchar>(j);
+    if (count == 0) {
+      std::copy(&centres[j * bytes], &centres[j * bytes] + bytes, word);
+      continue;
+    }
+    // Each bit of the word is the majority vote of the cluster's members.
+    std::vector<int> votes(bytes * 8, 0);
+    for (int m = clusterStart[j]; m < clusterStart[j + 1]; ++m) {
+      const uchar *descriptor = descriptors.ptr<uchar>(members[m]);
+      for (int b = 0; b < bytes * 8; ++b) {
+        votes[b] += (descriptor[b / 8] >> (b % 8)) & 1;
+      }
+    }
+    for (int d = 0; d < bytes; ++d) {
+      uchar packed = 0;
+      for (int bit = 0; bit < 8; ++bit) {
+        if (2 * votes[d * 8 + bit] > count) {
+          packed |= static_cast<uchar>(1 << bit);
+        }
+      }
+      word[d] = packed;
+    }
+  }
+  return vocabulary;
+}
@@ -0,0 +1,36 @@
+#ifndef VOCABULARY_CLUSTERER_H
+#define VOCABULARY_CLUSTERER_H
+
+#include "DescriptorStore.h"
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * Clusters descriptors into vocabulary words with the semantics of
+ * of2::BOWMSCTrainer::cluster: in order, a descriptor further than
+ * clusterSize (Euclidean) from every centre so far becomes a new centre,
+ * then every descriptor is assigned to its nearest centre and the words are
+ * the cluster means.
+ *
+ * Descriptors are processed in batches. Each batch is tested against the
+ * centres from earlier batches in parallel, and only the descriptors that no
+ * centre covers are merged serially, so the centres are the ones the
+ * sequential pass would choose. Assignment and averaging run in parallel too.
+ * The words are returned as CV_32F.
+ */
+cv::Mat clusterVocabulary(const DescriptorStore &descriptors,
+                          double clusterSize);
+
+/**
+ * The same clustering for binary (CV_8U, packed bits) descriptors such as
+ * ORB or BRIEF: clusterSize is a Hamming distance in bits, and each word is
+ * the bitwise majority of its cluster (as in k-majority), so the words stay
+ * packed bits.
+ */
+cv::Mat clusterBinaryVocabulary(const DescriptorStore &descriptors,
+                                double clusterSize);
+
+} // namespace ofpy3
+
+#endif // VOCABULARY_CLUSTERER_H
@@ -0,0 +1,342 @@
+#include "VocabularyTree.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+
+namespace {
+
+// Columns of the node table
+const int FIRST_CHILD = 0;
+const int NUM_CHILDREN = 1;
+const int CENTRE = 2;
+
+// Below this many descriptors a node is clustered on one thread.
+const int PARALLEL_MIN = 1024;
+
+float squaredDistance(const float *a, const float *b, int dims) {
+  float sum = 0.f;
+  for (int d = 0; d < dims; ++d) {
+    const float diff = a[d] - b[d];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+/**
+ * Builds the tree depth first, so that the leaves (and so the word ids) come
+ * out in depth first order. Each node's descriptors are clustered with
+ * k-means (k-means++ seeding), and only the member lists of the nodes still
+ * to be split are held at any time.
+ */
+class TreeBuilder {
+public:
+  TreeBuilder(const ofpy3::DescriptorStore &data, int branching, int depth,
+              int iterations, std::uint64_t seed)
+      : data(data), dims(data.cols()), branching(branching), depth(depth),
+        iterations(iterations), rng(seed) {}
+
+  void build() {
+    const int numDescs = static_cast<int>(data.rows());
+    std::vector<int> members(numDescs);
+    std::vector<double> sum(dims, 0.0);
+    for (int i = 0; i < numDescs; ++i) {
+      members[i] = i;
+      const float *descriptor = data.ptr<float>(i);
+      for (int d = 0; d < dims; ++d) {
+        sum[d] += descriptor[d];
+      }
+    }
+    std::vector<float> mean(dims);
+    for (int d = 0; d < dims; ++d) {
+      mean[d] = static_cast<float>(sum[d] / numDescs);
+    }
+    nodes.assign(3, 0);
+    split(0, std::move(members), mean.data(), 0);
+  }
+
+  std::vector<int> nodes;
+  std::vector<float> centres;
+  std::vector<float> words;
+
+private:
+  void split(int node, std::vector<int> members, const float *centre,
+             int level) {
+    std::vector<float> childCentres;
+    std::vector<int> assignment;
+    int numChildren = 0;
+    if (level < depth && static_cast<int>(members.size()) > branching) {
+      numChildren = cluster(members, childCentres, assignment);
+    }
+
+    if (numChildren < 2) {
+      nodes[node * 3 + CENTRE] = static_cast<int>(words.size()) / dims;
+      words.insert(words.end(), centre, centre + dims);
+      return;
+    }
+
+    nodes[node * 3 + CENTRE] = static_cast<int>(centres.size()) / dims;
+    centres.insert(centres.end(), centre, centre + dims);
+    const int firstChild = static_cast<int>(nodes.size()) / 3;
+    nodes[node * 3 + FIRST_CHILD] = firstChild;
+    nodes[node * 3 + NUM_CHILDREN] = numChildren;
+    nodes.resize(nodes.size() + 3 * numChildren, 0);
+
+    std::vector<std::vector<int>> childMembers(numChildren);
+    for (std::size_t m = 0; m < members.size(); ++m) {
+      childMembers[assignment[m]].push_back(members[m]);
+    }
+    std::vector<int>().swap(members);
+    for (int c = 0; c < numChildren; ++c) {
+      split(firstChild + c, std::move(childMembers[c]),
+            &childCentres[c * dims], level + 1);
+    }
+  }
+
+  /**
+   * k-means over members into at most branching clusters. Returns the
+   * number of (non-empty) clusters, their centres and each member's
+   * cluster. On return every member is assigned to its nearest centre.
+   */
+  int cluster(const std::vector<int> &members, std::vector<float> &clusterCentres,
+              std::vector<int> &assignment) {
+    const int n = static_cast<int>(members.size());
+
+    // k-means++ seeding
+    clusterCentres.clear();
+    std::vector<float> minDist(n, std::numeric_limits<float>::max());
+    int seed = static_cast<int>(rng() % static_cast<std::uint64_t>(n));
+    int k = 0;
+    while (true) {
+      const float *chosen = data.ptr<float>(members[seed]);
+      clusterCentres.insert(clusterCentres.end(), chosen, chosen + dims);
+      ++k;
+      double total = 0.0;
+#pragma omp parallel for reduction(+ : total) if (n >= PARALLEL_MIN)
+      for (int m = 0; m < n; ++m) {
+        minDist[m] = std::min(
+            minDist[m],
+            squaredDistance(data.ptr<float>(members[m]), chosen, dims));
+        total += minDist[m];
+      }
+      // Stop early if every descriptor already coincides with a centre.
+      if (k == branching || total <= 0.0) {
+        break;
+      }
+      double target = std::uniform_real_distribution<double>(0.0, total)(rng);
+      seed = n - 1;
+      for (int m = 0; m < n; ++m) {
+        target -= minDist[m];
+        if (target < 0.0) {
+          seed = m;
+          break;
+        }
+      }
+    }
+
+    auto assign = [&]() {
+      int changed = 0;
+#pragma omp parallel for reduction(+ : changed) if (n >= PARALLEL_MIN)
+      for (int m = 0; m < n; ++m) {
+        const float *descriptor = data.ptr<float>(members[m]);
+        float best = std::numeric_limits<float>::max();
+        int nearest = 0;
+        for (int c = 0; c < k; ++c) {
+          const float dist =
+              squaredDistance(descriptor, &clusterCentres[c * dims], dims);
+          if (dist < best) {
+            best = dist;
+            nearest = c;
+          }
+        }
+        if (assignment[m] != nearest) {
+          assignment[m] = nearest;
+          ++changed;
+        }
+      }
+      return changed;
+    };
+
+    assignment.assign(n, -1);
+    assign();
+    for (int it = 0; it < iterations; ++it) {
+      // Move the centres to their clusters' means (empty ones stay put),
+      // accumulated in one pass over the members...
+      std::vector<double> sum(static_cast<std::size_t>(k) * dims, 0.0);
+      std::vector<int> count(k, 0);
+      for (int m = 0; m < n; ++m) {
+        const float *descriptor = data.ptr<float>(members[m]);
+        double *clusterSum = &sum[static_cast<std::size_t>(assignment[m]) * dims];
+        for (int d = 0; d < dims; ++d) {
+          clusterSum[d] += descriptor[d];
+        }
+        ++count[assignment[m]];
+      }
+      for (int c = 0; c < k; ++c) {
+        if (count[c] > 0) {
+          for (int d = 0; d < dims; ++d) {
+            clusterCentres[c * dims + d] =
+                static_cast<float>(sum[c * dims + d] / count[c]);
+          }
+        }
+      }
+      // ...and reassign, until nothing moves.
+      if (assign() == 0) {
+        break;
+      }
+    }
+
+    // Drop the empty clusters
+    std::vector<int> remap(k, -1);
+    for (int m = 0; m < n; ++m) {
+      remap[assignment[m]] = 0;
+    }
+    int numClusters = 0;
+    for (int c = 0; c < k; ++c) {
+      if (remap[c] == 0) {
+        std::copy(&clusterCentres[c * dims], &clusterCentres[c * dims] + dims,
+                  &clusterCentres[numClusters * dims]);
+        remap[c] = numClusters++;
+      }
+    }
+    clusterCentres.resize(numClusters * dims);
+    for (int m = 0; m < n; ++m) {
+      assignment[m] = remap[assignment[m]];
+    }
+    return numClusters;
+  }
+
+private:
+  const ofpy3::DescriptorStore &data;
+  int dims;
+  int branching;
+  int depth;
+  int iterations;
+  std::mt19937_64 rng;
+};
+
+cv::Mat toMat(const std::vector<float> &values, int cols) {
+  cv::Mat mat(static_cast<int>(values.size()) / cols, cols, CV_32F);
+  std::copy(values.begin(), values.end(), mat.ptr<float>(0));
+  return mat;
+}
+
+} // namespace
+
+// ----------------- VocabularyTree -----------------
+
+ofpy3::VocabularyTree::VocabularyTree(cv::Mat words, cv::Mat centres,
+                                      cv::Mat nodes)
+    : words(std::move(words)), centres(std::move(centres)),
+      nodes(std::move(nodes)) {
+  CV_Assert(!this->words.empty() && this->words.type() == CV_32F);
+  CV_Assert(this->centres.empty() || (this->centres.type() == CV_32F &&
+                                      this->centres.cols == this->words.cols));
+  CV_Assert(!this->nodes.empty() && this->nodes.type() == CV_32S &&
+            this->nodes.cols == 3);
+  // Children always follow their parent, so a descent cannot loop, and every
+  // centre must exist.
+  for (int i = 0; i < this->nodes.rows; ++i) {
+    const int *node = this->nodes.ptr<int>(i);
+    CV_Assert(node[NUM_CHILDREN] >= 0);
+    if (node[NUM_CHILDREN] == 0) {
+      CV_Assert(node[CENTRE] >= 0 && node[CENTRE] < this->words.rows);
+    } else {
+      CV_Assert(node[FIRST_CHILD] > i &&
+                node[NUM_CHILDREN] <= this->nodes.rows - node[FIRST_CHILD]);
+      CV_Assert(node[CENTRE] >= 0 && node[CENTRE] < this->centres.rows);
+    }
+  }
+}
+
+std::shared_ptr<ofpy3::VocabularyTree>
+ofpy3::VocabularyTree::build(const DescriptorStore &descriptors, int branching,
+                             int depth, int iterations, std::uint64_t seed) {
+  CV_Assert(!descriptors.empty());
+  CV_Assert(branching >= 2 && depth >= 1);
+  DescriptorStore converted;
+  if (descriptors.type() != CV_32F) {
+    descriptors.convertTo(converted, CV_32F);
+  }
+  const DescriptorStore &data =
+      descriptors.type() == CV_32F ? descriptors : converted;
+
+  TreeBuilder builder(data, branching, depth, iterations, seed);
+  builder.build();
+
+  cv::Mat nodes(static_cast<int>(builder.nodes.size()) / 3, 3, CV_32S);
+  std::copy(builder.nodes.begin(), builder.nodes.end(), nodes.ptr<int>(0));
+  cv::Mat centres;
+  if (!builder.centres.empty()) {
+    centres = toMat(builder.centres, data.cols());
+  }
+  return std::make_shared<VocabularyTree>(toMat(builder.words, data.cols()),
+                                          centres, nodes);
+}
+
+std::vector<int>
+ofpy3::VocabularyTree::quantize(const cv::Mat &descriptors,
+                                int searchWidth) const {
+  CV_Assert(descriptors.type() == CV_32F && descriptors.cols == words.cols);
+  searchWidth = std::max(1, searchWidth);
+
+  std::vector<int> nearestWords(descriptors.rows);
+#pragma omp parallel
+  {
+    std::vector<std::pair<float, int>> beam, next;
+#pragma omp for schedule(static)
+    for (int i = 0; i < descriptors.rows; i++) {
+      nearestWords[i] =
+          nearestWord(descriptors.ptr<float>(i), searchWidth, beam, next);
+    }
+  }
+  return nearestWords;
+}
+
+/**
+ * Beam search down the tree: the children of the nodes in the beam are
+ * scored, leaves compete for the nearest word and the searchWidth closest
+ * internal nodes form the next beam.
+ */
+int ofpy3::VocabularyTree::nearestWord(
+    const float *descriptor, int searchWidth,
+    std::vector<std::pair<float, int>> &beam,
+    std::vector<std::pair<float, int>> &next) const {
+  const int dims = words.cols;
+  const int *root = nodes.ptr<int>(0);
+  if (root[NUM_CHILDREN] == 0) {
+    return root[CENTRE];
+  }
+
+  float bestDist = std::numeric_limits<float>::max();
+  int bestWord = 0;
+  beam.assign(1, std::make_pair(0.f, 0));
+  while (!beam.empty()) {
+    next.clear();
+    for (const std::pair<float, int> &entry : beam) {
+      const int *node = nodes.ptr<int>(entry.second);
+      const int end = node[FIRST_CHILD] + node[NUM_CHILDREN];
+      for (int c = node[FIRST_CHILD]; c < end; ++c) {
+        const int *child = nodes.ptr<int>(c);
+        if (child[NUM_CHILDREN] == 0) {
+          const float dist = squaredDistance(
+              descriptor, words.ptr<float>(child[CENTRE]), dims);
+          if (dist < bestDist) {
+            bestDist = dist;
+            bestWord = child[CENTRE];
+          }
+        } else {
+          next.push_back(std::make_pair(
+              squaredDistance(descriptor, centres.ptr<float>(child[CENTRE]),
+                              dims),
+              c));
+        }
+      }
+    }
+    if (static_cast<int>(next.size()) > searchWidth) {
+      std::nth_element(next.begin(), next.begin() + searchWidth, next.end());
+      next.resize(searchWidth);
+    }
+    beam.swap(next);
+  }
+  return bestWord;
+}
@@ -0,0 +1,61 @@
+#ifndef VOCABULARY_TREE_H
+#define VOCABULARY_TREE_H
+
+#include "DescriptorStore.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+
+/**
+ * A hierarchical k-means vocabulary tree over float descriptors. Each
+ * internal node splits its descriptors into (at most) branching clusters,
+ * down to depth levels, and the leaves are the vocabulary words. Word ids
+ * are the leaves in depth first order, and the vocabulary matrix holds the
+ * leaf centres in that order, so the words are used downstream exactly as a
+ * flat vocabulary's are.
+ *
+ * Quantizing a descriptor descends the tree keeping the searchWidth closest
+ * nodes at each level, which takes O(searchWidth * branching * depth)
+ * distances rather than one per word. A width of 1 is the classic greedy
+ * descent; wider searches recover more of the exact nearest words, and a
+ * width no smaller than the number of leaves gives the exact search.
+ */
+class VocabularyTree {
+public:
+  /**
+   * words is the vocabulary (leaf centres, CV_32F), centres the internal
+   * node centres (CV_32F) and nodes one CV_32S row per node of
+   * (first child, number of children, centre row or, for a leaf, word id).
+   * Node 0 is the root, and each node's children are consecutive.
+   */
+  VocabularyTree(cv::Mat words, cv::Mat centres, cv::Mat nodes);
+
+  static std::shared_ptr<VocabularyTree>
+  build(const DescriptorStore &descriptors, int branching, int depth,
+        int iterations, std::uint64_t seed);
+
+  cv::Mat getWords() const { return words; }
+  cv::Mat getCentres() const { return centres; }
+  cv::Mat getNodes() const { return nodes; }
+
+  // The word for each row of descriptors (CV_32F).
+  std::vector<int> quantize(const cv::Mat &descriptors, int searchWidth) const;
+
+private:
+  int nearestWord(const float *descriptor, int searchWidth,
+                  std::vector<std::pair<float, int>> &beam,
+                  std::vector<std::pair<float, int>> &next) const;
+
+private:
+  cv::Mat words;
+  cv::Mat centres;
+  cv::Mat nodes;
+};
+
+} // namespace ofpy3
+
+#endif // VOCABULARY_TREE_H
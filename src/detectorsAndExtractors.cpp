@@ -6,112 +6,157 @@
 
 // ------------------- DETECTORS -------------------
 
-cv::Ptr<cv::FeatureDetector> createSTAR(const pybind11::dict &settings) {
+cv::Ptr<cv::FeatureDetector> createSTAR(const ofpy3::Settings &settings) {
   int maxSize = 32;
   int responseThreshold = 30;
   int lineThreshold = 10;
   int lineBinarized = 8;
   int suppressNonmaxSize = 5;
 
-  if (settings.contains("MaxSize")) {
-    maxSize = settings["MaxSize"].cast<int>();
-  }
-  if (settings.contains("Response")) {
-    responseThreshold = settings["Response"].cast<int>();
-  }
-  if (settings.contains("LineThreshold")) {
-    lineThreshold = settings["LineThreshold"].cast<int>();
-  }
-  if (settings.contains("LineBinarized")) {
-    lineBinarized = settings["LineBinarized"].cast<int>();
-  }
-  if (settings.contains("Suppression")) {
-    suppressNonmaxSize = settings["Suppression"].cast<int>();
-  }
+  maxSize = settings.get<int>("MaxSize", maxSize);
+  responseThreshold = settings.get<int>("Response", responseThreshold);
+  lineThreshold = settings.get<int>("LineThreshold", lineThreshold);
+  lineBinarized = settings.get<int>("LineBinarized", lineBinarized);
+  suppressNonmaxSize = settings.get<int>("Suppression", suppressNonmaxSize);
 
   return cv::makePtr<cv::StarFeatureDetector>(maxSize, responseThreshold,
                                               lineThreshold, lineBinarized,
                                               suppressNonmaxSize);
 }
 
-cv::Ptr<cv::FeatureDetector> createFAST(const pybind11::dict &settings) {
+cv::Ptr<cv::FeatureDetector> createFAST(const ofpy3::Settings &settings) {
   int threshold = 10;
   bool nonmaxSuppression = true;
 
-  if (settings.contains("Threshold")) {
-    threshold = settings["Threshold"].cast<int>();
-  }
-  if (settings.contains("NonMaxSuppression")) {
-    nonmaxSuppression = settings["NonMaxSuppression"].cast<bool>();
-  }
+  threshold = settings.get<int>("Threshold", threshold);
+  nonmaxSuppression =
+      settings.get<bool>("NonMaxSuppression", nonmaxSuppression);
 
   return cv::makePtr<cv::FastFeatureDetector>(threshold, nonmaxSuppression);
 }
 
-cv::Ptr<cv::FeatureDetector> createSURF(const pybind11::dict &settings) {
+#ifdef OPENCV2P4
+// SURF, SIFT and ORB are cv::Feature2D, which detect and extract in one pass.
+
+cv::Ptr<cv::SURF> makeSURF(const ofpy3::Settings &settings) {
   double hessianThreshold = 400;
   int nOctaves = 4;
   int nOctaveLayers = 2;
   bool extended = true;
   bool upright = false;
 
-  if (settings.contains("HessianThreshold")) {
-    hessianThreshold = settings["HessianThreshold"].cast<double>();
-  }
-  if (settings.contains("NumOctaves")) {
-    nOctaves = settings["NumOctaves"].cast<int>();
-  }
-  if (settings.contains("NumOctaveLayers")) {
-    nOctaveLayers = settings["NumOctaveLayers"].cast<int>();
-  }
-  if (settings.contains("Extended")) {
-    extended = settings["Extended"].cast<bool>();
-  }
-  if (settings.contains("Upright")) {
-    upright = settings["Upright"].cast<bool>();
-  }
+  hessianThreshold = settings.get<double>("HessianThreshold", hessianThreshold);
+  nOctaves = settings.get<int>("NumOctaves", nOctaves);
+  nOctaveLayers = settings.get<int>("NumOctaveLayers", nOctaveLayers);
+  extended = settings.get<bool>("Extended", extended);
+  upright = settings.get<bool>("Upright", upright);
 
-#ifdef OPENCV2P4
   return cv::makePtr<cv::SURF>(hessianThreshold, nOctaves, nOctaveLayers,
                                extended, upright);
-#else
-  return cv::makePtr<cv::SurfFeatureDetector>(hessianThreshold, nOctaves,
-                                              nOctaveLayers, upright);
-#endif
 }
 
-cv::Ptr<cv::FeatureDetector> createSIFT(const pybind11::dict &settings) {
+cv::Ptr<cv::SIFT> makeSIFT(const ofpy3::Settings &settings) {
   int numFeatures = 0;
   int nOctaveLayers = 3;
   double contrastThreshold = 0.04;
   double edgeThreshold = 10;
   double sigma = 1.6;
 
-  if (settings.contains("NumFeatures")) {
-    numFeatures = settings["NumFeatures"].cast<int>();
-  }
-  if (settings.contains("NumOctaveLayers")) {
-    nOctaveLayers = settings["NumOctaveLayers"].cast<int>();
-  }
-  if (settings.contains("ContrastThreshold")) {
-    contrastThreshold = settings["ContrastThreshold"].cast<double>();
-  }
-  if (settings.contains("EdgeThreshold")) {
-    edgeThreshold = settings["EdgeThreshold"].cast<double>();
-  }
-  if (settings.contains("Sigma")) {
-    sigma = settings["Sigma"].cast<double>();
-  }
+  numFeatures = settings.get<int>("NumFeatures", numFeatures);
+  nOctaveLayers = settings.get<int>("NumOctaveLayers", nOctaveLayers);
+  contrastThreshold =
+      settings.get<double>("ContrastThreshold", contrastThreshold);
+  edgeThreshold = settings.get<double>("EdgeThreshold", edgeThreshold);
+  sigma = settings.get<double>("Sigma", sigma);
 
-#ifdef OPENCV2P4
   return cv::makePtr<cv::SIFT>(numFeatures, nOctaveLayers, contrastThreshold,
                                edgeThreshold, sigma);
+}
+
+// With every option of the ORB extractor.
+cv::Ptr<cv::ORB> makeORB(const ofpy3::Settings &settings) {
+  int numFeatures = 500;
+  double scaleFactor = 1.2;
+  int numLevels = 8;
+  int edgeThreshold = 31;
+  int WTA_K = 2;
+  int patchSize = 31;
+
+  numFeatures = settings.get<int>("NumFeatures", numFeatures);
+  scaleFactor = settings.get<double>("ScaleFactor", scaleFactor);
+  numLevels = settings.get<int>("NumLevels", numLevels);
+  edgeThreshold = settings.get<int>("EdgeThreshold", edgeThreshold);
+  WTA_K = settings.get<int>("WTA_K", WTA_K);
+  patchSize = settings.get<int>("PatchSize", patchSize);
+  // With 3 or 4 points each descriptor element is a 2 bit index rather than
+  // a bit, which Hamming matching over the bytes does not measure.
+  if (WTA_K != 2) {
+    CV_Error(CV_StsBadArg, "OrbDetector WTA_K must be 2, got " +
+                               std::to_string(WTA_K));
+  }
+
+  return cv::makePtr<cv::ORB>(numFeatures, static_cast<float>(scaleFactor),
+                              numLevels, edgeThreshold, 0, WTA_K,
+                              cv::ORB::HARRIS_SCORE, patchSize);
+}
+#endif
+
+cv::Ptr<cv::FeatureDetector> createSURF(const ofpy3::Settings &settings) {
+#ifdef OPENCV2P4
+  return makeSURF(settings);
 #else
+  double hessianThreshold = 400;
+  int nOctaves = 4;
+  int nOctaveLayers = 2;
+  bool extended = true;
+  bool upright = false;
+
+  hessianThreshold = settings.get<double>("HessianThreshold", hessianThreshold);
+  nOctaves = settings.get<int>("NumOctaves", nOctaves);
+  nOctaveLayers = settings.get<int>("NumOctaveLayers", nOctaveLayers);
+  extended = settings.get<bool>("Extended", extended);
+  upright = settings.get<bool>("Upright", upright);
+
+  return cv::makePtr<cv::SurfFeatureDetector>(hessianThreshold, nOctaves,
+                                              nOctaveLayers, upright);
+#endif
+}
+
+cv::Ptr<cv::FeatureDetector> createSIFT(const ofpy3::Settings &settings) {
+#ifdef OPENCV2P4
+  return makeSIFT(settings);
+#else
+  double contrastThreshold = 0.04;
+  double edgeThreshold = 10;
+
+  contrastThreshold =
+      settings.get<double>("ContrastThreshold", contrastThreshold);
+  edgeThreshold = settings.get<double>("EdgeThreshold", edgeThreshold);
+
   return cv::makePtr<cv::SiftFeatureDetector>(contrastThreshold, edgeThreshold);
 #endif
 }
 
-cv::Ptr<cv::FeatureDetector> createMSER(const pybind11::dict &settings) {
+cv::Ptr<cv::FeatureDetector> createORB(const ofpy3::Settings &settings) {
+  int numFeatures = 500;
+  double scaleFactor = 1.2;
+  int numLevels = 8;
+  int edgeThreshold = 31;
+
+  numFeatures = settings.get<int>("NumFeatures", numFeatures);
+  scaleFactor = settings.get<double>("ScaleFactor", scaleFactor);
+  numLevels = settings.get<int>("NumLevels", numLevels);
+  edgeThreshold = settings.get<int>("EdgeThreshold", edgeThreshold);
+
+#ifdef OPENCV2P4
+  return cv::makePtr<cv::ORB>(numFeatures, static_cast<float>(scaleFactor),
+                              numLevels, edgeThreshold);
+#else
+  return cv::makePtr<cv::OrbFeatureDetector>(numFeatures);
+#endif
+}
+
+cv::Ptr<cv::FeatureDetector> createMSER(const ofpy3::Settings &settings) {
   int delta = 5;
   int minArea = 60;
   int maxArea = 14400;
@@ -122,33 +167,15 @@ cv::Ptr<cv::FeatureDetector> createMSER(const pybind11::dict &settings) {
   double minMargin = 0.003;
   int edgeBlurSize = 5;
 
-  if (settings.contains("Delta")) {
-    delta = settings["Delta"].cast<int>();
-  }
-  if (settings.contains("MinArea")) {
-    minArea = settings["MinArea"].cast<int>();
-  }
-  if (settings.contains("MaxArea")) {
-    maxArea = settings["MaxArea"].cast<int>();
-  }
-  if (settings.contains("MaxVariation")) {
-    maxVariation = settings["MaxVariation"].cast<double>();
-  }
-  if (settings.contains("MinDiversity")) {
-    minDiversity = settings["MinDiversity"].cast<double>();
-  }
-  if (settings.contains("MaxEvolution")) {
-    maxEvolution = settings["MaxEvolution"].cast<double>();
-  }
-  if (settings.contains("AreaThreshold")) {
-    areaThreshold = settings["AreaThreshold"].cast<double>();
-  }
-  if (settings.contains("MinMargin")) {
-    minMargin = settings["MinMargin"].cast<double>();
-  }
-  if (settings.contains("EdgeBlurSize")) {
-    edgeBlurSize = settings["EdgeBlurSize"].cast<int>();
-  }
+  delta = settings.get<int>("Delta", delta);
+  minArea = settings.get<int>("MinArea", minArea);
+  maxArea = settings.get<int>("MaxArea", maxArea);
+  maxVariation = settings.get<double>("MaxVariation", maxVariation);
+  minDiversity = settings.get<double>("MinDiversity", minDiversity);
+  maxEvolution = settings.get<double>("MaxEvolution", maxEvolution);
+  areaThreshold = settings.get<double>("AreaThreshold", areaThreshold);
+  minMargin = settings.get<double>("MinMargin", minMargin);
+  edgeBlurSize = settings.get<int>("EdgeBlurSize", edgeBlurSize);
 
   return cv::makePtr<cv::MserFeatureDetector>(
       delta, minArea, maxArea, maxVariation, minDiversity, maxEvolution,
@@ -156,34 +183,27 @@ cv::Ptr<cv::FeatureDetector> createMSER(const pybind11::dict &settings) {
 }
 
 /**
- * Generates a feature detector based on options in the settings dict.
+ * Generates a feature detector based on the settings.
  * Does some fiddling for the setttings structure.
  * Will work with no settings specified, defaults to a STAR detector in STATIC
  * detector mode. Individual detector settings default to as in the OpenCV
  * documentation, or as in the sample openFABMAP settings where no OpenCV
  * default.
  *
- * @param settings A Python dict of settings, the full settings object.
+ * @param settings The full settings.
  * @return A cv::FeatureDetector pointer, as a cv::Ptr (for OpenCV
  * compatibility)
  */
 cv::Ptr<cv::FeatureDetector>
-ofpy3::generateDetector(const pybind11::dict &settings) {
+ofpy3::generateDetector(const Settings &settings) {
   // Get the feature settings
-  pybind11::dict featureOptions;
-  if (settings.contains("FeatureOptions")) {
-    featureOptions = settings["FeatureOptions"];
-  }
+  const Settings featureOptions = settings.section("FeatureOptions");
 
   // Read the settings, with default values.
   std::string detectorMode = "STATIC";
   std::string detectorType = "STAR";
-  if (featureOptions.contains("DetectorMode")) {
-    detectorMode = featureOptions["DetectorMode"].cast<std::string>();
-  }
-  if (featureOptions.contains("DetectorType")) {
-    detectorType = featureOptions["DetectorType"].cast<std::string>();
-  }
+  detectorMode = featureOptions.get<std::string>("DetectorMode", detectorMode);
+  detectorType = featureOptions.get<std::string>("DetectorType", detectorType);
 
   //
   if (detectorMode == "ADAPTIVE") {
@@ -195,155 +215,210 @@ ofpy3::generateDetector(const pybind11::dict &settings) {
     }
 
     // Get the settings for adaptive features
-    pybind11::dict adaptiveOptions;
-    if (featureOptions.contains("Adaptive")) {
-      adaptiveOptions = featureOptions["Adaptive"];
-    }
+    const Settings adaptiveOptions = featureOptions.section("Adaptive");
 
     // Defaults from the OpenCV documentation
     int minFeatures = 400;
     int maxFeatures = 500;
     int maxIters = 5;
-    if (adaptiveOptions.contains("MinFeatures")) {
-      minFeatures = adaptiveOptions["MinFeatures"].cast<int>();
+    minFeatures = adaptiveOptions.get<int>("MinFeatures", minFeatures);
+    maxFeatures = adaptiveOptions.get<int>("MaxFeatures", maxFeatures);
+    maxIters = adaptiveOptions.get<int>("MaxIters", maxIters);
+    if (minFeatures < 0) {
+      CV_Error(CV_StsBadArg, "Adaptive MinFeatures must not be negative, got " +
+                                 std::to_string(minFeatures));
     }
-    if (adaptiveOptions.contains("MaxFeatures")) {
-      maxFeatures = adaptiveOptions["MaxFeatures"].cast<int>();
+    if (maxFeatures < minFeatures) {
+      CV_Error(CV_StsBadArg,
+               "Adaptive MaxFeatures must be at least MinFeatures (" +
+                   std::to_string(minFeatures) + "), got " +
+                   std::to_string(maxFeatures));
     }
-    if (adaptiveOptions.contains("MaxIters")) {
-      maxIters = adaptiveOptions["MaxIters"].cast<int>();
+    if (maxIters <= 0) {
+      CV_Error(CV_StsBadArg, "Adaptive MaxIters must be positive, got " +
+                                 std::to_string(maxIters));
     }
-    return cv::makePtr<cv::DynamicAdaptedFeatureDetector>(
+    return cv::makePtr<WarmStartAdaptedFeatureDetector>(
         cv::AdjusterAdapter::create(detectorType), minFeatures, maxFeatures,
         maxIters);
 
   } else {
-    pybind11::dict detectorOptions;
     if (detectorType == "FAST") {
-      if (featureOptions.contains("FastDetector")) {
-        detectorOptions = featureOptions["FastDetector"];
-      }
-      return createFAST(detectorOptions);
+      return createFAST(featureOptions.section("FastDetector"));
     } else if (detectorType == "SURF") {
-      if (featureOptions.contains("SurfDetector")) {
-        detectorOptions = featureOptions["SurfDetector"];
-      }
-      return createSURF(detectorOptions);
+      return createSURF(featureOptions.section("SurfDetector"));
     } else if (detectorType == "SIFT") {
-      if (featureOptions.contains("SiftDetector")) {
-        detectorOptions = featureOptions["SiftDetector"];
-      }
-      return createSIFT(detectorOptions);
+      return createSIFT(featureOptions.section("SiftDetector"));
+    } else if (detectorType == "ORB") {
+      return createORB(featureOptions.section("OrbDetector"));
     } else if (detectorType == "MSER") {
-      if (featureOptions.contains("MSERDetector")) {
-        detectorOptions = featureOptions["MSERDetector"];
-      }
-      return createMSER(detectorOptions);
+      return createMSER(featureOptions.section("MSERDetector"));
     } else {
-      if (featureOptions.contains("StarDetector")) {
-        detectorOptions = featureOptions["StarDetector"];
-      }
-      return createSTAR(detectorOptions);
+      return createSTAR(featureOptions.section("StarDetector"));
     }
   }
 }
 
-// ------------------- EXTRACTORS -------------------
+ofpy3::WarmStartAdaptedFeatureDetector::WarmStartAdaptedFeatureDetector(
+    const cv::Ptr<cv::AdjusterAdapter> &adjuster, int minFeatures,
+    int maxFeatures, int maxIters)
+    : adjuster(adjuster), minFeatures(minFeatures), maxFeatures(maxFeatures),
+      maxIters(maxIters) {
+  CV_Assert(adjuster && minFeatures <= maxFeatures && maxIters > 0);
+}
 
-cv::Ptr<cv::DescriptorExtractor>
-createSIFTExtractor(const pybind11::dict &settings) {
-  int numFeatures = 0;
-  int nOctaveLayers = 3;
-  double contrastThreshold = 0.04;
-  double edgeThreshold = 10;
-  double sigma = 1.6;
+bool ofpy3::WarmStartAdaptedFeatureDetector::empty() const {
+  return !adjuster || adjuster->empty();
+}
 
-  if (settings.contains("NumFeatures")) {
-    numFeatures = settings["NumFeatures"].cast<int>();
-  }
-  if (settings.contains("NumOctaveLayers")) {
-    nOctaveLayers = settings["NumOctaveLayers"].cast<int>();
-  }
-  if (settings.contains("ContrastThreshold")) {
-    contrastThreshold = settings["ContrastThreshold"].cast<double>();
-  }
-  if (settings.contains("EdgeThreshold")) {
-    edgeThreshold = settings["EdgeThreshold"].cast<double>();
-  }
-  if (settings.contains("Sigma")) {
-    sigma = settings["Sigma"].cast<double>();
+void ofpy3::WarmStartAdaptedFeatureDetector::detectImpl(
+    const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints,
+    const cv::Mat &mask) const {
+  // Unlike cv::DynamicAdaptedFeatureDetector, adjust the adjuster itself
+  // rather than a clone, so the threshold carries over to the next frame.
+  // When the last pass misses the band the adjustment is still made, for the
+  // next frame to start from.
+  bool up = false;
+  bool down = false;
+  for (int iter = 0; iter < maxIters; ++iter) {
+    keypoints.clear();
+    adjuster->detect(image, keypoints, mask);
+    const int numFeatures = static_cast<int>(keypoints.size());
+    if (numFeatures >= minFeatures && numFeatures <= maxFeatures) {
+      break;
+    }
+
+    cv::Ptr<cv::AdjusterAdapter> previous = adjuster->clone();
+    if (numFeatures < minFeatures) {
+      up = true;
+      adjuster->tooFew(minFeatures, numFeatures);
+    } else {
+      down = true;
+      adjuster->tooMany(maxFeatures, numFeatures);
+    }
+    if (!adjuster->good()) {
+      // Past the threshold's limits. Stay at the last threshold within them:
+      // FastAdjuster does not clamp, and SurfAdjuster and StarAdjuster only
+      // clamp a lowered threshold at 1.1, so the state would otherwise drift
+      // further out with every frame that cannot reach the band.
+      adjuster = previous;
+      break;
+    }
+    if (up && down) {
+      // The band lies between two adjustment steps. Stop rather than
+      // oscillate, as cv::DynamicAdaptedFeatureDetector does, at the
+      // threshold that gave the keypoints returned.
+      adjuster = previous;
+      break;
+    }
   }
+}
+
+// ------------------- EXTRACTORS -------------------
 
+cv::Ptr<cv::DescriptorExtractor>
+createSIFTExtractor(const ofpy3::Settings &settings) {
 #ifdef OPENCV2P4
-  return cv::makePtr<cv::SIFT>(numFeatures, nOctaveLayers, contrastThreshold,
-                               edgeThreshold, sigma);
+  return makeSIFT(settings);
 #else
   return cv::makePtr<cv::SiftDescriptorExtractor>();
 #endif
 }
 
 cv::Ptr<cv::DescriptorExtractor>
-createSURFExtractor(const pybind11::dict &settings) {
-  double hessianThreshold = 400;
+createSURFExtractor(const ofpy3::Settings &settings) {
+#ifdef OPENCV2P4
+  return makeSURF(settings);
+#else
   int nOctaves = 4;
   int nOctaveLayers = 2;
   bool extended = true;
   bool upright = false;
 
-  if (settings.contains("HessianThreshold")) {
-    hessianThreshold = settings["HessianThreshold"].cast<double>();
-  }
-  if (settings.contains("NumOctaves")) {
-    nOctaves = settings["NumOctaves"].cast<int>();
-  }
-  if (settings.contains("NumOctaveLayers")) {
-    nOctaveLayers = settings["NumOctaveLayers"].cast<int>();
-  }
-  if (settings.contains("Extended")) {
-    extended = settings["Extended"].cast<bool>();
-  }
-  if (settings.contains("Upright")) {
-    upright = settings["Upright"].cast<bool>();
-  }
+  nOctaves = settings.get<int>("NumOctaves", nOctaves);
+  nOctaveLayers = settings.get<int>("NumOctaveLayers", nOctaveLayers);
+  extended = settings.get<bool>("Extended", extended);
+  upright = settings.get<bool>("Upright", upright);
 
-#ifdef OPENCV2P4
-  return cv::makePtr<cv::SURF>(hessianThreshold, nOctaves, nOctaveLayers,
-                               extended, upright);
-#else
   return cv::makePtr<cv::SurfDescriptorExtractor>(nOctaves, nOctaveLayers,
                                                   extended, upright);
 #endif
 }
 
+cv::Ptr<cv::DescriptorExtractor>
+createORBExtractor(const ofpy3::Settings &settings) {
+#ifdef OPENCV2P4
+  return makeORB(settings);
+#else
+  return cv::makePtr<cv::OrbDescriptorExtractor>();
+#endif
+}
+
+cv::Ptr<cv::DescriptorExtractor>
+createBRIEFExtractor(const ofpy3::Settings &settings) {
+  int bytes = 32;
+
+  bytes = settings.get<int>("Bytes", bytes);
+
+  return cv::makePtr<cv::BriefDescriptorExtractor>(bytes);
+}
+
 /**
  * Generates a feature detector based on options in the settings file
  *
- * @param settings A python dict of settings,
+ * @param settings The full settings.
  * @return
  */
 cv::Ptr<cv::DescriptorExtractor>
-ofpy3::generateExtractor(const pybind11::dict &settings) {
+ofpy3::generateExtractor(const Settings &settings) {
   // Get the feature settings
-  pybind11::dict featureOptions;
-  if (settings.contains("FeatureOptions")) {
-    featureOptions = settings["FeatureOptions"];
-  }
+  const Settings featureOptions = settings.section("FeatureOptions");
 
   std::string extractorType = "SURF";
-  if (featureOptions.contains("ExtractorType")) {
-    extractorType = featureOptions["ExtractorType"].cast<std::string>();
-  }
+  extractorType =
+      featureOptions.get<std::string>("ExtractorType", extractorType);
 
-  pybind11::dict detectorOptions;
   if (extractorType == "SIFT") {
-    if (featureOptions.contains("SiftDetector")) {
-      detectorOptions = featureOptions["SiftDetector"];
-    }
-    return createSIFTExtractor(detectorOptions);
+    return createSIFTExtractor(featureOptions.section("SiftDetector"));
+  } else if (extractorType == "ORB") {
+    return createORBExtractor(featureOptions.section("OrbDetector"));
+  } else if (extractorType == "BRIEF") {
+    return createBRIEFExtractor(featureOptions.section("BriefExtractor"));
   } else {
-    if (featureOptions.contains("SurfDetector")) {
-      detectorOptions = featureOptions["SurfDetector"];
+    return createSURFExtractor(featureOptions.section("SurfDetector"));
+  }
+}
+
+/**
+ * Generates a single cv::Feature2D that both detects and extracts, when the
+ * settings pick the same SURF, SIFT or ORB algorithm (in STATIC detector
+ * mode) for both. Its image pyramid and scale space are then built once per
+ * frame rather than once for each. A fused ORB takes every ORB option,
+ * including the extractor-only WTA_K and PatchSize.
+ *
+ * @param settings The full settings.
+ * @return The fused detector and extractor, or an empty pointer if the
+ * settings cannot be fused (or OpenCV predates cv::Feature2D).
+ */
+cv::Ptr<cv::Feature2D> ofpy3::generateFeature2D(const Settings &settings) {
+#ifdef OPENCV2P4
+  const Settings featureOptions = settings.section("FeatureOptions");
+  const std::string detectorMode =
+      featureOptions.get<std::string>("DetectorMode", "STATIC");
+  const std::string detectorType =
+      featureOptions.get<std::string>("DetectorType", "STAR");
+  const std::string extractorType =
+      featureOptions.get<std::string>("ExtractorType", "SURF");
+
+  if (detectorMode != "ADAPTIVE" && detectorType == extractorType) {
+    if (detectorType == "SURF") {
+      return makeSURF(featureOptions.section("SurfDetector"));
+    } else if (detectorType == "SIFT") {
+      return makeSIFT(featureOptions.section("SiftDetector"));
+    } else if (detectorType == "ORB") {
+      return makeORB(featureOptions.section("OrbDetector"));
     }
-    return createSURFExtractor(detectorOptions);
   }
-}
\ No newline at end of file
+#endif
+  return cv::Ptr<cv::Feature2D>();
+}
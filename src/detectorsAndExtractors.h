@@ -1,17 +1,49 @@
 #ifndef DETECTORS_AND_EXTRACTORS_H
 #define DETECTORS_AND_EXTRACTORS_H
 
-#include <Python.h>
+#include "Settings.h"
 #include <memory>
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
-
-#include <pybind11/pybind11.h>
+#include <vector>
 
 namespace ofpy3 {
-cv::Ptr<cv::FeatureDetector> generateDetector(const pybind11::dict &settings);
-cv::Ptr<cv::DescriptorExtractor>
-generateExtractor(const pybind11::dict &settings);
+
+/**
+ * Adjusts a detector's threshold until a frame gives between minFeatures and
+ * maxFeatures keypoints, as cv::DynamicAdaptedFeatureDetector does, but
+ * starts each frame from where the previous one left off rather than from
+ * the initial threshold. Consecutive video frames need nearly the same
+ * threshold, so most take a single detection pass. At most maxIters passes
+ * are made per frame, fewer if the threshold has to be both raised and
+ * lowered to reach the band; the last one's keypoints are kept either way.
+ *
+ * Not thread safe, the threshold changes on every detect.
+ */
+class WarmStartAdaptedFeatureDetector : public cv::FeatureDetector {
+public:
+  WarmStartAdaptedFeatureDetector(const cv::Ptr<cv::AdjusterAdapter> &adjuster,
+                                  int minFeatures, int maxFeatures,
+                                  int maxIters);
+
+  bool empty() const override;
+
+protected:
+  void detectImpl(const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints,
+                  const cv::Mat &mask = cv::Mat()) const override;
+
+private:
+  // Holds the current threshold, detect is const in OpenCV.
+  mutable cv::Ptr<cv::AdjusterAdapter> adjuster;
+  int minFeatures;
+  int maxFeatures;
+  int maxIters;
+};
+
+cv::Ptr<cv::FeatureDetector> generateDetector(const Settings &settings);
+cv::Ptr<cv::DescriptorExtractor> generateExtractor(const Settings &settings);
+// Empty unless the detector and extractor can run as one pass.
+cv::Ptr<cv::Feature2D> generateFeature2D(const Settings &settings);
 } // namespace ofpy3
 
 #endif // DETECTORS_AND_EXTRACTORS_H
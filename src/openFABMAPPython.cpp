@@ -52,218 +52,505 @@
 //////////////////////////////////////////////////////////////////////////////*/
 
 #include "openFABMAPPython.h"
+#include <algorithm>
 #include <conversion.h>
-#include <iostream>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/opencv.hpp>
+#include <limits>
 
-// ----------------- OpenFABMAPPython -----------------
+namespace {
 
-ofpy3::OpenFABMAPPython::OpenFABMAPPython(
-    std::shared_ptr<ofpy3::ChowLiuTree> chowLiuTree, pybind11::dict settings)
-    : vocabulary(chowLiuTree->getVocabulary()), fabmap(), imageIndex(0),
-      lastMatch(-1), bestLoopClosures() {
-  // Build the chow liu tree, if it hasn't been already.
-  if (!chowLiuTree->isTreeBuilt()) {
-    chowLiuTree->buildChowLiuTree();
-  }
-  pybind11::dict openFabMapOptions;
-  if (settings.contains("openFabMapOptions")) {
-    openFabMapOptions = settings["openFabMapOptions"];
+template <typename T>
+T columnAt(const ofpy3::LoopClosureStore::Columns::Column<T> &column,
+           std::size_t i) {
+  return (*column.data)[column.offset + i];
+}
+
+template <typename T>
+pybind11::array_t<T>
+columnView(const ofpy3::LoopClosureStore::Columns::Column<T> &column) {
+  // Read-only whether empty or not, like the column it views.
+  pybind11::array_t<T> view;
+  if (column.size == 0) {
+    view = pybind11::array_t<T>(0);
+  } else {
+    // The capsule keeps the buffer alive for as long as the view is.
+    auto *owner = new std::shared_ptr<const std::vector<T>>(column.data);
+    pybind11::capsule base(owner, [](void *p) {
+      delete reinterpret_cast<std::shared_ptr<const std::vector<T>> *>(p);
+    });
+    view = pybind11::array_t<T>(column.size,
+                                column.data->data() + column.offset, base);
   }
+  view.attr("setflags")(pybind11::arg("write") = false);
+  return view;
+}
 
-  // create options flags
-  std::string newPlaceMethod = "Meanfield";
-  std::string bayesMethod = "Naive";
-  bool simpleMotionModel = false;
+pybind11::dict toDict(const ofpy3::PipelineResult &result) {
+  pybind11::dict out;
+  out["path"] = result.path;
+  out["processed"] = result.processed;
+  out["query_idx"] = result.queryIdx;
+  out["best_idx"] = result.bestIdx;
+  out["best_likelihood"] = result.bestLikelihood;
+  return out;
+}
 
-  if (openFabMapOptions.contains("NewPlaceMethod")) {
-    newPlaceMethod = openFabMapOptions["NewPlaceMethod"].cast<std::string>();
-  }
-  if (openFabMapOptions.contains("BayesMethod")) {
-    bayesMethod = openFabMapOptions["BayesMethod"].cast<std::string>();
+// A histogram of durations in nanoseconds, reported in milliseconds.
+pybind11::dict stageDict(const ofpy3::Histogram::Snapshot &snapshot) {
+  const double ms = 1e-6;
+  pybind11::list histogram;
+  for (const auto &bucket : snapshot.buckets) {
+    histogram.append(pybind11::make_tuple(bucket.first * ms, bucket.second));
   }
-  if (openFabMapOptions.contains("SimpleMotion")) {
-    simpleMotionModel = openFabMapOptions["SimpleMotion"].cast<bool>();
+  pybind11::dict out;
+  out["count"] = snapshot.count;
+  out["total_ms"] = snapshot.sum * ms;
+  out["mean_ms"] = snapshot.mean() * ms;
+  out["min_ms"] = snapshot.min * ms;
+  out["max_ms"] = snapshot.max * ms;
+  out["p50_ms"] = snapshot.quantile(0.5) * ms;
+  out["p90_ms"] = snapshot.quantile(0.9) * ms;
+  out["p99_ms"] = snapshot.quantile(0.99) * ms;
+  out["histogram"] = histogram;
+  return out;
+}
+
+pybind11::dict counterDict(const ofpy3::Histogram::Snapshot &snapshot) {
+  pybind11::list histogram;
+  for (const auto &bucket : snapshot.buckets) {
+    histogram.append(pybind11::make_tuple(bucket.first, bucket.second));
   }
+  pybind11::dict out;
+  out["count"] = snapshot.count;
+  out["total"] = snapshot.sum;
+  out["mean"] = snapshot.mean();
+  out["min"] = snapshot.min;
+  out["max"] = snapshot.max;
+  out["p50"] = snapshot.quantile(0.5);
+  out["p90"] = snapshot.quantile(0.9);
+  out["p99"] = snapshot.quantile(0.99);
+  out["histogram"] = histogram;
+  return out;
+}
 
-  int options = 0;
-  if (newPlaceMethod == "Sampled") {
-    options |= of2::FabMap::SAMPLED;
-  } else {
-    options |= of2::FabMap::MEAN_FIELD;
+// The image files in a directory, or matching a glob pattern, sorted.
+pybind11::list expandImagePaths(const std::string &source) {
+  pybind11::module os = pybind11::module::import("os");
+  pybind11::module glob = pybind11::module::import("glob");
+  pybind11::object path = os.attr("path");
+  pybind11::object pattern = pybind11::str(source);
+  if (path.attr("isdir")(source).cast<bool>()) {
+    pattern = path.attr("join")(source, "*");
   }
-  if (bayesMethod == "ChowLiu") {
-    options |= of2::FabMap::CHOW_LIU;
-  } else {
-    options |= of2::FabMap::NAIVE_BAYES;
+  pybind11::list paths;
+  pybind11::object matches = pybind11::module::import("builtins")
+                                 .attr("sorted")(glob.attr("glob")(pattern));
+  for (pybind11::handle match : matches) {
+    if (path.attr("isfile")(match).cast<bool>()) {
+      paths.append(match);
+    }
   }
-  if (simpleMotionModel) {
-    options |= of2::FabMap::MOTION_MODEL;
+  return paths;
+}
+
+} // namespace
+
+// ----------------- Conversions -----------------
+
+ofpy3::Settings ofpy3::toSettings(const pybind11::dict &settings) {
+  Settings result;
+  for (const auto &item : settings) {
+    const std::string key = pybind11::str(item.first).cast<std::string>();
+    pybind11::handle value = item.second;
+    // bool first, as Python's bool is an int
+    if (value.is_none()) {
+      continue;
+    } else if (pybind11::isinstance<pybind11::bool_>(value) ||
+               pybind11::str(value.get_type().attr("__name__"))
+                       .cast<std::string>() == "bool_") {
+      result.set(key, value.cast<bool>());
+    } else if (pybind11::isinstance<pybind11::int_>(value)) {
+      result.set(key, value.cast<std::int64_t>());
+    } else if (pybind11::isinstance<pybind11::float_>(value)) {
+      result.set(key, value.cast<double>());
+    } else if (pybind11::isinstance<pybind11::str>(value)) {
+      result.set(key, value.cast<std::string>());
+    } else if (pybind11::isinstance<pybind11::dict>(value)) {
+      result.set(key, toSettings(value.cast<pybind11::dict>()));
+    } else if (pybind11::hasattr(value, "__index__")) {
+      // NumPy integers
+      result.set(key, pybind11::int_(value).cast<std::int64_t>());
+    } else if (pybind11::hasattr(value, "__float__")) {
+      result.set(key, pybind11::float_(value).cast<double>());
+    } else {
+      // Only an error if the setting is read
+      result.setUnsupported(
+          key, pybind11::str(value.get_type().attr("__name__"))
+                   .cast<std::string>());
+    }
   }
+  return result;
+}
+
+cv::Mat ofpy3::toMat(const pybind11::handle &array) {
+  NDArrayConverter cvt;
+  return cvt.toMat(array.ptr());
+}
 
-  // create an instance of the desired type of FabMap
-  std::string fabMapVersion = "FABMAP2";
-  if (openFabMapOptions.contains("FabMapVersion")) {
-    fabMapVersion = openFabMapOptions["FabMapVersion"].cast<std::string>();
+std::vector<cv::Mat> ofpy3::toMats(const pybind11::list &arrays) {
+  std::vector<cv::Mat> mats;
+  mats.reserve(arrays.size());
+  for (pybind11::handle array : arrays) {
+    mats.push_back(toMat(array));
   }
+  return mats;
+}
+
+// ----------------- PythonImagePipeline -----------------
 
-  // Read common settings
-  double PzGe = 0.39;
-  double PzGne = 0.0;
-  int numSamples = 3000;
-  if (openFabMapOptions.contains("PzGe")) {
-    PzGe = openFabMapOptions["PzGe"].cast<double>();
+ofpy3::PythonImagePipeline::~PythonImagePipeline() {
+  if (PyGILState_Check()) {
+    pybind11::gil_scoped_release release;
+    cancel();
+    join();
+  } else {
+    cancel();
+    join();
   }
-  if (openFabMapOptions.contains("PzGne")) {
-    PzGne = openFabMapOptions["PzGne"].cast<double>();
+}
+
+// The next result as a dict, or None if there is none within timeout
+// seconds (None waits for ever) or all have been delivered.
+pybind11::object
+ofpy3::PythonImagePipeline::nextResult(pybind11::object timeout) {
+  const double seconds = timeout.is_none() ? -1.0 : timeout.cast<double>();
+  PipelineResult result;
+  bool ready;
+  {
+    pybind11::gil_scoped_release release;
+    ready = ImagePipeline::nextResult(result, seconds);
   }
-  if (openFabMapOptions.contains("SimpleMotion")) {
-    numSamples = openFabMapOptions["SimpleMotion"].cast<int>();
+  if (!ready) {
+    return pybind11::none();
   }
+  return toDict(result);
+}
 
-  // Create the appropriate FABMAP object
-  if (fabMapVersion == "FABMAP1") {
-    fabmap = std::make_shared<of2::FabMap1>(chowLiuTree->getChowLiuTree(), PzGe,
-                                            PzGne, options, numSamples);
-  } else if (fabMapVersion == "FABMAPLUT") {
-    int precision = 6;
-    if (openFabMapOptions.contains("PzGe")) {
-      precision = openFabMapOptions["PzGe"].cast<int>();
-    }
+pybind11::object ofpy3::PythonImagePipeline::next() {
+  pybind11::object result = nextResult(pybind11::none());
+  if (result.is_none()) {
+    wait();
+    throw pybind11::stop_iteration();
+  }
+  return result;
+}
 
-    fabmap =
-        std::make_shared<of2::FabMapLUT>(chowLiuTree->getChowLiuTree(), PzGe,
-                                         PzGne, options, numSamples, precision);
-  } else if (fabMapVersion == "FABMAPFBO") {
-    double rejectionThreshold = 1e-8;
-    double PsGd = 1e-8;
-    int bisectionStart = 512;
-    int bisectionIts = 9;
-
-    if (openFabMapOptions.contains("RejectionThreshold")) {
-      rejectionThreshold =
-          openFabMapOptions["RejectionThreshold"].cast<double>();
-    }
-    if (openFabMapOptions.contains("PsGd")) {
-      PsGd = openFabMapOptions["PsGd"].cast<double>();
-    }
-    if (openFabMapOptions.contains("BisectionStart")) {
-      bisectionStart = openFabMapOptions["BisectionStart"].cast<int>();
-    }
-    if (openFabMapOptions.contains("BisectionIts")) {
-      bisectionIts = openFabMapOptions["BisectionIts"].cast<int>();
-    }
+void ofpy3::PythonImagePipeline::wait() {
+  pybind11::gil_scoped_release release;
+  ImagePipeline::wait();
+}
 
-    fabmap = std::make_shared<of2::FabMapFBO>(
-        chowLiuTree->getChowLiuTree(), PzGe, PzGne, options, numSamples,
-        rejectionThreshold, PsGd, bisectionStart, bisectionIts);
-  } else { // Default to FABMAP2
-    fabmap = std::make_shared<of2::FabMap2>(chowLiuTree->getChowLiuTree(), PzGe,
-                                            PzGne, options);
-  }
+// ----------------- OpenFABMAPPython -----------------
 
-  // add the training data for use with the sampling method
-  fabmap->addTraining(chowLiuTree->getTrainingData());
+// The map's lock is only ever taken with the GIL released, so that pipeline
+// threads waiting on the GIL cannot deadlock against it.
+ofpy3::OpenFABMAPPython::OpenFABMAPPython(
+    std::shared_ptr<ofpy3::ChowLiuTree> chowLiuTree, pybind11::dict settings) {
+  const Settings options = toSettings(settings);
+  pybind11::gil_scoped_release release;
+  openFabMap.reset(new OpenFABMAP(chowLiuTree, options));
 }
 
 ofpy3::OpenFABMAPPython::~OpenFABMAPPython() {}
 
-void ofpy3::OpenFABMAPPython::addDesc(const pybind11::array_t<float> & qImgDesc_arr) {
-  NDArrayConverter cvt;
-  cv::Mat qImgDesc{cvt.toMat(qImgDesc_arr.ptr())};
-  cv::Mat bow = vocabulary->generateBOWImageDescsInternal(qImgDesc);
-  fabmap->add(bow);
+void ofpy3::OpenFABMAPPython::addDesc(
+    const pybind11::array_t<float> &qImgDesc_arr) {
+  cv::Mat qImgDesc = toMat(qImgDesc_arr);
+  pybind11::gil_scoped_release release;
+  openFabMap->addDesc(qImgDesc);
 }
 
 bool ofpy3::OpenFABMAPPython::loadAndProcessImage(std::string imageFile) {
-  cv::Mat frame = cv::imread(imageFile, CV_LOAD_IMAGE_UNCHANGED);
-  return ProcessImageInternal(frame);
+  pybind11::gil_scoped_release release;
+  return openFabMap->loadAndProcessImage(imageFile);
 }
 
 bool ofpy3::OpenFABMAPPython::ProcessImage(
     const pybind11::array_t<uchar> &frame) {
-  NDArrayConverter cvt;
-  cv::Mat mat{cvt.toMat(frame.ptr())};
-  return ProcessImageInternal(mat);
-}
-
-bool ofpy3::OpenFABMAPPython::ProcessImageInternal(const cv::Mat &frame) {
-  if (frame.data) {
-    cv::Mat bow = vocabulary->generateBOWImageDescs(frame);
-    if (!bow.empty()) {
-      std::vector<of2::IMatch> matches;
-      fabmap->localize(bow, matches, true);
-
-      pybind11::list loopClosures;
-
-      double bestLikelihood = 0.0;
-      int bestMatchIndex = -1;
-      for (std::vector<of2::IMatch>::iterator iter = matches.begin();
-           iter != matches.end(); ++iter) {
-        if (iter->likelihood > bestLikelihood) {
-          bestLikelihood = iter->likelihood;
-          bestMatchIndex = iter->imgIdx;
-        }
-        loopClosures.append(
-            pybind11::make_tuple(iter->imgIdx, iter->likelihood));
-      }
-      lastMatch = bestMatchIndex;
-      allLoopClosures[pybind11::int_(imageIndex)] = loopClosures;
-      bestLoopClosures.append(
-          pybind11::make_tuple(imageIndex, bestMatchIndex, bestLikelihood));
-      ++imageIndex;
-      return true;
-    } else {
+  cv::Mat mat = toMat(frame);
+  pybind11::gil_scoped_release release;
+  return openFabMap->processImage(mat);
+}
+
+bool ofpy3::OpenFABMAPPython::ProcessDesc(
+    const pybind11::array_t<float> &desc_arr, bool addQ) {
+  cv::Mat desc = toMat(desc_arr);
+  pybind11::gil_scoped_release release;
+  return openFabMap->processDesc(desc, addQ);
+}
+
+/**
+ * Starts localizing a stream of images in a pipeline (see ImagePipeline),
+ * configured by the PipelineOptions settings.
+ *
+ * @param source A directory (every file in it), a glob pattern, or any
+ * iterable of paths. Iterables are consumed lazily, as the pipeline has room.
+ * @param callback Called with each result, in order, from a pipeline thread.
+ * If None, results are read from the returned pipeline instead.
+ * @param addQ Whether each frame is added to the map after it is localized.
+ */
+std::shared_ptr<ofpy3::PythonImagePipeline>
+ofpy3::OpenFABMAPPython::startPipeline(pybind11::object source,
+                                       pybind11::object callback, bool addQ) {
+  pybind11::object paths = source;
+  if (pybind11::isinstance<pybind11::str>(source)) {
+    paths = expandImagePaths(source.cast<std::string>());
+  }
+  std::shared_ptr<pybind11::iterator> iterator =
+      std::make_shared<pybind11::iterator>(pybind11::iter(paths));
+  ImagePipeline::Source nextPath = [iterator](std::string &path) {
+    pybind11::gil_scoped_acquire acquire;
+    if (*iterator == pybind11::iterator::sentinel()) {
       return false;
     }
+    // str() also accepts pathlib paths
+    path = pybind11::str(**iterator).cast<std::string>();
+    ++*iterator;
+    return true;
+  };
+
+  ImagePipeline::Sink sink;
+  if (!callback.is_none()) {
+    sink = [callback](const PipelineResult &result) {
+      pybind11::gil_scoped_acquire acquire;
+      callback(toDict(result));
+    };
   }
-  return false;
+
+  std::shared_ptr<PythonImagePipeline> pipeline =
+      std::make_shared<PythonImagePipeline>(
+          openFabMap->getVocabulary(), openFabMap->pipelineLocalizer(addQ),
+          openFabMap->getPipelineOptions(), openFabMap->getStats());
+  pipeline->start(std::move(nextPath), std::move(sink));
+  return pipeline;
 }
 
-bool ofpy3::OpenFABMAPPython::ProcessDesc(const pybind11::array_t<float> & desc_arr, bool addQ) {
+/**
+ * Quantizes and localizes a list of descriptor arrays in one call, see
+ * OpenFABMAP::processDescsBatch. The GIL is released for both.
+ *
+ * @param descs A list of (numKeypoints x descriptorSize) arrays, one per frame.
+ * @param addQ Whether each frame is added to the map after it is localized.
+ * @param denseLikelihoods Whether to also return the full likelihood matrix.
+ * @return A tuple (queryIdx, bestIdx, bestLikelihood[, likelihoods]) of NumPy
+ * arrays with one row per input frame. Frames without descriptors get a
+ * queryIdx of -1. The likelihood matrix has the new place hypothesis in
+ * column 0 and place i in column i + 1, NaN where a place did not exist yet
+ * (or was not selected, with top_k or min_likelihood).
+ */
+pybind11::tuple
+ofpy3::OpenFABMAPPython::ProcessDescsBatch(const pybind11::list &descs,
+                                           bool addQ, bool denseLikelihoods) {
+  const std::vector<cv::Mat> descMats = toMats(descs);
+  BatchResult batch;
+  {
+    pybind11::gil_scoped_release release;
+    batch = openFabMap->processDescsBatch(descMats, addQ);
+  }
 
-  NDArrayConverter cvt;
-  cv::Mat desc{cvt.toMat(desc_arr.ptr())};
-
-  cv::Mat bow = vocabulary->generateBOWImageDescsInternal(desc);
-
-  if (!bow.empty()) {
-    std::vector<of2::IMatch> matches;
-    fabmap->localize(bow, matches, addQ);
-
-    pybind11::list loopClosures;
-
-    double bestLikelihood = 0.0;
-    int bestMatchIndex = -1;
-    for (std::vector<of2::IMatch>::iterator iter = matches.begin();
-         iter != matches.end(); ++iter) {
-      if (iter->likelihood > bestLikelihood) {
-        bestLikelihood = iter->likelihood;
-        bestMatchIndex = iter->imgIdx;
-      }
-      loopClosures.append(
-          pybind11::make_tuple(iter->imgIdx, iter->likelihood));
-    }
-    lastMatch = bestMatchIndex;
-    allLoopClosures[pybind11::int_(imageIndex)] = loopClosures;
-    bestLoopClosures.append(
-        pybind11::make_tuple(imageIndex, bestMatchIndex, bestLikelihood));
-    ++imageIndex;
-    return true;
-  } else {
-    return false;
+  const int numFrames = static_cast<int>(descMats.size());
+  pybind11::array_t<int> queryIdx(numFrames, batch.queryIdx.data());
+  pybind11::array_t<int> bestIdx(numFrames, batch.bestIdx.data());
+  pybind11::array_t<double> bestLikelihood(numFrames,
+                                           batch.bestLikelihood.data());
+  if (!denseLikelihoods) {
+    return pybind11::make_tuple(queryIdx, bestIdx, bestLikelihood);
   }
 
-  return false;
+  const cv::Mat dense = denseLikelihoods(batch);
+  pybind11::array_t<double> likelihoods({dense.rows, dense.cols},
+                                        dense.ptr<double>());
+  return pybind11::make_tuple(queryIdx, bestIdx, bestLikelihood, likelihoods);
 }
 
-int ofpy3::OpenFABMAPPython::getLastMatch() const { return lastMatch; }
+int ofpy3::OpenFABMAPPython::getLastMatch() const {
+  return openFabMap->getLastMatch();
+}
 
 pybind11::list ofpy3::OpenFABMAPPython::getBestLoopClosures() const {
+  LoopClosureStore::Columns columns = openFabMap->getResults();
+  pybind11::list bestLoopClosures;
+  for (std::size_t i = 0; i < columns.queryIdx.size; ++i) {
+    bestLoopClosures.append(pybind11::make_tuple(
+        columnAt(columns.queryIdx, i), columnAt(columns.bestIdx, i),
+        columnAt(columns.bestLikelihood, i)));
+  }
   return bestLoopClosures;
 }
 
 pybind11::dict ofpy3::OpenFABMAPPython::getAllLoopClosures() const {
+  LoopClosureStore::Columns columns = openFabMap->getResults();
+  pybind11::dict allLoopClosures;
+  pybind11::list loopClosures;
+  int currentQuery = -1;
+  for (std::size_t i = 0; i < columns.matchQueryIdx.size; ++i) {
+    const int queryIndex = columnAt(columns.matchQueryIdx, i);
+    if (queryIndex != currentQuery) {
+      // a query's matches are contiguous
+      loopClosures = pybind11::list();
+      allLoopClosures[pybind11::int_(queryIndex)] = loopClosures;
+      currentQuery = queryIndex;
+    }
+    loopClosures.append(pybind11::make_tuple(
+        columnAt(columns.matchImgIdx, i), columnAt(columns.matchLikelihood, i)));
+  }
   return allLoopClosures;
 }
+
+/**
+ * Returns the result history as read-only NumPy views onto the native
+ * columns, without copying. The views stay valid (and unchanged) while more
+ * frames are processed, call again to see the new results.
+ *
+ * @return A dict of 1D arrays. "query_idx", "best_idx" and "best_likelihood"
+ * have one entry per query, "match_query_idx", "match_img_idx" and
+ * "match_likelihood" one entry per retained match.
+ */
+pybind11::dict ofpy3::OpenFABMAPPython::getResults() const {
+  LoopClosureStore::Columns columns = openFabMap->getResults();
+  pybind11::dict views;
+  views["query_idx"] = columnView(columns.queryIdx);
+  views["best_idx"] = columnView(columns.bestIdx);
+  views["best_likelihood"] = columnView(columns.bestLikelihood);
+  views["match_query_idx"] = columnView(columns.matchQueryIdx);
+  views["match_img_idx"] = columnView(columns.matchImgIdx);
+  views["match_likelihood"] = columnView(columns.matchLikelihood);
+  return views;
+}
+
+void ofpy3::OpenFABMAPPython::clearResults() { openFabMap->clearResults(); }
+
+/**
+ * Checks the engine in use against the reference of2 implementation, see
+ * OpenFABMAP::validateEngine.
+ *
+ * @param descs A list of (numKeypoints x descriptorSize) arrays, one per frame.
+ * @return A dict with the number of "queries" and "likelihoods" compared, and
+ * the "max_abs_error" and "mean_abs_error" of the log likelihoods.
+ */
+pybind11::dict
+ofpy3::OpenFABMAPPython::validateEngine(const pybind11::list &descs) {
+  const std::vector<cv::Mat> descMats = toMats(descs);
+  EngineValidation validation;
+  {
+    pybind11::gil_scoped_release release;
+    validation = openFabMap->validateEngine(descMats);
+  }
+
+  pybind11::dict report;
+  report["queries"] = validation.queries;
+  report["likelihoods"] = validation.likelihoods;
+  report["max_abs_error"] = validation.maxAbsError;
+  report["mean_abs_error"] = validation.meanAbsError;
+  return report;
+}
+
+int ofpy3::OpenFABMAPPython::getTopK() const { return openFabMap->getTopK(); }
+
+void ofpy3::OpenFABMAPPython::setTopK(int topK) { openFabMap->setTopK(topK); }
+
+pybind11::object ofpy3::OpenFABMAPPython::getMinLikelihood() const {
+  const double value = openFabMap->getMinLikelihood();
+  if (value == -std::numeric_limits<double>::infinity()) {
+    return pybind11::none();
+  }
+  return pybind11::float_(value);
+}
+
+// None keeps every match.
+void ofpy3::OpenFABMAPPython::setMinLikelihood(
+    pybind11::object minLikelihood) {
+  openFabMap->setMinLikelihood(minLikelihood.is_none()
+                                   ? -std::numeric_limits<double>::infinity()
+                                   : minLikelihood.cast<double>());
+}
+
+/**
+ * Returns the stage timings and counters recorded since the last reset:
+ * "stages" maps each stage to its count and total, mean, min, max, p50, p90
+ * and p99 times in milliseconds, plus a "histogram" of (bucket max, count);
+ * "counters" does the same for the descriptors and distinct words per frame
+ * and the places scored per query. "map_bytes" is the current size of the
+ * map, and "trace" the state of the span trace.
+ */
+pybind11::dict ofpy3::OpenFABMAPPython::getStats() {
+  std::size_t mapBytes;
+  {
+    pybind11::gil_scoped_release release;
+    mapBytes = openFabMap->getMapBytes();
+  }
+  const std::shared_ptr<Stats> stats = openFabMap->getStats();
+
+  pybind11::dict stages;
+  for (int i = 0; i < static_cast<int>(Stage::Count); ++i) {
+    const Stage stage = static_cast<Stage>(i);
+    stages[stageName(stage)] = stageDict(stats->getStage(stage));
+  }
+  pybind11::dict counters;
+  for (int i = 0; i < static_cast<int>(Counter::Count); ++i) {
+    const Counter counter = static_cast<Counter>(i);
+    counters[counterName(counter)] = counterDict(stats->getCounter(counter));
+  }
+  pybind11::dict trace;
+  trace["enabled"] = stats->isTracing();
+  trace["spans"] = stats->getTraceSpans();
+  trace["dropped"] = stats->getDroppedSpans();
+
+  pybind11::dict report;
+  report["enabled"] = stats->isEnabled();
+  report["stages"] = stages;
+  report["counters"] = counters;
+  report["map_bytes"] = mapBytes;
+  report["trace"] = trace;
+  return report;
+}
+
+// Clears the timings, counters and trace, not whether they are recorded.
+void ofpy3::OpenFABMAPPython::resetStats() { openFabMap->getStats()->reset(); }
+
+bool ofpy3::OpenFABMAPPython::getStatsEnabled() const {
+  return openFabMap->getStats()->isEnabled();
+}
+
+void ofpy3::OpenFABMAPPython::setStatsEnabled(bool enabled) {
+  openFabMap->getStats()->setEnabled(enabled);
+}
+
+/**
+ * Keeps every span timed from now on, up to capacity spans, for saveTrace.
+ * Spans are only timed while stats are enabled.
+ */
+void ofpy3::OpenFABMAPPython::startTrace(std::size_t capacity) {
+  openFabMap->getStats()->setTracing(true, capacity);
+}
+
+void ofpy3::OpenFABMAPPython::stopTrace() {
+  openFabMap->getStats()->setTracing(false);
+}
+
+// Writes the spans kept so far as Chrome trace JSON.
+void ofpy3::OpenFABMAPPython::saveTrace(std::string filename) const {
+  openFabMap->getStats()->writeTrace(filename);
+}
+
+// The map persistence calls are bound with the GIL released.
+void ofpy3::OpenFABMAPPython::saveMap(std::string filename) {
+  openFabMap->saveMap(filename);
+}
+
+void ofpy3::OpenFABMAPPython::checkpointMap(std::string filename) {
+  openFabMap->checkpointMap(filename);
+}
+
+void ofpy3::OpenFABMAPPython::loadMap(std::string filename) {
+  openFabMap->loadMap(filename);
+}
@@ -1,43 +1,87 @@
 #ifndef OPEN_FABMAP_PYTHON_H
 #define OPEN_FABMAP_PYTHON_H
 
-#include "ChowLiuTree.h"
-#include "FabMapVocabulary.h"
+#include "ImagePipeline.h"
+#include "OpenFABMAP.h"
+#include "Settings.h"
 #include <Python.h>
-#include <fabmap.hpp>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace ofpy3 {
 
+// The settings in a (nested) Python settings dict. None values are left out.
+Settings toSettings(const pybind11::dict &settings);
+
+// A view of a NumPy array as a cv::Mat, or an empty one for None.
+cv::Mat toMat(const pybind11::handle &array);
+std::vector<cv::Mat> toMats(const pybind11::list &arrays);
+
+/**
+ * An ImagePipeline fed from and reporting to Python. Its threads take the GIL
+ * to pull paths and to call back, so it is waited on and destroyed with the
+ * GIL released.
+ */
+class PythonImagePipeline : public ImagePipeline {
+public:
+  using ImagePipeline::ImagePipeline;
+  ~PythonImagePipeline() override;
+
+  pybind11::object nextResult(pybind11::object timeout);
+  pybind11::object next();
+  void wait();
+};
+
+/**
+ * The Python face of OpenFABMAP: converts NumPy arrays and settings dicts,
+ * releases the GIL around everything that touches the map, and builds the
+ * Python results.
+ */
 class OpenFABMAPPython {
 public:
   OpenFABMAPPython(std::shared_ptr<ChowLiuTree> chowLiuTree,
                    pybind11::dict settings = pybind11::dict());
   virtual ~OpenFABMAPPython();
 
-  void addDesc(const pybind11::array_t<float> & qImgDesc_arr);
+  void addDesc(const pybind11::array_t<float> &qImgDesc_arr);
 
   bool loadAndProcessImage(std::string imageFile);
   bool ProcessImage(const pybind11::array_t<uchar> &frame);
-  bool ProcessDesc(const pybind11::array_t<float> & desc_arr, bool addQ);
+  bool ProcessDesc(const pybind11::array_t<float> &desc_arr, bool addQ);
+  pybind11::tuple ProcessDescsBatch(const pybind11::list &descs, bool addQ,
+                                    bool denseLikelihoods);
+  std::shared_ptr<PythonImagePipeline>
+  startPipeline(pybind11::object source, pybind11::object callback, bool addQ);
 
-private:
-  bool ProcessImageInternal(const cv::Mat &frame);
-
-public:
   int getLastMatch() const;
   pybind11::list getBestLoopClosures() const;
   pybind11::dict getAllLoopClosures() const;
+  pybind11::dict getResults() const;
+  void clearResults();
+  pybind11::dict validateEngine(const pybind11::list &descs);
 
-private:
-  std::shared_ptr<FabMapVocabulary> vocabulary;
-  std::shared_ptr<of2::FabMap> fabmap;
+  int getTopK() const;
+  void setTopK(int topK);
+  pybind11::object getMinLikelihood() const;
+  void setMinLikelihood(pybind11::object minLikelihood);
 
-  int imageIndex;
-  int lastMatch;
-  pybind11::list bestLoopClosures;
-  pybind11::dict allLoopClosures;
+  pybind11::dict getStats();
+  void resetStats();
+  bool getStatsEnabled() const;
+  void setStatsEnabled(bool enabled);
+  void startTrace(std::size_t capacity);
+  void stopTrace();
+  void saveTrace(std::string filename) const;
+
+  void saveMap(std::string filename);
+  void checkpointMap(std::string filename);
+  void loadMap(std::string filename);
+
+private:
+  std::unique_ptr<OpenFABMAP> openFabMap;
 };
 
 } // namespace ofpy3
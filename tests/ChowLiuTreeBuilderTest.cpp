@@ -0,0 +1,96 @@
+#include "ChowLiuTreeBuilder.h"
+#include "TestUtils.h"
+#include <chowliutree.hpp>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+const double INFO_THRESHOLD = 0.0005;
+
+class ChowLiuTreeBuilderTest : public ::testing::Test {
+protected:
+  ChowLiuTreeBuilderTest() : data(ofpy3::test::smallConfig()) {}
+
+  int vocabSize() const { return data.getConfig().vocabSize; }
+
+  ofpy3::bench::SyntheticData data;
+};
+
+TEST_F(ChowLiuTreeBuilderTest, MatchesReferenceBuilder) {
+  of2::ChowLiuTree reference;
+  reference.add(ofpy3::toDense(data.getTrainingBOWs(), vocabSize()));
+  const cv::Mat expected = reference.make(INFO_THRESHOLD);
+
+  const cv::Mat tree = ofpy3::buildChowLiuTree(data.getTrainingBOWs(),
+                                               vocabSize(), INFO_THRESHOLD);
+  // Same edges, same root, and the same arithmetic for the probabilities.
+  ofpy3::test::expectSameMat(expected, tree);
+}
+
+TEST_F(ChowLiuTreeBuilderTest, IsATreeOverEveryWord) {
+  const cv::Mat tree = ofpy3::buildChowLiuTree(data.getTrainingBOWs(),
+                                               vocabSize(), INFO_THRESHOLD);
+  ASSERT_EQ(4, tree.rows);
+  ASSERT_EQ(vocabSize(), tree.cols);
+  ASSERT_EQ(CV_64F, tree.type());
+
+  // Exactly one root (its own parent), and every word reaches it.
+  int roots = 0;
+  for (int q = 0; q < vocabSize(); ++q) {
+    const int parent = static_cast<int>(tree.at<double>(0, q));
+    ASSERT_GE(parent, 0);
+    ASSERT_LT(parent, vocabSize());
+    roots += parent == q;
+    int word = q;
+    for (int steps = 0; steps < vocabSize(); ++steps) {
+      word = static_cast<int>(tree.at<double>(0, word));
+    }
+    EXPECT_EQ(word, static_cast<int>(tree.at<double>(0, word))) << q;
+    for (int row = 1; row < 4; ++row) {
+      EXPECT_GT(tree.at<double>(row, q), 0.0);
+      EXPECT_LT(tree.at<double>(row, q), 1.0);
+    }
+  }
+  EXPECT_EQ(1, roots);
+}
+
+TEST_F(ChowLiuTreeBuilderTest, DoesNotDependOnThreadCount) {
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  const cv::Mat serial = ofpy3::buildChowLiuTree(data.getTrainingBOWs(),
+                                                 vocabSize(), INFO_THRESHOLD);
+  omp_set_num_threads(std::max(4, threads));
+  const cv::Mat parallel = ofpy3::buildChowLiuTree(
+      data.getTrainingBOWs(), vocabSize(), INFO_THRESHOLD);
+  omp_set_num_threads(threads);
+  ofpy3::test::expectSameMat(serial, parallel);
+#else
+  GTEST_SKIP() << "built without OpenMP";
+#endif
+}
+
+TEST_F(ChowLiuTreeBuilderTest, ReportsProgressUpToEveryWord) {
+  std::vector<int> added;
+  ofpy3::buildChowLiuTree(data.getTrainingBOWs(), vocabSize(), INFO_THRESHOLD,
+                          [&](int wordsAdded, int numWords) {
+                            EXPECT_EQ(vocabSize(), numWords);
+                            added.push_back(wordsAdded);
+                          });
+  ASSERT_FALSE(added.empty());
+  EXPECT_TRUE(std::is_sorted(added.begin(), added.end()));
+  EXPECT_EQ(vocabSize(), added.back());
+}
+
+TEST_F(ChowLiuTreeBuilderTest, RejectsWordsBelowTheInformationBound) {
+  // With a bound no pair of words reaches, they cannot be joined.
+  EXPECT_THROW(ofpy3::buildChowLiuTree(data.getTrainingBOWs(), vocabSize(),
+                                       1e9),
+               cv::Exception);
+}
+
+} // namespace
@@ -0,0 +1,139 @@
+#include "ChowLiuTree.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <vector>
+
+namespace {
+
+class ChowLiuTreeTest : public ::testing::Test {
+protected:
+  ChowLiuTreeTest()
+      : data(ofpy3::test::smallConfig()),
+        vocabulary(std::make_shared<ofpy3::FabMapVocabulary>(
+            ofpy3::Settings(), data.getWords(), false)) {
+    vocabulary->setExactSearch(true, "Scalar");
+    // Training frames, with frames that have no descriptors between them.
+    for (std::size_t i = 0; i < data.getTrainingBOWs().size(); ++i) {
+      frames.push_back(data.descriptors(data.getTrainingBOWs()[i], 1000 + i));
+      if (i % 7 == 3) {
+        frames.push_back(cv::Mat());
+      }
+    }
+  }
+
+  ofpy3::bench::SyntheticData data;
+  std::shared_ptr<ofpy3::FabMapVocabulary> vocabulary;
+  std::vector<cv::Mat> frames;
+};
+
+TEST_F(ChowLiuTreeTest, AddsBatchesInListOrder) {
+  ofpy3::ChowLiuTree serial(vocabulary, ofpy3::Settings());
+  std::vector<bool> serialAdded;
+  for (const cv::Mat &frame : frames) {
+    serialAdded.push_back(serial.addTrainingDesc(frame));
+  }
+
+  // Over several batches, as a caller streaming frames would.
+  ofpy3::ChowLiuTree batched(vocabulary, ofpy3::Settings());
+  std::vector<bool> batchAdded;
+  for (std::size_t begin = 0; begin < frames.size(); begin += 16) {
+    const std::size_t end = std::min(frames.size(), begin + 16);
+    const std::vector<bool> added = batched.addTrainingDescsBatch(
+        std::vector<cv::Mat>(frames.begin() + begin, frames.begin() + end));
+    batchAdded.insert(batchAdded.end(), added.begin(), added.end());
+  }
+  EXPECT_EQ(serialAdded, batchAdded);
+  EXPECT_EQ(data.getTrainingBOWs().size(),
+            (std::size_t)std::count(batchAdded.begin(), batchAdded.end(),
+                                    true));
+
+  const std::vector<ofpy3::SparseBOW> &expected = serial.getTrainingBOWs();
+  const std::vector<ofpy3::SparseBOW> &actual = batched.getTrainingBOWs();
+  ASSERT_EQ(data.getTrainingBOWs().size(), expected.size());
+  ASSERT_EQ(expected.size(), actual.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    ofpy3::test::expectSameBOW(expected[i], actual[i]);
+  }
+  EXPECT_TRUE(batched.addTrainingDescsBatch(std::vector<cv::Mat>()).empty());
+}
+
+// Saving a model writes its FLANN word index to <model>.flann, for loading
+// to reuse, as a YAML model (FileStorage) or a binary model file.
+class ModelIndexTest : public ::testing::TestWithParam<bool> {
+protected:
+  ModelIndexTest()
+      : data(ofpy3::test::smallConfig()),
+        model(ofpy3::test::syntheticModel(data)),
+        file(GetParam() ? "model.bin" : "model.yml"),
+        indexFile(GetParam() ? "model.bin.flann" : "model.yml.flann") {
+    // The index file is named after the model.
+    EXPECT_EQ(file.getPath() + ".flann", indexFile.getPath());
+  }
+
+  void save() const {
+    if (GetParam()) {
+      model->saveBinary(file.getPath(), false);
+    } else {
+      model->save(file.getPath());
+    }
+  }
+
+  std::shared_ptr<ofpy3::ChowLiuTree> load() const {
+    return GetParam() ? ofpy3::ChowLiuTree::loadBinary(
+                            ofpy3::Settings(), file.getPath(), false, true)
+                      : ofpy3::ChowLiuTree::load(ofpy3::Settings(),
+                                                 file.getPath());
+  }
+
+  // Quantizes the same frames with the saved and the loaded vocabulary.
+  void expectSameWords(const ofpy3::ChowLiuTree &loaded) const {
+    for (int i = 0; i < 10; ++i) {
+      const cv::Mat descs = data.descriptors(data.getMapBOWs()[i], i);
+      ofpy3::test::expectSameBOW(model->getVocabulary()->quantize(descs),
+                                 loaded.getVocabulary()->quantize(descs));
+    }
+  }
+
+  ofpy3::bench::SyntheticData data;
+  std::shared_ptr<ofpy3::ChowLiuTree> model;
+  ofpy3::test::TempFile file;
+  ofpy3::test::TempFile indexFile;
+};
+
+TEST_P(ModelIndexTest, LoadsTheSavedIndex) {
+  ASSERT_FALSE(model->getVocabulary()->isIndexLoaded());
+  save();
+  ASSERT_TRUE(std::ifstream(indexFile.getPath().c_str()).good());
+  std::shared_ptr<ofpy3::ChowLiuTree> loaded = load();
+  EXPECT_TRUE(loaded->getVocabulary()->isIndexLoaded());
+  expectSameWords(*loaded);
+}
+
+TEST_P(ModelIndexTest, RebuildsAnIndexThatDoesNotMatch) {
+  save();
+  // Another model's index, over words of the same shape, so only the
+  // checksum tells them apart.
+  const ofpy3::bench::SyntheticData other(ofpy3::test::smallConfig(8));
+  ASSERT_TRUE(ofpy3::test::syntheticModel(other)->getVocabulary()->saveIndex(
+      indexFile.getPath()));
+  std::shared_ptr<ofpy3::ChowLiuTree> loaded = load();
+  EXPECT_FALSE(loaded->getVocabulary()->isIndexLoaded());
+  expectSameWords(*loaded);
+}
+
+TEST_P(ModelIndexTest, RebuildsAMissingIndex) {
+  save();
+  std::remove(indexFile.getPath().c_str());
+  std::shared_ptr<ofpy3::ChowLiuTree> loaded = load();
+  EXPECT_FALSE(loaded->getVocabulary()->isIndexLoaded());
+  expectSameWords(*loaded);
+}
+
+INSTANTIATE_TEST_SUITE_P(YamlAndBinaryModels, ModelIndexTest,
+                         ::testing::Values(false, true));
+
+} // namespace
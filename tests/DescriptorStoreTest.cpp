@@ -0,0 +1,96 @@
+#include "DescriptorStore.h"
+#include "TestUtils.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+cv::Mat numberedRows(int rows, int cols, int first = 0) {
+  cv::Mat descs(rows, cols, CV_32F);
+  for (int i = 0; i < rows; ++i) {
+    for (int d = 0; d < cols; ++d) {
+      descs.at<float>(i, d) = static_cast<float>((first + i) * 100 + d);
+    }
+  }
+  return descs;
+}
+
+// Descriptor stores in RAM, and in a scratch file.
+class DescriptorStoreTest : public ::testing::TestWithParam<bool> {
+protected:
+  std::string scratchDir() const {
+    return GetParam() ? ::testing::TempDir() : std::string();
+  }
+};
+
+TEST_P(DescriptorStoreTest, AppendsAcrossChunks) {
+  ofpy3::DescriptorStore store(16, scratchDir());
+  EXPECT_TRUE(store.empty());
+  // Appends that fill a chunk exactly, straddle chunks and span several.
+  store.append(numberedRows(16, 8, 0));
+  store.append(numberedRows(5, 8, 16));
+  store.append(numberedRows(40, 8, 21));
+  store.append(cv::Mat());
+
+  ASSERT_EQ(61u, store.rows());
+  EXPECT_EQ(8, store.cols());
+  EXPECT_EQ(CV_32F, store.type());
+  ASSERT_EQ(4u, store.numChunks());
+  EXPECT_EQ(16, store.chunk(0).rows);
+  EXPECT_EQ(13, store.chunk(3).rows);
+
+  const cv::Mat expected = numberedRows(61, 8);
+  for (std::size_t i = 0; i < store.rows(); ++i) {
+    ofpy3::test::expectSameMat(expected.row((int)i), store.row(i));
+    EXPECT_EQ(expected.at<float>((int)i, 3), store.ptr<float>(i)[3]);
+  }
+  int row = 0;
+  for (std::size_t k = 0; k < store.numChunks(); ++k) {
+    const cv::Mat chunk = store.chunk(k);
+    ofpy3::test::expectSameMat(expected.rowRange(row, row + chunk.rows),
+                               chunk);
+    row += chunk.rows;
+  }
+}
+
+TEST_P(DescriptorStoreTest, KeepsRowsInPlaceAsItGrows) {
+  ofpy3::DescriptorStore store(16, scratchDir());
+  store.reserve(20);
+  store.append(numberedRows(10, 4));
+  const float *first = store.ptr<float>(0);
+  store.append(numberedRows(100, 4, 10));
+  // Growing never copies what is already held.
+  EXPECT_EQ(first, store.ptr<float>(0));
+  EXPECT_EQ(0.f, store.ptr<float>(0)[0]);
+}
+
+TEST_P(DescriptorStoreTest, ConvertsAndClears) {
+  ofpy3::DescriptorStore store(16, scratchDir());
+  cv::Mat bytes(20, 4, CV_8U);
+  for (int i = 0; i < bytes.rows; ++i) {
+    for (int d = 0; d < bytes.cols; ++d) {
+      bytes.at<uchar>(i, d) = static_cast<uchar>(i + d);
+    }
+  }
+  store.append(bytes);
+
+  ofpy3::DescriptorStore converted(7);
+  store.convertTo(converted, CV_32F);
+  ASSERT_EQ(20u, converted.rows());
+  EXPECT_EQ(CV_32F, converted.type());
+  EXPECT_EQ(22.f, converted.ptr<float>(19)[3]);
+
+  // Rows must match the first append, until cleared.
+  EXPECT_THROW(store.append(numberedRows(1, 4)), cv::Exception);
+  EXPECT_THROW(store.append(cv::Mat(1, 5, CV_8U)), cv::Exception);
+  store.clear();
+  EXPECT_TRUE(store.empty());
+  store.append(numberedRows(3, 5));
+  EXPECT_EQ(3u, store.rows());
+  EXPECT_EQ(5, store.cols());
+}
+
+INSTANTIATE_TEST_SUITE_P(InMemoryAndScratchFile, DescriptorStoreTest,
+                         ::testing::Values(false, true));
+
+} // namespace
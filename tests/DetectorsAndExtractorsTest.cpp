@@ -0,0 +1,120 @@
+#include "TestUtils.h"
+#include "detectorsAndExtractors.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * An adjuster whose threshold t, from 1 to 19, finds 10 * (20 - t)
+ * keypoints in any image. Each step moves the threshold by one. Every
+ * detection's threshold is logged, clones sharing the log.
+ */
+class FakeAdjuster : public cv::AdjusterAdapter {
+public:
+  explicit FakeAdjuster(int threshold)
+      : threshold(threshold),
+        detections(std::make_shared<std::vector<int>>()) {}
+
+  void tooFew(int, int) override { --threshold; }
+  void tooMany(int, int) override { ++threshold; }
+  bool good() const override { return threshold >= 1 && threshold <= 19; }
+  cv::Ptr<cv::AdjusterAdapter> clone() const override {
+    return cv::makePtr<FakeAdjuster>(*this);
+  }
+
+  const std::vector<int> &getDetections() const { return *detections; }
+
+protected:
+  void detectImpl(const cv::Mat &, std::vector<cv::KeyPoint> &keypoints,
+                  const cv::Mat &) const override {
+    detections->push_back(threshold);
+    keypoints.assign(10 * (20 - threshold), cv::KeyPoint());
+  }
+
+private:
+  int threshold;
+  std::shared_ptr<std::vector<int>> detections;
+};
+
+class WarmStartAdaptedFeatureDetectorTest : public ::testing::Test {
+protected:
+  WarmStartAdaptedFeatureDetectorTest() : image(8, 8, CV_8U) {}
+
+  // Detects in a frame, returning the thresholds it detected with.
+  std::vector<int> detect(const cv::FeatureDetector &detector,
+                          const FakeAdjuster &adjuster,
+                          std::size_t expectedKeypoints) {
+    const std::size_t before = adjuster.getDetections().size();
+    std::vector<cv::KeyPoint> keypoints;
+    detector.detect(image, keypoints);
+    EXPECT_EQ(expectedKeypoints, keypoints.size());
+    return std::vector<int>(adjuster.getDetections().begin() + before,
+                            adjuster.getDetections().end());
+  }
+
+  cv::Mat image;
+};
+
+TEST_F(WarmStartAdaptedFeatureDetectorTest, StartsFromTheLastThreshold) {
+  cv::Ptr<FakeAdjuster> adjuster = cv::makePtr<FakeAdjuster>(14);
+  ofpy3::WarmStartAdaptedFeatureDetector detector(adjuster, 100, 100, 10);
+  EXPECT_EQ(std::vector<int>({14, 13, 12, 11, 10}),
+            detect(detector, *adjuster, 100));
+  // The next frame needs the same threshold, and finds it first time.
+  EXPECT_EQ(std::vector<int>({10}), detect(detector, *adjuster, 100));
+}
+
+TEST_F(WarmStartAdaptedFeatureDetectorTest, CarriesOnAfterMaxIters) {
+  cv::Ptr<FakeAdjuster> adjuster = cv::makePtr<FakeAdjuster>(14);
+  ofpy3::WarmStartAdaptedFeatureDetector detector(adjuster, 100, 100, 2);
+  // The last pass's keypoints are kept, and its adjustment too.
+  EXPECT_EQ(std::vector<int>({14, 13}), detect(detector, *adjuster, 70));
+  EXPECT_EQ(std::vector<int>({12, 11}), detect(detector, *adjuster, 90));
+  EXPECT_EQ(std::vector<int>({10}), detect(detector, *adjuster, 100));
+}
+
+TEST_F(WarmStartAdaptedFeatureDetectorTest, StopsOnceTheThresholdTurns) {
+  cv::Ptr<FakeAdjuster> adjuster = cv::makePtr<FakeAdjuster>(12);
+  // No threshold gives 95 keypoints: 11 too few, 10 too many.
+  ofpy3::WarmStartAdaptedFeatureDetector detector(adjuster, 95, 95, 10);
+  EXPECT_EQ(std::vector<int>({12, 11, 10}), detect(detector, *adjuster, 100));
+  // Each frame starts from the threshold that gave the last one's keypoints.
+  EXPECT_EQ(std::vector<int>({10, 11}), detect(detector, *adjuster, 90));
+  EXPECT_EQ(std::vector<int>({11, 10}), detect(detector, *adjuster, 100));
+}
+
+TEST_F(WarmStartAdaptedFeatureDetectorTest, KeepsTheLastGoodThreshold) {
+  cv::Ptr<FakeAdjuster> adjuster = cv::makePtr<FakeAdjuster>(3);
+  // More keypoints than any threshold finds.
+  ofpy3::WarmStartAdaptedFeatureDetector detector(adjuster, 500, 600, 10);
+  EXPECT_EQ(std::vector<int>({3, 2, 1}), detect(detector, *adjuster, 190));
+  // Not 0, or lower with every frame.
+  EXPECT_EQ(std::vector<int>({1}), detect(detector, *adjuster, 190));
+  EXPECT_EQ(std::vector<int>({1}), detect(detector, *adjuster, 190));
+}
+
+TEST(GenerateDetectorTest, RejectsBadAdaptiveSettings) {
+  auto adaptive = [](int minFeatures, int maxFeatures, int maxIters) {
+    ofpy3::Settings adaptiveOptions;
+    adaptiveOptions.set("MinFeatures", minFeatures);
+    adaptiveOptions.set("MaxFeatures", maxFeatures);
+    adaptiveOptions.set("MaxIters", maxIters);
+    ofpy3::Settings featureOptions;
+    featureOptions.set("DetectorMode", "ADAPTIVE");
+    featureOptions.set("Adaptive", adaptiveOptions);
+    ofpy3::Settings settings;
+    settings.set("FeatureOptions", featureOptions);
+    return settings;
+  };
+  EXPECT_THROW(ofpy3::generateDetector(adaptive(-1, 500, 5)), cv::Exception);
+  EXPECT_THROW(ofpy3::generateDetector(adaptive(400, 399, 5)),
+               cv::Exception);
+  EXPECT_THROW(ofpy3::generateDetector(adaptive(400, 500, 0)), cv::Exception);
+  EXPECT_THROW(ofpy3::WarmStartAdaptedFeatureDetector(
+                   cv::Ptr<cv::AdjusterAdapter>(), 400, 500, 5),
+               cv::Exception);
+}
+
+} // namespace
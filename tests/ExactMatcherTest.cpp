@@ -0,0 +1,122 @@
+#include "ExactMatcher.h"
+#include "TestUtils.h"
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+cv::Mat randomFloats(int rows, int cols, std::mt19937 &random) {
+  std::normal_distribution<float> value(0.f, 1.f);
+  cv::Mat floats(rows, cols, CV_32F);
+  for (int i = 0; i < rows; ++i) {
+    for (int d = 0; d < cols; ++d) {
+      floats.at<float>(i, d) = value(random);
+    }
+  }
+  return floats;
+}
+
+double distance2(const cv::Mat &a, int i, const cv::Mat &b, int j) {
+  double sum = 0.0;
+  for (int d = 0; d < a.cols; ++d) {
+    const double diff = a.at<float>(i, d) - b.at<float>(j, d);
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+// Each kernel against brute force, skipped where the CPU lacks it.
+class ExactMatcherTest
+    : public ::testing::TestWithParam<ofpy3::MatcherKernel> {
+protected:
+  void SetUp() override {
+    if (!ofpy3::isMatcherKernelSupported(GetParam())) {
+      GTEST_SKIP() << ofpy3::matcherKernelName(GetParam())
+                   << " is not supported on this CPU";
+    }
+  }
+
+  // The nearest words are nearest up to float rounding.
+  void expectNearest(const cv::Mat &words, const cv::Mat &descriptors) {
+    ofpy3::ExactMatcher matcher(words, GetParam());
+    EXPECT_EQ(GetParam(), matcher.getKernel());
+    const std::vector<int> nearest = matcher.nearestWords(descriptors);
+    ASSERT_EQ((std::size_t)descriptors.rows, nearest.size());
+    for (int i = 0; i < descriptors.rows; ++i) {
+      double best = std::numeric_limits<double>::max();
+      for (int q = 0; q < words.rows; ++q) {
+        best = std::min(best, distance2(descriptors, i, words, q));
+      }
+      ASSERT_GE(nearest[i], 0);
+      ASSERT_LT(nearest[i], words.rows);
+      EXPECT_NEAR(best, distance2(descriptors, i, words, nearest[i]),
+                  1e-4 * std::max(1.0, best))
+          << "descriptor " << i;
+    }
+  }
+};
+
+TEST_P(ExactMatcherTest, FindsTheNearestWords) {
+  std::mt19937 random(21);
+  // Whole panels and blocks, and sizes that leave partial ones.
+  expectNearest(randomFloats(128, 64, random), randomFloats(300, 64, random));
+  expectNearest(randomFloats(37, 13, random), randomFloats(61, 13, random));
+  expectNearest(randomFloats(1, 5, random), randomFloats(3, 5, random));
+}
+
+TEST_P(ExactMatcherTest, TakesTheFirstOnTies) {
+  std::mt19937 random(22);
+  cv::Mat words = randomFloats(40, 32, random);
+  cv::Mat duplicate = words.row(30);
+  words.row(5).copyTo(duplicate);
+  const ofpy3::ExactMatcher matcher(words, GetParam());
+  const std::vector<int> nearest = matcher.nearestWords(words);
+  for (int q = 0; q < words.rows; ++q) {
+    EXPECT_EQ(q == 30 ? 5 : q, nearest[q]);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Kernels, ExactMatcherTest,
+    ::testing::Values(ofpy3::MatcherKernel::Scalar,
+                      ofpy3::MatcherKernel::AVX2,
+                      ofpy3::MatcherKernel::AVX512,
+                      ofpy3::MatcherKernel::NEON),
+    [](const ::testing::TestParamInfo<ofpy3::MatcherKernel> &info) {
+      return ofpy3::matcherKernelName(info.param);
+    });
+
+TEST(MatcherKernelTest, ParsesKernelNames) {
+  for (const char *name : {"Auto", "Scalar", "AVX2", "AVX512", "NEON"}) {
+    EXPECT_EQ(name,
+              ofpy3::matcherKernelName(ofpy3::parseMatcherKernel(name)));
+  }
+  EXPECT_THROW(ofpy3::parseMatcherKernel("SSE"), cv::Exception);
+  EXPECT_TRUE(ofpy3::isMatcherKernelSupported(ofpy3::MatcherKernel::Scalar));
+  EXPECT_TRUE(ofpy3::isMatcherKernelSupported(ofpy3::detectMatcherKernel()));
+}
+
+TEST(MatcherKernelTest, AutoPicksTheDetectedKernel) {
+  std::mt19937 random(23);
+  const ofpy3::ExactMatcher matcher(randomFloats(20, 8, random));
+  EXPECT_EQ(ofpy3::detectMatcherKernel(), matcher.getKernel());
+}
+
+TEST(MatcherKernelTest, RejectsUnsupportedKernels) {
+  std::mt19937 random(24);
+  const cv::Mat words = randomFloats(20, 8, random);
+  for (ofpy3::MatcherKernel kernel :
+       {ofpy3::MatcherKernel::AVX2, ofpy3::MatcherKernel::AVX512,
+        ofpy3::MatcherKernel::NEON}) {
+    if (!ofpy3::isMatcherKernelSupported(kernel)) {
+      EXPECT_THROW(ofpy3::ExactMatcher(words, kernel), cv::Exception);
+    }
+  }
+  cv::Mat bytes;
+  words.convertTo(bytes, CV_8U);
+  EXPECT_THROW(ofpy3::ExactMatcher(bytes, ofpy3::MatcherKernel::Scalar),
+               cv::Exception);
+}
+
+} // namespace
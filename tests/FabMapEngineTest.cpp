@@ -0,0 +1,68 @@
+#include "FabMapEngine.h"
+#include "TestUtils.h"
+#include <limits>
+#include <vector>
+
+namespace {
+
+ofpy3::MatchSelection selection(int topK, double minLikelihood) {
+  ofpy3::MatchSelection result;
+  result.topK = topK;
+  result.minLikelihood = minLikelihood;
+  return result;
+}
+
+const double NONE = -std::numeric_limits<double>::infinity();
+
+TEST(MatchSelectionTest, KeepsEverythingByDefault) {
+  EXPECT_TRUE(ofpy3::MatchSelection().all());
+  EXPECT_FALSE(selection(3, NONE).all());
+  EXPECT_FALSE(selection(0, -10.0).all());
+  EXPECT_EQ(std::vector<int>({0, 1, 2}),
+            ofpy3::selectLikelihoods({-3.0, -1.0, -2.0},
+                                     ofpy3::MatchSelection()));
+}
+
+TEST(MatchSelectionTest, KeepsTheMostLikelyInPlaceOrder) {
+  const std::vector<double> likelihoods = {-5.0, -1.0, -7.0, -2.0,
+                                           -1.0, -9.0, -3.0};
+  EXPECT_EQ(std::vector<int>({1, 3, 4}),
+            ofpy3::selectLikelihoods(likelihoods, selection(3, NONE)));
+  // Earlier places first among equals
+  EXPECT_EQ(std::vector<int>({1}),
+            ofpy3::selectLikelihoods(likelihoods, selection(1, NONE)));
+  EXPECT_EQ(7u,
+            ofpy3::selectLikelihoods(likelihoods, selection(20, NONE)).size());
+}
+
+TEST(MatchSelectionTest, AppliesTheThresholdWithTopK) {
+  const std::vector<double> likelihoods = {-5.0, -1.0, -7.0, -2.0,
+                                           -1.0, -9.0, -3.0};
+  EXPECT_EQ(std::vector<int>({0, 1, 3, 4, 6}),
+            ofpy3::selectLikelihoods(likelihoods, selection(0, -5.0)));
+  EXPECT_EQ(std::vector<int>({1, 4}),
+            ofpy3::selectLikelihoods(likelihoods, selection(2, -5.0)));
+  EXPECT_TRUE(
+      ofpy3::selectLikelihoods(likelihoods, selection(2, 0.0)).empty());
+}
+
+TEST(MatchSelectionTest, SelectsMatchesByLikelihood) {
+  const double likelihoods[] = {-7.0, -6.0, -10.0, -9.0, -8.0, -7.0, -6.0};
+  std::vector<of2::IMatch> matches;
+  for (int i = -1; i < 6; ++i) {
+    matches.push_back(of2::IMatch(3, i, likelihoods[i + 1], 0.1 * i));
+  }
+  const std::vector<of2::IMatch> all = matches;
+  ofpy3::selectMatches(matches, ofpy3::MatchSelection());
+  EXPECT_EQ(all.size(), matches.size());
+
+  ofpy3::selectMatches(matches, selection(2, NONE));
+  ASSERT_EQ(2u, matches.size());
+  // The two -6
+  EXPECT_EQ(0, matches[0].imgIdx);
+  EXPECT_EQ(5, matches[1].imgIdx);
+  EXPECT_EQ(all[1].match, matches[0].match);
+  EXPECT_EQ(3, matches[1].queryIdx);
+}
+
+} // namespace
@@ -0,0 +1,132 @@
+#include "FabMapVocabulary.h"
+#include "Hamming.h"
+#include "TestUtils.h"
+#include "detectorsAndExtractors.h"
+#include <random>
+#include <vector>
+
+namespace {
+
+cv::Mat randomBits(int rows, int bytes, std::mt19937 &random) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  cv::Mat bits(rows, bytes, CV_8U);
+  for (int i = 0; i < rows; ++i) {
+    for (int d = 0; d < bytes; ++d) {
+      bits.at<uchar>(i, d) = static_cast<uchar>(byte(random));
+    }
+  }
+  return bits;
+}
+
+int slowHammingDistance(const cv::Mat &a, const cv::Mat &b) {
+  int distance = 0;
+  for (int d = 0; d < a.cols; ++d) {
+    for (int bit = 0; bit < 8; ++bit) {
+      distance += ((a.at<uchar>(0, d) ^ b.at<uchar>(0, d)) >> bit) & 1;
+    }
+  }
+  return distance;
+}
+
+TEST(HammingTest, CountsDifferingBits) {
+  std::mt19937 random(5);
+  // Whole 64 bit blocks, and a tail of single bytes.
+  for (int bytes : {1, 8, 13, 32, 61}) {
+    const cv::Mat bits = randomBits(2, bytes, random);
+    EXPECT_EQ(slowHammingDistance(bits.row(0), bits.row(1)),
+              ofpy3::hammingDistance(bits.ptr<uchar>(0), bits.ptr<uchar>(1),
+                                     bytes))
+        << bytes << " bytes";
+    EXPECT_EQ(0, ofpy3::hammingDistance(bits.ptr<uchar>(0),
+                                        bits.ptr<uchar>(0), bytes));
+  }
+}
+
+class BinaryVocabularyTest : public ::testing::Test {
+protected:
+  BinaryVocabularyTest() : random(9), words(randomBits(40, 32, random)) {}
+
+  // The nearest word by Hamming distance, the first on ties.
+  std::vector<int> nearestWords(const cv::Mat &descriptors) const {
+    std::vector<int> nearest;
+    for (int i = 0; i < descriptors.rows; ++i) {
+      int best = 0;
+      for (int q = 1; q < words.rows; ++q) {
+        if (slowHammingDistance(descriptors.row(i), words.row(q)) <
+            slowHammingDistance(descriptors.row(i), words.row(best))) {
+          best = q;
+        }
+      }
+      nearest.push_back(best);
+    }
+    return nearest;
+  }
+
+  std::mt19937 random;
+  cv::Mat words;
+};
+
+TEST_F(BinaryVocabularyTest, QuantizesByHammingDistance) {
+  ofpy3::FabMapVocabulary vocabulary(ofpy3::Settings(), words, true);
+  EXPECT_TRUE(vocabulary.isBinary());
+  // Random descriptors, and some words themselves.
+  cv::Mat descriptors = randomBits(200, 32, random);
+  cv::Mat head = descriptors.rowRange(0, 10);
+  words.rowRange(0, 10).copyTo(head);
+
+  const std::vector<int> expected = nearestWords(descriptors);
+  const ofpy3::SparseBOW bow = vocabulary.quantize(descriptors);
+  const ofpy3::SparseBOW reference =
+      ofpy3::SparseBOW::fromNearestWords(std::vector<int>(expected));
+  ofpy3::test::expectSameBOW(reference, bow);
+
+  // Binary descriptors passed in as float arrays are the same descriptors.
+  cv::Mat floats;
+  descriptors.convertTo(floats, CV_32F);
+  ofpy3::test::expectSameBOW(reference, vocabulary.quantize(floats));
+}
+
+TEST_F(BinaryVocabularyTest, StaysPackedAndExact) {
+  ofpy3::FabMapVocabulary vocabulary(ofpy3::Settings(), words, true);
+  vocabulary.convert();
+  EXPECT_EQ(CV_8U, vocabulary.getVocabulary().type());
+  // Binary vocabularies are always matched exactly, without a kernel.
+  vocabulary.setExactSearch(true);
+  EXPECT_EQ("", vocabulary.getExactKernel());
+
+  const cv::Mat descriptors = randomBits(50, 32, random);
+  const std::vector<int> expected = nearestWords(descriptors);
+  ofpy3::test::expectSameBOW(
+      ofpy3::SparseBOW::fromNearestWords(std::vector<int>(expected)),
+      vocabulary.quantize(descriptors));
+}
+
+TEST_F(BinaryVocabularyTest, RejectsUnpackedWords) {
+  cv::Mat floats;
+  words.convertTo(floats, CV_32F);
+  EXPECT_THROW(ofpy3::FabMapVocabulary(ofpy3::Settings(), floats, true),
+               cv::Exception);
+}
+
+TEST(OrbSettingsTest, RejectsTwoBitDescriptorElements) {
+#ifdef OPENCV2P4
+  ofpy3::Settings orb;
+  orb.set("WTA_K", 3);
+  ofpy3::Settings featureOptions;
+  featureOptions.set("DetectorType", "ORB");
+  featureOptions.set("ExtractorType", "ORB");
+  featureOptions.set("OrbDetector", orb);
+  ofpy3::Settings settings;
+  settings.set("FeatureOptions", featureOptions);
+  EXPECT_THROW(ofpy3::generateFeature2D(settings), cv::Exception);
+
+  orb.set("WTA_K", 2);
+  featureOptions.set("OrbDetector", orb);
+  settings.set("FeatureOptions", featureOptions);
+  EXPECT_TRUE(ofpy3::generateFeature2D(settings));
+#else
+  GTEST_SKIP() << "ORB options need OpenCV 2.4's cv::ORB";
+#endif
+}
+
+} // namespace
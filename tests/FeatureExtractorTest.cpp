@@ -0,0 +1,109 @@
+#include "FeatureExtractor.h"
+#include "TestUtils.h"
+#include "detectorsAndExtractors.h"
+#include <random>
+#include <string>
+
+namespace {
+
+ofpy3::Settings featureSettings(const std::string &detectorType,
+                                const std::string &extractorType,
+                                const std::string &detectorMode = "STATIC") {
+  ofpy3::Settings featureOptions;
+  featureOptions.set("DetectorMode", detectorMode);
+  featureOptions.set("DetectorType", detectorType);
+  featureOptions.set("ExtractorType", extractorType);
+  ofpy3::Settings settings;
+  settings.set("FeatureOptions", featureOptions);
+  return settings;
+}
+
+// Random blocks of grey, a corner at every block.
+cv::Mat texturedImage() {
+  std::mt19937 random(5);
+  std::uniform_int_distribution<int> grey(0, 255);
+  cv::Mat image(240, 240, CV_8U);
+  for (int y = 0; y < image.rows; y += 8) {
+    for (int x = 0; x < image.cols; x += 8) {
+      const uchar value = static_cast<uchar>(grey(random));
+      for (int dy = 0; dy < 8; ++dy) {
+        for (int dx = 0; dx < 8; ++dx) {
+          image.at<uchar>(y + dy, x + dx) = value;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+TEST(FeatureExtractorTest, FusesTheSameSurfSiftOrOrb) {
+#ifdef OPENCV2P4
+  for (const char *type : {"SURF", "SIFT", "ORB"}) {
+    EXPECT_TRUE(ofpy3::generateFeature2D(featureSettings(type, type)))
+        << type;
+    EXPECT_TRUE(ofpy3::FeatureExtractor(featureSettings(type, type))
+                    .isFused())
+        << type;
+  }
+  // Different algorithms, or ones without a fused pass, run as two.
+  EXPECT_FALSE(ofpy3::generateFeature2D(featureSettings("STAR", "SURF")));
+  EXPECT_FALSE(ofpy3::generateFeature2D(featureSettings("SURF", "SIFT")));
+  EXPECT_FALSE(ofpy3::generateFeature2D(featureSettings("ORB", "BRIEF")));
+  EXPECT_FALSE(ofpy3::generateFeature2D(featureSettings("FAST", "FAST")));
+  EXPECT_FALSE(
+      ofpy3::FeatureExtractor(featureSettings("STAR", "SURF")).isFused());
+  // As does an adaptive detector, which repeats the detection.
+  EXPECT_FALSE(ofpy3::generateFeature2D(
+      featureSettings("SURF", "SURF", "ADAPTIVE")));
+#else
+  GTEST_SKIP() << "fusing needs OpenCV 2.4's cv::Feature2D";
+#endif
+}
+
+TEST(FeatureExtractorTest, TimesAFusedPassAsDetection) {
+#ifdef OPENCV2P4
+  const cv::Mat image = texturedImage();
+  ofpy3::Stats stats;
+  stats.setEnabled(true);
+
+  ofpy3::FeatureExtractor fused(featureSettings("ORB", "ORB"));
+  ASSERT_TRUE(fused.detectAndCompute(image, &stats));
+  EXPECT_EQ(CV_8U, fused.getDescriptors().type());
+  EXPECT_EQ(32, fused.getDescriptors().cols);
+  EXPECT_EQ(1u, stats.getStage(ofpy3::Stage::Detect).count);
+  EXPECT_EQ(0u, stats.getStage(ofpy3::Stage::Extract).count);
+
+  ofpy3::FeatureExtractor twoPass(featureSettings("ORB", "BRIEF"));
+  ASSERT_FALSE(twoPass.isFused());
+  ASSERT_TRUE(twoPass.detectAndCompute(image, &stats));
+  EXPECT_EQ(32, twoPass.getDescriptors().cols);
+  EXPECT_EQ(2u, stats.getStage(ofpy3::Stage::Detect).count);
+  EXPECT_EQ(1u, stats.getStage(ofpy3::Stage::Extract).count);
+
+  // A blank frame has no features to describe.
+  EXPECT_FALSE(fused.detectAndCompute(cv::Mat::zeros(240, 240, CV_8U)));
+  EXPECT_FALSE(twoPass.detectAndCompute(cv::Mat::zeros(240, 240, CV_8U)));
+#else
+  GTEST_SKIP() << "fusing needs OpenCV 2.4's cv::Feature2D";
+#endif
+}
+
+TEST(FeatureExtractorPoolTest, LeasesOneExtractorPerThread) {
+  ofpy3::FeatureExtractorPool pool(featureSettings("STAR", "SURF"));
+  ofpy3::FeatureExtractor *first = nullptr;
+  {
+    ofpy3::FeatureExtractorPool::Lease lease = pool.acquire();
+    first = &*lease;
+    // Leases held at once have extractors of their own.
+    ofpy3::FeatureExtractorPool::Lease other = pool.acquire();
+    EXPECT_NE(first, &*other);
+  }
+  // Returned ones are reused, rather than new ones made.
+  ofpy3::FeatureExtractorPool::Lease a = pool.acquire();
+  ofpy3::FeatureExtractorPool::Lease b = pool.acquire();
+  ofpy3::FeatureExtractorPool::Lease c = pool.acquire();
+  EXPECT_TRUE(&*a == first || &*b == first);
+  EXPECT_NE(first, &*c);
+}
+
+} // namespace
@@ -0,0 +1,201 @@
+#include "ImagePipeline.h"
+#include "TestUtils.h"
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/highgui/highgui.hpp>
+
+namespace {
+
+using ofpy3::test::TempFile;
+
+const int NUM_FRAMES = 40;
+
+// Fused ORB, which finds features in any texture.
+ofpy3::Settings orbSettings() {
+  ofpy3::Settings featureOptions;
+  featureOptions.set("DetectorType", "ORB");
+  featureOptions.set("ExtractorType", "ORB");
+  ofpy3::Settings settings;
+  settings.set("FeatureOptions", featureOptions);
+  return settings;
+}
+
+// Random 256 bit words, as a binary vocabulary.
+cv::Mat randomWords(int rows, std::mt19937 &random) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  cv::Mat words(rows, 32, CV_8U);
+  for (int i = 0; i < rows; ++i) {
+    for (int d = 0; d < 32; ++d) {
+      words.at<uchar>(i, d) = static_cast<uchar>(byte(random));
+    }
+  }
+  return words;
+}
+
+// Random blocks of grey, a corner at every block.
+cv::Mat texturedImage(std::mt19937 &random) {
+  std::uniform_int_distribution<int> grey(0, 255);
+  cv::Mat image(240, 240, CV_8U);
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; x += 8) {
+      if (y % 8 == 0) {
+        image.at<uchar>(y, x) = static_cast<uchar>(grey(random));
+      } else {
+        image.at<uchar>(y, x) = image.at<uchar>(y - y % 8, x);
+      }
+      for (int dx = 1; dx < 8; ++dx) {
+        image.at<uchar>(y, x + dx) = image.at<uchar>(y, x);
+      }
+    }
+  }
+  return image;
+}
+
+// Every third frame's image is missing.
+bool isMissing(int frame) { return frame % 3 == 1; }
+
+class ImagePipelineTest : public ::testing::Test {
+protected:
+  ImagePipelineTest()
+      : random(31), settings(orbSettings()),
+        vocabulary(std::make_shared<ofpy3::FabMapVocabulary>(
+            settings, randomWords(120, random), true)) {
+    for (int i = 0; i < NUM_FRAMES; ++i) {
+      images.emplace_back(new TempFile("frame" + std::to_string(i) + ".png"));
+      if (!isMissing(i)) {
+        cv::imwrite(images.back()->getPath(), texturedImage(random));
+      }
+    }
+    // Small queues and several workers, so frames finish out of order.
+    options.decodeThreads = 3;
+    options.extractThreads = 3;
+    options.queueSize = 2;
+  }
+
+  ofpy3::ImagePipeline::Source source() {
+    std::shared_ptr<int> next = std::make_shared<int>(0);
+    return [this, next](std::string &path) {
+      if (*next == NUM_FRAMES) {
+        return false;
+      }
+      path = images[(*next)++]->getPath();
+      return true;
+    };
+  }
+
+  std::mt19937 random;
+  ofpy3::Settings settings;
+  std::shared_ptr<ofpy3::FabMapVocabulary> vocabulary;
+  std::vector<std::unique_ptr<TempFile>> images;
+  ofpy3::PipelineOptions options;
+};
+
+TEST_F(ImagePipelineTest, LocalizesInSourceOrder) {
+  int localized = 0;
+  ofpy3::ImagePipeline pipeline(
+      vocabulary,
+      [&localized](const ofpy3::SparseBOW &bow,
+                   ofpy3::PipelineResult &result) {
+        result.processed = !bow.empty();
+        result.queryIdx = localized++;
+      },
+      options);
+  pipeline.start(source());
+
+  std::vector<ofpy3::PipelineResult> results;
+  ofpy3::PipelineResult result;
+  while (pipeline.nextResult(result)) {
+    results.push_back(result);
+  }
+  pipeline.wait();
+  EXPECT_TRUE(pipeline.finished());
+
+  ASSERT_EQ((std::size_t)NUM_FRAMES, results.size());
+  for (int i = 0; i < NUM_FRAMES; ++i) {
+    EXPECT_EQ(images[i]->getPath(), results[i].path);
+    EXPECT_EQ(i, results[i].queryIdx);
+    // Missing images reach the localizer, without words.
+    EXPECT_EQ(!isMissing(i), results[i].processed) << "frame " << i;
+  }
+}
+
+TEST_F(ImagePipelineTest, PassesResultsToTheSink) {
+  std::vector<std::string> paths;
+  ofpy3::ImagePipeline pipeline(
+      vocabulary,
+      [](const ofpy3::SparseBOW &, ofpy3::PipelineResult &) {}, options);
+  pipeline.start(source(), [&paths](const ofpy3::PipelineResult &result) {
+    paths.push_back(result.path);
+  });
+  pipeline.wait();
+
+  ASSERT_EQ((std::size_t)NUM_FRAMES, paths.size());
+  for (int i = 0; i < NUM_FRAMES; ++i) {
+    EXPECT_EQ(images[i]->getPath(), paths[i]);
+  }
+  ofpy3::PipelineResult result;
+  EXPECT_FALSE(pipeline.nextResult(result, 0.0));
+}
+
+TEST_F(ImagePipelineTest, RethrowsTheLocalizersError) {
+  ofpy3::ImagePipeline pipeline(
+      vocabulary,
+      [](const ofpy3::SparseBOW &, ofpy3::PipelineResult &result) {
+        if (result.path.find("frame5.png") != std::string::npos) {
+          throw std::runtime_error("localizer failed");
+        }
+      },
+      options);
+  pipeline.start(source());
+  EXPECT_THROW(pipeline.wait(), std::runtime_error);
+}
+
+TEST_F(ImagePipelineTest, SkipsMissingImagesInTheMap) {
+  ofpy3::bench::SyntheticData data(ofpy3::test::smallConfig());
+  const cv::Mat tree = ofpy3::buildChowLiuTree(
+      data.getTrainingBOWs(), vocabulary->getVocabularySize(), 0.0005);
+  ofpy3::Settings mapSettings =
+      ofpy3::test::fabMapSettings("FABMAP1", "Sparse");
+  mapSettings.set("FeatureOptions", settings.section("FeatureOptions"));
+  ofpy3::Settings pipelineOptions;
+  pipelineOptions.set("DecodeThreads", 3);
+  pipelineOptions.set("ExtractThreads", 3);
+  pipelineOptions.set("QueueSize", 2);
+  mapSettings.set("PipelineOptions", pipelineOptions);
+  ofpy3::OpenFABMAP map(std::make_shared<ofpy3::ChowLiuTree>(
+                            vocabulary, tree, data.getTrainingBOWs(),
+                            mapSettings),
+                        mapSettings);
+
+  std::vector<ofpy3::PipelineResult> results;
+  map.startPipeline(source(),
+                    [&results](const ofpy3::PipelineResult &result) {
+                      results.push_back(result);
+                    },
+                    true)
+      ->wait();
+
+  ASSERT_EQ((std::size_t)NUM_FRAMES, results.size());
+  std::vector<int> queries;
+  for (int i = 0; i < NUM_FRAMES; ++i) {
+    EXPECT_EQ(images[i]->getPath(), results[i].path);
+    if (isMissing(i)) {
+      EXPECT_FALSE(results[i].processed);
+      EXPECT_EQ(-1, results[i].queryIdx);
+    } else {
+      EXPECT_TRUE(results[i].processed);
+      queries.push_back(results[i].queryIdx);
+    }
+  }
+  // Only the images that were found are queries, numbered in order.
+  EXPECT_EQ(queries, ofpy3::test::columnValues(map.getResults().queryIdx));
+  for (std::size_t q = 0; q < queries.size(); ++q) {
+    EXPECT_EQ((int)q, queries[q]);
+  }
+}
+
+} // namespace
@@ -0,0 +1,167 @@
+#include "LoopClosureStore.h"
+#include "TestUtils.h"
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using ofpy3::LoopClosureStore;
+using ofpy3::test::columnValues;
+
+// The matches of query q: the new place and q % 4 places, each less likely
+// than the one before, but the last place the most probable.
+std::vector<of2::IMatch> queryMatches(int q) {
+  const int numPlaces = q % 4;
+  std::vector<of2::IMatch> matches;
+  matches.push_back(of2::IMatch(0, -1, -10.0 - q, 0.1));
+  for (int i = 0; i < numPlaces; ++i) {
+    matches.push_back(of2::IMatch(0, 10 * q + i, -11.0 - q - i,
+                                  i + 1 == numPlaces ? 0.5 : 0.2));
+  }
+  return matches;
+}
+
+TEST(LoopClosureStoreTest, RecordsTheMostProbablePlace) {
+  LoopClosureStore store;
+  int bestIdx = 0;
+  double bestLikelihood = 1.0;
+  // Not the most likely (the new place), the most probable.
+  EXPECT_EQ(0, store.record(queryMatches(3), bestIdx, bestLikelihood));
+  EXPECT_EQ(32, bestIdx);
+  EXPECT_EQ(-16.0, bestLikelihood);
+  EXPECT_EQ(32, store.getLastMatch());
+
+  // The first of equally probable places.
+  std::vector<of2::IMatch> tied;
+  tied.push_back(of2::IMatch(0, -1, -30.0, 0.25));
+  tied.push_back(of2::IMatch(0, 4, -20.0, 0.25));
+  EXPECT_EQ(1, store.record(tied, bestIdx, bestLikelihood));
+  EXPECT_EQ(-1, bestIdx);
+  EXPECT_EQ(-30.0, bestLikelihood);
+
+  EXPECT_EQ(2, store.record(std::vector<of2::IMatch>(), bestIdx,
+                            bestLikelihood));
+  EXPECT_EQ(-1, bestIdx);
+  EXPECT_EQ(0.0, bestLikelihood);
+  EXPECT_EQ(3, store.getNumQueries());
+}
+
+TEST(LoopClosureStoreTest, KeepsTheTopKMatchesOfEachQuery) {
+  LoopClosureStore store(LoopClosureStore::KEEP_TOP_K, 2);
+  int bestIdx = 0;
+  double bestLikelihood = 0.0;
+  for (int q = 0; q < 8; ++q) {
+    store.record(queryMatches(q), bestIdx, bestLikelihood);
+  }
+  // The best is chosen from every match, kept or not.
+  EXPECT_EQ(72, bestIdx);
+
+  std::vector<int> queryIdx;
+  std::vector<int> imgIdx;
+  for (int q = 0; q < 8; ++q) {
+    // The new place, then the most likely place if there is one.
+    queryIdx.push_back(q);
+    imgIdx.push_back(-1);
+    if (q % 4 > 0) {
+      queryIdx.push_back(q);
+      imgIdx.push_back(10 * q);
+    }
+  }
+  const LoopClosureStore::Columns columns = store.getColumns();
+  EXPECT_EQ(8u, columns.queryIdx.size);
+  EXPECT_EQ(std::vector<int>({-1, 10, 21, 32, -1, 50, 61, 72}),
+            columnValues(columns.bestIdx));
+  EXPECT_EQ(queryIdx, columnValues(columns.matchQueryIdx));
+  EXPECT_EQ(imgIdx, columnValues(columns.matchImgIdx));
+}
+
+TEST(LoopClosureStoreTest, EvictsAllButTheLastNQueries) {
+  const int lastN = 3;
+  LoopClosureStore store(LoopClosureStore::KEEP_LAST_N, 0, lastN);
+  int bestIdx = 0;
+  double bestLikelihood = 0.0;
+  bool skipped = false;
+  bool compacted = false;
+  for (int q = 0; q < 100; ++q) {
+    EXPECT_EQ(q, store.record(queryMatches(q), bestIdx, bestLikelihood));
+
+    std::vector<int> queryIdx;
+    std::vector<int> matchQueryIdx;
+    std::vector<int> matchImgIdx;
+    std::vector<double> matchLikelihood;
+    for (int kept = std::max(0, q - lastN + 1); kept <= q; ++kept) {
+      queryIdx.push_back(kept);
+      for (const of2::IMatch &match : queryMatches(kept)) {
+        matchQueryIdx.push_back(kept);
+        matchImgIdx.push_back(match.imgIdx);
+        matchLikelihood.push_back(match.likelihood);
+      }
+    }
+    const LoopClosureStore::Columns columns = store.getColumns();
+    ASSERT_EQ(queryIdx, columnValues(columns.queryIdx)) << q;
+    ASSERT_EQ(matchQueryIdx, columnValues(columns.matchQueryIdx)) << q;
+    ASSERT_EQ(matchImgIdx, columnValues(columns.matchImgIdx)) << q;
+    ASSERT_EQ(matchLikelihood, columnValues(columns.matchLikelihood)) << q;
+    ASSERT_EQ(queryIdx.size(), columnValues(columns.bestIdx).size()) << q;
+    ASSERT_LE(columns.matchImgIdx.offset + columns.matchImgIdx.size,
+              columns.matchImgIdx.data->size())
+        << q;
+    // The dropped prefix is skipped, and compacted away from time to time.
+    compacted = compacted || (skipped && columns.queryIdx.offset == 0);
+    skipped = skipped || columns.queryIdx.offset > 0;
+  }
+  EXPECT_TRUE(compacted);
+  EXPECT_EQ(100, store.getNumQueries());
+}
+
+TEST(LoopClosureStoreTest, ViewsStayValidAsTheColumnsGrow) {
+  static_assert(
+      std::is_const<std::remove_reference<decltype(
+          *LoopClosureStore::Columns().matchImgIdx.data)>::type>::value,
+      "views are read-only");
+  for (LoopClosureStore::Retention retention :
+       {LoopClosureStore::KEEP_ALL, LoopClosureStore::KEEP_LAST_N}) {
+    LoopClosureStore store(retention, 0, 2);
+    int bestIdx = 0;
+    double bestLikelihood = 0.0;
+    for (int q = 0; q < 4; ++q) {
+      store.record(queryMatches(q), bestIdx, bestLikelihood);
+    }
+    const LoopClosureStore::Columns before = store.getColumns();
+    const std::vector<int> queryIdx = columnValues(before.queryIdx);
+    const std::vector<int> imgIdx = columnValues(before.matchImgIdx);
+    const std::vector<double> likelihood =
+        columnValues(before.matchLikelihood);
+
+    // Enough to grow every buffer, and with LastN to drop and compact.
+    for (int q = 4; q < 200; ++q) {
+      store.record(queryMatches(q), bestIdx, bestLikelihood);
+    }
+    const LoopClosureStore::Columns after = store.getColumns();
+    EXPECT_NE(before.matchImgIdx.data, after.matchImgIdx.data) << retention;
+    EXPECT_EQ(queryIdx, columnValues(before.queryIdx)) << retention;
+    EXPECT_EQ(imgIdx, columnValues(before.matchImgIdx)) << retention;
+    EXPECT_EQ(likelihood, columnValues(before.matchLikelihood)) << retention;
+
+    // Nor does clearing touch them.
+    store.clear();
+    EXPECT_EQ(0u, store.getColumns().queryIdx.size) << retention;
+    EXPECT_EQ(imgIdx, columnValues(before.matchImgIdx)) << retention;
+  }
+}
+
+TEST(LoopClosureStoreTest, RejectsAnEmptyRetention) {
+  EXPECT_THROW(LoopClosureStore(LoopClosureStore::KEEP_TOP_K, 0),
+               cv::Exception);
+  EXPECT_THROW(LoopClosureStore(LoopClosureStore::KEEP_LAST_N, 5, 0),
+               cv::Exception);
+  EXPECT_EQ(LoopClosureStore::KEEP_TOP_K,
+            LoopClosureStore::parseRetention("TopK"));
+  EXPECT_EQ(LoopClosureStore::KEEP_LAST_N,
+            LoopClosureStore::parseRetention("LastN"));
+  EXPECT_EQ(LoopClosureStore::KEEP_ALL,
+            LoopClosureStore::parseRetention("All"));
+}
+
+} // namespace
@@ -0,0 +1,245 @@
+#include "MapLog.h"
+#include "OpenFABMAP.h"
+#include "TestUtils.h"
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using ofpy3::test::TempFile;
+
+const int VOCAB_SIZE = 50;
+
+struct QueryRecord {
+  int queryIndex;
+  int bestMatchIndex;
+  double bestLikelihood;
+  std::vector<of2::IMatch> matches;
+};
+
+// Everything a map log holds, in order.
+struct MapLogContents {
+  std::vector<int> placeIndices;
+  std::vector<ofpy3::SparseBOW> places;
+  std::vector<QueryRecord> queries;
+  std::uint64_t validEnd = 0;
+};
+
+MapLogContents readLog(const std::string &filename) {
+  MapLogContents contents;
+  contents.validEnd = ofpy3::readMapLog(
+      filename, VOCAB_SIZE,
+      [&contents](int placeIndex, const ofpy3::SparseBOW &bow) {
+        contents.placeIndices.push_back(placeIndex);
+        contents.places.push_back(bow);
+      },
+      [&contents](int queryIndex, int bestMatchIndex, double bestLikelihood,
+                  const std::vector<of2::IMatch> &matches) {
+        contents.queries.push_back(
+            {queryIndex, bestMatchIndex, bestLikelihood, matches});
+      });
+  return contents;
+}
+
+ofpy3::SparseBOW place(int i) {
+  ofpy3::SparseBOW bow;
+  for (int q = i % 3; q < VOCAB_SIZE; q += 7 + i % 5) {
+    bow.words.push_back(q);
+    bow.values.push_back(0.5f + 0.01f * q);
+  }
+  return bow;
+}
+
+std::vector<of2::IMatch> matches(int queryIndex, int numPlaces) {
+  std::vector<of2::IMatch> result;
+  for (int i = -1; i < numPlaces; ++i) {
+    of2::IMatch match;
+    match.queryIdx = queryIndex;
+    match.imgIdx = i;
+    match.likelihood = -100.0 * (queryIndex + 1) + i;
+    result.push_back(match);
+  }
+  return result;
+}
+
+std::uint64_t fileSize(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary | std::ios::ate);
+  return static_cast<std::uint64_t>(in.tellg());
+}
+
+std::vector<char> readBytes(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(in),
+                           std::istreambuf_iterator<char>());
+}
+
+TEST(MapLogTest, RoundTripsPlacesAndQueries) {
+  TempFile file("map.log");
+  {
+    ofpy3::MapLogWriter writer(file.getPath(), VOCAB_SIZE, true);
+    writer.writePlace(0, place(0));
+    writer.writeQuery(0, -1, -12.5, matches(0, 1));
+    writer.writePlace(1, place(1));
+    writer.writeQuery(1, 0, -3.25, matches(1, 2));
+    writer.flush();
+  }
+
+  MapLogContents contents = readLog(file.getPath());
+  EXPECT_EQ(fileSize(file.getPath()), contents.validEnd);
+  ASSERT_EQ(2u, contents.places.size());
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(i, contents.placeIndices[i]);
+    ofpy3::test::expectSameBOW(place(i), contents.places[i]);
+  }
+  ASSERT_EQ(2u, contents.queries.size());
+  EXPECT_EQ(1, contents.queries[1].queryIndex);
+  EXPECT_EQ(0, contents.queries[1].bestMatchIndex);
+  EXPECT_EQ(-3.25, contents.queries[1].bestLikelihood);
+  const std::vector<of2::IMatch> expected = matches(1, 2);
+  ASSERT_EQ(expected.size(), contents.queries[1].matches.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].imgIdx, contents.queries[1].matches[i].imgIdx);
+    EXPECT_EQ(expected[i].likelihood,
+              contents.queries[1].matches[i].likelihood);
+  }
+}
+
+TEST(MapLogTest, StopsAtTruncatedRecordAndResumes) {
+  TempFile file("map.log");
+  {
+    ofpy3::MapLogWriter writer(file.getPath(), VOCAB_SIZE, true);
+    writer.writePlace(0, place(0));
+    writer.writePlace(1, place(1));
+    writer.flush();
+  }
+  const std::uint64_t complete = fileSize(file.getPath());
+  {
+    ofpy3::MapLogWriter writer(file.getPath(), VOCAB_SIZE, false);
+    writer.writePlace(2, place(2));
+    writer.flush();
+  }
+  // As a crash partway through the last record would leave it
+  ofpy3::truncateMapLog(file.getPath(), fileSize(file.getPath()) - 5);
+
+  MapLogContents contents = readLog(file.getPath());
+  EXPECT_EQ(2u, contents.places.size());
+  EXPECT_EQ(complete, contents.validEnd);
+
+  ofpy3::truncateMapLog(file.getPath(), contents.validEnd);
+  {
+    ofpy3::MapLogWriter writer(file.getPath(), VOCAB_SIZE, false);
+    writer.writePlace(2, place(3));
+    writer.flush();
+  }
+  contents = readLog(file.getPath());
+  ASSERT_EQ(3u, contents.places.size());
+  ofpy3::test::expectSameBOW(place(3), contents.places[2]);
+}
+
+TEST(MapLogTest, RejectsAnotherVocabulary) {
+  TempFile file("map.log");
+  {
+    ofpy3::MapLogWriter writer(file.getPath(), VOCAB_SIZE, true);
+    writer.writePlace(0, place(0));
+    writer.flush();
+  }
+  EXPECT_THROW(ofpy3::MapLogWriter(file.getPath(), VOCAB_SIZE + 1, false),
+               cv::Exception);
+  EXPECT_THROW(ofpy3::readMapLog(
+                   file.getPath(), VOCAB_SIZE + 1,
+                   [](int, const ofpy3::SparseBOW &) {},
+                   [](int, int, double, const std::vector<of2::IMatch> &) {}),
+               cv::Exception);
+}
+
+// saveMap, checkpointMap and loadMap on a live map.
+class MapPersistenceTest : public ::testing::Test {
+protected:
+  MapPersistenceTest()
+      : data(ofpy3::test::smallConfig()),
+        settings(ofpy3::test::fabMapSettings("FABMAP1", "Sparse")),
+        model(ofpy3::test::syntheticModel(data, settings)) {}
+
+  std::unique_ptr<ofpy3::OpenFABMAP> makeMap() {
+    return std::unique_ptr<ofpy3::OpenFABMAP>(
+        new ofpy3::OpenFABMAP(model, settings));
+  }
+
+  // Localizes map frames [begin, end), adding each to the map.
+  void localize(ofpy3::OpenFABMAP &map, int begin, int end, bool addQ = true) {
+    for (int i = begin; i < end; ++i) {
+      ASSERT_TRUE(map.processDesc(
+          data.descriptors(data.getMapBOWs()[i], static_cast<std::uint64_t>(i)),
+          addQ));
+    }
+  }
+
+  ofpy3::bench::SyntheticData data;
+  ofpy3::Settings settings;
+  std::shared_ptr<ofpy3::ChowLiuTree> model;
+};
+
+TEST_F(MapPersistenceTest, LoadMapRestoresPlacesAndResults) {
+  TempFile file("map.log");
+  std::unique_ptr<ofpy3::OpenFABMAP> map = makeMap();
+  localize(*map, 0, 15);
+  map->saveMap(file.getPath());
+
+  std::unique_ptr<ofpy3::OpenFABMAP> restored = makeMap();
+  restored->loadMap(file.getPath());
+  ofpy3::test::expectSameResults(map->getResults(), restored->getResults());
+  EXPECT_EQ(map->getLastMatch(), restored->getLastMatch());
+
+  // The places are restored too, so later frames localize the same.
+  localize(*map, 15, 20);
+  localize(*restored, 15, 20);
+  ofpy3::test::expectSameResults(map->getResults(), restored->getResults());
+}
+
+TEST_F(MapPersistenceTest, CheckpointsOnlyAppend) {
+  TempFile file("map.log");
+  std::unique_ptr<ofpy3::OpenFABMAP> map = makeMap();
+  localize(*map, 0, 8);
+  map->checkpointMap(file.getPath());
+  const std::vector<char> first = readBytes(file.getPath());
+
+  localize(*map, 8, 16);
+  map->checkpointMap(file.getPath());
+  const std::vector<char> second = readBytes(file.getPath());
+  ASSERT_GT(second.size(), first.size());
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), second.begin()));
+
+  std::unique_ptr<ofpy3::OpenFABMAP> restored = makeMap();
+  restored->loadMap(file.getPath());
+  ofpy3::test::expectSameResults(map->getResults(), restored->getResults());
+
+  // Checkpointing a restored map carries on appending to its log.
+  localize(*restored, 16, 20);
+  restored->checkpointMap(file.getPath());
+  std::unique_ptr<ofpy3::OpenFABMAP> again = makeMap();
+  again->loadMap(file.getPath());
+  ofpy3::test::expectSameResults(restored->getResults(), again->getResults());
+}
+
+TEST_F(MapPersistenceTest, ClearResultsRestartsCheckpoints) {
+  TempFile file("map.log");
+  std::unique_ptr<ofpy3::OpenFABMAP> map = makeMap();
+  localize(*map, 0, 8);
+  map->checkpointMap(file.getPath());
+  map->clearResults();
+  localize(*map, 8, 12);
+  map->checkpointMap(file.getPath());
+
+  // The log was rewritten: every place, and only the results since clearing.
+  std::unique_ptr<ofpy3::OpenFABMAP> restored = makeMap();
+  restored->loadMap(file.getPath());
+  ofpy3::test::expectSameResults(map->getResults(), restored->getResults());
+
+  localize(*map, 12, 14, false);
+  localize(*restored, 12, 14, false);
+  ofpy3::test::expectSameResults(map->getResults(), restored->getResults());
+}
+
+} // namespace
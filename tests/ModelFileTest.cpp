@@ -0,0 +1,242 @@
+#include "BinaryIO.h"
+#include "ModelFile.h"
+#include "TestUtils.h"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+using ofpy3::test::TempFile;
+
+// The on-disk layout of the header and section table (see ModelFile.cpp),
+// for corrupting files in place.
+const std::size_t HEADER_SIZE = 32;
+const std::size_t VERSION_OFFSET = 8;
+const std::size_t TABLE_CHECKSUM_OFFSET = 24;
+const std::size_t ENTRY_SIZE = 48;
+const std::size_t ENTRY_ROWS_OFFSET = 8;
+const std::size_t ENTRY_TYPE_OFFSET = 16;
+
+std::vector<char> readBytes(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(in),
+                           std::istreambuf_iterator<char>());
+}
+
+void writeBytes(const std::string &filename, const std::vector<char> &bytes) {
+  std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+template <typename T>
+void poke(std::vector<char> &bytes, std::size_t offset, T value) {
+  std::memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+// Edits the header and section table, then fixes up the table checksum so
+// that only the edit itself is wrong.
+void patchTable(const std::string &filename,
+                const std::function<void(std::vector<char> &bytes)> &edit) {
+  std::vector<char> bytes = readBytes(filename);
+  edit(bytes);
+  std::uint32_t numSections = 0;
+  std::memcpy(&numSections, bytes.data() + 16, sizeof(numSections));
+  poke(bytes, TABLE_CHECKSUM_OFFSET,
+       ofpy3::binaryio::checksum(bytes.data() + HEADER_SIZE,
+                                 numSections * ENTRY_SIZE));
+  writeBytes(filename, bytes);
+}
+
+class ModelFileTest : public ::testing::Test {
+protected:
+  ModelFileTest() : data(ofpy3::test::smallConfig()) {
+    vocabulary = data.getWords();
+    const int vocabSize = vocabulary.rows;
+    chowLiuTree.create(4, vocabSize, CV_64F);
+    for (int i = 0; i < 4; ++i) {
+      for (int q = 0; q < vocabSize; ++q) {
+        chowLiuTree.at<double>(i, q) = i == 0 ? q / 2 : 0.25 + 0.001 * q;
+      }
+    }
+  }
+
+  void write(const std::string &filename, bool compress,
+             const std::string &index = std::string(),
+             std::uint64_t indexChecksum = 0) {
+    ofpy3::writeModelFile(filename, vocabulary, false, cv::Mat(), cv::Mat(),
+                          chowLiuTree, data.getTrainingBOWs(), index,
+                          indexChecksum, compress);
+  }
+
+  void expectModel(const ofpy3::ModelData &model) {
+    ofpy3::test::expectSameMat(vocabulary, model.vocabulary);
+    EXPECT_FALSE(model.vocabularyBinary);
+    ofpy3::test::expectSameMat(chowLiuTree, model.chowLiuTree);
+    const std::vector<ofpy3::SparseBOW> &training = data.getTrainingBOWs();
+    ASSERT_EQ(training.size(), model.trainingData.size());
+    for (std::size_t i = 0; i < training.size(); ++i) {
+      ofpy3::test::expectSameBOW(training[i], model.trainingData[i]);
+    }
+  }
+
+  ofpy3::bench::SyntheticData data;
+  cv::Mat vocabulary;
+  cv::Mat chowLiuTree;
+};
+
+TEST_F(ModelFileTest, RoundTripsDenseTrainingData) {
+  TempFile file("model.bin");
+  write(file.getPath(), false);
+  for (bool useMmap : {false, true}) {
+    ofpy3::ModelData model =
+        ofpy3::readModelFile(file.getPath(), useMmap, true);
+    expectModel(model);
+    // Stored dense, the rows are kept for the of2 classes as well.
+    ofpy3::test::expectSameMat(
+        ofpy3::toDense(data.getTrainingBOWs(), vocabulary.rows),
+        model.denseTrainingData);
+  }
+}
+
+TEST_F(ModelFileTest, RoundTripsSparseTrainingData) {
+  TempFile file("model.bin");
+  write(file.getPath(), true);
+  for (bool useMmap : {false, true}) {
+    ofpy3::ModelData model =
+        ofpy3::readModelFile(file.getPath(), useMmap, true);
+    expectModel(model);
+    EXPECT_TRUE(model.denseTrainingData.empty());
+  }
+}
+
+TEST_F(ModelFileTest, RoundTripsVocabularyIndex) {
+  TempFile file("model.bin");
+  write(file.getPath(), false, "model.bin.flann", 0x0123456789abcdefull);
+  ofpy3::ModelData model = ofpy3::readModelFile(file.getPath(), false, true);
+  EXPECT_EQ("model.bin.flann", model.vocabularyIndex);
+  EXPECT_EQ(0x0123456789abcdefull, model.vocabularyIndexChecksum);
+}
+
+TEST_F(ModelFileTest, MappedMatricesDoNotWriteThrough) {
+  TempFile file("model.bin");
+  write(file.getPath(), false);
+  {
+    ofpy3::ModelData model = ofpy3::readModelFile(file.getPath(), true, true);
+    model.vocabulary.at<float>(0, 0) += 1.f;
+    model.chowLiuTree.at<double>(1, 0) = -1.0;
+  }
+  expectModel(ofpy3::readModelFile(file.getPath(), false, true));
+}
+
+TEST_F(ModelFileTest, VerifyDetectsCorruptSections) {
+  TempFile file("model.bin");
+  write(file.getPath(), false);
+  std::vector<char> bytes = readBytes(file.getPath());
+  // The last byte belongs to the training data, the last section written.
+  bytes.back() ^= 0x40;
+  writeBytes(file.getPath(), bytes);
+
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, true),
+               cv::Exception);
+  // Without verify only the header and section table are checked.
+  EXPECT_NO_THROW(ofpy3::readModelFile(file.getPath(), false, false));
+}
+
+TEST_F(ModelFileTest, RejectsCorruptSectionTable) {
+  TempFile file("model.bin");
+  write(file.getPath(), false);
+  std::vector<char> bytes = readBytes(file.getPath());
+  bytes[HEADER_SIZE + ENTRY_ROWS_OFFSET] ^= 0x01;
+  writeBytes(file.getPath(), bytes);
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, false),
+               cv::Exception);
+}
+
+TEST_F(ModelFileTest, RejectsNegativeShapes) {
+  TempFile file("model.bin");
+  write(file.getPath(), true);
+  // The training data section is last.
+  patchTable(file.getPath(), [](std::vector<char> &bytes) {
+    std::uint32_t numSections = 0;
+    std::memcpy(&numSections, bytes.data() + 16, sizeof(numSections));
+    poke<std::int32_t>(bytes,
+                       HEADER_SIZE + (numSections - 1) * ENTRY_SIZE +
+                           ENTRY_ROWS_OFFSET,
+                       -2);
+  });
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, false),
+               cv::Exception);
+}
+
+TEST_F(ModelFileTest, RejectsUnexpectedSectionTypes) {
+  TempFile file("model.bin");
+  write(file.getPath(), false);
+  // The vocabulary is the first section, a CV_64F one is not valid.
+  patchTable(file.getPath(), [](std::vector<char> &bytes) {
+    poke<std::int32_t>(bytes, HEADER_SIZE + ENTRY_TYPE_OFFSET, CV_64F);
+  });
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, false),
+               cv::Exception);
+}
+
+TEST_F(ModelFileTest, RejectsSparseRowsOutOfOrder) {
+  TempFile file("model.bin");
+  std::vector<ofpy3::SparseBOW> training = data.getTrainingBOWs();
+  std::swap(training[3].words[0], training[3].words[1]);
+  ofpy3::writeModelFile(file.getPath(), vocabulary, false, cv::Mat(),
+                        cv::Mat(), chowLiuTree, training, std::string(), 0,
+                        true);
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, true),
+               cv::Exception);
+
+  // Nor may a word appear twice, or lie outside the vocabulary.
+  training = data.getTrainingBOWs();
+  training[3].words[1] = training[3].words[0];
+  ofpy3::writeModelFile(file.getPath(), vocabulary, false, cv::Mat(),
+                        cv::Mat(), chowLiuTree, training, std::string(), 0,
+                        true);
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, true),
+               cv::Exception);
+
+  training = data.getTrainingBOWs();
+  training[3].words.back() = vocabulary.rows;
+  ofpy3::writeModelFile(file.getPath(), vocabulary, false, cv::Mat(),
+                        cv::Mat(), chowLiuTree, training, std::string(), 0,
+                        true);
+  EXPECT_THROW(ofpy3::readModelFile(file.getPath(), false, true),
+               cv::Exception);
+}
+
+TEST_F(ModelFileTest, RecordsBinaryVocabularies) {
+  TempFile file("model.bin");
+  cv::Mat binaryWords(8, 32, CV_8U);
+  for (int i = 0; i < binaryWords.rows; ++i) {
+    for (int j = 0; j < binaryWords.cols; ++j) {
+      binaryWords.at<uchar>(i, j) = static_cast<uchar>(i * 31 + j * 7);
+    }
+  }
+  ofpy3::writeModelFile(file.getPath(), binaryWords, true, cv::Mat(),
+                        cv::Mat(), cv::Mat(), std::vector<ofpy3::SparseBOW>(),
+                        std::string(), 0, false);
+  EXPECT_TRUE(ofpy3::readModelFile(file.getPath(), false, true)
+                  .vocabularyBinary);
+
+  // A float vocabulary not yet converted from CV_8U descriptors.
+  ofpy3::writeModelFile(file.getPath(), binaryWords, false, cv::Mat(),
+                        cv::Mat(), cv::Mat(), std::vector<ofpy3::SparseBOW>(),
+                        std::string(), 0, false);
+  EXPECT_FALSE(ofpy3::readModelFile(file.getPath(), false, true)
+                   .vocabularyBinary);
+
+  // Version 1 files had no flag, only binary vocabularies were CV_8U.
+  patchTable(file.getPath(), [](std::vector<char> &bytes) {
+    poke<std::uint32_t>(bytes, VERSION_OFFSET, 1);
+  });
+  EXPECT_TRUE(ofpy3::readModelFile(file.getPath(), false, true)
+                  .vocabularyBinary);
+}
+
+} // namespace
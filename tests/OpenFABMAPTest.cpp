@@ -0,0 +1,289 @@
+#include "OpenFABMAP.h"
+#include "TestUtils.h"
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The (place, likelihood) matches of one recorded query, in stored order.
+typedef std::vector<std::pair<int, double>> Record;
+
+std::vector<Record> records(const ofpy3::LoopClosureStore::Columns &results) {
+  const std::vector<int> queryIdx =
+      ofpy3::test::columnValues(results.queryIdx);
+  const std::vector<int> matchQueryIdx =
+      ofpy3::test::columnValues(results.matchQueryIdx);
+  const std::vector<int> matchImgIdx =
+      ofpy3::test::columnValues(results.matchImgIdx);
+  const std::vector<double> matchLikelihood =
+      ofpy3::test::columnValues(results.matchLikelihood);
+  std::vector<Record> byQuery(queryIdx.size());
+  for (std::size_t m = 0; m < matchQueryIdx.size(); ++m) {
+    byQuery[matchQueryIdx[m]].emplace_back(matchImgIdx[m], matchLikelihood[m]);
+  }
+  return byQuery;
+}
+
+bool sameRecord(const Record &expected, const Record &actual) {
+  if (expected.size() != actual.size()) {
+    return false;
+  }
+  for (std::size_t m = 0; m < expected.size(); ++m) {
+    if (expected[m].first != actual[m].first ||
+        std::abs(expected[m].second - actual[m].second) >
+            ofpy3::test::likelihoodTolerance(expected[m].second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+class OpenFABMAPTest : public ::testing::Test {
+protected:
+  OpenFABMAPTest() : data(ofpy3::test::smallConfig()) {}
+
+  std::unique_ptr<ofpy3::OpenFABMAP> makeMap(const ofpy3::Settings &settings) {
+    std::shared_ptr<ofpy3::ChowLiuTree> model =
+        ofpy3::test::syntheticModel(data, settings);
+    // Exact search, so each frame quantizes to its own words.
+    model->getVocabulary()->setExactSearch(true, "Scalar");
+    return std::unique_ptr<ofpy3::OpenFABMAP>(
+        new ofpy3::OpenFABMAP(model, settings));
+  }
+
+  // Descriptors of the map frames [begin, end) or of the queries.
+  std::vector<cv::Mat> mapFrames(int begin, int end) const {
+    std::vector<cv::Mat> frames;
+    for (int i = begin; i < end; ++i) {
+      frames.push_back(data.descriptors(data.getMapBOWs()[i], i));
+    }
+    return frames;
+  }
+  std::vector<cv::Mat> queryFrames() const {
+    std::vector<cv::Mat> frames;
+    for (std::size_t i = 0; i < data.getQueryBOWs().size(); ++i) {
+      frames.push_back(data.descriptors(data.getQueryBOWs()[i], 1000 + i));
+    }
+    return frames;
+  }
+
+  ofpy3::bench::SyntheticData data;
+};
+
+TEST_F(OpenFABMAPTest, ValidatesTheSparseEngineAgainstTheReference) {
+  // Whichever engine the map runs on, the sparse one is checked.
+  for (const char *engine : {"Sparse", "Reference"}) {
+    std::unique_ptr<ofpy3::OpenFABMAP> map =
+        makeMap(ofpy3::test::fabMapSettings("FABMAP1", engine));
+    for (const cv::Mat &frame : mapFrames(0, 15)) {
+      ASSERT_TRUE(map->processDesc(frame, true));
+    }
+    const std::vector<cv::Mat> frames = queryFrames();
+    const ofpy3::EngineValidation report = map->validateEngine(frames);
+    EXPECT_EQ((int)frames.size(), report.queries) << engine;
+    // The places and the mean field new place, for every query
+    EXPECT_EQ(frames.size() * 16, report.likelihoods) << engine;
+    EXPECT_LT(report.maxAbsError, 1e-6) << engine;
+    EXPECT_LE(report.meanAbsError, report.maxAbsError) << engine;
+    // The map itself is left as it was
+    EXPECT_EQ(15u, ofpy3::test::columnValues(map->getResults().queryIdx)
+                       .size());
+  }
+}
+
+TEST_F(OpenFABMAPTest, ReturnsTheRevisitedPlaceAsTheBest) {
+  std::unique_ptr<ofpy3::OpenFABMAP> map =
+      makeMap(ofpy3::test::fabMapSettings("FABMAP1", "Sparse"));
+  const int mapSize = data.getConfig().mapSize;
+  for (const cv::Mat &frame : mapFrames(0, mapSize)) {
+    ASSERT_TRUE(map->processDesc(frame, true));
+  }
+  const std::vector<cv::Mat> frames = queryFrames();
+  for (std::size_t q = 0; q < frames.size(); ++q) {
+    ASSERT_TRUE(map->processDesc(frames[q], false));
+  }
+  const ofpy3::LoopClosureStore::Columns results = map->getResults();
+  const std::vector<int> bestIdx =
+      ofpy3::test::columnValues(results.bestIdx);
+  const std::vector<double> bestLikelihood =
+      ofpy3::test::columnValues(results.bestLikelihood);
+  ASSERT_EQ(mapSize + frames.size(), bestIdx.size());
+  for (std::size_t q = 0; q < frames.size(); ++q) {
+    EXPECT_EQ(data.getQueryPlace(q), bestIdx[mapSize + q]) << "query " << q;
+    // Its log-likelihood, not the 0 no match is recorded with.
+    EXPECT_LT(bestLikelihood[mapSize + q], 0.0) << "query " << q;
+  }
+}
+
+TEST_F(OpenFABMAPTest, BatchesLikeOneFrameAtATime) {
+  const ofpy3::Settings settings =
+      ofpy3::test::fabMapSettings("FABMAP1", "Sparse");
+  std::unique_ptr<ofpy3::OpenFABMAP> serial = makeMap(settings);
+  std::unique_ptr<ofpy3::OpenFABMAP> batched = makeMap(settings);
+
+  // Added to the map, then queried against it, with a frame without
+  // descriptors in each batch.
+  for (bool addQ : {true, false}) {
+    std::vector<cv::Mat> frames = addQ ? mapFrames(0, 15) : queryFrames();
+    for (const cv::Mat &frame : frames) {
+      ASSERT_TRUE(serial->processDesc(frame, addQ));
+    }
+    frames.insert(frames.begin() + 3, cv::Mat());
+    const ofpy3::BatchResult batch =
+        batched->processDescsBatch(frames, addQ);
+    ofpy3::test::expectSameResults(serial->getResults(),
+                                   batched->getResults());
+
+    const ofpy3::LoopClosureStore::Columns results = serial->getResults();
+    const std::vector<int> queryIdx =
+        ofpy3::test::columnValues(results.queryIdx);
+    const std::vector<int> bestIdx =
+        ofpy3::test::columnValues(results.bestIdx);
+    const std::vector<double> bestLikelihood =
+        ofpy3::test::columnValues(results.bestLikelihood);
+    const std::vector<int> matchQueryIdx =
+        ofpy3::test::columnValues(results.matchQueryIdx);
+    const std::vector<int> matchImgIdx =
+        ofpy3::test::columnValues(results.matchImgIdx);
+    const std::vector<double> matchLikelihood =
+        ofpy3::test::columnValues(results.matchLikelihood);
+    const std::size_t first = queryIdx.size() - (frames.size() - 1);
+
+    ASSERT_EQ(frames.size(), batch.queryIdx.size()) << addQ;
+    EXPECT_EQ(-1, batch.queryIdx[3]) << addQ;
+    EXPECT_TRUE(batch.matches[3].empty()) << addQ;
+    const cv::Mat dense = ofpy3::denseLikelihoods(batch);
+    ASSERT_EQ((int)frames.size(), dense.rows) << addQ;
+    // The new place, and the places matched: the 15 of the map, or the 14
+    // the last frame added saw.
+    ASSERT_EQ(addQ ? 15 : 16, dense.cols) << addQ;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+      if (i == 3) {
+        for (int j = 0; j < dense.cols; ++j) {
+          EXPECT_TRUE(std::isnan(dense.at<double>(3, j))) << addQ;
+        }
+        continue;
+      }
+      const std::size_t q = first + i - (i > 3 ? 1 : 0);
+      EXPECT_EQ(queryIdx[q], batch.queryIdx[i]) << addQ << " " << i;
+      EXPECT_EQ(bestIdx[q], batch.bestIdx[i]) << addQ << " " << i;
+      EXPECT_EQ(bestLikelihood[q], batch.bestLikelihood[i])
+          << addQ << " " << i;
+
+      // Every match of the query is in its row, the rest NaN.
+      std::vector<double> expected(dense.cols,
+                                   std::numeric_limits<double>::quiet_NaN());
+      for (std::size_t m = 0; m < matchQueryIdx.size(); ++m) {
+        if (matchQueryIdx[m] == queryIdx[q]) {
+          expected[matchImgIdx[m] + 1] = matchLikelihood[m];
+        }
+      }
+      for (int j = 0; j < dense.cols; ++j) {
+        if (std::isnan(expected[j])) {
+          EXPECT_TRUE(std::isnan(dense.at<double>(i, j)))
+              << addQ << " " << i << " " << j;
+        } else {
+          EXPECT_EQ(expected[j], dense.at<double>(i, j))
+              << addQ << " " << i << " " << j;
+        }
+      }
+      // Places are only matched once they exist, all of them.
+      for (int j = 0; j < dense.cols; ++j) {
+        EXPECT_EQ(!addQ || j <= queryIdx[q],
+                  !std::isnan(dense.at<double>(i, j)))
+            << addQ << " " << i << " " << j;
+      }
+    }
+  }
+}
+
+TEST_F(OpenFABMAPTest, QueriesWhilePlacesAreAdded) {
+  const ofpy3::Settings settings =
+      ofpy3::test::fabMapSettings("FABMAP1", "Sparse");
+  // The map frames, three times over.
+  const std::vector<cv::Mat> frames = mapFrames(0, data.getConfig().mapSize);
+  std::vector<cv::Mat> places;
+  for (int i = 0; i < 3; ++i) {
+    places.insert(places.end(), frames.begin(), frames.end());
+  }
+  const int numPlaces = static_cast<int>(places.size());
+  const int initialPlaces = 10;
+  const std::vector<cv::Mat> queries = queryFrames();
+
+  // Serially, every query against every state of the map, and every add.
+  std::unique_ptr<ofpy3::OpenFABMAP> serial = makeMap(settings);
+  for (int n = 0; n < numPlaces; ++n) {
+    if (n >= initialPlaces) {
+      for (const cv::Mat &query : queries) {
+        ASSERT_TRUE(serial->processDesc(query, false));
+      }
+    }
+    ASSERT_TRUE(serial->processDesc(places[n], true));
+  }
+  for (const cv::Mat &query : queries) {
+    ASSERT_TRUE(serial->processDesc(query, false));
+  }
+  const std::vector<Record> expected = records(serial->getResults());
+
+  std::unique_ptr<ofpy3::OpenFABMAP> map = makeMap(settings);
+  for (int n = 0; n < initialPlaces; ++n) {
+    ASSERT_TRUE(map->processDesc(places[n], true));
+  }
+  std::atomic<bool> adding(true);
+  std::atomic<int> queried(0);
+  std::vector<std::thread> threads;
+  threads.emplace_back([&] {
+    for (int n = initialPlaces; n < numPlaces; ++n) {
+      map->processDesc(places[n], true);
+    }
+    adding = false;
+  });
+  for (int t = 0; t < 3; ++t) {
+    threads.emplace_back([&] {
+      while (adding) {
+        for (const cv::Mat &query : queries) {
+          map->processDesc(query, false);
+          ++queried;
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  // And once all places are in, each query as the serial run's last ones.
+  for (const cv::Mat &query : queries) {
+    ASSERT_TRUE(map->processDesc(query, false));
+  }
+
+  const std::vector<Record> actual = records(map->getResults());
+  ASSERT_EQ(numPlaces + queried + queries.size(), actual.size());
+  // Each query saw the map as it was between two adds, with no place
+  // missing, as did each place added.
+  for (std::size_t i = 0; i < actual.size(); ++i) {
+    bool found = false;
+    for (std::size_t e = 0; e < expected.size() && !found; ++e) {
+      found = sameRecord(expected[e], actual[i]);
+    }
+    EXPECT_TRUE(found) << "query " << i;
+  }
+  for (std::size_t q = 0; q < queries.size(); ++q) {
+    EXPECT_TRUE(sameRecord(expected[expected.size() - queries.size() + q],
+                           actual[actual.size() - queries.size() + q]))
+        << "query " << q;
+  }
+}
+
+TEST_F(OpenFABMAPTest, RaisesWithoutASparseEngineToValidate) {
+  std::unique_ptr<ofpy3::OpenFABMAP> map =
+      makeMap(ofpy3::test::fabMapSettings("FABMAPFBO", "Reference"));
+  EXPECT_THROW(map->validateEngine(queryFrames()), cv::Exception);
+}
+
+} // namespace
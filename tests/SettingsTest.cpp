@@ -0,0 +1,109 @@
+#include "Settings.h"
+#include "TestUtils.h"
+#include <fstream>
+#include <string>
+
+namespace {
+
+using ofpy3::Settings;
+
+TEST(SettingsTest, ReadsTypedValuesAndDefaults) {
+  Settings settings;
+  settings.set("Flag", true);
+  settings.set("Count", 12);
+  settings.set("Size", 0.25);
+  settings.set("Name", "SURF");
+
+  EXPECT_TRUE(settings.contains("Flag"));
+  EXPECT_FALSE(settings.contains("Missing"));
+  EXPECT_TRUE(settings.get<bool>("Flag", false));
+  EXPECT_EQ(12, settings.get<int>("Count", 0));
+  EXPECT_EQ(12u, settings.get<std::size_t>("Count", 0));
+  EXPECT_EQ(0.25, settings.get<double>("Size", 0.0));
+  EXPECT_EQ("SURF", settings.get<std::string>("Name", ""));
+  EXPECT_EQ(7, settings.get<int>("Missing", 7));
+  EXPECT_EQ("ORB", settings.get<std::string>("Missing", "ORB"));
+
+  // Later values replace earlier ones, of whatever type.
+  settings.set("Count", "many");
+  EXPECT_EQ("many", settings.get<std::string>("Count", ""));
+}
+
+TEST(SettingsTest, ConvertsAsPythonWould) {
+  Settings settings;
+  settings.set("One", 1);
+  settings.set("Two", 2);
+  settings.set("True", true);
+  settings.set("Text", "False");
+  settings.set("Real", 0.5);
+
+  // Integers read as reals, and bools as integers, not the other way round.
+  EXPECT_EQ(2.0, settings.get<double>("Two", 0.0));
+  EXPECT_EQ(1, settings.get<int>("True", 0));
+  EXPECT_EQ(1.0, settings.get<double>("True", 0.0));
+  EXPECT_THROW(settings.get<int>("Real", 0), cv::Exception);
+  // 0 and 1 are bools, other integers are not.
+  EXPECT_TRUE(settings.get<bool>("One", false));
+  EXPECT_THROW(settings.get<bool>("Two", false), cv::Exception);
+  // "true" and "false" strings are, in any case, for YAML.
+  EXPECT_FALSE(settings.get<bool>("Text", true));
+  EXPECT_THROW(settings.get<std::string>("One", ""), cv::Exception);
+  EXPECT_THROW(settings.get<int>("Text", 0), cv::Exception);
+  EXPECT_THROW(settings.get<double>("Text", 0.0), cv::Exception);
+}
+
+TEST(SettingsTest, RaisesForUnsupportedValuesOnlyWhenRead) {
+  Settings settings;
+  settings.set("Count", 3);
+  settings.setUnsupported("Sizes", "list");
+  EXPECT_TRUE(settings.contains("Sizes"));
+  EXPECT_EQ(3, settings.get<int>("Count", 0));
+  EXPECT_THROW(settings.get<int>("Sizes", 0), cv::Exception);
+  EXPECT_THROW(settings.section("Sizes"), cv::Exception);
+}
+
+TEST(SettingsTest, NestsSections) {
+  Settings features;
+  features.set("FeatureType", "ORB");
+  Settings settings;
+  settings.set("FeatureOptions", features);
+  settings.set("Count", 3);
+
+  const Settings section = settings.section("FeatureOptions");
+  EXPECT_EQ("ORB", section.get<std::string>("FeatureType", ""));
+  // A section is a copy: changing the original later leaves it alone.
+  features.set("FeatureType", "SURF");
+  EXPECT_EQ("ORB", settings.section("FeatureOptions")
+                       .get<std::string>("FeatureType", ""));
+  EXPECT_FALSE(settings.section("Missing").contains("FeatureType"));
+  EXPECT_THROW(settings.section("Count"), cv::Exception);
+}
+
+TEST(SettingsTest, LoadsAFileStorageFile) {
+  ofpy3::test::TempFile file("settings.yml");
+  {
+    std::ofstream out(file.getPath().c_str());
+    out << "%YAML:1.0\n"
+        << "FeatureOptions:\n"
+        << "  FeatureType: ORB\n"
+        << "  ORB:\n"
+        << "    nFeatures: 500\n"
+        << "    scaleFactor: 1.2\n"
+        << "openFabMapOptions:\n"
+        << "  FabMapVersion: FABMAP2\n"
+        << "  Sampled: \"true\"\n";
+  }
+  const Settings settings = Settings::load(file.getPath());
+  const Settings features = settings.section("FeatureOptions");
+  EXPECT_EQ("ORB", features.get<std::string>("FeatureType", ""));
+  EXPECT_EQ(500, features.section("ORB").get<int>("nFeatures", 0));
+  EXPECT_EQ(1.2, features.section("ORB").get<double>("scaleFactor", 0.0));
+  const Settings options = settings.section("openFabMapOptions");
+  EXPECT_EQ("FABMAP2", options.get<std::string>("FabMapVersion", ""));
+  EXPECT_TRUE(options.get<bool>("Sampled", false));
+
+  EXPECT_THROW(Settings::load(ofpy3::test::tempPath("missing.yml")),
+               cv::Exception);
+}
+
+} // namespace
@@ -0,0 +1,62 @@
+#include "SparseBOW.h"
+#include "TestUtils.h"
+#include <vector>
+
+namespace {
+
+TEST(SparseBOWTest, CountsNearestWordsInAscendingOrder) {
+  const ofpy3::SparseBOW bow =
+      ofpy3::SparseBOW::fromNearestWords({7, 2, 7, 9, 2, 7, 0, 7});
+  EXPECT_EQ(std::vector<int>({0, 2, 7, 9}), bow.words);
+  // Counts normalised by the number of descriptors, as the dense rows were.
+  EXPECT_EQ(std::vector<float>({1.f / 8, 2.f / 8, 4.f / 8, 1.f / 8}),
+            bow.values);
+  EXPECT_TRUE(ofpy3::SparseBOW::fromNearestWords({}).empty());
+
+  // 5 of 6 is not 5 times a sixth in floats.
+  const float five = 5.f;
+  const float six = 6.f;
+  EXPECT_EQ(std::vector<float>({1.f / six, five / six}),
+            ofpy3::SparseBOW::fromNearestWords({4, 4, 4, 1, 4, 4}).values);
+}
+
+TEST(SparseBOWTest, RoundTripsThroughDenseRows) {
+  ofpy3::bench::SyntheticData data(ofpy3::test::smallConfig());
+  const std::vector<ofpy3::SparseBOW> &bows = data.getMapBOWs();
+  const int vocabSize = data.getConfig().vocabSize;
+
+  const cv::Mat dense = ofpy3::toDense(bows, vocabSize);
+  ASSERT_EQ((int)bows.size(), dense.rows);
+  ASSERT_EQ(vocabSize, dense.cols);
+  ASSERT_EQ(CV_32F, dense.type());
+  const std::vector<ofpy3::SparseBOW> sparse = ofpy3::fromDense(dense);
+  ASSERT_EQ(bows.size(), sparse.size());
+  for (std::size_t i = 0; i < bows.size(); ++i) {
+    ofpy3::test::expectSameBOW(bows[i], sparse[i]);
+    ofpy3::test::expectSameMat(dense.row((int)i),
+                               bows[i].toDense(vocabSize));
+    ofpy3::test::expectSameBOW(
+        bows[i], ofpy3::SparseBOW::fromDense(dense.row((int)i)));
+  }
+}
+
+TEST(SparseBOWTest, MarksObservedWords) {
+  ofpy3::SparseBOW bow;
+  bow.words = {1, 4};
+  bow.values = {0.5f, 0.5f};
+  std::vector<char> observed(6, 0);
+  bow.mark(observed);
+  EXPECT_EQ(std::vector<char>({0, 1, 0, 0, 1, 0}), observed);
+}
+
+TEST(SparseBOWTest, RejectsWordsOutsideTheVocabulary) {
+  ofpy3::SparseBOW bow;
+  bow.words = {3, 10};
+  bow.values = {0.5f, 0.5f};
+  EXPECT_THROW(bow.toDense(10), cv::Exception);
+  EXPECT_THROW(ofpy3::toDense({bow}, 10), cv::Exception);
+  bow.words = {-1, 3};
+  EXPECT_THROW(ofpy3::toDense({bow}, 10), cv::Exception);
+}
+
+} // namespace
@@ -0,0 +1,565 @@
+#include "FabMapEngine.h"
+#include "SparseFabMap.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fabmap.hpp>
+
+namespace {
+
+using ofpy3::SparseFabMap;
+
+const double PZGE = 0.39;
+const double PZGNE = 0.0;
+const int NUM_SAMPLES = 50;
+const int LUT_PRECISION = 6;
+
+std::string versionName(SparseFabMap::Version version) {
+  switch (version) {
+  case SparseFabMap::FABMAP1:
+    return "FABMAP1";
+  case SparseFabMap::FABMAPLUT:
+    return "FABMAPLUT";
+  case SparseFabMap::FABMAP2:
+    return "FABMAP2";
+  }
+  return "Unknown";
+}
+
+// The synthetic workload and its Chow-Liu tree, shared by the engines.
+class SparseFabMapTestBase {
+protected:
+  explicit SparseFabMapTestBase(
+      const ofpy3::bench::SyntheticConfig &config = ofpy3::test::smallConfig())
+      : data(config),
+        tree(ofpy3::buildChowLiuTree(data.getTrainingBOWs(), vocabSize(),
+                                     0.0005)) {}
+
+  int vocabSize() const { return data.getConfig().vocabSize; }
+
+  std::unique_ptr<SparseFabMap> makeSparse(SparseFabMap::Version version,
+                                           int flags) const {
+    std::unique_ptr<SparseFabMap> engine(new SparseFabMap(
+        tree, PZGE, PZGNE, flags, NUM_SAMPLES, version, LUT_PRECISION));
+    engine->addTraining(data.getTrainingBOWs());
+    return engine;
+  }
+
+  std::unique_ptr<ofpy3::FabMapEngine>
+  makeReference(SparseFabMap::Version version, int flags) const {
+    std::shared_ptr<of2::FabMap> fabmap;
+    if (version == SparseFabMap::FABMAP1) {
+      fabmap = std::make_shared<of2::FabMap1>(tree, PZGE, PZGNE, flags,
+                                              NUM_SAMPLES);
+    } else if (version == SparseFabMap::FABMAPLUT) {
+      fabmap = std::make_shared<of2::FabMapLUT>(tree, PZGE, PZGNE, flags,
+                                                NUM_SAMPLES, LUT_PRECISION);
+    } else {
+      fabmap = std::make_shared<of2::FabMap2>(tree, PZGE, PZGNE, flags);
+    }
+    std::unique_ptr<ofpy3::FabMapEngine> engine(
+        new ofpy3::Of2FabMapEngine(fabmap, vocabSize()));
+    engine->addTraining(data.getTrainingBOWs());
+    return engine;
+  }
+
+  /**
+   * Builds a map from half of the map frames, localizes the other half
+   * (adding them if addQ) and then the queries, on both engines. Every
+   * result must agree, but for the new place when it is sampled at random.
+   */
+  void expectSameLocalization(ofpy3::FabMapEngine &engine,
+                              ofpy3::FabMapEngine &reference, bool addQ,
+                              bool compareNewPlace) const {
+    const std::vector<ofpy3::SparseBOW> &map = data.getMapBOWs();
+    std::vector<ofpy3::SparseBOW> frames(map.begin() + map.size() / 2,
+                                         map.end());
+    frames.insert(frames.end(), data.getQueryBOWs().begin(),
+                  data.getQueryBOWs().end());
+    for (std::size_t i = 0; i < map.size() / 2; ++i) {
+      engine.add(map[i]);
+      reference.add(map[i]);
+    }
+
+    std::vector<of2::IMatch> matches, expected;
+    for (std::size_t f = 0; f < frames.size(); ++f) {
+      const bool add = addQ && f < map.size() - map.size() / 2;
+      engine.localize(frames[f], matches, add, ofpy3::MatchSelection());
+      reference.localize(frames[f], expected, add, ofpy3::MatchSelection());
+      ASSERT_EQ(expected.size(), matches.size()) << "frame " << f;
+      for (std::size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(expected[i].imgIdx, matches[i].imgIdx);
+        if (expected[i].imgIdx == -1 && !compareNewPlace) {
+          continue;
+        }
+        EXPECT_NEAR(expected[i].likelihood, matches[i].likelihood,
+                    ofpy3::test::likelihoodTolerance(expected[i].likelihood))
+            << "frame " << f << ", place " << expected[i].imgIdx;
+        if (compareNewPlace) {
+          // Normalised over every place, so only with the same new place
+          EXPECT_NEAR(expected[i].match, matches[i].match, 1e-9)
+              << "frame " << f << ", place " << expected[i].imgIdx;
+        }
+      }
+    }
+    EXPECT_EQ(reference.numPlaces(), engine.numPlaces());
+  }
+
+  ofpy3::bench::SyntheticData data;
+  cv::Mat tree;
+};
+
+// FABMAP1 and FABMAPLUT, with the mean field or sampled new place, adding
+// each query to the map or not.
+class SparseFabMapReferenceTest
+    : public SparseFabMapTestBase,
+      public ::testing::TestWithParam<
+          std::tuple<SparseFabMap::Version, bool, bool>> {};
+
+TEST_P(SparseFabMapReferenceTest, MatchesReferenceEngine) {
+  const SparseFabMap::Version version = std::get<0>(GetParam());
+  const bool meanField = std::get<1>(GetParam());
+  const bool addQ = std::get<2>(GetParam());
+  const int flags = of2::FabMap::CHOW_LIU |
+                    (meanField ? of2::FabMap::MEAN_FIELD
+                               : of2::FabMap::SAMPLED);
+
+  std::unique_ptr<SparseFabMap> engine = makeSparse(version, flags);
+  std::unique_ptr<ofpy3::FabMapEngine> reference =
+      makeReference(version, flags);
+  expectSameLocalization(*engine, *reference, addQ, meanField);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    VersionsAndNewPlaces, SparseFabMapReferenceTest,
+    ::testing::Combine(::testing::Values(SparseFabMap::FABMAP1,
+                                         SparseFabMap::FABMAPLUT),
+                       ::testing::Bool(), ::testing::Bool()),
+    [](const ::testing::TestParamInfo<
+        std::tuple<SparseFabMap::Version, bool, bool>> &info) {
+      return versionName(std::get<0>(info.param)) +
+             (std::get<1>(info.param) ? "_MeanField" : "_Sampled") +
+             (std::get<2>(info.param) ? "_AddQ" : "_NoAddQ");
+    });
+
+// FABMAP2's new place averages every training bag-of-words, so it is
+// compared too.
+class SparseFabMap2ReferenceTest : public SparseFabMapTestBase,
+                                   public ::testing::TestWithParam<bool> {};
+
+TEST_P(SparseFabMap2ReferenceTest, MatchesReferenceEngine) {
+  const int flags = of2::FabMap::CHOW_LIU | of2::FabMap::SAMPLED;
+  std::unique_ptr<SparseFabMap> engine =
+      makeSparse(SparseFabMap::FABMAP2, flags);
+  std::unique_ptr<ofpy3::FabMapEngine> reference =
+      makeReference(SparseFabMap::FABMAP2, flags);
+  expectSameLocalization(*engine, *reference, GetParam(), true);
+}
+
+INSTANTIATE_TEST_SUITE_P(AddQ, SparseFabMap2ReferenceTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &info) {
+                           return info.param ? "AddQ" : "NoAddQ";
+                         });
+
+// A map and training set of several scoring blocks (4096 places) each.
+ofpy3::bench::SyntheticConfig largeConfig() {
+  ofpy3::bench::SyntheticConfig config = ofpy3::test::smallConfig();
+  config.mapSize = 9000;
+  config.trainingFrames = 5000;
+  config.queries = 6;
+  return config;
+}
+
+void expectSameMatches(const std::vector<of2::IMatch> &expected,
+                       const std::vector<of2::IMatch> &actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].imgIdx, actual[i].imgIdx);
+    EXPECT_EQ(expected[i].likelihood, actual[i].likelihood)
+        << "place " << expected[i].imgIdx;
+    EXPECT_EQ(expected[i].match, actual[i].match)
+        << "place " << expected[i].imgIdx;
+  }
+}
+
+// Each version with its deterministic new place, and with the motion model.
+class SparseFabMapThreadsTest
+    : public SparseFabMapTestBase,
+      public ::testing::TestWithParam<std::tuple<SparseFabMap::Version, int>> {
+protected:
+  SparseFabMapThreadsTest() : SparseFabMapTestBase(largeConfig()) {}
+};
+
+TEST_P(SparseFabMapThreadsTest, LikelihoodsDoNotDependOnThreadCount) {
+  const SparseFabMap::Version version = std::get<0>(GetParam());
+  const int flags = std::get<1>(GetParam());
+  std::unique_ptr<SparseFabMap> serial = makeSparse(version, flags);
+  std::unique_ptr<SparseFabMap> parallel = makeSparse(version, flags);
+  serial->setNumThreads(1);
+  parallel->setNumThreads(4);
+  EXPECT_EQ(4, parallel->getNumThreads());
+  for (const ofpy3::SparseBOW &bow : data.getMapBOWs()) {
+    serial->add(bow);
+    parallel->add(bow);
+  }
+
+  std::vector<of2::IMatch> expected, matches;
+  for (std::size_t q = 0; q < data.getQueryBOWs().size(); ++q) {
+    const bool addQ = q % 2 == 1;
+    serial->localize(data.getQueryBOWs()[q], expected, addQ,
+                     ofpy3::MatchSelection());
+    parallel->localize(data.getQueryBOWs()[q], matches, addQ,
+                       ofpy3::MatchSelection());
+    ASSERT_EQ(data.getMapBOWs().size() + q / 2 + 1, expected.size());
+    expectSameMatches(expected, matches);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Versions, SparseFabMapThreadsTest,
+    ::testing::Values(
+        std::make_tuple(SparseFabMap::FABMAP1,
+                        of2::FabMap::CHOW_LIU | of2::FabMap::MEAN_FIELD),
+        std::make_tuple(SparseFabMap::FABMAPLUT,
+                        of2::FabMap::CHOW_LIU | of2::FabMap::MEAN_FIELD),
+        std::make_tuple(SparseFabMap::FABMAP2,
+                        of2::FabMap::CHOW_LIU | of2::FabMap::SAMPLED),
+        std::make_tuple(SparseFabMap::FABMAP1,
+                        of2::FabMap::CHOW_LIU | of2::FabMap::MEAN_FIELD |
+                            of2::FabMap::MOTION_MODEL)),
+    [](const ::testing::TestParamInfo<std::tuple<SparseFabMap::Version, int>>
+           &info) {
+      return versionName(std::get<0>(info.param)) +
+             (std::get<1>(info.param) & of2::FabMap::MOTION_MODEL
+                  ? "_MotionModel"
+                  : "");
+    });
+
+// Selecting while normalising gives the matches full normalisation would,
+// then selecting. With the motion model each localize moves the prior on,
+// so the two run on engines of their own.
+TEST_P(SparseFabMapThreadsTest, SelectsTheMatchesOfFullNormalisation) {
+  const SparseFabMap::Version version = std::get<0>(GetParam());
+  const int flags = std::get<1>(GetParam());
+  for (int threads : {1, 4}) {
+    for (int mode = 0; mode < 3; ++mode) {
+      std::unique_ptr<SparseFabMap> full = makeSparse(version, flags);
+      std::unique_ptr<SparseFabMap> selective = makeSparse(version, flags);
+      full->setNumThreads(threads);
+      selective->setNumThreads(threads);
+      for (const ofpy3::SparseBOW &bow : data.getMapBOWs()) {
+        full->add(bow);
+        selective->add(bow);
+      }
+
+      std::vector<of2::IMatch> expected, matches;
+      for (const ofpy3::SparseBOW &bow : data.getQueryBOWs()) {
+        full->localize(bow, expected, false, ofpy3::MatchSelection());
+        // top 10, a threshold keeping about a tenth, or both
+        ofpy3::MatchSelection selection;
+        if (mode != 1) {
+          selection.topK = 10;
+        }
+        if (mode != 0) {
+          std::vector<double> likelihoods;
+          for (const of2::IMatch &match : expected) {
+            likelihoods.push_back(match.likelihood);
+          }
+          const std::size_t tenth = likelihoods.size() / 10;
+          std::nth_element(likelihoods.begin(), likelihoods.begin() + tenth,
+                           likelihoods.end(), std::greater<double>());
+          selection.minLikelihood = likelihoods[tenth];
+        }
+        ofpy3::selectMatches(expected, selection);
+        selective->localize(bow, matches, false, selection);
+        expectSameMatches(expected, matches);
+      }
+    }
+  }
+}
+
+class SparseFabMapFixedSamplesTest : public SparseFabMapTestBase,
+                                     public ::testing::Test {
+protected:
+  std::unique_ptr<SparseFabMap> makeSampled(SparseFabMap::Version version,
+                                            int samples) const {
+    std::unique_ptr<SparseFabMap> engine = makeSparse(
+        version, of2::FabMap::CHOW_LIU | of2::FabMap::SAMPLED);
+    engine->setFixedSamples(samples);
+    for (const ofpy3::SparseBOW &bow : data.getMapBOWs()) {
+      engine->add(bow);
+    }
+    return engine;
+  }
+
+  double newPlaceLikelihood(SparseFabMap &engine,
+                            const ofpy3::SparseBOW &bow) const {
+    std::vector<of2::IMatch> matches;
+    engine.localize(bow, matches, false, ofpy3::MatchSelection());
+    EXPECT_EQ(-1, matches.front().imgIdx);
+    return matches.front().likelihood;
+  }
+};
+
+TEST_F(SparseFabMapFixedSamplesTest, AreReproducible) {
+  for (SparseFabMap::Version version :
+       {SparseFabMap::FABMAP1, SparseFabMap::FABMAPLUT}) {
+    std::unique_ptr<SparseFabMap> engine = makeSampled(version, 20);
+    std::unique_ptr<SparseFabMap> again = makeSampled(version, 20);
+    EXPECT_EQ(20, engine->getFixedSamples());
+    for (const ofpy3::SparseBOW &bow : data.getQueryBOWs()) {
+      const double likelihood = newPlaceLikelihood(*engine, bow);
+      // The same samples for every query, and for every engine
+      EXPECT_EQ(likelihood, newPlaceLikelihood(*engine, bow));
+      EXPECT_EQ(likelihood, newPlaceLikelihood(*again, bow));
+    }
+    // Choosing them again draws the same set
+    const double before = newPlaceLikelihood(*engine, data.getQueryBOWs()[0]);
+    engine->setFixedSamples(5);
+    engine->setFixedSamples(20);
+    EXPECT_EQ(before, newPlaceLikelihood(*engine, data.getQueryBOWs()[0]));
+  }
+}
+
+TEST_F(SparseFabMapFixedSamplesTest, CoveringTheTrainingDataIsItsAverage) {
+  // The training bags-of-words as places, scored as of2 scores samples.
+  std::unique_ptr<SparseFabMap> trainingMap = makeSparse(
+      SparseFabMap::FABMAP1, of2::FabMap::CHOW_LIU | of2::FabMap::MEAN_FIELD);
+  for (const ofpy3::SparseBOW &bow : data.getTrainingBOWs()) {
+    trainingMap->add(bow);
+  }
+  const int numTraining = static_cast<int>(data.getTrainingBOWs().size());
+  std::unique_ptr<SparseFabMap> engine =
+      makeSampled(SparseFabMap::FABMAP1, numTraining + 10);
+
+  std::vector<of2::IMatch> matches;
+  for (const ofpy3::SparseBOW &bow : data.getQueryBOWs()) {
+    trainingMap->localize(bow, matches, false, ofpy3::MatchSelection());
+    double max = -DBL_MAX;
+    for (std::size_t i = 1; i < matches.size(); ++i) {
+      max = std::max(max, matches[i].likelihood);
+    }
+    double sum = 0.0;
+    for (std::size_t i = 1; i < matches.size(); ++i) {
+      sum += std::exp(matches[i].likelihood - max);
+    }
+    const double expected = max + std::log(sum / numTraining);
+    EXPECT_NEAR(expected, newPlaceLikelihood(*engine, bow),
+                ofpy3::test::likelihoodTolerance(expected));
+  }
+}
+
+TEST(SparseFabMapLargeFixedSamplesTest, DoNotDependOnThreadCount) {
+  // Several blocks of samples
+  ofpy3::bench::SyntheticData data(largeConfig());
+  const cv::Mat tree =
+      ofpy3::buildChowLiuTree(data.getTrainingBOWs(),
+                              data.getConfig().vocabSize, 0.0005);
+  std::vector<of2::IMatch> expected, matches;
+  std::unique_ptr<SparseFabMap> engines[2];
+  for (int e = 0; e < 2; ++e) {
+    engines[e].reset(new SparseFabMap(
+        tree, PZGE, PZGNE, of2::FabMap::CHOW_LIU | of2::FabMap::SAMPLED,
+        NUM_SAMPLES));
+    engines[e]->addTraining(data.getTrainingBOWs());
+    engines[e]->setFixedSamples(4500);
+    engines[e]->setNumThreads(e == 0 ? 1 : 4);
+    for (int i = 0; i < 100; ++i) {
+      engines[e]->add(data.getMapBOWs()[i]);
+    }
+  }
+  for (const ofpy3::SparseBOW &bow : data.getQueryBOWs()) {
+    engines[0]->localize(bow, expected, false, ofpy3::MatchSelection());
+    engines[1]->localize(bow, matches, false, ofpy3::MatchSelection());
+    expectSameMatches(expected, matches);
+  }
+}
+
+/**
+ * of2::FabMap's observation model evaluated densely, word by word over the
+ * whole vocabulary, as of2::FabMap1 and of2::FabMapLUT sum it.
+ */
+class DenseFabMap {
+public:
+  DenseFabMap(const cv::Mat &clTree, bool naiveBayes)
+      : clTree(clTree), naiveBayes(naiveBayes) {}
+
+  // log P(Z | L), for a query and place given as observed words.
+  double logLikelihood(const std::vector<char> &query,
+                       const std::vector<char> &place) const {
+    double logP = 0;
+    for (int q = 0; q < clTree.cols; ++q) {
+      logP += std::log(term(q, query[q] != 0, query[parent(q)] != 0,
+                            place[q] != 0));
+    }
+    return logP;
+  }
+
+  // The same in of2::FabMapLUT's integers, -log P scaled by 10^precision.
+  std::int64_t lutLikelihood(const std::vector<char> &query,
+                             const std::vector<char> &place,
+                             int precision) const {
+    const double factor = std::pow(10.0, precision);
+    std::int64_t sum = 0;
+    for (int q = 0; q < clTree.cols; ++q) {
+      sum += -(int)(std::log(term(q, query[q] != 0, query[parent(q)] != 0,
+                                  place[q] != 0)) *
+                    factor);
+    }
+    return sum;
+  }
+
+  // The mean field new place.
+  double meanField(const std::vector<char> &query) const {
+    double logP = 0;
+    for (int q = 0; q < clTree.cols; ++q) {
+      const bool zq = query[q] != 0, zpq = query[parent(q)] != 0;
+      if (naiveBayes) {
+        logP += std::log(Pzq(q, false) * PzqGeq(zq, false) +
+                         Pzq(q, true) * PzqGeq(zq, true));
+      } else {
+        logP += std::log(Pzq(q, false) * detected(q, zq, zpq, false) +
+                         Pzq(q, true) * detected(q, zq, zpq, true));
+      }
+    }
+    return logP;
+  }
+
+private:
+  int parent(int q) const { return (int)clTree.at<double>(0, q); }
+  double Pzq(int q, bool zq) const {
+    return zq ? clTree.at<double>(1, q) : 1 - clTree.at<double>(1, q);
+  }
+  double PzqGzpq(int q, bool zq, bool zpq) const {
+    const double p = clTree.at<double>(zpq ? 2 : 3, q);
+    return zq ? p : 1 - p;
+  }
+  double PzqGeq(bool zq, bool eq) const {
+    const double p = eq ? PZGE : PZGNE;
+    return zq ? p : 1 - p;
+  }
+  double PeqGL(int q, bool Lzq, bool eq) const {
+    const double alpha = PzqGeq(Lzq, true) * Pzq(q, true);
+    const double beta = PzqGeq(Lzq, false) * Pzq(q, false);
+    return eq ? alpha / (alpha + beta) : 1 - alpha / (alpha + beta);
+  }
+  // P(zq | eq, zpq), by Bayes over the Chow-Liu and detector models
+  double detected(int q, bool zq, bool zpq, bool eq) const {
+    const double alpha = Pzq(q, zq) * PzqGeq(!zq, eq) * PzqGzpq(q, !zq, zpq);
+    const double beta = Pzq(q, !zq) * PzqGeq(zq, eq) * PzqGzpq(q, zq, zpq);
+    return beta / (alpha + beta);
+  }
+  double term(int q, bool zq, bool zpq, bool Lzq) const {
+    if (naiveBayes) {
+      return PeqGL(q, Lzq, false) * PzqGeq(zq, false) +
+             PeqGL(q, Lzq, true) * PzqGeq(zq, true);
+    }
+    return PeqGL(q, Lzq, false) * detected(q, zq, zpq, false) +
+           PeqGL(q, Lzq, true) * detected(q, zq, zpq, true);
+  }
+
+  cv::Mat clTree;
+  bool naiveBayes;
+};
+
+// The Chow-Liu and naive Bayes observation models.
+class SparseFabMapTermsTest : public SparseFabMapTestBase,
+                              public ::testing::TestWithParam<bool> {
+protected:
+  std::vector<char> observed(const ofpy3::SparseBOW &bow) const {
+    std::vector<char> words(vocabSize(), 0);
+    bow.mark(words);
+    return words;
+  }
+
+  int flags(int newPlace) const {
+    return newPlace |
+           (GetParam() ? of2::FabMap::NAIVE_BAYES : of2::FabMap::CHOW_LIU);
+  }
+
+  // Localizes the queries against the map on a sparse engine, checking each
+  // match with expect(query, place, match); place -1 is the new place.
+  template <typename Expect>
+  void forEachMatch(SparseFabMap::Version version, int newPlace,
+                    Expect expect) const {
+    std::unique_ptr<SparseFabMap> engine =
+        makeSparse(version, flags(newPlace));
+    for (const ofpy3::SparseBOW &bow : data.getMapBOWs()) {
+      engine->add(bow);
+    }
+    std::vector<of2::IMatch> matches;
+    for (const ofpy3::SparseBOW &query : data.getQueryBOWs()) {
+      engine->localize(query, matches, false, ofpy3::MatchSelection());
+      ASSERT_EQ(data.getMapBOWs().size() + 1, matches.size());
+      for (const of2::IMatch &match : matches) {
+        expect(observed(query), match.imgIdx, match.likelihood);
+      }
+    }
+  }
+};
+
+TEST_P(SparseFabMapTermsTest, MatchesDenseFABMAP1) {
+  const DenseFabMap dense(tree, GetParam());
+  forEachMatch(SparseFabMap::FABMAP1, of2::FabMap::MEAN_FIELD,
+               [&](const std::vector<char> &query, int place,
+                   double likelihood) {
+                 const double expected =
+                     place < 0 ? dense.meanField(query)
+                               : dense.logLikelihood(
+                                     query, observed(data.getMapBOWs()[place]));
+                 EXPECT_NEAR(expected, likelihood,
+                             ofpy3::test::likelihoodTolerance(expected))
+                     << "place " << place;
+               });
+}
+
+TEST_P(SparseFabMapTermsTest, SumsTheSameLookupTableEntries) {
+  const DenseFabMap dense(tree, GetParam());
+  forEachMatch(
+      SparseFabMap::FABMAPLUT, of2::FabMap::MEAN_FIELD,
+      [&](const std::vector<char> &query, int place, double likelihood) {
+        if (place >= 0) {
+          // Integer sums, so exactly equal
+          EXPECT_EQ(-std::pow(10.0, -LUT_PRECISION) *
+                        static_cast<double>(dense.lutLikelihood(
+                            query, observed(data.getMapBOWs()[place]),
+                            LUT_PRECISION)),
+                    likelihood)
+              << "place " << place;
+        }
+      });
+}
+
+TEST_P(SparseFabMapTermsTest, ScoresFABMAP2RelativeToTheEmptyPlace) {
+  const DenseFabMap dense(tree, GetParam());
+  const std::vector<char> empty(vocabSize(), 0);
+  forEachMatch(SparseFabMap::FABMAP2, of2::FabMap::SAMPLED,
+               [&](const std::vector<char> &query, int place,
+                   double likelihood) {
+                 if (place >= 0) {
+                   const double expected =
+                       dense.logLikelihood(
+                           query, observed(data.getMapBOWs()[place])) -
+                       dense.logLikelihood(query, empty);
+                   EXPECT_NEAR(expected, likelihood,
+                               ofpy3::test::likelihoodTolerance(expected))
+                       << "place " << place;
+                 }
+               });
+}
+
+INSTANTIATE_TEST_SUITE_P(ObservationModels, SparseFabMapTermsTest,
+                         ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &info) {
+                           return info.param ? "NaiveBayes" : "ChowLiu";
+                         });
+
+} // namespace
@@ -0,0 +1,213 @@
+#include "Stats.h"
+#include "TestUtils.h"
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using ofpy3::Counter;
+using ofpy3::Histogram;
+using ofpy3::Stage;
+using ofpy3::Stats;
+
+std::string readText(const std::string &filename) {
+  std::ifstream in(filename.c_str());
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+std::size_t occurrences(const std::string &text, const std::string &what) {
+  std::size_t n = 0;
+  for (std::size_t at = text.find(what); at != std::string::npos;
+       at = text.find(what, at + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+TEST(HistogramTest, BucketsCoverEveryValueWithinAQuarter) {
+  const int numBuckets = Histogram::NUM_BUCKETS;
+  const int lastBucket =
+      Histogram::bucketOf(std::numeric_limits<std::uint64_t>::max());
+  ASSERT_LT(lastBucket, numBuckets);
+  EXPECT_EQ(std::numeric_limits<std::uint64_t>::max(),
+            Histogram::bucketMax(lastBucket));
+  std::vector<std::uint64_t> values;
+  for (std::uint64_t v = 0; v < 5000; ++v) {
+    values.push_back(v);
+  }
+  for (int e = 13; e < 64; ++e) {
+    values.push_back((std::uint64_t(1) << e) - 1);
+    values.push_back(std::uint64_t(1) << e);
+    values.push_back((std::uint64_t(3) << (e - 1)) + 12345);
+  }
+  for (std::uint64_t v : values) {
+    const int bucket = Histogram::bucketOf(v);
+    ASSERT_GE(bucket, 0);
+    ASSERT_LE(bucket, lastBucket);
+    // Buckets are consecutive ranges, each ending at bucketMax.
+    EXPECT_LE(v, Histogram::bucketMax(bucket)) << v;
+    if (bucket > 0) {
+      EXPECT_GT(v, Histogram::bucketMax(bucket - 1)) << v;
+    }
+    EXPECT_LE((double)Histogram::bucketMax(bucket), 1.25 * v + 1) << v;
+  }
+}
+
+TEST(HistogramTest, SummarisesTheRecordedValues) {
+  Histogram histogram;
+  EXPECT_EQ(0u, histogram.snapshot().count);
+  EXPECT_EQ(0u, histogram.snapshot().quantile(0.5));
+  for (std::uint64_t v = 1; v <= 1000; ++v) {
+    histogram.record(v);
+  }
+  const Histogram::Snapshot snapshot = histogram.snapshot();
+  EXPECT_EQ(1000u, snapshot.count);
+  EXPECT_EQ(500500u, snapshot.sum);
+  EXPECT_EQ(1u, snapshot.min);
+  EXPECT_EQ(1000u, snapshot.max);
+  EXPECT_DOUBLE_EQ(500.5, snapshot.mean());
+  std::uint64_t counted = 0;
+  for (const auto &bucket : snapshot.buckets) {
+    counted += bucket.second;
+  }
+  EXPECT_EQ(snapshot.count, counted);
+
+  // Quantiles are the exact rank's bucket, never past the maximum.
+  for (double q : {0.01, 0.5, 0.9, 0.99}) {
+    const std::uint64_t exact = static_cast<std::uint64_t>(q * 1000);
+    EXPECT_GE(snapshot.quantile(q), exact) << q;
+    EXPECT_LE(snapshot.quantile(q), exact * 1.25) << q;
+  }
+  EXPECT_EQ(1000u, snapshot.quantile(1.0));
+
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.snapshot().count);
+  EXPECT_TRUE(histogram.snapshot().buckets.empty());
+  histogram.record(7);
+  EXPECT_EQ(7u, histogram.snapshot().min);
+}
+
+TEST(HistogramTest, CountsEveryConcurrentRecord) {
+  Histogram histogram;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&histogram, t] {
+      for (int i = 0; i < 10000; ++i) {
+        histogram.record(static_cast<std::uint64_t>(t * 10000 + i));
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  const Histogram::Snapshot snapshot = histogram.snapshot();
+  EXPECT_EQ(40000u, snapshot.count);
+  EXPECT_EQ(0u, snapshot.min);
+  EXPECT_EQ(39999u, snapshot.max);
+}
+
+TEST(StatsTest, RecordsNothingUntilEnabled) {
+  Stats stats;
+  {
+    ofpy3::StageTimer timer(&stats, Stage::Detect);
+  }
+  ofpy3::recordCounter(&stats, Counter::Words, 12);
+  EXPECT_EQ(0u, stats.getStage(Stage::Detect).count);
+  EXPECT_EQ(0u, stats.getCounter(Counter::Words).count);
+  // Null stats are always off.
+  {
+    ofpy3::StageTimer timer(nullptr, Stage::Detect);
+  }
+  ofpy3::recordCounter(nullptr, Counter::Words, 12);
+
+  stats.setEnabled(true);
+  {
+    ofpy3::StageTimer timer(&stats, Stage::Detect);
+  }
+  ofpy3::recordCounter(&stats, Counter::Words, 12);
+  EXPECT_EQ(1u, stats.getStage(Stage::Detect).count);
+  EXPECT_EQ(0u, stats.getStage(Stage::Extract).count);
+  EXPECT_EQ(12u, stats.getCounter(Counter::Words).sum);
+  // Tracing is separate, and off.
+  EXPECT_EQ(0u, stats.getTraceSpans());
+
+  stats.reset();
+  EXPECT_EQ(0u, stats.getStage(Stage::Detect).count);
+  EXPECT_EQ(0u, stats.getCounter(Counter::Words).count);
+}
+
+TEST(StatsTest, TracesSpansUpToItsCapacity) {
+  ofpy3::test::TempFile file("trace.json");
+  Stats stats;
+  stats.setEnabled(true);
+  stats.setTracing(true, 5);
+  const long frame = stats.nextFrame();
+  {
+    ofpy3::StageTimer frameTimer(&stats, Stage::Frame, frame);
+    ofpy3::StageTimer timer(&stats, Stage::Quantize, frame);
+  }
+  for (int i = 0; i < 5; ++i) {
+    ofpy3::StageTimer timer(&stats, Stage::Score);
+  }
+  EXPECT_EQ(5u, stats.getTraceSpans());
+  EXPECT_EQ(2u, stats.getDroppedSpans());
+  // Histograms keep everything.
+  EXPECT_EQ(5u, stats.getStage(Stage::Score).count);
+
+  stats.writeTrace(file.getPath());
+  const std::string trace = readText(file.getPath());
+  EXPECT_EQ(0u, trace.find("{\"displayTimeUnit\""));
+  // The frame is an async begin and end, the stages complete events.
+  EXPECT_EQ(1u, occurrences(trace, "\"ph\": \"b\""));
+  EXPECT_EQ(1u, occurrences(trace, "\"ph\": \"e\""));
+  EXPECT_EQ(4u, occurrences(trace, "\"ph\": \"X\""));
+  EXPECT_EQ(1u, occurrences(trace, "\"name\": \"quantize\""));
+  EXPECT_EQ(1u, occurrences(trace, "\"args\": {\"frame\": 0}"));
+
+  stats.reset();
+  EXPECT_EQ(0u, stats.getTraceSpans());
+  EXPECT_EQ(0u, stats.getDroppedSpans());
+  stats.setTracing(false);
+  {
+    ofpy3::StageTimer timer(&stats, Stage::Score);
+  }
+  EXPECT_EQ(0u, stats.getTraceSpans());
+}
+
+TEST(StatsTest, ProcessDescTimesItsStages) {
+  const ofpy3::bench::SyntheticData data(ofpy3::test::smallConfig());
+  ofpy3::Settings settings =
+      ofpy3::test::fabMapSettings("FABMAP1", "Sparse");
+  ofpy3::Settings statsOptions;
+  statsOptions.set("Enabled", true);
+  settings.set("StatsOptions", statsOptions);
+  std::shared_ptr<ofpy3::ChowLiuTree> model =
+      ofpy3::test::syntheticModel(data, settings);
+  // Exact search, so each frame quantizes to its own words.
+  model->getVocabulary()->setExactSearch(true, "Scalar");
+  ofpy3::OpenFABMAP map(model, settings);
+  std::shared_ptr<Stats> stats = map.getStats();
+  ASSERT_TRUE(stats->isEnabled());
+
+  const int frames = 6;
+  for (int i = 0; i < frames; ++i) {
+    map.processDesc(data.descriptors(data.getMapBOWs()[i], i), true);
+  }
+  EXPECT_EQ((std::uint64_t)frames, stats->getStage(Stage::Frame).count);
+  EXPECT_EQ((std::uint64_t)frames, stats->getStage(Stage::Quantize).count);
+  EXPECT_EQ((std::uint64_t)frames, stats->getStage(Stage::Localize).count);
+  EXPECT_EQ(0u, stats->getStage(Stage::Detect).count);
+  const Histogram::Snapshot words = stats->getCounter(Counter::Words);
+  EXPECT_EQ((std::uint64_t)frames, words.count);
+  EXPECT_EQ((std::uint64_t)data.getConfig().wordsPerFrame, words.max);
+  EXPECT_EQ((std::uint64_t)(frames - 1),
+            stats->getCounter(Counter::PlacesScored).max);
+}
+
+} // namespace
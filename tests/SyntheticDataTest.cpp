@@ -0,0 +1,115 @@
+#include "TestUtils.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+using ofpy3::bench::SyntheticData;
+
+void expectSameBOWs(const std::vector<ofpy3::SparseBOW> &expected,
+                    const std::vector<ofpy3::SparseBOW> &actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    ofpy3::test::expectSameBOW(expected[i], actual[i]);
+  }
+}
+
+bool sameWords(const std::vector<ofpy3::SparseBOW> &a,
+               const std::vector<ofpy3::SparseBOW> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (a[i].words != b[i].words) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(SyntheticDataTest, IsReproducibleBySeed) {
+  const SyntheticData data(ofpy3::test::smallConfig(3));
+  const SyntheticData again(ofpy3::test::smallConfig(3));
+  ofpy3::test::expectSameMat(data.getWords(), again.getWords());
+  expectSameBOWs(data.getTrainingBOWs(), again.getTrainingBOWs());
+  expectSameBOWs(data.getMapBOWs(), again.getMapBOWs());
+  expectSameBOWs(data.getQueryBOWs(), again.getQueryBOWs());
+  for (int q = 0; q < data.getConfig().queries; ++q) {
+    EXPECT_EQ(data.getQueryPlace(q), again.getQueryPlace(q));
+  }
+  ofpy3::test::expectSameMat(data.descriptors(data.getMapBOWs()[4], 4),
+                             again.descriptors(again.getMapBOWs()[4], 4));
+  ofpy3::test::expectSameMat(data.randomDescriptors(50, 20, 9),
+                             again.randomDescriptors(50, 20, 9));
+
+  // Another seed is another workload.
+  const SyntheticData other(ofpy3::test::smallConfig(4));
+  EXPECT_FALSE(sameWords(data.getMapBOWs(), other.getMapBOWs()));
+  EXPECT_FALSE(sameWords(data.getTrainingBOWs(), other.getTrainingBOWs()));
+}
+
+TEST(SyntheticDataTest, FramesHoldDistinctAscendingWords) {
+  const SyntheticData data(ofpy3::test::smallConfig());
+  const ofpy3::bench::SyntheticConfig &config = data.getConfig();
+  ASSERT_EQ(config.trainingFrames, (int)data.getTrainingBOWs().size());
+  ASSERT_EQ(config.mapSize, (int)data.getMapBOWs().size());
+  ASSERT_EQ(config.queries, (int)data.getQueryBOWs().size());
+
+  for (const std::vector<ofpy3::SparseBOW> *bows :
+       {&data.getTrainingBOWs(), &data.getMapBOWs()}) {
+    for (const ofpy3::SparseBOW &bow : *bows) {
+      // Co-occurring words never take a frame past wordsPerFrame.
+      ASSERT_EQ(config.wordsPerFrame, (int)bow.words.size());
+      ASSERT_EQ(bow.words.size(), bow.values.size());
+      EXPECT_GE(bow.words.front(), 0);
+      EXPECT_LT(bow.words.back(), config.vocabSize);
+      EXPECT_TRUE(std::adjacent_find(bow.words.begin(), bow.words.end(),
+                                     std::greater_equal<int>()) ==
+                  bow.words.end());
+    }
+  }
+}
+
+TEST(SyntheticDataTest, QueriesRevisitTheirPlace) {
+  const SyntheticData data(ofpy3::test::smallConfig());
+  const ofpy3::bench::SyntheticConfig &config = data.getConfig();
+  for (int q = 0; q < config.queries; ++q) {
+    const int place = data.getQueryPlace(q);
+    ASSERT_GE(place, 0);
+    ASSERT_LT(place, config.mapSize);
+    const std::vector<int> &query = data.getQueryBOWs()[q].words;
+    const std::vector<int> &seen = data.getMapBOWs()[place].words;
+    ASSERT_EQ(seen.size(), query.size());
+    std::vector<int> kept;
+    std::set_intersection(query.begin(), query.end(), seen.begin(),
+                          seen.end(), std::back_inserter(kept));
+    // About revisitNoise of the words are replaced, and rarely all of them.
+    EXPECT_GT(kept.size(), seen.size() / 2) << "query " << q;
+  }
+}
+
+TEST(SyntheticDataTest, DescriptorsAreUnitLength) {
+  const SyntheticData data(ofpy3::test::smallConfig());
+  const ofpy3::bench::SyntheticConfig &config = data.getConfig();
+  ASSERT_EQ(config.vocabSize, data.getWords().rows);
+  ASSERT_EQ(config.descriptorSize, data.getWords().cols);
+
+  const cv::Mat descs = data.descriptors(data.getMapBOWs()[0], 0);
+  ASSERT_EQ(config.descriptorsPerFrame, descs.rows);
+  ASSERT_EQ(config.descriptorSize, descs.cols);
+  ASSERT_EQ(CV_32F, descs.type());
+  for (int i = 0; i < descs.rows; ++i) {
+    double norm2 = 0.0;
+    for (int d = 0; d < descs.cols; ++d) {
+      norm2 += descs.at<float>(i, d) * descs.at<float>(i, d);
+    }
+    EXPECT_NEAR(1.0, std::sqrt(norm2), 1e-5) << "row " << i;
+  }
+  EXPECT_THROW(data.randomDescriptors(10, config.vocabSize + 1, 0),
+               cv::Exception);
+}
+
+} // namespace
@@ -0,0 +1,143 @@
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include "ChowLiuTree.h"
+#include "ChowLiuTreeBuilder.h"
+#include "FabMapVocabulary.h"
+#include "LoopClosureStore.h"
+#include "OpenFABMAP.h"
+#include "Settings.h"
+#include "SparseBOW.h"
+#include "SyntheticData.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <opencv2/core/core.hpp>
+
+namespace ofpy3 {
+namespace test {
+
+// A file name in the test temporary directory, unique to the running test.
+inline std::string tempPath(const std::string &name) {
+  const ::testing::TestInfo *info =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  // Parameterized tests are named Prefix/Suite and Test/N.
+  std::string test =
+      std::string(info->test_suite_name()) + "_" + info->name();
+  std::replace(test.begin(), test.end(), '/', '_');
+  return ::testing::TempDir() + "ofpy3_" + test + "_" + name;
+}
+
+// Removes a file when it goes out of scope.
+class TempFile {
+public:
+  explicit TempFile(const std::string &name) : path(tempPath(name)) {
+    std::remove(path.c_str());
+  }
+  ~TempFile() { std::remove(path.c_str()); }
+  TempFile(const TempFile &) = delete;
+  TempFile &operator=(const TempFile &) = delete;
+
+  const std::string &getPath() const { return path; }
+
+private:
+  std::string path;
+};
+
+// A workload small enough for of2's dense reference implementations.
+inline bench::SyntheticConfig smallConfig(std::uint64_t seed = 7) {
+  bench::SyntheticConfig config;
+  config.vocabSize = 120;
+  config.descriptorSize = 16;
+  config.wordsPerFrame = 15;
+  config.descriptorsPerFrame = 30;
+  config.mapSize = 25;
+  config.trainingFrames = 60;
+  config.queries = 10;
+  config.groupSize = 4;
+  config.coOccurrence = 0.6;
+  config.seed = seed;
+  return config;
+}
+
+inline void expectSameBOW(const SparseBOW &expected, const SparseBOW &actual) {
+  EXPECT_EQ(expected.words, actual.words);
+  EXPECT_EQ(expected.values, actual.values);
+}
+
+inline void expectSameMat(const cv::Mat &expected, const cv::Mat &actual) {
+  ASSERT_EQ(expected.rows, actual.rows);
+  ASSERT_EQ(expected.cols, actual.cols);
+  ASSERT_EQ(expected.type(), actual.type());
+  for (int i = 0; i < expected.rows; ++i) {
+    const std::size_t rowBytes = expected.cols * expected.elemSize();
+    EXPECT_EQ(0, std::memcmp(expected.ptr(i), actual.ptr(i), rowBytes))
+        << "row " << i;
+  }
+}
+
+// A trained model over the synthetic words and training frames.
+inline std::shared_ptr<ChowLiuTree>
+syntheticModel(const bench::SyntheticData &data,
+               const Settings &settings = Settings()) {
+  std::shared_ptr<FabMapVocabulary> vocabulary =
+      std::make_shared<FabMapVocabulary>(settings, data.getWords(), false);
+  const cv::Mat tree = buildChowLiuTree(data.getTrainingBOWs(),
+                                        data.getWords().rows, 0.0005);
+  return std::make_shared<ChowLiuTree>(vocabulary, tree,
+                                       data.getTrainingBOWs(), settings);
+}
+
+// Settings for an OpenFABMAP of the given FabMapVersion and Engine.
+inline Settings
+fabMapSettings(const std::string &version, const std::string &engine,
+               const std::string &newPlaceMethod = "Meanfield") {
+  Settings options;
+  options.set("FabMapVersion", version);
+  options.set("Engine", engine);
+  options.set("NewPlaceMethod", newPlaceMethod);
+  Settings settings;
+  settings.set("openFabMapOptions", options);
+  return settings;
+}
+
+// A column of results, as a vector.
+template <typename T>
+std::vector<T>
+columnValues(const LoopClosureStore::Columns::Column<T> &column) {
+  if (!column.data) {
+    return std::vector<T>();
+  }
+  return std::vector<T>(column.data->begin() + column.offset,
+                        column.data->begin() + column.offset + column.size);
+}
+
+inline void expectSameResults(const LoopClosureStore::Columns &expected,
+                              const LoopClosureStore::Columns &actual) {
+  EXPECT_EQ(columnValues(expected.queryIdx), columnValues(actual.queryIdx));
+  EXPECT_EQ(columnValues(expected.bestIdx), columnValues(actual.bestIdx));
+  EXPECT_EQ(columnValues(expected.bestLikelihood),
+            columnValues(actual.bestLikelihood));
+  EXPECT_EQ(columnValues(expected.matchQueryIdx),
+            columnValues(actual.matchQueryIdx));
+  EXPECT_EQ(columnValues(expected.matchImgIdx),
+            columnValues(actual.matchImgIdx));
+  EXPECT_EQ(columnValues(expected.matchLikelihood),
+            columnValues(actual.matchLikelihood));
+}
+
+// Log-likelihoods are sums over the vocabulary, compare them relatively.
+inline double likelihoodTolerance(double expected) {
+  return 1e-9 * std::max(1.0, std::abs(expected));
+}
+
+} // namespace test
+} // namespace ofpy3
+
+#endif // TEST_UTILS_H
@@ -0,0 +1,151 @@
+#include "DescriptorStore.h"
+#include "TestUtils.h"
+#include "VocabularyClusterer.h"
+#include <bowmsctrainer.hpp>
+#include <random>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+const double CLUSTER_SIZE = 0.3;
+
+/**
+ * of2::BOWMSCTrainer::cluster spelled out: in order, a descriptor further
+ * than clusterSize from every centre so far becomes a centre, then the words
+ * are the means of the descriptors nearest each centre.
+ */
+cv::Mat leaderClustering(const cv::Mat &descriptors, double clusterSize) {
+  std::vector<int> centres;
+  auto distance2 = [&](int a, int b) {
+    double sum = 0.0;
+    for (int d = 0; d < descriptors.cols; ++d) {
+      const double diff =
+          descriptors.at<float>(a, d) - descriptors.at<float>(b, d);
+      sum += diff * diff;
+    }
+    return sum;
+  };
+  for (int i = 0; i < descriptors.rows; ++i) {
+    bool covered = false;
+    for (int c : centres) {
+      covered = covered || distance2(i, c) <= clusterSize * clusterSize;
+    }
+    if (!covered) {
+      centres.push_back(i);
+    }
+  }
+
+  cv::Mat sums = cv::Mat::zeros((int)centres.size(), descriptors.cols, CV_64F);
+  std::vector<int> counts(centres.size(), 0);
+  for (int i = 0; i < descriptors.rows; ++i) {
+    std::size_t nearest = 0;
+    for (std::size_t j = 1; j < centres.size(); ++j) {
+      if (distance2(i, centres[j]) < distance2(i, centres[nearest])) {
+        nearest = j;
+      }
+    }
+    ++counts[nearest];
+    for (int d = 0; d < descriptors.cols; ++d) {
+      sums.at<double>((int)nearest, d) += descriptors.at<float>(i, d);
+    }
+  }
+  cv::Mat words((int)centres.size(), descriptors.cols, CV_32F);
+  for (int j = 0; j < words.rows; ++j) {
+    for (int d = 0; d < words.cols; ++d) {
+      words.at<float>(j, d) =
+          static_cast<float>(sums.at<double>(j, d) / counts[j]);
+    }
+  }
+  return words;
+}
+
+void expectNearMat(const cv::Mat &expected, const cv::Mat &actual,
+                   double tolerance) {
+  ASSERT_EQ(expected.rows, actual.rows);
+  ASSERT_EQ(expected.cols, actual.cols);
+  for (int i = 0; i < expected.rows; ++i) {
+    for (int d = 0; d < expected.cols; ++d) {
+      EXPECT_NEAR(expected.at<float>(i, d), actual.at<float>(i, d), tolerance)
+          << "word " << i;
+    }
+  }
+}
+
+class VocabularyClustererTest : public ::testing::Test {
+protected:
+  VocabularyClustererTest()
+      : data(ofpy3::test::smallConfig()),
+        // More than one batch of the clusterer, over several store chunks
+        descriptors(data.randomDescriptors(5000, 40, 11)), store(1000) {
+    store.append(descriptors);
+  }
+
+  ofpy3::bench::SyntheticData data;
+  cv::Mat descriptors;
+  ofpy3::DescriptorStore store;
+};
+
+TEST_F(VocabularyClustererTest, MatchesReferenceTrainer) {
+  of2::BOWMSCTrainer trainer(CLUSTER_SIZE);
+  trainer.add(descriptors);
+  const cv::Mat expected = trainer.cluster();
+  expectNearMat(expected, ofpy3::clusterVocabulary(store, CLUSTER_SIZE),
+                1e-5);
+}
+
+TEST_F(VocabularyClustererTest, ChoosesTheSequentialCentres) {
+  const cv::Mat expected = leaderClustering(descriptors, CLUSTER_SIZE);
+  const cv::Mat words = ofpy3::clusterVocabulary(store, CLUSTER_SIZE);
+  ASSERT_EQ(CV_32F, words.type());
+  expectNearMat(expected, words, 1e-5);
+}
+
+TEST_F(VocabularyClustererTest, DoesNotDependOnThreadCount) {
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  const cv::Mat serial = ofpy3::clusterVocabulary(store, CLUSTER_SIZE);
+  omp_set_num_threads(std::max(4, threads));
+  const cv::Mat parallel = ofpy3::clusterVocabulary(store, CLUSTER_SIZE);
+  omp_set_num_threads(threads);
+  ofpy3::test::expectSameMat(serial, parallel);
+#else
+  GTEST_SKIP() << "built without OpenMP";
+#endif
+}
+
+TEST(BinaryVocabularyClustererTest, TakesTheMajorityOfEachCluster) {
+  // Noisy copies of a few random 256 bit words, a few bits flipped each.
+  const int numWords = 6, copies = 50, bytes = 32;
+  std::mt19937 random(3);
+  std::uniform_int_distribution<int> byte(0, 255), bit(0, bytes * 8 - 1);
+  cv::Mat words(numWords, bytes, CV_8U);
+  for (int i = 0; i < numWords; ++i) {
+    for (int d = 0; d < bytes; ++d) {
+      words.at<uchar>(i, d) = static_cast<uchar>(byte(random));
+    }
+  }
+  cv::Mat descriptors(numWords * copies, bytes, CV_8U);
+  for (int i = 0; i < descriptors.rows; ++i) {
+    for (int d = 0; d < bytes; ++d) {
+      descriptors.at<uchar>(i, d) = words.at<uchar>(i % numWords, d);
+    }
+    for (int flip = 0; flip < 4; ++flip) {
+      const int b = bit(random);
+      descriptors.at<uchar>(i, b / 8) ^= static_cast<uchar>(1 << (b % 8));
+    }
+  }
+  ofpy3::DescriptorStore store(64);
+  store.append(descriptors);
+
+  // Copies are within 8 bits of each other, random words about 128 apart.
+  const cv::Mat vocabulary = ofpy3::clusterBinaryVocabulary(store, 20);
+  ASSERT_EQ(CV_8U, vocabulary.type());
+  ofpy3::test::expectSameMat(words, vocabulary);
+}
+
+} // namespace
@@ -0,0 +1,139 @@
+#include "DescriptorStore.h"
+#include "TestUtils.h"
+#include "VocabularyTree.h"
+#include <limits>
+#include <vector>
+
+namespace {
+
+// Columns of the node table
+const int FIRST_CHILD = 0;
+const int NUM_CHILDREN = 1;
+const int CENTRE = 2;
+
+float distance2(const cv::Mat &a, const cv::Mat &b) {
+  float sum = 0.f;
+  for (int d = 0; d < a.cols; ++d) {
+    const float diff = a.at<float>(0, d) - b.at<float>(0, d);
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+// The leaves' word ids, depth first.
+void collectLeaves(const cv::Mat &nodes, int node, std::vector<int> &leaves) {
+  const int *row = nodes.ptr<int>(node);
+  if (row[NUM_CHILDREN] == 0) {
+    leaves.push_back(row[CENTRE]);
+    return;
+  }
+  for (int c = row[FIRST_CHILD]; c < row[FIRST_CHILD] + row[NUM_CHILDREN];
+       ++c) {
+    collectLeaves(nodes, c, leaves);
+  }
+}
+
+class VocabularyTreeTest : public ::testing::Test {
+protected:
+  VocabularyTreeTest()
+      : data(ofpy3::test::smallConfig()),
+        descriptors(data.randomDescriptors(3000, 40, 13)), store(512) {
+    store.append(descriptors);
+  }
+
+  std::shared_ptr<ofpy3::VocabularyTree> build(std::uint64_t seed = 1) const {
+    return ofpy3::VocabularyTree::build(store, 4, 3, 5, seed);
+  }
+
+  ofpy3::bench::SyntheticData data;
+  cv::Mat descriptors;
+  ofpy3::DescriptorStore store;
+};
+
+TEST_F(VocabularyTreeTest, NumbersTheLeavesDepthFirst) {
+  std::shared_ptr<ofpy3::VocabularyTree> tree = build();
+  const cv::Mat words = tree->getWords();
+  ASSERT_EQ(CV_32F, words.type());
+  EXPECT_EQ(descriptors.cols, words.cols);
+  EXPECT_GT(words.rows, 4);
+  EXPECT_LE(words.rows, 4 * 4 * 4);
+
+  std::vector<int> leaves;
+  collectLeaves(tree->getNodes(), 0, leaves);
+  ASSERT_EQ(words.rows, (int)leaves.size());
+  for (int q = 0; q < words.rows; ++q) {
+    EXPECT_EQ(q, leaves[q]);
+  }
+}
+
+TEST_F(VocabularyTreeTest, IsReproducibleBySeed) {
+  std::shared_ptr<ofpy3::VocabularyTree> first = build(1);
+  std::shared_ptr<ofpy3::VocabularyTree> second = build(1);
+  ofpy3::test::expectSameMat(first->getWords(), second->getWords());
+  ofpy3::test::expectSameMat(first->getCentres(), second->getCentres());
+  ofpy3::test::expectSameMat(first->getNodes(), second->getNodes());
+}
+
+TEST_F(VocabularyTreeTest, WideSearchIsExact) {
+  std::shared_ptr<ofpy3::VocabularyTree> tree = build();
+  const cv::Mat words = tree->getWords();
+  const cv::Mat queries = data.randomDescriptors(300, 40, 17);
+  const std::vector<int> exact = tree->quantize(queries, words.rows);
+  const std::vector<int> greedy = tree->quantize(queries, 1);
+  ASSERT_EQ(300u, exact.size());
+
+  for (int i = 0; i < queries.rows; ++i) {
+    float nearest = std::numeric_limits<float>::max();
+    for (int q = 0; q < words.rows; ++q) {
+      nearest = std::min(nearest, distance2(queries.row(i), words.row(q)));
+    }
+    ASSERT_GE(exact[i], 0);
+    ASSERT_LT(exact[i], words.rows);
+    EXPECT_NEAR(nearest, distance2(queries.row(i), words.row(exact[i])),
+                1e-5f * nearest)
+        << "descriptor " << i;
+    // A narrower search can only miss the nearest word.
+    EXPECT_GE(distance2(queries.row(i), words.row(greedy[i])),
+              distance2(queries.row(i), words.row(exact[i])) * (1 - 1e-5f));
+  }
+}
+
+TEST(VocabularyTreeLoadTest, RejectsMalformedNodes) {
+  const cv::Mat words = cv::Mat::zeros(2, 4, CV_32F);
+  const cv::Mat centres = cv::Mat::zeros(1, 4, CV_32F);
+  // A root over two leaves.
+  const int table[3][3] = {{1, 2, 0}, {0, 0, 0}, {0, 0, 1}};
+  cv::Mat nodes(3, 3, CV_32S);
+  for (int i = 0; i < 3; ++i) {
+    std::copy(table[i], table[i] + 3, nodes.ptr<int>(i));
+  }
+  EXPECT_NO_THROW(ofpy3::VocabularyTree(words, centres, nodes));
+
+  cv::Mat loop = nodes.clone();
+  loop.at<int>(0, FIRST_CHILD) = 0;
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, loop), cv::Exception);
+  cv::Mat pastEnd = nodes.clone();
+  pastEnd.at<int>(0, NUM_CHILDREN) = 3;
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, pastEnd), cv::Exception);
+  cv::Mat noCentre = nodes.clone();
+  noCentre.at<int>(0, CENTRE) = 1;
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, noCentre),
+               cv::Exception);
+  cv::Mat noWord = nodes.clone();
+  noWord.at<int>(2, CENTRE) = 2;
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, noWord), cv::Exception);
+  cv::Mat negative = nodes.clone();
+  negative.at<int>(1, NUM_CHILDREN) = -1;
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, negative),
+               cv::Exception);
+
+  cv::Mat doubles;
+  words.convertTo(doubles, CV_64F);
+  EXPECT_THROW(ofpy3::VocabularyTree(doubles, centres, nodes), cv::Exception);
+  cv::Mat floatNodes;
+  nodes.convertTo(floatNodes, CV_32F);
+  EXPECT_THROW(ofpy3::VocabularyTree(words, centres, floatNodes),
+               cv::Exception);
+}
+
+} // namespace